@@ -10,7 +10,9 @@
 #include <cstdlib>
 #include <cstdint>
 #include <cstring>
+#include <atomic>
 #include <chrono>
+#include <memory>
 #include <vector>
 #include <thread>
 #include <list>
@@ -20,6 +22,14 @@
 #include <random>
 #include <exception>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PROXIMA_FLAKE_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
 // Combination of Twitter's Snowflake and Sony's Sonyflake
 struct ProximaFlakeData 
 {
@@ -32,6 +42,439 @@ struct ProximaFlakeData
 constexpr size_t FlakeSize = sizeof(ProximaFlakeData);
 constexpr size_t ProximaEpoch = 162081220000;
 
+// Values of base62 chars "0-9A-Za-z", -1 for other chars
+struct ProximaFlakeBase62Table
+{
+	int8_t Values[256] = {};
+
+	constexpr ProximaFlakeBase62Table()
+	{
+		for (int i = 0; i < 256; i++) {
+			Values[i] = -1;
+		}
+
+		for (int i = 0; i < 10; i++) {
+			Values['0' + i] = static_cast<int8_t>(i);
+		}
+
+		for (int i = 0; i < 26; i++) {
+			Values['A' + i] = static_cast<int8_t>(10 + i);
+			Values['a' + i] = static_cast<int8_t>(36 + i);
+		}
+	}
+};
+
+constexpr ProximaFlakeBase62Table ProximaFlakeBase62 = {};
+
+/*
+	Text codec of flakes: no exceptions, no locale and no allocations. Functions write into
+	caller buffers and return count of written (or parsed) chars, 0 means error, like
+	std::to_chars/std::from_chars. Decimal is the form of JSON and CSV exports, base62 is
+	fixed 11 chars of "0-9A-Za-z", so its strings sort in the same order as flakes (by time).
+
+	Batch functions convert arrays to text with separator between flakes and back. On x86
+	16 decimal digits are converted at once with SSE2, and fields are extracted from raw
+	flakes with SSE2 too; other targets use scalar code.
+*/
+class CProximaFlakeCodec
+{
+public:
+	static constexpr size_t MaxDecimalLength = 20;
+	static constexpr size_t Base62Length = 11;
+
+	// Positions of ProximaFlakeData fields in raw flake: bit-fields are allocated from low bits
+	static constexpr uint64_t TimestampMask = (1ull << 39) - 1;
+	static constexpr unsigned SequenceShift = 39;
+	static constexpr unsigned MachineIdShift = 47;
+	static constexpr uint64_t MachineIdMask = (1ull << 11) - 1;
+	static constexpr unsigned ObjectTypeShift = 58;
+
+private:
+	static constexpr uint64_t Pow10_8 = 100000000ull;
+	static constexpr uint64_t Pow10_16 = 10000000000000000ull;
+	static constexpr uint32_t Pow62_5 = 916132832u;
+	static constexpr uint64_t Pow62_10 = 839299365868340224ull;
+	static constexpr char Base62Alphabet[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+	static bool IsDigit(char Char)
+	{
+		return static_cast<uint8_t>(Char - '0') < 10;
+	}
+
+	// Digits of small value, written backwards from the end of output
+	static void WriteDigits(uint64_t Value, char* OutEnd, size_t Length)
+	{
+		for (size_t i = 0; i < Length; i++) {
+			*--OutEnd = static_cast<char>('0' + Value % 10);
+			Value /= 10;
+		}
+	}
+
+	static size_t GetDigitsCount(uint64_t Value)
+	{
+		size_t Count = 1;
+		while (Value >= 10) {
+			Value /= 10;
+			Count++;
+		}
+
+		return Count;
+	}
+
+	static uint64_t ParseDigits(const char* String, size_t Length)
+	{
+		uint64_t Value = 0;
+		for (size_t i = 0; i < Length; i++) {
+			Value = Value * 10 + static_cast<uint64_t>(String[i] - '0');
+		}
+
+		return Value;
+	}
+
+#ifdef PROXIMA_FLAKE_SSE2
+	// 8 digits of value in 16-bit lanes: value is split to halves by 10000, every half is divided by 1000, 100, 10 and 1
+	static __m128i Convert8Digits(uint32_t Value)
+	{
+		__m128i Octet = _mm_cvtsi32_si128(static_cast<int>(Value));
+		__m128i High = _mm_srli_epi64(_mm_mul_epu32(Octet, _mm_set1_epi32(static_cast<int>(0xd1b71759))), 45);
+		__m128i Low = _mm_sub_epi32(Octet, _mm_mul_epu32(High, _mm_set1_epi32(10000)));
+		__m128i Halves = _mm_slli_epi64(_mm_unpacklo_epi16(High, Low), 2);
+		Halves = _mm_unpacklo_epi16(Halves, Halves);
+		Halves = _mm_unpacklo_epi32(Halves, Halves);
+
+		// Division by multiplication: [a, ab, abc, abcd] for every half, then tens are subtracted
+		__m128i Prefixes = _mm_mulhi_epu16(Halves, _mm_setr_epi16(8389, 5243, 13108, -32768, 8389, 5243, 13108, -32768));
+		Prefixes = _mm_mulhi_epu16(Prefixes, _mm_setr_epi16(1 << 7, 1 << 11, 1 << 13, -32768, 1 << 7, 1 << 11, 1 << 13, -32768));
+		__m128i Tens = _mm_slli_epi64(_mm_mullo_epi16(Prefixes, _mm_set1_epi16(10)), 16);
+		return _mm_sub_epi16(Prefixes, Tens);
+	}
+
+	static unsigned CountTrailingZeros(uint32_t Value)
+	{
+#ifdef _MSC_VER
+		unsigned long Index = 0;
+		_BitScanForward(&Index, Value);
+		return static_cast<unsigned>(Index);
+#else
+		return static_cast<unsigned>(__builtin_ctz(Value));
+#endif
+	}
+
+	// Pairs of digits are joined by 16-bit multiplication, then quads and octets by multiply-add
+	static uint64_t Parse16Digits(const char* String)
+	{
+		__m128i Digits = _mm_sub_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(String)), _mm_set1_epi8('0'));
+		__m128i Pairs = _mm_add_epi16(_mm_mullo_epi16(_mm_and_si128(Digits, _mm_set1_epi16(0xFF)), _mm_set1_epi16(10)), _mm_srli_epi16(Digits, 8));
+		__m128i Quads = _mm_madd_epi16(Pairs, _mm_setr_epi16(100, 1, 100, 1, 100, 1, 100, 1));
+		__m128i Octets = _mm_madd_epi16(_mm_packs_epi32(Quads, Quads), _mm_setr_epi16(10000, 1, 10000, 1, 10000, 1, 10000, 1));
+		uint64_t High = static_cast<uint32_t>(_mm_cvtsi128_si32(Octets));
+		uint64_t Low = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(Octets, 4)));
+		return High * Pow10_8 + Low;
+	}
+
+	// Keeps low 32 bits of 64-bit lanes in both registers: [a0, a1, b0, b1]
+	static __m128i Narrow64To32(__m128i First, __m128i Second)
+	{
+		return _mm_unpacklo_epi64(_mm_shuffle_epi32(First, _MM_SHUFFLE(3, 1, 2, 0)), _mm_shuffle_epi32(Second, _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+#endif
+
+	static void Write16Digits(uint64_t Value, char* Out)
+	{
+#ifdef PROXIMA_FLAKE_SSE2
+		__m128i Digits = _mm_packus_epi16(Convert8Digits(static_cast<uint32_t>(Value / Pow10_8)), Convert8Digits(static_cast<uint32_t>(Value % Pow10_8)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(Out), _mm_add_epi8(Digits, _mm_set1_epi8('0')));
+#else
+		WriteDigits(Value / Pow10_8, Out + 8, 8);
+		WriteDigits(Value % Pow10_8, Out + 16, 8);
+#endif
+	}
+
+	// Output must have room for MaxDecimalLength chars
+	static size_t WriteDecimal(uint64_t Flake, char* Out)
+	{
+		if (Flake < Pow10_8) {
+			size_t Length = GetDigitsCount(Flake);
+			WriteDigits(Flake, Out + Length, Length);
+			return Length;
+		}
+
+		uint64_t Head = Flake / Pow10_16;
+		if (Head != 0) {
+			size_t HeadLength = GetDigitsCount(Head);
+			WriteDigits(Head, Out + HeadLength, HeadLength);
+			Write16Digits(Flake % Pow10_16, Out + HeadLength);
+			return HeadLength + 16;
+		}
+
+		char Digits[16];
+		Write16Digits(Flake, Digits);
+		size_t Zeros = 0;
+		while (Digits[Zeros] == '0') {
+			Zeros++;
+		}
+
+		std::memcpy(Out, Digits + Zeros, 16 - Zeros);
+		return 16 - Zeros;
+	}
+
+	// Length of digits run, which is longer than MaxDecimalLength only for invalid input
+	static size_t GetDigitsLength(const char* String, size_t Length)
+	{
+		size_t Position = 0;
+#ifdef PROXIMA_FLAKE_SSE2
+		while (Length - Position >= 16 && Position <= MaxDecimalLength) {
+			__m128i Chars = _mm_sub_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(String + Position)), _mm_set1_epi8('0'));
+			__m128i Digits = _mm_cmpeq_epi8(_mm_min_epu8(Chars, _mm_set1_epi8(9)), Chars);
+			uint32_t NotDigits = ~static_cast<uint32_t>(_mm_movemask_epi8(Digits)) & 0xFFFF;
+			if (NotDigits != 0) {
+				return Position + CountTrailingZeros(NotDigits);
+			}
+
+			Position += 16;
+		}
+#endif
+		while (Position < Length && Position <= MaxDecimalLength && IsDigit(String[Position])) {
+			Position++;
+		}
+
+		return Position;
+	}
+
+	static void WriteBase62Part(uint32_t Value, char* Out)
+	{
+		for (int i = 4; i >= 0; i--) {
+			Out[i] = Base62Alphabet[Value % 62];
+			Value /= 62;
+		}
+	}
+
+	// 62^10 is more than 2^59: flake is split to 2 parts of 5 chars, which fit 32 bits, and leading char
+	static void WriteBase62(uint64_t Flake, char* Out)
+	{
+		uint64_t Upper = Flake / Pow62_5;
+		Out[0] = Base62Alphabet[Upper / Pow62_5];
+		WriteBase62Part(static_cast<uint32_t>(Upper % Pow62_5), Out + 1);
+		WriteBase62Part(static_cast<uint32_t>(Flake % Pow62_5), Out + 6);
+	}
+
+	template<typename WriteFunction>
+	static size_t EncodeBatch(const uint64_t* Flakes, size_t FlakesCount, char Separator, char* OutBuffer, size_t BufferSize, WriteFunction&& Write)
+	{
+		size_t Written = 0;
+		for (size_t i = 0; i < FlakesCount; i++) {
+			if (i != 0) {
+				if (Written == BufferSize) {
+					return 0;
+				}
+
+				OutBuffer[Written++] = Separator;
+			}
+
+			size_t Length = Write(Flakes[i], OutBuffer + Written, BufferSize - Written);
+			if (Length == 0) {
+				return 0;
+			}
+
+			Written += Length;
+		}
+
+		return Written;
+	}
+
+	template<typename DecodeFunction>
+	static bool DecodeBatch(const char* String, size_t Length, char Separator, std::vector<uint64_t>& OutFlakes, DecodeFunction&& Decode)
+	{
+		size_t Position = 0;
+		while (Position < Length) {
+			uint64_t Flake = 0;
+			size_t Parsed = Decode(String + Position, Length - Position, Flake);
+			if (Parsed == 0) {
+				return false;
+			}
+
+			OutFlakes.push_back(Flake);
+			Position += Parsed;
+			if (Position != Length && String[Position++] != Separator) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+public:
+	static size_t EncodeDecimal(uint64_t Flake, char* OutBuffer, size_t BufferSize)
+	{
+		if (BufferSize >= MaxDecimalLength) {
+			return WriteDecimal(Flake, OutBuffer);
+		}
+
+		char Digits[MaxDecimalLength];
+		size_t Length = WriteDecimal(Flake, Digits);
+		if (Length > BufferSize) {
+			return 0;
+		}
+
+		std::memcpy(OutBuffer, Digits, Length);
+		return Length;
+	}
+
+	// Parses digits from the start of string, returns 0 if there are no digits or number doesn't fit 64 bits
+	static size_t DecodeDecimal(const char* String, size_t Length, uint64_t& OutFlake)
+	{
+		size_t Zeros = 0;
+		while (Zeros < Length && String[Zeros] == '0') {
+			Zeros++;
+		}
+
+		String += Zeros;
+		size_t DigitsLength = GetDigitsLength(String, Length - Zeros);
+		if (DigitsLength + Zeros == 0 || DigitsLength > MaxDecimalLength) {
+			return 0;
+		}
+
+		size_t HeadLength = DigitsLength > 16 ? DigitsLength - 16 : 0;
+		uint64_t Head = ParseDigits(String, HeadLength);
+#ifdef PROXIMA_FLAKE_SSE2
+		uint64_t Tail = DigitsLength >= 16 ? Parse16Digits(String + HeadLength) : ParseDigits(String, DigitsLength);
+#else
+		uint64_t Tail = ParseDigits(String + HeadLength, DigitsLength - HeadLength);
+#endif
+		if (Head > UINT64_MAX / Pow10_16 || Tail > UINT64_MAX - Head * Pow10_16) {
+			return 0;
+		}
+
+		OutFlake = Head * Pow10_16 + Tail;
+		return Zeros + DigitsLength;
+	}
+
+	static size_t EncodeBase62(uint64_t Flake, char* OutBuffer, size_t BufferSize)
+	{
+		if (BufferSize < Base62Length) {
+			return 0;
+		}
+
+		WriteBase62(Flake, OutBuffer);
+		return Base62Length;
+	}
+
+	// Shorter strings are accepted too, as numbers without leading zeros
+	static size_t DecodeBase62(const char* String, size_t Length, uint64_t& OutFlake)
+	{
+		uint64_t Value = 0;
+		size_t Position = 0;
+		for (; Position < Length && Position <= Base62Length; Position++) {
+			int Digit = ProximaFlakeBase62.Values[static_cast<uint8_t>(String[Position])];
+			if (Digit < 0) {
+				break;
+			}
+
+			// Only 11th char can overflow
+			if (Position == Base62Length - 1 && Value > (UINT64_MAX - static_cast<uint64_t>(Digit)) / 62) {
+				return 0;
+			}
+
+			Value = Value * 62 + static_cast<uint64_t>(Digit);
+		}
+
+		if (Position == 0 || Position > Base62Length) {
+			return 0;
+		}
+
+		OutFlake = Value;
+		return Position;
+	}
+
+	// Returns written size without terminating zero, or 0 if buffer is too small for all flakes
+	static size_t EncodeDecimalBatch(const uint64_t* Flakes, size_t FlakesCount, char Separator, char* OutBuffer, size_t BufferSize)
+	{
+		return EncodeBatch(Flakes, FlakesCount, Separator, OutBuffer, BufferSize, EncodeDecimal);
+	}
+
+	static size_t EncodeBase62Batch(const uint64_t* Flakes, size_t FlakesCount, char Separator, char* OutBuffer, size_t BufferSize)
+	{
+		return EncodeBatch(Flakes, FlakesCount, Separator, OutBuffer, BufferSize, EncodeBase62);
+	}
+
+	// Enough for any flakes, with separators
+	static constexpr size_t GetDecimalBatchSize(size_t FlakesCount)
+	{
+		return FlakesCount * (MaxDecimalLength + 1);
+	}
+
+	static constexpr size_t GetBase62BatchSize(size_t FlakesCount)
+	{
+		return FlakesCount * (Base62Length + 1);
+	}
+
+	// Appends flakes of separated list (separator after the last one is allowed), false on malformed flake
+	static bool DecodeDecimalBatch(const char* String, size_t Length, char Separator, std::vector<uint64_t>& OutFlakes)
+	{
+		return DecodeBatch(String, Length, Separator, OutFlakes, DecodeDecimal);
+	}
+
+	static bool DecodeBase62Batch(const char* String, size_t Length, char Separator, std::vector<uint64_t>& OutFlakes)
+	{
+		return DecodeBatch(String, Length, Separator, OutFlakes, DecodeBase62);
+	}
+
+	// Raw timestamps: 10 ms ticks since ProximaEpoch
+	static void ExtractTimestamps(const uint64_t* Flakes, size_t FlakesCount, uint64_t* OutTimestamps)
+	{
+		size_t i = 0;
+#ifdef PROXIMA_FLAKE_SSE2
+		for (; i + 2 <= FlakesCount; i += 2) {
+			__m128i Values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Flakes + i));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(OutTimestamps + i), _mm_and_si128(Values, _mm_set1_epi64x(TimestampMask)));
+		}
+#endif
+		for (; i < FlakesCount; i++) {
+			OutTimestamps[i] = Flakes[i] & TimestampMask;
+		}
+	}
+
+	static void ExtractMachineIds(const uint64_t* Flakes, size_t FlakesCount, uint16_t* OutMachineIds)
+	{
+		size_t i = 0;
+#ifdef PROXIMA_FLAKE_SSE2
+		for (; i + 8 <= FlakesCount; i += 8) {
+			__m128i Values[4];
+			for (size_t j = 0; j < 4; j++) {
+				Values[j] = _mm_srli_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(Flakes + i + j * 2)), MachineIdShift);
+				Values[j] = _mm_and_si128(Values[j], _mm_set1_epi64x(MachineIdMask));
+			}
+
+			__m128i MachineIds = _mm_packs_epi32(Narrow64To32(Values[0], Values[1]), Narrow64To32(Values[2], Values[3]));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(OutMachineIds + i), MachineIds);
+		}
+#endif
+		for (; i < FlakesCount; i++) {
+			OutMachineIds[i] = static_cast<uint16_t>((Flakes[i] >> MachineIdShift) & MachineIdMask);
+		}
+	}
+
+	static void ExtractObjectTypes(const uint64_t* Flakes, size_t FlakesCount, uint8_t* OutObjectTypes)
+	{
+		size_t i = 0;
+#ifdef PROXIMA_FLAKE_SSE2
+		for (; i + 16 <= FlakesCount; i += 16) {
+			__m128i Values[8];
+			for (size_t j = 0; j < 8; j++) {
+				Values[j] = _mm_srli_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(Flakes + i + j * 2)), ObjectTypeShift);
+			}
+
+			__m128i LowTypes = _mm_packs_epi32(Narrow64To32(Values[0], Values[1]), Narrow64To32(Values[2], Values[3]));
+			__m128i HighTypes = _mm_packs_epi32(Narrow64To32(Values[4], Values[5]), Narrow64To32(Values[6], Values[7]));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(OutObjectTypes + i), _mm_packus_epi16(LowTypes, HighTypes));
+		}
+#endif
+		for (; i < FlakesCount; i++) {
+			OutObjectTypes[i] = static_cast<uint8_t>(Flakes[i] >> ObjectTypeShift);
+		}
+	}
+};
+
 class CProximaFlake
 {
 private:
@@ -93,18 +536,28 @@ public:
 		rawData = NewData;
 	}
 
+	// Whole string must be decimal flake, CProximaFlakeCodec parses without exceptions
 	CProximaFlake(const char* String)
+		: CProximaFlake(String, std::strlen(String))
 	{
-		uint64_t Number = std::stoull(String);
-		std::memcpy(&rawData, &Number, sizeof(uint64_t));
 	}
 
-	CProximaFlake(std::string String) 
+	CProximaFlake(const std::string& String)
+		: CProximaFlake(String.data(), String.size())
 	{
-		uint64_t Number = std::stoull(String);
+	}
+
+	CProximaFlake(const char* String, size_t Length)
+	{
+		uint64_t Number = 0;
+		if (Length == 0 || CProximaFlakeCodec::DecodeDecimal(String, Length, Number) != Length) {
+			throw std::exception();
+		}
+
 		std::memcpy(&rawData, &Number, sizeof(uint64_t));
 	}
 
+	// Caller manages sequence, so IDs of the same tick can collide; CProximaFlakeGenerator doesn't have this problem
 	static CProximaFlake GenerateSnowFlake(uint64_t MachineId, uint64_t ObjectType, uint64_t Sequence)
 	{
 		ProximaFlakeData newData = {};
@@ -127,12 +580,21 @@ public:
 
 	uint64_t GetFlake()
 	{
-		return *(uint64_t*)&rawData;
+		uint64_t Number = 0;
+		std::memcpy(&Number, &rawData, sizeof(uint64_t));
+		return Number;
 	}
 
 	std::string GetFlakeString()
 	{
-		return std::to_string(GetFlake());
+		char Buffer[CProximaFlakeCodec::MaxDecimalLength];
+		return std::string(Buffer, CProximaFlakeCodec::EncodeDecimal(GetFlake(), Buffer, sizeof(Buffer)));
+	}
+
+	std::string GetFlakeBase62String()
+	{
+		char Buffer[CProximaFlakeCodec::Base62Length];
+		return std::string(Buffer, CProximaFlakeCodec::EncodeBase62(GetFlake(), Buffer, sizeof(Buffer)));
 	}
 
 	ProximaFlakeData GetRawFlake()
@@ -140,3 +602,156 @@ public:
 		return rawData;
 	}
 };
+
+/*
+	Thread-safe generator of unique flakes. Range of machine ids is split into shards, every
+	shard keeps last issued (tick, sequence) pair as one atomic counter: tick * 256 + sequence.
+	So sequence overflow moves counter to the next tick by itself, and ID is taken by single
+	compare-exchange, without locks. Thread starts from its own shard; when tick of shard
+	is exhausted, sequences are taken from other shards, then borrowed from a few next ticks,
+	and only after that generator waits for the clock.
+
+	Time is steady clock anchored to wall clock (and ProximaEpoch) once at construction, so
+	wall clock going backwards doesn't repeat IDs. Every machine id must belong to one
+	generator at a time.
+*/
+class CProximaFlakeGenerator
+{
+public:
+	static constexpr uint64_t SequenceCount = 256;
+	static constexpr uint64_t MaxMachineId = 2048;
+	static constexpr uint64_t MaxBorrowTicks = 10;		// 100 ms ahead of clock at most
+
+private:
+	struct alignas(64) FlakeShard
+	{
+		std::atomic<uint64_t> LastCounter = { 0 };
+		uint64_t MachineId = 0;
+	};
+
+	std::unique_ptr<FlakeShard[]> Shards;
+	size_t ShardsCount = 0;
+	std::atomic<size_t> SpareShard = { 0 };			// last shard which had free sequences in its tick
+	std::atomic<uint64_t> ExhaustedTick = { 0 };		// tick in which all shards were found exhausted
+	uint64_t AnchorTick = 0;
+	std::chrono::steady_clock::time_point AnchorTime;
+
+	static size_t GetThreadSlot()
+	{
+		static std::atomic<size_t> NextSlot = { 0 };
+		thread_local size_t ThreadSlot = NextSlot.fetch_add(1, std::memory_order_relaxed);
+		return ThreadSlot;
+	}
+
+	uint64_t GetCurrentTick()
+	{
+		auto Elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - AnchorTime);
+		return AnchorTick + static_cast<uint64_t>(Elapsed.count()) / 10;
+	}
+
+	// Take up to Count counters of shard which aren't past LastTick, returns count taken
+	static uint64_t ReserveCounters(FlakeShard& Shard, uint64_t CurrentTick, uint64_t LastTick, uint64_t Count, uint64_t& OutFirst)
+	{
+		uint64_t LastCounter = Shard.LastCounter.load(std::memory_order_relaxed);
+		while (true) {
+			uint64_t FirstCounter = std::max(LastCounter + 1, CurrentTick * SequenceCount);
+			uint64_t EndCounter = (LastTick + 1) * SequenceCount;
+			if (FirstCounter >= EndCounter) {
+				return 0;
+			}
+
+			uint64_t Taken = std::min(Count, EndCounter - FirstCounter);
+			if (Shard.LastCounter.compare_exchange_weak(LastCounter, FirstCounter + Taken - 1, std::memory_order_relaxed)) {
+				OutFirst = FirstCounter;
+				return Taken;
+			}
+		}
+	}
+
+	static void WriteFlakes(const FlakeShard& Shard, uint64_t ObjectType, uint64_t FirstCounter, uint64_t Count, uint64_t* OutFlakes)
+	{
+		for (uint64_t i = 0; i < Count; i++) {
+			ProximaFlakeData NewData = {};
+			NewData.Timestamp = (FirstCounter + i) / SequenceCount;
+			NewData.Sequence = (FirstCounter + i) % SequenceCount;
+			NewData.MachineId = Shard.MachineId;
+			NewData.ObjectType = ObjectType;
+			std::memcpy(&OutFlakes[i], &NewData, sizeof(uint64_t));
+		}
+	}
+
+public:
+	// Shards use machine ids [FirstMachineId, FirstMachineId + MachineIdsCount)
+	CProximaFlakeGenerator(uint64_t FirstMachineId, size_t MachineIdsCount = 1)
+	{
+		if (MachineIdsCount == 0 || FirstMachineId >= MaxMachineId || MachineIdsCount > MaxMachineId - FirstMachineId) {
+			throw std::exception();
+		}
+
+		ShardsCount = MachineIdsCount;
+		Shards = std::make_unique<FlakeShard[]>(ShardsCount);
+		for (size_t i = 0; i < ShardsCount; i++) {
+			Shards[i].MachineId = FirstMachineId + i;
+		}
+
+		uint64_t WallTime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		AnchorTime = std::chrono::steady_clock::now();
+		AnchorTick = WallTime / 10 - ProximaEpoch;
+	}
+
+	CProximaFlake Generate(CProximaFlake::ObjectType Type)
+	{
+		uint64_t Flake = 0;
+		GenerateBatch(Type, &Flake, 1);
+		return CProximaFlake(Flake);
+	}
+
+	// Flakes of one shard are ordered, but batch can be made of several shards
+	void GenerateBatch(CProximaFlake::ObjectType Type, uint64_t* OutFlakes, size_t FlakesCount)
+	{
+		size_t HomeShard = GetThreadSlot() % ShardsCount;
+		while (FlakesCount != 0) {
+			uint64_t CurrentTick = GetCurrentTick();
+			uint64_t FirstCounter = 0;
+			size_t ShardIndex = HomeShard;
+			uint64_t Taken = ReserveCounters(Shards[ShardIndex], CurrentTick, CurrentTick, FlakesCount, FirstCounter);
+
+			// Shared hints keep search short: start from the last spare shard, don't search in tick found exhausted
+			if (Taken == 0 && ShardsCount > 1 && ExhaustedTick.load(std::memory_order_relaxed) != CurrentTick) {
+				size_t FirstShard = SpareShard.load(std::memory_order_relaxed);
+				for (size_t i = 0; i < ShardsCount && Taken == 0; i++) {
+					ShardIndex = (FirstShard + i) % ShardsCount;
+					Taken = ReserveCounters(Shards[ShardIndex], CurrentTick, CurrentTick, FlakesCount, FirstCounter);
+				}
+
+				if (Taken != 0) {
+					SpareShard.store(ShardIndex, std::memory_order_relaxed);
+				} else {
+					ExhaustedTick.store(CurrentTick, std::memory_order_relaxed);
+				}
+			}
+
+			if (Taken == 0) {
+				ShardIndex = HomeShard;
+				Taken = ReserveCounters(Shards[ShardIndex], CurrentTick, CurrentTick + MaxBorrowTicks, FlakesCount, FirstCounter);
+			}
+
+			// Every sequence up to borrow limit is taken: wait for the next tick
+			if (Taken == 0) {
+				std::this_thread::sleep_until(AnchorTime + std::chrono::milliseconds((CurrentTick + 1 - AnchorTick) * 10));
+				continue;
+			}
+
+			WriteFlakes(Shards[ShardIndex], static_cast<uint64_t>(Type), FirstCounter, Taken, OutFlakes);
+			OutFlakes += Taken;
+			FlakesCount -= static_cast<size_t>(Taken);
+		}
+	}
+
+	void GenerateBatch(CProximaFlake::ObjectType Type, std::vector<uint64_t>& OutFlakes, size_t FlakesCount)
+	{
+		size_t BaseSize = OutFlakes.size();
+		OutFlakes.resize(BaseSize + FlakesCount);
+		GenerateBatch(Type, OutFlakes.data() + BaseSize, FlakesCount);
+	}
+};
@@ -5,11 +5,15 @@
 **********************************************************
 * Module Name: base include header for xpackage
 *********************************************************/
+#pragma once
 #include <string>
 #include <memory>
 #include <vector>
 #include <unordered_map>
 #include <set>
+#include <string_view>
+#include <future>
+#include "simdjson.h"
 
 namespace xpckg
 {
@@ -51,16 +55,34 @@ namespace xpckg
 		AU = 0x8
 	};
 
+	/*
+		View of package manifest. Strings point into parsed document, which is kept alive by
+		view itself, so copies of information are cheap and listings don't allocate per field.
+	*/
 	class PackageInformation
 	{
 	private:
+		std::shared_ptr<simdjson::dom::element> Manifest;
+		uint64_t Id = 0;
+		std::string_view Name;
+		std::string_view Description;
+		std::string_view Version;
+
+		size_t Binaries = 0;
+		size_t Systems = 0;
+		size_t Renders = 0;
+		size_t Hosts = 0;
 
 	public:
-		std::string GetId();
-		std::string GetName();
-		std::string GetDescription();
-		std::string GetVersion();
+		PackageInformation() = default;
+		PackageInformation(std::shared_ptr<simdjson::dom::element> ManifestElement);
+
+		uint64_t GetId();
+		std::string_view GetName();
+		std::string_view GetDescription();
+		std::string_view GetVersion();
 		
+		/* Bitmasks of PackageBinaries, PackageSystems, RenderSystems and Hosts values */
 		size_t GetBinaries();
 		size_t GetSystems();
 		size_t GetRenders();
@@ -68,6 +90,10 @@ namespace xpckg
 	};
 }
 
-#include "simdjson.h"
 #include "proximaflake.h"
-#include "xpackage_manager.h"
\ No newline at end of file
+#include "xpackage_pool.h"
+#include "xpackage_stats.h"
+#include "xpackage_manager.h"
+#include "xpackage_archive.h"
+#include "xpackage_registry.h"
+#include "xpackage_store.h"
\ No newline at end of file
@@ -0,0 +1,260 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: memory mapped package archive reader and writer
+*********************************************************/
+#pragma once
+#include <array>
+#include <atomic>
+#include <string_view>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+
+namespace xpckg
+{
+	enum class CompressionMethod : uint16_t
+	{
+		Stored = 0,
+		Deflated = 8,
+		Zstd = 93			// seekable zstd stream, see "ZstdFrame"
+	};
+
+	/* Container of package: ZIP or native one with binary index and aligned payloads */
+	enum class ArchiveFormat
+	{
+		Zip,
+		Native
+	};
+
+	/*
+		Entry of central directory (or native index). Name points directly to mapped archive
+		memory, so entry is valid only while owner archive is alive.
+	*/
+	struct ArchiveEntry
+	{
+		std::string_view Name;
+		uint64_t LocalHeaderOffset;
+		uint64_t DataOffset;			// known for native packages only, ZIP ones have it after local header
+		uint64_t CompressedSize;
+		uint64_t UncompressedSize;
+		uint32_t Crc32;
+		uint32_t PlatformMask;			// "PackageBinaries" of entry from native index, zero if unknown
+		uint16_t Method;
+		uint16_t Flags;
+	};
+
+	/* SHA-256 of entry content, "sha256" object of manifest maps entry paths to them */
+	using Sha256Digest = std::array<uint8_t, 32>;
+
+	class Archive;
+	class ThreadPool;
+	class Sha256;
+	class ZstdStream;
+	struct TraceCounters;
+	struct NativeIndexEntry;
+
+	/* Opens destination file for entry, returns nullptr (or throws) on failure */
+	using EntryTarget = std::function<FilePointer(const ArchiveEntry& Entry, const std::string& EntryPath)>;
+
+	/*
+		Reusable state for streaming extraction to disk: bounded set of output chunks and
+		background writer thread. While writer flushes chunk N to file, caller inflates
+		chunk N+1, so extraction time tends to max(decompress, disk) with flat memory usage.
+	*/
+	class ExtractStream
+	{
+	private:
+		struct StreamChunk
+		{
+			std::vector<uint8_t> Data;
+			size_t DataSize = 0;
+			size_t FileOffset = 0;
+			FileHandle* TargetFile = nullptr;
+			TraceCounters* Counters = nullptr;		// statistics of install phase which filled chunk
+		};
+
+		std::vector<StreamChunk> Chunks;
+		std::deque<size_t> FreeChunks;
+		std::deque<size_t> FilledChunks;
+		std::mutex StreamMutex;
+		std::condition_variable StreamEvent;
+		std::thread WriterThread;
+		bool IsWriteFailed = false;
+		bool IsTerminating = false;
+		void* InflateState = nullptr;
+		std::unique_ptr<ZstdStream> ZstdState;		// created by first zstd entry
+
+		/*
+			Checksums of entry being streamed. Chunks are hashed right before they are written,
+			while still in cache, and on writer thread, so hashing overlaps inflate of next chunk.
+		*/
+		uint32_t EntryCrc = 0;
+		std::unique_ptr<Sha256> EntryHasher;		// null if entry has no declared digest
+
+		void WriterProc();
+		void BeginEntry(bool bHashSha256);
+		void HashChunk(const StreamChunk& Chunk);
+		size_t AcquireChunk();
+		void SubmitChunk(size_t ChunkIndex);
+		bool WaitForWrites();
+
+		friend class Archive;
+
+	public:
+		/* Without background writer chunks are written inline, for callers which are parallel themselves */
+		ExtractStream(size_t ChunkSize = 1024 * 1024, size_t ChunksCount = 2, bool bBackgroundWriter = true);
+		~ExtractStream();
+	};
+
+	class Archive
+	{
+	private:
+		FilePointer ArchiveFile;
+		const uint8_t* ArchiveData = nullptr;
+		size_t ArchiveSize = 0;
+		std::vector<ArchiveEntry> Entries;
+
+		/*
+			Open addressing table over central directory, built once at open time. Slot keeps
+			part of name hash next to entry index, so probing doesn't touch entries on mismatch.
+		*/
+		struct IndexSlot
+		{
+			uint32_t HashTag;
+			uint32_t EntryIndex;	// index + 1, zero means empty slot
+		};
+
+		std::vector<IndexSlot> EntriesIndex;
+		size_t IndexMask = 0;
+
+		/* Index and buckets of native package inside mapping, entries go in index order; null for ZIP */
+		const NativeIndexEntry* NativeIndex = nullptr;
+		const uint32_t* NativeBuckets = nullptr;
+		uint32_t NativeBucketShift = 0;
+
+		/* Digests declared by manifest, entries without one are checked by CRC only */
+		std::unordered_map<const ArchiveEntry*, Sha256Digest> EntryDigests;
+		std::atomic<bool> IsMismatchFound = { false };
+
+		bool ReadCentralDirectory();
+		bool ReadNativeIndex();
+		void BuildIndex();
+		bool VerifyEntry(const ArchiveEntry& Entry, uint32_t Crc, Sha256* Hasher, Sha256Digest* OutDigest = nullptr);
+
+	public:
+		/* Format is detected by signature, both ones give the same entries */
+		Archive(FilePointer ZipFile);
+		~Archive();
+
+		ArchiveFormat GetFormat();
+
+		const std::vector<ArchiveEntry>& GetEntries();
+		const ArchiveEntry* FindEntry(std::string_view EntryName);
+
+		/* Pointer to raw (possibly compressed) entry payload inside mapped archive */
+		const uint8_t* GetEntryData(const ArchiveEntry& Entry);
+
+		/* Fault in pages of entry payload, so following inflate doesn't wait for disk */
+		void PrefetchEntry(const ArchiveEntry& Entry);
+
+		/*
+			Read part of entry content without extracting all of it. Stored and seekable zstd
+			entries are supported, zstd ones decode only frames covering the range. Data read
+			by ranges isn't checked against CRC, it's known only for the whole entry.
+		*/
+		bool ReadEntryRange(const ArchiveEntry& Entry, uint64_t Offset, uint8_t* OutData, size_t DataSize);
+
+		/* Digest checked by every following extraction of entry, not safe to call during extraction */
+		void SetEntryDigest(const ArchiveEntry& Entry, const Sha256Digest& Digest);
+		const Sha256Digest* GetEntryDigest(const ArchiveEntry& Entry);
+
+		/*
+			Every extraction checks CRC of entry (and digest, if any). Data which doesn't match
+			fails extraction and raises this flag, so callers can tell damaged package from I/O errors.
+		*/
+		bool IsIntegrityFailed();
+
+		bool ExtractEntryToMemory(const ArchiveEntry& Entry, std::vector<uint8_t>& OutData);
+		bool ExtractEntryToMemory(std::string_view EntryName, std::vector<uint8_t>& OutData);
+
+		/*
+			Streaming extraction through bounded buffers of stream, output file is written from zero offset.
+			With digest output content is hashed on the way, even if manifest declares no digest for it.
+		*/
+		bool ExtractEntryToFile(const ArchiveEntry& Entry, FileHandle& OutFile, ExtractStream& Stream, Sha256Digest* OutDigest = nullptr);
+
+		/*
+			Extract list of entries to files opened by target callback. With pool entries are
+			spread between workers, biggest first, otherwise they are streamed on calling thread.
+			Output is the same for both paths because entries are independent. Big seekable
+			zstd entries without declared digest are split by frames between workers too.
+			Digests output gets SHA-256 of every entry, in order of list; no entry is split then.
+		*/
+		bool ExtractEntries(const EntriesList& Entries, const EntryTarget& OpenTarget, ThreadPool* Pool, size_t ChunkSize = 1024 * 1024,
+			std::vector<Sha256Digest>* OutDigests = nullptr);
+	};
+
+	/* Source of entry for archive writer: file on disk (opened by worker) or memory */
+	struct WriterEntry
+	{
+		std::string Name;					// archive path with '/' separators
+		std::string SourcePath;				// empty if content is in "SourceData"
+		std::vector<uint8_t> SourceData;
+		bool IsStored = false;				// content is already compressed, don't try deflate
+		uint32_t PlatformMask = 0;			// "PackageBinaries" which install entry, kept by native index only
+	};
+
+	/*
+		ZIP writer. Entries are compressed on pool, bounded count of them at once, but
+		written strictly in order of list, so caller decides layout of archive. Deflated
+		entry which isn't smaller than source is stored instead. ZIP64 records are added
+		only for entries and archives which don't fit plain ZIP. Level is deflate (1-9) or
+		zstd (1-19) one, zero stores all entries. Native format has the same entries and
+		methods, but payloads are aligned and index is written sorted instead of directory.
+	*/
+	class ArchiveWriter
+	{
+	private:
+		struct WrittenEntry
+		{
+			std::string Name;
+			uint64_t LocalHeaderOffset;		// payload offset in native format
+			uint64_t CompressedSize;
+			uint64_t UncompressedSize;
+			uint32_t Crc32;
+			uint32_t PlatformMask;
+			uint16_t Method;
+		};
+
+		FilePointer ArchiveFile;
+		ArchiveFormat Format = ArchiveFormat::Zip;
+		uint64_t ArchiveOffset = 0;
+		std::vector<WrittenEntry> WrittenEntries;
+		bool IsFailed = false;
+		CompressionMethod Method = CompressionMethod::Deflated;
+		size_t FrameSize = 1024 * 1024;
+
+		bool WriteData(const void* Data, size_t DataSize);
+		bool FinishNative();
+
+	public:
+		ArchiveWriter(FilePointer TargetFile, ArchiveFormat NewFormat = ArchiveFormat::Zip);
+
+		/* Method of following entries, deflate or seekable zstd; false if zstd isn't built in */
+		bool SetCompression(CompressionMethod NewMethod, size_t NewFrameSize = 1024 * 1024);
+
+		/* Append entries in list order, can be called many times before "Finish()" */
+		bool AddEntries(std::vector<WriterEntry>& Entries, ThreadPool* Pool, int Level);
+
+		/* Write central directory (or native index and header), archive is readable only after that */
+		bool Finish();
+
+		uint64_t GetArchiveSize();
+		size_t GetStoredCount();
+	};
+}
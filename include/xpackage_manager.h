@@ -6,15 +6,25 @@
 * Module Name: base include header for xpackage manager
 *********************************************************/
 
-namespace zipper
-{
-	class Unzipper;
-}
-
 namespace xpckg
 {
 	using RawHandle = void*;
 
+	class Archive;
+	struct ArchiveEntry;
+	using ArchivePointer = std::shared_ptr<Archive>;
+	using EntriesList = std::vector<std::pair<const ArchiveEntry*, std::string>>;
+
+	class PackageRegistry;
+	struct InstalledPackage;
+	struct InstalledFile;
+	using RegistryPointer = std::shared_ptr<PackageRegistry>;
+
+	class ContentStore;
+	using StorePointer = std::shared_ptr<ContentStore>;
+
+	struct InstallTask;
+
 	struct PackageInfo 
 	{
 		std::string HashName;				// Mixer to folder name
@@ -27,10 +37,13 @@ namespace xpckg
 
 	class FileHandle	{
 	private:
-		size_t FileSeek;
-		size_t FileSize;
+		size_t FileSeek = 0;
+		size_t FileSize = 0;
 		std::string FileName;
-		RawHandle CurrentHandle;
+		RawHandle CurrentHandle = nullptr;
+		RawHandle MappingHandle = nullptr;
+		const uint8_t* MappedMemory = nullptr;
+		size_t MappedSize = 0;
 
 		bool IsInvalid();
 
@@ -46,6 +59,7 @@ namespace xpckg
 
 	public:
 		FileHandle(std::string PathToFile, bool bNewFile);
+		FileHandle(RawHandle BaseDirectory, std::string PathToFile, bool bNewFile);
 		~FileHandle();
 
 		std::string GetFileName();
@@ -60,6 +74,23 @@ namespace xpckg
 		size_t WriteToFile(std::shared_ptr<std::vector<uint8_t>> InMemory);
 		size_t WriteToFile(void* InMemory, size_t SizeToWrite);
 
+		/* Positional I/O, doesn't touch current file seek */
+		size_t ReadFromFile(void* OutMemory, size_t SizeToRead, size_t FilePosition);
+		size_t WriteToFile(const void* InMemory, size_t SizeToWrite, size_t FilePosition);
+
+		/* Copy range of other file to this one, done by kernel where it's possible */
+		size_t CopyFromFile(FileHandle& SourceFile, size_t SourcePosition, size_t SizeToCopy, size_t FilePosition);
+
+		/* Reserve disk space for known final size, so filesystem can lay out file in one piece */
+		bool AllocateFile(size_t SizeToAllocate);
+
+		/* Wait until written data (and size of file) is on disk */
+		bool FlushFile();
+
+		/* Read-only view of the whole file, valid until handle destruction */
+		const uint8_t* MapFile();
+		void UnmapFile();
+
 		bool SeekFile(size_t FilePosition);
 	};
 
@@ -68,34 +99,89 @@ namespace xpckg
 	class Package
 	{
 	private:
-		std::shared_ptr<zipper::Unzipper> PackageZip;
+		ArchivePointer PackageArchive;
 		std::shared_ptr<simdjson::dom::element> PackageJson;
+		std::shared_ptr<PackageInformation> Information;
 
 	public:
-		Package(std::shared_ptr<zipper::Unzipper> ZipFile, std::shared_ptr<simdjson::dom::element> jsonElem);
+		Package(ArchivePointer ZipFile, std::shared_ptr<simdjson::dom::element> jsonElem);
 		~Package();
 
+		/* Fields are extracted from manifest once, on first call */
 		PackageInformation GetPackageInformation();
 		bool GetPlatformBinary(xpckg::PackageBinaries BinaryType, std::list<std::pair<std::vector<uint8_t>, std::string>>& BinariesList);
 		bool GetInstallPackageName(xpckg::PackageBinaries BinaryType, std::list<std::string>& PathsList);
+
+		/* Archive entries of platform with native relative paths, nothing is extracted here */
+		bool GetPlatformEntries(xpckg::PackageBinaries BinaryType, EntriesList& OutEntries);
+		ArchivePointer GetArchive();
+		std::shared_ptr<simdjson::dom::element> GetManifest();
 	};
 
 	using PackagePointer = std::shared_ptr<Package>;
 	typedef bool(PackageCallback)(PackageInfo* PathToPackage, xpckg::PackageBinaries BinaryType);
 	typedef bool(DeleteCallback)(PackageInfo* HandleOfPackage, xpckg::PackageBinaries BinaryType);
 
+	/* Single package of batch install, fields have the same meaning as InstallPackage arguments */
+	struct InstallRequest
+	{
+		PackageInfo PathToPackage;
+		xpckg::PackageBinaries BinaryType;
+		PackagePointer PackageToInstall = nullptr;
+		PackageCallback* CustomCallback = nullptr;
+	};
+
+	/*
+		Shared state of asynchronous install. Install threads update counters, caller polls
+		them from any thread without locks. Cancel request is checked between extracted chunks.
+	*/
+	struct InstallControl
+	{
+		std::atomic<uint64_t> BytesTotal = { 0 };		// uncompressed size of entries to write, known when extraction starts
+		std::atomic<uint64_t> BytesDone = { 0 };
+		std::atomic<InstallPhase> Phase = { InstallPhase::Open };
+		std::atomic<bool> IsCancelRequested = { false };
+
+		void Cancel()
+		{
+			IsCancelRequested.store(true, std::memory_order_relaxed);
+		}
+	};
+
+	using ControlPointer = std::shared_ptr<InstallControl>;
+
 	class PackageManager
 	{
 	private:
-		FilePointer ConfigHandle;
+		RegistryPointer ConfigRegistry;
+		StorePointer SharedStore;
+		PoolPointer ExtractPool;
+		PoolPointer AsyncPool;
+		PoolPointer RemovePool;
+		size_t ThreadsCount = 0;
+		size_t BufferSize = 1024 * 1024;
+		bool IsIncrementalInstall = false;
+		bool IsBatchedWrites = false;
+		bool IsInstallStats = false;
+
+		/* Parsers keep their internal buffers between manifests, documents are owned by packages */
+		std::vector<std::unique_ptr<simdjson::dom::parser>> ParsersPool;
+		std::mutex ParsersMutex;
+
+		/* Statistics of finished installs, handed out by "GetInstallStats()" */
+		std::vector<InstallStats> CollectedStats;
+		std::mutex StatsMutex;
 
 		bool IsElevatedProcess();
 		bool OpenFilePackage(FilePointer& OutPointer, std::string PathToFile);
 		bool UnpackFile(std::vector<uint8_t>& UnpackedData, FilePointer PackageHandle);
-		bool UnzipFile(FilePointer ZipPointer, std::shared_ptr<zipper::Unzipper>& UnzippedData);
-		bool ParseJson(std::shared_ptr<simdjson::dom::element>& ParsedElement, simdjson::dom::parser& customParser, std::vector<uint8_t>& UnpackedData);
+		bool UnzipFile(FilePointer ZipPointer, ArchivePointer& UnzippedData);
+		bool ParseJson(std::shared_ptr<simdjson::dom::element>& ParsedElement, std::vector<uint8_t>& UnpackedData);
 
 		void ConvertStringsToWindowsStyle(PackageInfo& packageInfo);
+		ThreadPool* GetExtractPool();
+		ThreadPool* GetRemovePool();
+		bool RegisterPackage(PackagePointer PackageToRegister, xpckg::PackageBinaries BinaryType, const std::string& FullPluginDir, const EntriesList& InstalledEntries);
 
 	public:
 		enum class ReturnCodes 
@@ -107,13 +193,122 @@ namespace xpckg
 			IsNotPackage,
 			IoFailed,
 			AfterInstallationOperationFailed,
-			OtherError
+			OtherError,
+			Cancelled,
+			IntegrityCheckFailed		// extracted data doesn't match CRC or SHA-256 digest of its entry
+		};
+
+		/*
+			What survives power loss right after install:
+			None - whatever OS has flushed by itself, files can be empty or partial.
+			Batched - new files go to staging folder, which is flushed once and renamed over
+			plugin folder, so there is either old or new version (upgrades in incremental
+			mode write changed files next to old ones, flush once and rename them over, so
+			every file is either old or new one).
+			Strict - every file is flushed before close, folders are flushed at the end.
+		*/
+		enum class DurabilityLevel
+		{
+			None,
+			Batched,
+			Strict
 		};
 
 		PackageManager(std::string PathToConfig);
 		~PackageManager();
 
+		/* Count of extraction threads: 0 - all hardware threads, 1 - extract on calling thread */
+		void SetThreadsCount(size_t NewThreadsCount);
+
+		/* Size of inflate and write buffers, larger buffers mean less syscalls per byte */
+		void SetBufferSize(size_t NewBufferSize);
+
+		/*
+			Upgrade mode: entries with the same size and CRC as in previous install of package
+			(and still present on disk with that size) are not written again, files dropped by
+			new version are removed. Works only if manager has config file.
+		*/
+		void SetIncrementalInstall(bool bIncremental);
+
+		/*
+			Shared store of file contents: equal files of all packages are written there once
+			and installed as links to it. Empty path disables store, false if it can't be created.
+		*/
+		bool SetSharedStore(std::string PathToStore);
+
+		/*
+			Small files of package are inflated to memory and written in batches by one kernel
+			request each batch (io_uring on Linux), so installs of many tiny files don't pay
+			open/write/close syscalls per file. Without kernel support install uses thread pool.
+		*/
+		void SetBatchedWrites(bool bBatched);
+
+		void SetDurability(DurabilityLevel NewDurability);
+
+		/*
+			Per-phase statistics of every install: wall time, bytes, entries and file system
+			calls. Off by default, then instrumented calls cost one thread-local check.
+		*/
+		void SetInstallStats(bool bEnabled);
+
+		/* Statistics of installs finished since previous call, in order of completion */
+		void GetInstallStats(std::vector<InstallStats>& OutStats);
+
 		ReturnCodes InstallPackage(PackageInfo PathToPackage, xpckg::PackageBinaries BinaryType, PackagePointer PackageToInstall, PackageCallback CustomCallback = nullptr);
+
+		/*
+			Install stages (map, manifest, prefetch, extract, link) run concurrently on different
+			packages with bounded queues between them, so batch takes about time of the slowest
+			stage instead of sum of all. Link stage and custom callbacks run on calling thread.
+			Result codes are returned in order of requests.
+		*/
+		std::vector<ReturnCodes> InstallPackages(const std::vector<InstallRequest>& Requests);
+
+		/*
+			Start install on internal executor and return at once. Control (optional) reports
+			progress and takes cancel request: install cancelled before its files are complete
+			removes what it has written and finishes with "Cancelled", later request is ignored.
+			Upgrade keeps previous version then, new files replace old ones only when all are written.
+			Settings of manager must not change while asynchronous installs are running.
+		*/
+		std::future<ReturnCodes> InstallPackageAsync(InstallRequest Request, ControlPointer Control = nullptr);
+
+		/*
+			Remove symlink and plugin folder of package. Folder is renamed aside first, so package
+			disappears at once, and its files are removed on background threads: by installed
+			file list from config if it's known, otherwise by walking folder. Custom callback runs
+			before anything is removed and can refuse removal. Manager destruction waits for
+			background removal to finish.
+		*/
 		ReturnCodes DeletePackage(PackageInfo PackageId, xpckg::PackageBinaries BinaryType, DeleteCallback CustomCallback = nullptr);
+
+		/* Queries to database of installed packages, available if manager has config file */
+		bool IsPackageInstalled(uint64_t PackageId);
+		bool GetInstalledPackage(uint64_t PackageId, InstalledPackage& OutPackage);
+		void GetInstalledPackages(std::vector<uint64_t>& OutIds);
+
+	private:
+		static constexpr size_t InstallStagesCount = 5;
+		DurabilityLevel Durability = DurabilityLevel::None;
+
+		ReturnCodes CheckInstallRights();
+		ReturnCodes AccessErrorCode(ReturnCodes DefaultCode);
+		ReturnCodes RunInstallStage(size_t StageIndex, InstallTask& Task);
+		ReturnCodes RunInstallTask(InstallTask& Task);
+
+		/* Record of package installed to given plugin folder, false if there is none */
+		bool FindInstalledPackage(const std::string& FullPluginDir, InstalledPackage& OutPackage);
+		void ForgetInstalledPackage(const std::string& FullPluginDir);
+		void CollectInstallStats(InstallTask& Task);
+
+		/* Returns false if there is nothing to compare with, then whole entries list must be extracted */
+		bool GetChangedEntries(InstallTask& Task, const std::function<bool(const InstalledFile& File)>& IsFileUnchanged, EntriesList& OutEntries, std::vector<std::string>& OutObsoleteFiles);
+
+		/* Stages of install in execution order, every stage works on its own package */
+		ReturnCodes MapPackage(InstallTask& Task);
+		ReturnCodes ReadManifest(InstallTask& Task);
+		ReturnCodes PrefetchPackage(InstallTask& Task);
+		ReturnCodes ExtractPackage(InstallTask& Task);
+		ReturnCodes LinkPackage(InstallTask& Task);
 	};
 }
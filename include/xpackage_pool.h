@@ -0,0 +1,67 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: work-stealing thread pool
+*********************************************************/
+#pragma once
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+
+namespace xpckg
+{
+	/*
+		Every worker owns a task deque: it pops own tasks from back (LIFO, cache-hot) and
+		steals from front of other queues when own queue is empty, so thief takes tasks
+		which owner would run last. External submits are spread between queues round-robin.
+	*/
+	class ThreadPool
+	{
+	private:
+		struct WorkerQueue
+		{
+			std::mutex QueueMutex;
+			std::deque<std::function<void()>> Tasks;
+		};
+
+		std::vector<std::unique_ptr<WorkerQueue>> Queues;
+		std::vector<std::thread> Workers;
+		std::atomic<size_t> QueuedTasks = { 0 };
+		std::atomic<size_t> ActiveTasks = { 0 };
+		std::atomic<size_t> NextQueue = { 0 };
+		std::mutex PoolMutex;
+		std::condition_variable WorkEvent;
+		std::condition_variable DoneEvent;
+		bool IsTerminating = false;
+
+		void WorkerProc(size_t WorkerIndex);
+		bool PopTask(size_t WorkerIndex, std::function<void()>& OutTask);
+		std::function<void()> WrapTask(std::function<void()> Task);
+
+	public:
+		ThreadPool(size_t ThreadsCount = 0);
+		~ThreadPool();
+
+		size_t GetThreadsCount();
+
+		/* Index of current worker in [0, GetThreadsCount()), or -1 for foreign threads */
+		static size_t GetWorkerIndex();
+
+		void Submit(std::function<void()> Task);
+
+		/*
+			Tasks in order of priority, the first ones are started first: every queue is filled
+			so its owner pops tasks in given order, and workers are woken after whole batch is queued.
+		*/
+		void SubmitBatch(std::vector<std::function<void()>>& Tasks);
+		void Wait();
+	};
+
+	using PoolPointer = std::shared_ptr<ThreadPool>;
+}
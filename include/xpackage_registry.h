@@ -0,0 +1,86 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: database of installed packages
+*********************************************************/
+#pragma once
+
+namespace xpckg
+{
+	struct InstalledFile
+	{
+		std::string Path;				// Path relative to install directory
+		uint64_t Size;
+		uint32_t Crc32;
+	};
+
+	struct InstalledPackage
+	{
+		uint64_t Id;					// ProximaFlake id from "package.json"
+		std::string Version;
+		PackageBinaries Platform;
+		std::string InstallDirectory;	// Full path to plugin folder
+		std::vector<InstalledFile> Files;
+	};
+
+	/*
+		Registry file layout (little-endian):
+			header | snapshot records | sorted index (id -> record) | log of appended records
+
+		Snapshot is written only by compaction and is queried in place through file mapping
+		with binary search over index. Updates are appended to log and mirrored in memory
+		overlay, so lookups are O(log n) for snapshot and O(1) for recent changes. When log
+		becomes large, compaction merges it into new snapshot on background thread.
+	*/
+	class PackageRegistry
+	{
+	private:
+		struct IndexRecord
+		{
+			uint64_t Id;
+			uint64_t RecordOffset;
+			uint64_t RecordSize;
+		};
+
+		std::string RegistryPath;
+		FilePointer RegistryFile;
+		const uint8_t* SnapshotData = nullptr;
+		size_t SnapshotSize = 0;
+		const IndexRecord* SnapshotIndex = nullptr;
+		size_t SnapshotCount = 0;
+		size_t LogEnd = 0;
+		size_t LogRecords = 0;
+
+		/* Overlay of log records, null pointer marks removed package */
+		std::unordered_map<uint64_t, std::shared_ptr<InstalledPackage>> LogOverlay;
+		std::vector<std::pair<uint64_t, std::shared_ptr<InstalledPackage>>> CompactionBacklog;
+		std::mutex RegistryMutex;
+		std::thread CompactionThread;
+		bool IsCompacting = false;
+
+		bool OpenRegistry();
+		bool CreateRegistry();
+		bool AppendRecord(uint64_t Id, const std::shared_ptr<InstalledPackage>& Package);
+		const IndexRecord* FindInSnapshot(uint64_t Id);
+		bool CompactRegistry();
+		void StartCompaction();
+
+	public:
+		PackageRegistry(std::string PathToRegistry);
+		~PackageRegistry();
+
+		bool ContainsPackage(uint64_t PackageId);
+		bool FindPackage(uint64_t PackageId, InstalledPackage& OutPackage);
+		void GetPackagesIds(std::vector<uint64_t>& OutIds);
+
+		bool PutPackage(const InstalledPackage& NewPackage);
+		bool RemovePackage(uint64_t PackageId);
+
+		/* Merge log into snapshot right now, on calling thread */
+		bool Compact();
+	};
+
+	using RegistryPointer = std::shared_ptr<PackageRegistry>;
+}
@@ -0,0 +1,59 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: install statistics and traces
+*********************************************************/
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace xpckg
+{
+	enum class InstallPhase : uint8_t
+	{
+		Open,			// open and map package, read central directory
+		Manifest,		// extract and parse "package.json", list entries of platform
+		Prefetch,		// read compressed entries ahead into page cache
+		Folders,		// open install folders, compare with previous version, create package folders
+		Extract,		// inflate and write files (or link them from shared store)
+		Flush,			// durability work: flush files and folders, swap staging folder
+		Link,			// symlink, custom callback and registry update
+		Count
+	};
+
+	constexpr size_t InstallPhasesCount = static_cast<size_t>(InstallPhase::Count);
+
+	/* Short lowercase name of phase, used in traces */
+	const char* GetPhaseName(InstallPhase Phase);
+
+	/*
+		Duration is wall time of phase on thread which ran it. Counters include work of
+		all threads helping that phase (extraction pool, writer threads), so summed times
+		of inflate and writes can be bigger than duration.
+	*/
+	struct PhaseStats
+	{
+		uint64_t StartTime = 0;			// monotonic clock, ns; only differences are meaningful
+		uint64_t Duration = 0;			// ns, zero if phase didn't run
+		uint64_t BytesRead = 0;			// package bytes inflated, copied, read or read ahead
+		uint64_t BytesWritten = 0;
+		uint64_t EntriesCount = 0;		// archive entries, folders or files, depending on phase
+		uint64_t SystemCalls = 0;		// file system calls made by library wrappers
+		uint64_t InflateTime = 0;		// ns in inflate or zstd decode, summed over threads
+		uint64_t WriteTime = 0;			// ns in file writes, summed over threads
+		uint32_t ThreadId = 0;			// small sequential id of thread which ran the phase
+	};
+
+	struct InstallStats
+	{
+		std::string PackagePath;
+		bool IsSucceeded = false;
+		PhaseStats Phases[InstallPhasesCount];
+	};
+
+	/* Write statistics as Chrome trace-event JSON, for "chrome://tracing" or Perfetto */
+	bool WriteChromeTrace(const std::vector<InstallStats>& Stats, std::string PathToTrace);
+}
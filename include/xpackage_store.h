@@ -0,0 +1,62 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: content-addressed store of installed files
+*********************************************************/
+#pragma once
+
+namespace xpckg
+{
+	/*
+		Store keeps one copy of every file content, named by its SHA-256:
+			<store>/<first byte of digest>/<digest>
+		Entries with digest declared by manifest are looked up without reading entry data.
+		The rest are looked up by CRC32 and size through index of objects stored before:
+			<store>/index/<CRC32>-<size>, file with digest of object
+		so they rely on CRC32 of package like extraction does; packages which need more
+		declare digests. Missing entries are hashed while extracted. Object gets its name
+		only after it's fully written and checked, so name always matches content.
+		Installed files are hardlinks to store objects, reflinks or plain copies as fallback.
+		Objects are read-only where links share permissions, targets are always unlinked
+		before write, so objects are never modified after creation.
+	*/
+	class ContentStore
+	{
+	private:
+		std::string StorePath;
+		uint64_t TempToken = 0;
+		std::atomic<uint64_t> TempCounter = { 0 };
+
+		std::string MakeTempPath();
+		std::string GetIndexPath(uint32_t Crc32, uint64_t ObjectSize);
+		bool FindIndexedObject(uint32_t Crc32, uint64_t ObjectSize, std::string& OutObjectPath);
+		void IndexObject(uint32_t Crc32, uint64_t ObjectSize, const Sha256Digest& Digest);
+
+		/* Forbid writes to object before it gets its name */
+		bool SealObject(const std::string& TempPath);
+
+	public:
+		ContentStore(std::string PathToStore);
+		~ContentStore();
+
+		std::string GetObjectPath(const Sha256Digest& Digest);
+		bool ContainsObject(const std::string& ObjectPath, uint64_t ObjectSize);
+
+		/*
+			Create file at target path as link to object (or its copy), target must not exist. Path
+			is relative to base directory handle, on platforms without such handles it's full path.
+		*/
+		bool MaterializeObject(const std::string& ObjectPath, RawHandle BaseDirectory, const std::string& TargetPath);
+
+		/*
+			Extract entries missing in store (every content once), then materialize all entries.
+			Prepare callback creates parent folders of target and removes old target file.
+		*/
+		bool InstallEntries(Archive& SourceArchive, const EntriesList& Entries, RawHandle BaseDirectory,
+			const std::function<bool(const std::string& EntryPath)>& PrepareTarget, ThreadPool* Pool, size_t ChunkSize);
+	};
+
+	using StorePointer = std::shared_ptr<ContentStore>;
+}
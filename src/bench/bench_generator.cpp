@@ -0,0 +1,176 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: synthetic packages for benchmarks
+*********************************************************/
+#include "xpackage_internal.h"
+#include "bench_generator.h"
+#include "zlib.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+namespace xpckg
+{
+	constexpr size_t GeneratorBatchSize = 256;
+
+	/* Text-like filler: compressible, but not a single repeated byte */
+	static const char FillerText[] =
+		"void ProcessBlock(float* Samples, size_t Count) { for (size_t i = 0; i < Count; i++) "
+		"{ Samples[i] *= Gain; } } <param id=\"gain\" min=\"0.0\" max=\"1.0\" default=\"0.5\"/> "
+		"static const uint32_t Table[] = { 0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA }; ";
+
+	static void
+	FillContent(std::vector<uint8_t>& Content, size_t ContentSize, double RandomRatio, std::mt19937_64& Random)
+	{
+		/* Content is made of 64-byte pieces, every piece is random or text */
+		constexpr size_t PieceSize = 64;
+		std::uniform_real_distribution<double> Coin(0.0, 1.0);
+		std::uniform_int_distribution<size_t> TextOffset(0, sizeof(FillerText) - 1 - PieceSize);
+
+		Content.resize(ContentSize);
+		for (size_t Offset = 0; Offset < ContentSize; Offset += PieceSize) {
+			size_t PartSize = std::min(PieceSize, ContentSize - Offset);
+			if (Coin(Random) < RandomRatio) {
+				for (size_t i = 0; i < PartSize; i++) {
+					Content[Offset + i] = static_cast<uint8_t>(Random());
+				}
+			} else {
+				std::copy_n(FillerText + TextOffset(Random), PartSize, Content.begin() + Offset);
+			}
+		}
+	}
+
+	static size_t
+	NextFileSize(const GeneratorConfig& Config, std::mt19937_64& Random)
+	{
+		size_t MinSize = std::min(Config.MinFileSize, Config.MaxFileSize);
+		size_t MaxSize = Config.MaxFileSize;
+		switch (Config.Distribution) {
+		case SizeDistribution::Fixed:
+			return MaxSize;
+		case SizeDistribution::Uniform:
+			return std::uniform_int_distribution<size_t>(MinSize, MaxSize)(Random);
+		default:
+			break;
+		}
+
+		/* Median near geometric middle of range, values outside of range are clamped */
+		double Median = std::sqrt(static_cast<double>(std::max<size_t>(MinSize, 1)) * static_cast<double>(MaxSize));
+		double Size = std::lognormal_distribution<double>(std::log(Median), 1.0)(Random);
+		return std::clamp(static_cast<size_t>(Size), MinSize, MaxSize);
+	}
+
+	static bool
+	WriteGzipCopy(const std::string& SourcePath, const std::string& TargetPath)
+	{
+		FILE* SourceFile = std::fopen(SourcePath.c_str(), "rb");
+		FILE* TargetFile = std::fopen(TargetPath.c_str(), "wb");
+		z_stream Stream = {};
+		bool IsWritten = SourceFile != nullptr && TargetFile != nullptr &&
+			deflateInit2(&Stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+
+		if (IsWritten) {
+			std::vector<uint8_t> InputBuffer(1024 * 1024);
+			std::vector<uint8_t> OutputBuffer(1024 * 1024);
+			int Flush = Z_NO_FLUSH;
+			while (IsWritten && Flush != Z_FINISH) {
+				size_t ReadedSize = std::fread(InputBuffer.data(), 1, InputBuffer.size(), SourceFile);
+				Flush = ReadedSize < InputBuffer.size() ? Z_FINISH : Z_NO_FLUSH;
+				Stream.next_in = InputBuffer.data();
+				Stream.avail_in = static_cast<uInt>(ReadedSize);
+				do {
+					Stream.next_out = OutputBuffer.data();
+					Stream.avail_out = static_cast<uInt>(OutputBuffer.size());
+					deflate(&Stream, Flush);
+					size_t OutputSize = OutputBuffer.size() - Stream.avail_out;
+					IsWritten = IsWritten && std::fwrite(OutputBuffer.data(), 1, OutputSize, TargetFile) == OutputSize;
+				} while (Stream.avail_out == 0);
+			}
+
+			deflateEnd(&Stream);
+		}
+
+		if (SourceFile != nullptr) {
+			std::fclose(SourceFile);
+		}
+
+		if (TargetFile != nullptr) {
+			IsWritten = (std::fclose(TargetFile) == 0) && IsWritten;
+		}
+
+		return IsWritten;
+	}
+
+	bool
+	GeneratePackage(const GeneratorConfig& Config, const std::string& PlatformName, const std::string& OutputPath, GeneratedPackage& OutPackage)
+	{
+		if (Config.FilesCount == 0) {
+			return false;
+		}
+
+		std::shared_ptr<ArchiveWriter> Writer;
+		try {
+			Writer = std::make_shared<ArchiveWriter>(std::make_shared<FileHandle>(OutputPath, true), Config.IsNative ? ArchiveFormat::Native : ArchiveFormat::Zip);
+		}
+		catch (...) {
+			return false;
+		}
+
+		if (!Writer->SetCompression(Config.IsZstd ? CompressionMethod::Zstd : CompressionMethod::Deflated)) {
+			return false;
+		}
+
+		std::mt19937_64 Random(Config.Seed);
+		std::uniform_real_distribution<double> Coin(0.0, 1.0);
+		std::vector<WriterEntry> Entries;
+		bool IsWritten = true;
+
+		OutPackage = GeneratedPackage();
+		OutPackage.PackagePath = OutputPath;
+
+		auto PlatformIt = BinaryPlatformsMap.find(PlatformName);
+		uint32_t PlatformMask = PlatformIt != BinaryPlatformsMap.end() ? static_cast<uint32_t>(PlatformIt->second) : 0;
+
+		/* Manifest is written as the last entry, it lists every generated file */
+		std::string Manifest = "{\"id\":1,\"name\":\"Benchmark\",\"version\":\"1.0\",\"platforms\":{\"" + PlatformName + "\":[";
+		for (size_t i = 0; i <= Config.FilesCount && IsWritten; i++) {
+			WriterEntry Entry;
+			if (i < Config.FilesCount) {
+				Entry.Name = "data/f" + std::to_string(i % std::max<size_t>(Config.FoldersCount, 1)) + "/file" + std::to_string(i) + ".bin";
+				FillContent(Entry.SourceData, NextFileSize(Config, Random), Config.RandomRatio, Random);
+				Entry.PlatformMask = PlatformMask;
+				Manifest += (i == 0 ? "\"" : ",\"") + Entry.Name + "\"";
+				OutPackage.EntryNames.push_back(Entry.Name);
+			} else {
+				Manifest += "]}}";
+				Entry.Name = "package.json";
+				Entry.SourceData.assign(Manifest.begin(), Manifest.end());
+				OutPackage.Manifest = Entry.SourceData;
+			}
+
+			Entry.IsStored = Coin(Random) < Config.StoredRatio;
+			OutPackage.UncompressedSize += Entry.SourceData.size();
+			Entries.push_back(std::move(Entry));
+
+			/* Content is generated in batches, so whole package is never in memory */
+			if (Entries.size() == GeneratorBatchSize || i == Config.FilesCount) {
+				IsWritten = Writer->AddEntries(Entries, nullptr, Config.CompressionLevel);
+				Entries.clear();
+			}
+		}
+
+		IsWritten = IsWritten && Writer->Finish();
+		OutPackage.ArchiveSize = static_cast<size_t>(Writer->GetArchiveSize());
+		Writer = nullptr;
+		if (!IsWritten) {
+			return false;
+		}
+
+		OutPackage.GzipPath = OutputPath + ".gz";
+		return WriteGzipCopy(OutputPath, OutPackage.GzipPath);
+	}
+}
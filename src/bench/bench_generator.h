@@ -0,0 +1,52 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: synthetic packages for benchmarks
+*********************************************************/
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace xpckg
+{
+	enum class SizeDistribution
+	{
+		Fixed,			// every file has max size
+		Uniform,		// sizes are spread evenly between min and max
+		LogNormal		// most files are small with long tail of big ones, like real plugins
+	};
+
+	struct GeneratorConfig
+	{
+		size_t FilesCount = 1000;
+		size_t MinFileSize = 1024;
+		size_t MaxFileSize = 256 * 1024;
+		SizeDistribution Distribution = SizeDistribution::LogNormal;
+		int CompressionLevel = 6;
+		bool IsZstd = false;			// seekable zstd entries instead of deflate
+		bool IsNative = false;			// native package instead of ZIP
+		double StoredRatio = 0.0;		// part of entries written without compression
+		double RandomRatio = 0.3;		// part of file content which is incompressible
+		size_t FoldersCount = 16;
+		uint64_t Seed = 1;
+	};
+
+	struct GeneratedPackage
+	{
+		std::string PackagePath;
+		std::string GzipPath;				// the same archive as gzip stream, input of "UnpackFile()"
+		std::vector<uint8_t> Manifest;		// content of "package.json"
+		std::vector<std::string> EntryNames;
+		size_t ArchiveSize = 0;
+		size_t UncompressedSize = 0;
+	};
+
+	/*
+		Write ZIP (or native) package with files of configured sizes and manifest listing all of them
+		for given platform. Archive goes through library writer, the same as real packages.
+	*/
+	bool GeneratePackage(const GeneratorConfig& Config, const std::string& PlatformName, const std::string& OutputPath, GeneratedPackage& OutPackage);
+}
@@ -0,0 +1,553 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: phase benchmarks of package install
+*********************************************************/
+#include "xpackage_internal.h"
+#include "bench_generator.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <thread>
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+struct BenchConfig
+{
+	xpckg::GeneratorConfig Generator;
+	size_t Iterations = 5;
+	size_t ThreadsCount = 0;
+	std::string WorkDirectory = ".";
+	std::string OutputPath;
+	std::string TracePath;
+};
+
+/* Flakes per run of generator phases, and machine ids generator owns: each gives 25600 IDs per second */
+constexpr size_t FlakesCount = 4 * 1024 * 1024;
+constexpr size_t FlakeMachineIds = 2048;
+constexpr size_t FlakeBatchSize = 1024;
+
+struct PhaseResult
+{
+	std::string Name;
+	std::vector<double> Times;
+	uint64_t Bytes = 0;
+	uint64_t Items = 0;
+	bool IsFailed = false;
+};
+
+static void
+PrintUsage()
+{
+	std::printf(
+		"xpackage-bench [options]\n"
+		"  --files N          count of files in package (1000)\n"
+		"  --min-size BYTES   smallest file (1024)\n"
+		"  --max-size BYTES   biggest file (262144)\n"
+		"  --dist NAME        fixed, uniform or lognormal (lognormal)\n"
+		"  --method NAME      deflate or zstd (deflate)\n"
+		"  --format NAME      zip or xpkg (zip)\n"
+		"  --level N          deflate or zstd level, 0 stores everything (6)\n"
+		"  --stored RATIO     part of entries stored without compression (0)\n"
+		"  --random RATIO     incompressible part of file content (0.3)\n"
+		"  --folders N        count of folders files are spread over (16)\n"
+		"  --seed N           seed of generator (1)\n"
+		"  --iterations N     runs of every phase (5)\n"
+		"  --threads N        extraction threads, 0 - all cores (0)\n"
+		"  --dir PATH         folder for run files, they go to its own subfolder (.)\n"
+		"  --output PATH      JSON report path, stdout by default\n"
+		"  --trace PATH       Chrome trace of install phases\n");
+}
+
+static bool
+ParseArguments(int argc, char** argv, BenchConfig& Config)
+{
+	for (int i = 1; i < argc; i++) {
+		std::string Argument = argv[i];
+		if (Argument == "--help" || i + 1 >= argc) {
+			return false;
+		}
+
+		const char* Value = argv[++i];
+		if (Argument == "--files") {
+			Config.Generator.FilesCount = std::strtoull(Value, nullptr, 10);
+		} else if (Argument == "--min-size") {
+			Config.Generator.MinFileSize = std::strtoull(Value, nullptr, 10);
+		} else if (Argument == "--max-size") {
+			Config.Generator.MaxFileSize = std::strtoull(Value, nullptr, 10);
+		} else if (Argument == "--dist") {
+			std::string Name = Value;
+			if (Name == "fixed") {
+				Config.Generator.Distribution = xpckg::SizeDistribution::Fixed;
+			} else if (Name == "uniform") {
+				Config.Generator.Distribution = xpckg::SizeDistribution::Uniform;
+			} else if (Name == "lognormal") {
+				Config.Generator.Distribution = xpckg::SizeDistribution::LogNormal;
+			} else {
+				return false;
+			}
+		} else if (Argument == "--method") {
+			std::string Name = Value;
+			if (Name != "deflate" && Name != "zstd") {
+				return false;
+			}
+
+			Config.Generator.IsZstd = Name == "zstd";
+		} else if (Argument == "--format") {
+			std::string Name = Value;
+			if (Name != "zip" && Name != "xpkg") {
+				return false;
+			}
+
+			Config.Generator.IsNative = Name == "xpkg";
+		} else if (Argument == "--level") {
+			Config.Generator.CompressionLevel = std::atoi(Value);
+		} else if (Argument == "--stored") {
+			Config.Generator.StoredRatio = std::atof(Value);
+		} else if (Argument == "--random") {
+			Config.Generator.RandomRatio = std::atof(Value);
+		} else if (Argument == "--folders") {
+			Config.Generator.FoldersCount = std::strtoull(Value, nullptr, 10);
+		} else if (Argument == "--seed") {
+			Config.Generator.Seed = std::strtoull(Value, nullptr, 10);
+		} else if (Argument == "--iterations") {
+			Config.Iterations = std::max<size_t>(std::strtoull(Value, nullptr, 10), 1);
+		} else if (Argument == "--threads") {
+			Config.ThreadsCount = std::strtoull(Value, nullptr, 10);
+		} else if (Argument == "--dir") {
+			Config.WorkDirectory = Value;
+		} else if (Argument == "--output") {
+			Config.OutputPath = Value;
+		} else if (Argument == "--trace") {
+			Config.TracePath = Value;
+		} else {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+	Run phase given count of times. "Prepare" and "Verify" aren't measured: first one resets
+	state which phase changes (removes installed files and so on), second one checks result
+	of every run. Failed run marks whole phase as failed.
+*/
+static PhaseResult
+MeasurePhase(const char* Name, size_t Iterations, uint64_t Bytes, uint64_t Items,
+	const std::function<bool()>& Phase, const std::function<void()>& Prepare = nullptr, const std::function<bool()>& Verify = nullptr)
+{
+	PhaseResult Result;
+	Result.Name = Name;
+	Result.Bytes = Bytes;
+	Result.Items = Items;
+	for (size_t i = 0; i < Iterations && !Result.IsFailed; i++) {
+		if (Prepare) {
+			Prepare();
+		}
+
+		auto StartTime = std::chrono::steady_clock::now();
+		Result.IsFailed = !Phase();
+		auto EndTime = std::chrono::steady_clock::now();
+		Result.Times.push_back(std::chrono::duration<double, std::milli>(EndTime - StartTime).count());
+		if (!Result.IsFailed && Verify) {
+			Result.IsFailed = !Verify();
+		}
+	}
+
+	return Result;
+}
+
+/* Tree must have exactly the files of package entries with their content */
+static bool
+IsTreeValid(xpckg::Archive& PackageArchive, const std::vector<const xpckg::ArchiveEntry*>& Entries,
+	const std::vector<std::string>& EntryNames, const std::filesystem::path& RootPath)
+{
+	std::vector<uint8_t> EntryData;
+	std::vector<uint8_t> FileData;
+	for (size_t i = 0; i < Entries.size(); i++) {
+		if (!PackageArchive.ExtractEntryToMemory(*Entries[i], EntryData)) {
+			return false;
+		}
+
+		try {
+			xpckg::FileHandle TreeFile((RootPath / std::filesystem::u8path(EntryNames[i])).u8string(), false);
+			FileData.resize(TreeFile.GetFileSize());
+			if (!FileData.empty() && TreeFile.ReadFromFile(FileData.data(), FileData.size(), 0) != FileData.size()) {
+				return false;
+			}
+		}
+		catch (...) {
+			return false;
+		}
+
+		if (FileData != EntryData) {
+			return false;
+		}
+	}
+
+	size_t FilesCount = 0;
+	std::error_code IterateError;
+	for (std::filesystem::recursive_directory_iterator It(RootPath, IterateError), End; !IterateError && It != End; It.increment(IterateError)) {
+		FilesCount += It->is_regular_file() ? 1 : 0;
+	}
+
+	return !IterateError && FilesCount == Entries.size();
+}
+
+/* Fill output from given count of threads, by single calls or batches; generator is new for every run */
+static void
+GenerateFlakes(size_t ThreadsCount, bool bBatch, std::vector<uint64_t>& OutFlakes)
+{
+	CProximaFlakeGenerator Generator(0, FlakeMachineIds);
+	OutFlakes.resize(FlakesCount);
+	auto ThreadProc = [&](size_t ThreadIndex) {
+		size_t First = FlakesCount * ThreadIndex / ThreadsCount;
+		size_t Last = FlakesCount * (ThreadIndex + 1) / ThreadsCount;
+		for (size_t i = First; i < Last; i += bBatch ? FlakeBatchSize : 1) {
+			if (bBatch) {
+				Generator.GenerateBatch(CProximaFlake::ObjectType::PackageObject, &OutFlakes[i], std::min(FlakeBatchSize, Last - i));
+			} else {
+				OutFlakes[i] = Generator.Generate(CProximaFlake::ObjectType::PackageObject).GetFlake();
+			}
+		}
+	};
+
+	std::vector<std::thread> Threads;
+	for (size_t i = 1; i < ThreadsCount; i++) {
+		Threads.emplace_back(ThreadProc, i);
+	}
+
+	ThreadProc(0);
+	for (auto& Thread : Threads) {
+		Thread.join();
+	}
+}
+
+static bool
+IsFlakesUnique(std::vector<uint64_t> Flakes)
+{
+	std::sort(Flakes.begin(), Flakes.end());
+	return std::adjacent_find(Flakes.begin(), Flakes.end()) == Flakes.end();
+}
+
+static std::string
+FormatReport(const BenchConfig& Config, const xpckg::GeneratedPackage& Package, const std::vector<PhaseResult>& Results)
+{
+	static const char* DistributionNames[] = { "fixed", "uniform", "lognormal" };
+	const xpckg::GeneratorConfig& Generator = Config.Generator;
+	char Buffer[1024] = {};
+	std::string Report = "{\n";
+
+	std::snprintf(Buffer, sizeof(Buffer),
+		"  \"config\": {\"files\": %zu, \"min_size\": %zu, \"max_size\": %zu, \"distribution\": \"%s\", \"method\": \"%s\", \"format\": \"%s\", \"level\": %d, "
+		"\"stored_ratio\": %.3f, \"random_ratio\": %.3f, \"folders\": %zu, \"seed\": %llu, \"iterations\": %zu, \"threads\": %zu},\n",
+		Generator.FilesCount, Generator.MinFileSize, Generator.MaxFileSize, DistributionNames[static_cast<size_t>(Generator.Distribution)],
+		Generator.IsZstd ? "zstd" : "deflate", Generator.IsNative ? "xpkg" : "zip", Generator.CompressionLevel, Generator.StoredRatio, Generator.RandomRatio, Generator.FoldersCount,
+		static_cast<unsigned long long>(Generator.Seed), Config.Iterations, Config.ThreadsCount);
+	Report += Buffer;
+
+	std::snprintf(Buffer, sizeof(Buffer), "  \"package\": {\"entries\": %zu, \"archive_bytes\": %zu, \"uncompressed_bytes\": %zu},\n  \"phases\": [\n",
+		Package.EntryNames.size() + 1, Package.ArchiveSize, Package.UncompressedSize);
+	Report += Buffer;
+
+	for (size_t i = 0; i < Results.size(); i++) {
+		const PhaseResult& Result = Results[i];
+		std::vector<double> Times = Result.Times;
+		std::sort(Times.begin(), Times.end());
+
+		double MeanTime = 0.0;
+		for (double Time : Times) {
+			MeanTime += Time / Times.size();
+		}
+
+		/* Throughput is counted by median, it's less sensitive to cold first run */
+		double MedianTime = Times.empty() ? 0.0 : Times[Times.size() / 2];
+		double Seconds = std::max(MedianTime / 1000.0, 1e-9);
+		std::snprintf(Buffer, sizeof(Buffer),
+			"    {\"name\": \"%s\", \"failed\": %s, \"iterations\": %zu, \"min_ms\": %.4f, \"median_ms\": %.4f, \"mean_ms\": %.4f, "
+			"\"max_ms\": %.4f, \"bytes\": %llu, \"items\": %llu, \"mb_per_s\": %.2f, \"items_per_s\": %.1f}%s\n",
+			Result.Name.c_str(), Result.IsFailed ? "true" : "false", Times.size(), Times.empty() ? 0.0 : Times.front(), MedianTime, MeanTime,
+			Times.empty() ? 0.0 : Times.back(), static_cast<unsigned long long>(Result.Bytes), static_cast<unsigned long long>(Result.Items),
+			Result.Bytes / Seconds / (1024.0 * 1024.0), Result.Items / Seconds, i + 1 == Results.size() ? "" : ",");
+		Report += Buffer;
+	}
+
+	Report += "  ]\n}\n";
+	return Report;
+}
+
+int main(int argc, char** argv)
+{
+	BenchConfig Config;
+	if (!ParseArguments(argc, argv, Config)) {
+		PrintUsage();
+		return 1;
+	}
+
+	namespace fs = std::filesystem;
+	fs::path WorkPath = fs::absolute(fs::u8path(Config.WorkDirectory)) / ("xpackage-bench-" + std::to_string(getpid()));
+	std::error_code FsError;
+	fs::create_directories(WorkPath.parent_path(), FsError);
+
+	/* Folder is removed with everything inside at exit, so it must be made by this run */
+	if (FsError || !fs::create_directory(WorkPath, FsError)) {
+		std::fprintf(stderr, "can't create work directory \"%s\"\n", WorkPath.u8string().c_str());
+		return 1;
+	}
+
+	xpckg::PackageBinaries BinaryType = xpckg::PackageBinaries::BinariesWindows_x64;
+	xpckg::GeneratedPackage Package;
+	std::string PackagePath = (WorkPath / (Config.Generator.IsNative ? "package.xpkg" : "package.zip")).u8string();
+	if (!xpckg::GeneratePackage(Config.Generator, xpckg::PlatformsStringMap[BinaryType], PackagePath, Package)) {
+		std::fprintf(stderr, "can't generate package\n");
+		return 1;
+	}
+
+	xpckg::PackageManager Manager("");
+	Manager.SetThreadsCount(Config.ThreadsCount);
+	Manager.SetInstallStats(!Config.TracePath.empty());
+
+	size_t EntriesCount = Package.EntryNames.size();
+	size_t Iterations = Config.Iterations;
+	std::vector<PhaseResult> Results;
+
+	/* Open: file handle and mapping of whole archive, pages are not read yet */
+	Results.push_back(MeasurePhase("archive_open", Iterations, 0, 1, [&]() {
+		try {
+			xpckg::FileHandle PackageFile(PackagePath, false);
+			return PackageFile.MapFile() != nullptr;
+		}
+		catch (...) {
+			return false;
+		}
+	}));
+
+	/* Scan: parsing and indexing of central directory (or check of native index) over already mapped file */
+	xpckg::FilePointer PackageFile;
+	xpckg::ArchivePointer PackageArchive;
+	Results.push_back(MeasurePhase("directory_scan", Iterations, 0, EntriesCount + 1, [&]() {
+		try {
+			PackageArchive = std::make_shared<xpckg::Archive>(PackageFile);
+			return true;
+		}
+		catch (...) {
+			return false;
+		}
+	}, [&]() {
+		PackageArchive = nullptr;
+		PackageFile = std::make_shared<xpckg::FileHandle>(PackagePath, false);
+		PackageFile->MapFile();
+	}));
+
+	if (PackageArchive == nullptr) {
+		std::fprintf(stderr, "can't open generated package\n");
+		return 1;
+	}
+
+	Results.push_back(MeasurePhase("entry_lookup", Iterations, 0, EntriesCount, [&]() {
+		bool IsFound = true;
+		for (auto& EntryName : Package.EntryNames) {
+			IsFound &= PackageArchive->FindEntry(EntryName) != nullptr;
+		}
+
+		return IsFound;
+	}));
+
+	/* Parser is reused between runs, like parsers of manager pool */
+	simdjson::dom::parser ManifestParser;
+	Results.push_back(MeasurePhase("parse_json", Iterations, Package.Manifest.size(), 1, [&]() {
+		std::shared_ptr<simdjson::dom::element> Manifest;
+		return xpckg::ParseManifest(ManifestParser, Package.Manifest, Manifest);
+	}));
+
+	xpckg::FilePointer GzipFile;
+	Results.push_back(MeasurePhase("unpack_file", Iterations, Package.ArchiveSize, 1, [&]() {
+		std::vector<uint8_t> UnpackedData;
+		return GzipFile != nullptr && xpckg::UnpackDeflateFile(*GzipFile, UnpackedData, 1024 * 1024) && UnpackedData.size() == Package.ArchiveSize;
+	}, [&]() {
+		try {
+			GzipFile = std::make_shared<xpckg::FileHandle>(Package.GzipPath, false);
+		}
+		catch (...) {
+			GzipFile = nullptr;
+		}
+	}));
+
+	/* Decompression only, output buffer is reused like in streaming extraction */
+	std::vector<const xpckg::ArchiveEntry*> Entries;
+	for (auto& EntryName : Package.EntryNames) {
+		Entries.push_back(PackageArchive->FindEntry(EntryName));
+	}
+
+	uint64_t FilesSize = Package.UncompressedSize - Package.Manifest.size();
+	Results.push_back(MeasurePhase("extract_entries", Iterations, FilesSize, EntriesCount, [&]() {
+		std::vector<uint8_t> EntryData;
+		for (auto Entry : Entries) {
+			if (!PackageArchive->ExtractEntryToMemory(*Entry, EntryData)) {
+				return false;
+			}
+		}
+
+		return true;
+	}));
+
+	/* Disk only: already inflated files are written to fresh folders */
+	std::vector<std::vector<uint8_t>> FilesData(Entries.size());
+	for (size_t i = 0; i < Entries.size(); i++) {
+		PackageArchive->ExtractEntryToMemory(*Entries[i], FilesData[i]);
+	}
+
+	fs::path WritePath = WorkPath / "write";
+	Results.push_back(MeasurePhase("write_files", Iterations, FilesSize, EntriesCount, [&]() {
+		try {
+			for (size_t i = 0; i < FilesData.size(); i++) {
+				xpckg::FileHandle TargetFile((WritePath / fs::u8path(Package.EntryNames[i])).u8string(), true);
+				if (!FilesData[i].empty() && TargetFile.WriteToFile(FilesData[i].data(), FilesData[i].size(), 0) != FilesData[i].size()) {
+					return false;
+				}
+			}
+		}
+		catch (...) {
+			return false;
+		}
+
+		return true;
+	}, [&]() {
+		std::error_code PrepareError;
+		fs::remove_all(WritePath, PrepareError);
+		for (auto& EntryName : Package.EntryNames) {
+			fs::create_directories((WritePath / fs::u8path(EntryName)).parent_path(), PrepareError);
+		}
+	}, [&]() {
+		return IsTreeValid(*PackageArchive, Entries, Package.EntryNames, WritePath);
+	}));
+
+	FilesData.clear();
+
+	/* Whole install: open, manifest, extraction with folders, symlink */
+	fs::path InstallPath = WorkPath / "install";
+	fs::path SymlinkPath = WorkPath / "symlinks";
+	Results.push_back(MeasurePhase("install_package", Iterations, FilesSize, EntriesCount, [&]() {
+		xpckg::PackageInfo Info = {};
+		Info.CompanyName = "Bench";
+		Info.PluginName = "Package";
+		Info.InstallDirectory = InstallPath.u8string();
+		Info.SymlinkDirectory = SymlinkPath.u8string();
+		Info.SourceDirectory = PackagePath;
+		return Manager.InstallPackage(Info, BinaryType, nullptr) == xpckg::PackageManager::ReturnCodes::NoError;
+	}, [&]() {
+		std::error_code PrepareError;
+		fs::remove_all(InstallPath, PrepareError);
+		fs::remove_all(SymlinkPath, PrepareError);
+	}, [&]() {
+		return IsTreeValid(*PackageArchive, Entries, Package.EntryNames, InstallPath / "Bench" / "Package");
+	}));
+
+	/* ID generation for registry records: one thread, then all threads; run is failed if any ID repeats */
+	size_t FlakeThreads = Config.ThreadsCount != 0 ? Config.ThreadsCount : std::max<size_t>(std::thread::hardware_concurrency(), 1);
+	std::vector<uint64_t> Flakes;
+	const std::pair<const char*, std::pair<size_t, bool>> FlakePhases[] = {
+		{ "flake_generate", { 1, false } },
+		{ "flake_batch", { 1, true } },
+		{ "flake_generate_threads", { FlakeThreads, false } },
+		{ "flake_batch_threads", { FlakeThreads, true } }
+	};
+
+	for (auto& [PhaseName, PhaseMode] : FlakePhases) {
+		/* Uniqueness of previous run is checked by unmeasured preparation of the next one */
+		bool IsUnique = true;
+		Flakes.clear();
+		PhaseResult Result = MeasurePhase(PhaseName, Iterations, 0, FlakesCount, [&]() {
+			GenerateFlakes(PhaseMode.first, PhaseMode.second, Flakes);
+			return true;
+		}, [&]() {
+			IsUnique = IsUnique && IsFlakesUnique(Flakes);
+		});
+
+		Result.IsFailed |= !IsUnique || !IsFlakesUnique(Flakes);
+		Results.push_back(std::move(Result));
+	}
+
+	/* Text of flakes for catalog exports: per-flake std::to_string as reference, then batch codec; decoded flakes must match */
+	std::vector<char> FlakesText(CProximaFlakeCodec::GetDecimalBatchSize(Flakes.size()));
+	std::vector<uint64_t> DecodedFlakes;
+	size_t DecimalSize = 0;
+	size_t Base62Size = 0;
+	Results.push_back(MeasurePhase("flake_to_string", Iterations, 0, Flakes.size(), [&]() {
+		size_t TextSize = 0;
+		for (uint64_t Flake : Flakes) {
+			TextSize += std::to_string(Flake).size() + 1;
+		}
+
+		return TextSize != 0;
+	}));
+
+	Results.push_back(MeasurePhase("flake_encode_decimal", Iterations, 0, Flakes.size(), [&]() {
+		DecimalSize = CProximaFlakeCodec::EncodeDecimalBatch(Flakes.data(), Flakes.size(), ',', FlakesText.data(), FlakesText.size());
+		return DecimalSize != 0;
+	}));
+
+	Results.push_back(MeasurePhase("flake_decode_decimal", Iterations, DecimalSize, Flakes.size(), [&]() {
+		DecodedFlakes.clear();
+		return CProximaFlakeCodec::DecodeDecimalBatch(FlakesText.data(), DecimalSize, ',', DecodedFlakes) && DecodedFlakes == Flakes;
+	}));
+
+	Results.push_back(MeasurePhase("flake_encode_base62", Iterations, 0, Flakes.size(), [&]() {
+		Base62Size = CProximaFlakeCodec::EncodeBase62Batch(Flakes.data(), Flakes.size(), ',', FlakesText.data(), FlakesText.size());
+		return Base62Size != 0;
+	}));
+
+	Results.push_back(MeasurePhase("flake_decode_base62", Iterations, Base62Size, Flakes.size(), [&]() {
+		DecodedFlakes.clear();
+		return CProximaFlakeCodec::DecodeBase62Batch(FlakesText.data(), Base62Size, ',', DecodedFlakes) && DecodedFlakes == Flakes;
+	}));
+
+	/* Every field of every flake: the same types and machine ids, which generator gave */
+	std::vector<uint64_t> Timestamps(Flakes.size());
+	std::vector<uint16_t> MachineIds(Flakes.size());
+	std::vector<uint8_t> ObjectTypes(Flakes.size());
+	Results.push_back(MeasurePhase("flake_extract_fields", Iterations, 0, Flakes.size(), [&]() {
+		CProximaFlakeCodec::ExtractTimestamps(Flakes.data(), Flakes.size(), Timestamps.data());
+		CProximaFlakeCodec::ExtractMachineIds(Flakes.data(), Flakes.size(), MachineIds.data());
+		CProximaFlakeCodec::ExtractObjectTypes(Flakes.data(), Flakes.size(), ObjectTypes.data());
+		return std::all_of(ObjectTypes.begin(), ObjectTypes.end(), [](uint8_t Type) { return Type == static_cast<uint8_t>(CProximaFlake::ObjectType::PackageObject); }) &&
+			std::all_of(MachineIds.begin(), MachineIds.end(), [](uint16_t MachineId) { return MachineId < FlakeMachineIds; });
+	}));
+
+	PackageArchive = nullptr;
+	PackageFile = nullptr;
+	GzipFile = nullptr;
+	fs::remove_all(WorkPath, FsError);
+
+	std::vector<xpckg::InstallStats> InstallStats;
+	Manager.GetInstallStats(InstallStats);
+	if (!Config.TracePath.empty() && !xpckg::WriteChromeTrace(InstallStats, Config.TracePath)) {
+		std::fprintf(stderr, "can't write trace \"%s\"\n", Config.TracePath.c_str());
+	}
+
+	std::string Report = FormatReport(Config, Package, Results);
+	if (Config.OutputPath.empty()) {
+		std::fputs(Report.c_str(), stdout);
+	} else {
+		FILE* ReportFile = std::fopen(Config.OutputPath.c_str(), "wb");
+		if (ReportFile == nullptr || std::fputs(Report.c_str(), ReportFile) < 0) {
+			return 1;
+		}
+
+		std::fclose(ReportFile);
+	}
+
+	bool IsFailed = std::any_of(Results.begin(), Results.end(), [](const PhaseResult& Result) { return Result.IsFailed; });
+	return IsFailed ? 2 : 0;
+}
@@ -0,0 +1,303 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: package builder
+*********************************************************/
+#include "xpackage_internal.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+struct PackConfig
+{
+	std::string SourceDirectory;
+	std::string OutputPath;
+	std::string ManifestPath;
+	int CompressionLevel = 6;
+	size_t ThreadsCount = 0;
+	xpckg::CompressionMethod Method = xpckg::CompressionMethod::Deflated;
+	size_t FrameSize = xpckg::DefaultZstdFrameSize;
+	std::string FormatName;
+	xpckg::ArchiveFormat Format = xpckg::ArchiveFormat::Zip;
+};
+
+/* Source file with index of layout group: unlisted files first, then platforms in manifest order */
+struct SourceFile
+{
+	std::string Name;
+	std::string Path;
+	size_t Group = 0;
+	uint32_t PlatformMask = 0;
+};
+
+/* Formats which are compressed already, deflate would burn time to win nothing */
+static const std::set<std::string> StoredExtensions = {
+	"wav", "flac", "mp3", "ogg", "opus", "aac", "m4a",
+	"png", "jpg", "jpeg", "gif", "webp",
+	"mp4", "webm",
+	"zip", "gz", "xz", "bz2", "7z", "zst"
+};
+
+static void
+PrintUsage()
+{
+	std::printf(
+		"xpackage-pack [options] <source directory> <output package>\n"
+		"  --manifest PATH    package manifest (<source directory>/package.json)\n"
+		"  --method NAME      deflate or zstd, zstd entries are split into seekable frames (deflate)\n"
+		"  --level N          deflate (1-9) or zstd (1-19) level, 0 stores everything (6)\n"
+		"  --frame-size N     uncompressed bytes per zstd frame (1048576)\n"
+		"  --format NAME      zip or xpkg, native package with aligned payloads (by output extension)\n"
+		"  --threads N        compression threads, 0 - all cores (0)\n");
+}
+
+static bool
+ParseArguments(int argc, char** argv, PackConfig& Config)
+{
+	std::vector<std::string> Positional;
+	for (int i = 1; i < argc; i++) {
+		std::string Argument = argv[i];
+		if (Argument == "--help") {
+			return false;
+		}
+
+		if (Argument.compare(0, 2, "--") != 0) {
+			Positional.push_back(Argument);
+			continue;
+		}
+
+		if (i + 1 >= argc) {
+			return false;
+		}
+
+		const char* Value = argv[++i];
+		if (Argument == "--manifest") {
+			Config.ManifestPath = Value;
+		} else if (Argument == "--level") {
+			Config.CompressionLevel = std::atoi(Value);
+		} else if (Argument == "--threads") {
+			Config.ThreadsCount = std::strtoull(Value, nullptr, 10);
+		} else if (Argument == "--method" && std::string(Value) == "deflate") {
+			Config.Method = xpckg::CompressionMethod::Deflated;
+		} else if (Argument == "--method" && std::string(Value) == "zstd") {
+			Config.Method = xpckg::CompressionMethod::Zstd;
+		} else if (Argument == "--frame-size") {
+			Config.FrameSize = std::strtoull(Value, nullptr, 10);
+		} else if (Argument == "--format") {
+			Config.FormatName = Value;
+		} else {
+			return false;
+		}
+	}
+
+	if (Positional.size() != 2) {
+		return false;
+	}
+
+	Config.SourceDirectory = Positional[0];
+	Config.OutputPath = Positional[1];
+	if (Config.ManifestPath.empty()) {
+		Config.ManifestPath = (std::filesystem::u8path(Config.SourceDirectory) / "package.json").u8string();
+	}
+
+	if (Config.FormatName.empty()) {
+		Config.FormatName = std::filesystem::u8path(Config.OutputPath).extension() == ".xpkg" ? "xpkg" : "zip";
+	}
+
+	if (Config.FormatName != "zip" && Config.FormatName != "xpkg") {
+		return false;
+	}
+
+	Config.Format = Config.FormatName == "xpkg" ? xpckg::ArchiveFormat::Native : xpckg::ArchiveFormat::Zip;
+	return true;
+}
+
+static bool
+IsStoredFile(const std::string& Name)
+{
+	size_t DotPosition = Name.find_last_of('.');
+	if (DotPosition == std::string::npos || Name.find_first_of('/', DotPosition) != std::string::npos) {
+		return false;
+	}
+
+	std::string Extension = Name.substr(DotPosition + 1);
+	std::transform(Extension.begin(), Extension.end(), Extension.begin(), [](unsigned char Symbol) {
+		return static_cast<char>(std::tolower(Symbol));
+	});
+
+	return StoredExtensions.count(Extension) != 0;
+}
+
+/* Group of every listed path: index of first platform in manifest which installs it, and mask of all such platforms */
+static bool
+ReadPlatformGroups(simdjson::dom::element& Manifest, std::unordered_map<std::string, size_t>& OutGroups, std::unordered_map<std::string, uint32_t>& OutMasks)
+{
+	simdjson::dom::object Platforms;
+	if (Manifest["platforms"].get(Platforms)) {
+		return false;
+	}
+
+	size_t PlatformIndex = 0;
+	for (auto [PlatformName, PlatformEntries] : Platforms) {
+		PlatformIndex++;
+		auto PlatformIt = xpckg::BinaryPlatformsMap.find(std::string(PlatformName));
+		if (PlatformIt == xpckg::BinaryPlatformsMap.end()) {
+			std::fprintf(stderr, "unknown platform \"%.*s\"\n", static_cast<int>(PlatformName.size()), PlatformName.data());
+			return false;
+		}
+
+		simdjson::dom::array EntriesArray;
+		if (PlatformEntries.get(EntriesArray)) {
+			return false;
+		}
+
+		for (auto EntryElement : EntriesArray) {
+			std::string_view EntryName;
+			if (EntryElement.get(EntryName)) {
+				return false;
+			}
+
+			OutGroups.emplace(std::string(EntryName), PlatformIndex);
+			OutMasks[std::string(EntryName)] |= static_cast<uint32_t>(PlatformIt->second);
+		}
+	}
+
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	PackConfig Config;
+	if (!ParseArguments(argc, argv, Config)) {
+		PrintUsage();
+		return 1;
+	}
+
+	if (Config.Method == xpckg::CompressionMethod::Zstd && !xpckg::IsZstdSupported()) {
+		std::fprintf(stderr, "zstd is not supported by this build\n");
+		return 1;
+	}
+
+	namespace fs = std::filesystem;
+	auto StartTime = std::chrono::steady_clock::now();
+
+	std::ifstream ManifestStream(fs::u8path(Config.ManifestPath), std::ios::binary);
+	std::vector<uint8_t> ManifestData((std::istreambuf_iterator<char>(ManifestStream)), std::istreambuf_iterator<char>());
+	simdjson::dom::parser ManifestParser;
+	simdjson::dom::element Manifest;
+	if (ManifestData.empty() || ManifestParser.parse(ManifestData.data(), ManifestData.size()).get(Manifest)) {
+		std::fprintf(stderr, "can't read manifest \"%s\"\n", Config.ManifestPath.c_str());
+		return 1;
+	}
+
+	/* Installer refuses manifest without numeric id, so does builder */
+	std::unordered_map<std::string, size_t> PlatformGroups;
+	std::unordered_map<std::string, uint32_t> PlatformMasks;
+	if (!Manifest["id"].is_uint64() || !ReadPlatformGroups(Manifest, PlatformGroups, PlatformMasks)) {
+		std::fprintf(stderr, "manifest has no valid \"id\" or \"platforms\"\n");
+		return 1;
+	}
+
+	std::error_code FsError;
+	fs::path SourcePath = fs::u8path(Config.SourceDirectory);
+	fs::path ManifestPath = fs::absolute(fs::u8path(Config.ManifestPath), FsError).lexically_normal();
+	fs::path OutputPath = fs::absolute(fs::u8path(Config.OutputPath), FsError).lexically_normal();
+	std::vector<SourceFile> Files;
+	for (fs::recursive_directory_iterator It(SourcePath, FsError), End; It != End && !FsError; It.increment(FsError)) {
+		std::error_code EntryError;
+		fs::path FilePath = fs::absolute(It->path(), EntryError).lexically_normal();
+		if (!It->is_regular_file(EntryError) || FilePath == ManifestPath || FilePath == OutputPath) {
+			continue;
+		}
+
+		/* Manifest is always written from "--manifest", stale copy in source tree would duplicate it */
+		SourceFile NewFile;
+		NewFile.Name = It->path().lexically_relative(SourcePath).generic_u8string();
+		NewFile.Path = It->path().u8string();
+		if (NewFile.Name == "package.json") {
+			continue;
+		}
+
+		auto GroupIt = PlatformGroups.find(NewFile.Name);
+		if (GroupIt != PlatformGroups.end()) {
+			NewFile.Group = GroupIt->second;
+			NewFile.PlatformMask = PlatformMasks[NewFile.Name];
+			PlatformGroups.erase(GroupIt);
+		}
+
+		Files.push_back(std::move(NewFile));
+	}
+
+	if (FsError) {
+		std::fprintf(stderr, "can't read source directory \"%s\"\n", Config.SourceDirectory.c_str());
+		return 1;
+	}
+
+	/* Everything left in map is listed by manifest, but missing on disk: such package can't be installed */
+	for (auto& [MissingName, MissingGroup] : PlatformGroups) {
+		std::fprintf(stderr, "manifest entry \"%s\" not found in source directory\n", MissingName.c_str());
+	}
+
+	if (!PlatformGroups.empty()) {
+		return 1;
+	}
+
+	/*
+		Layout: entries of each platform are contiguous and sorted by path, so install of one
+		platform is a sequential read. Entry shared between platforms lives in group of the
+		first one. Stored manifest goes last, right before central directory (or native
+		index): installer reads both from the tail of file without inflating anything.
+	*/
+	std::sort(Files.begin(), Files.end(), [](const SourceFile& Left, const SourceFile& Right) {
+		return Left.Group != Right.Group ? Left.Group < Right.Group : Left.Name < Right.Name;
+	});
+
+	std::vector<xpckg::WriterEntry> Entries;
+	Entries.reserve(Files.size());
+	for (auto& File : Files) {
+		xpckg::WriterEntry NewEntry;
+		NewEntry.Name = File.Name;
+		NewEntry.SourcePath = File.Path;
+		NewEntry.IsStored = IsStoredFile(File.Name);
+		NewEntry.PlatformMask = File.PlatformMask;
+		Entries.push_back(std::move(NewEntry));
+	}
+
+	std::vector<xpckg::WriterEntry> ManifestEntry(1);
+	ManifestEntry[0].Name = "package.json";
+	ManifestEntry[0].SourceData = std::move(ManifestData);
+	ManifestEntry[0].IsStored = true;
+
+	bool IsPacked = false;
+	uint64_t ArchiveSize = 0;
+	size_t StoredCount = 0;
+	try {
+		xpckg::ThreadPool Pool(Config.ThreadsCount);
+		xpckg::ArchiveWriter Writer(std::make_shared<xpckg::FileHandle>(Config.OutputPath, true), Config.Format);
+		IsPacked = Writer.SetCompression(Config.Method, Config.FrameSize) && Writer.AddEntries(Entries, &Pool, Config.CompressionLevel) &&
+			Writer.AddEntries(ManifestEntry, nullptr, 0) && Writer.Finish();
+		ArchiveSize = Writer.GetArchiveSize();
+		StoredCount = Writer.GetStoredCount();
+	}
+	catch (...) {
+		IsPacked = false;
+	}
+
+	if (!IsPacked) {
+		std::fprintf(stderr, "can't write package \"%s\"\n", Config.OutputPath.c_str());
+		fs::remove(OutputPath, FsError);
+		return 1;
+	}
+
+	double Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+	std::printf("%zu entries (%zu stored), %llu bytes, %.2f s\n", Entries.size() + 1, StoredCount,
+		static_cast<unsigned long long>(ArchiveSize), Seconds);
+	return 0;
+}
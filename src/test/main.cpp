@@ -1,19 +1,39 @@
-#include "xpackage.h"
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: test runner, argument filters cases by name
+*********************************************************/
+#include "test_common.h"
 
-int main()
+int main(int argc, char** argv)
 {
-	xpckg::PackageInfo packageInfo = {};
-	xpckg::PackageManager packageManager("");
+	auto TestCases = xpckg::GetTestCases();
+	std::sort(TestCases.begin(), TestCases.end(), [](const xpckg::TestCase& First, const xpckg::TestCase& Second) {
+		return std::strcmp(First.Name, Second.Name) < 0;
+	});
 
-	packageInfo.CompanyName = "Suirless";
-	packageInfo.PluginName = "Dynation";
-	packageInfo.InstallDirectory = "Y:/Test/test_install";
-	packageInfo.SymlinkDirectory = "Y:/Test/test_vst";
-	packageInfo.SourceDirectory = "Y:/Test/Suirless_Dynation_1.0.zip";
-	auto returnCode = packageManager.InstallPackage(packageInfo, xpckg::PackageBinaries::BinariesWindows_x64, nullptr);
-	if (returnCode != xpckg::PackageManager::ReturnCodes::NoError) {
-		return (int)returnCode;
+	size_t FailedCount = 0;
+	size_t RunCount = 0;
+	for (auto& Case : TestCases) {
+		if (argc > 1 && std::strstr(Case.Name, argv[1]) == nullptr) {
+			continue;
+		}
+
+		bool IsPassed = false;
+		try {
+			IsPassed = Case.Function();
+		}
+		catch (...) {
+			std::fprintf(stderr, "%s: unexpected exception\n", Case.Name);
+		}
+
+		std::printf("[%s] %s\n", IsPassed ? "  OK  " : "FAILED", Case.Name);
+		FailedCount += IsPassed ? 0 : 1;
+		RunCount++;
 	}
 
-	return 0;
+	std::printf("%zu of %zu tests passed\n", RunCount - FailedCount, RunCount);
+	return (FailedCount != 0 || RunCount == 0) ? 1 : 0;
 }
@@ -0,0 +1,416 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: archive formats and their validation
+*********************************************************/
+#include "test_common.h"
+#include "zlib.h"
+#include <cstddef>
+
+namespace xpckg
+{
+	using ReturnCodes = PackageManager::ReturnCodes;
+
+	static std::shared_ptr<Archive>
+	OpenArchive(const std::string& PackagePath)
+	{
+		try {
+			return std::make_shared<Archive>(std::make_shared<FileHandle>(PackagePath, false));
+		}
+		catch (...) {
+			return nullptr;
+		}
+	}
+
+	template<typename T>
+	static T
+	ReadTestField(const std::vector<uint8_t>& Data, size_t Offset)
+	{
+		T Value = {};
+		std::memcpy(&Value, Data.data() + Offset, sizeof(T));
+		return Value;
+	}
+
+	template<typename T>
+	static void
+	WriteTestField(std::vector<uint8_t>& Data, size_t Offset, T Value)
+	{
+		std::memcpy(Data.data() + Offset, &Value, sizeof(T));
+	}
+
+	/*
+		Damaged package must be refused by archive open or by install, without crash and
+		without plugin folder. Archive which opens anyway can't give damaged entries.
+	*/
+	static bool
+	IsPackageRejected(const std::vector<uint8_t>& PackageData, bool bOpenFails)
+	{
+		TestFolder Folder;
+		std::string PackagePath = Folder.GetPath("package.zip");
+		TEST_CHECK(WriteWholeFile(PackagePath, PackageData));
+
+		auto PackageArchive = OpenArchive(PackagePath);
+		TEST_CHECK(!bOpenFails || PackageArchive == nullptr);
+		if (PackageArchive != nullptr) {
+			for (auto& Entry : PackageArchive->GetEntries()) {
+				std::vector<uint8_t> EntryData;
+				PackageArchive->ExtractEntryToMemory(Entry, EntryData);
+			}
+		}
+
+		PackageManager Manager("");
+		ReturnCodes ReturnValue = Manager.InstallPackage(MakePackageInfo(Folder, PackagePath), TestPlatform, nullptr);
+		TEST_CHECK(ReturnValue != ReturnCodes::NoError);
+		TEST_CHECK(!bOpenFails || ReturnValue == ReturnCodes::PackageDamaged);
+		TEST_CHECK(!std::filesystem::exists(std::filesystem::u8path(GetPluginPath(Folder))));
+		return true;
+	}
+
+	static bool
+	IsPackageAccepted(const std::vector<uint8_t>& PackageData)
+	{
+		TestFolder Folder;
+		std::string PackagePath = Folder.GetPath("package.zip");
+		TEST_CHECK(WriteWholeFile(PackagePath, PackageData));
+
+		PackageManager Manager("");
+		TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, PackagePath), TestPlatform, nullptr) == ReturnCodes::NoError);
+		return true;
+	}
+
+	static TestPackage
+	MakeSmallPackage(ArchiveFormat Format)
+	{
+		TestPackage Package;
+		Package.Format = Format;
+		Package.Files.push_back({ "bin/plugin.dll", MakeContent(200 * 1024, 1, false) });
+		Package.Files.push_back({ "presets/default.xml", MakeContent(5000, 2) });
+		return Package;
+	}
+
+	static bool
+	ReadPackageData(const TestPackage& Package, std::vector<uint8_t>& OutData)
+	{
+		TestFolder Folder;
+		std::string PackagePath = Folder.GetPath("package.zip");
+		return WriteTestPackage(Package, PackagePath) && ReadWholeFile(PackagePath, OutData);
+	}
+
+	/* Entries bigger than frame, exactly one frame and empty one */
+	static TestPackage
+	MakeZstdPackage(ArchiveFormat Format)
+	{
+		TestPackage Package;
+		Package.Format = Format;
+		Package.Method = CompressionMethod::Zstd;
+		Package.Level = 3;
+		Package.Files.push_back({ "bin/plugin.dll", MakeContent(3 * 1024 * 1024 + 333, 1, false) });
+		Package.Files.push_back({ "bin/plugin.pdb", MakeContent(5 * 1024 * 1024 + 1, 2) });
+		Package.Files.push_back({ "presets/frame.xml", MakeContent(1024 * 1024, 3) });
+		Package.Files.push_back({ "presets/empty.xml", {} });
+		return Package;
+	}
+
+	XPACKAGE_TEST(ZstdPackageRoundTrip)
+	{
+		if (!IsZstdSupported()) {
+			std::printf("zstd isn't built in, test skipped\n");
+			return true;
+		}
+
+		for (ArchiveFormat Format : { ArchiveFormat::Zip, ArchiveFormat::Native }) {
+			TestFolder Folder;
+			TestPackage Package = MakeZstdPackage(Format);
+			std::string PackagePath = Folder.GetPath("package.zip");
+			TEST_CHECK(WriteTestPackage(Package, PackagePath));
+
+			auto PackageArchive = OpenArchive(PackagePath);
+			TEST_CHECK(PackageArchive != nullptr && PackageArchive->GetFormat() == Format);
+
+			/* Random content isn't smaller after compression, so it's stored */
+			size_t ZstdCount = 0;
+			for (auto& File : Package.Files) {
+				const ArchiveEntry* Entry = PackageArchive->FindEntry(File.Name);
+				std::vector<uint8_t> EntryData;
+				TEST_CHECK(Entry != nullptr && PackageArchive->ExtractEntryToMemory(*Entry, EntryData) && EntryData == File.Content);
+				ZstdCount += Entry->Method == static_cast<uint16_t>(CompressionMethod::Zstd) ? 1 : 0;
+
+				/* Ranges across frame borders decode only frames they cover */
+				for (uint64_t Offset : { uint64_t(0), uint64_t(1024 * 1024 - 7), uint64_t(File.Content.size() / 2) }) {
+					size_t RangeSize = std::min<size_t>(64 * 1024, File.Content.size() - std::min<size_t>(Offset, File.Content.size()));
+					if (RangeSize == 0) {
+						continue;
+					}
+
+					std::vector<uint8_t> RangeData(RangeSize);
+					TEST_CHECK(PackageArchive->ReadEntryRange(*Entry, Offset, RangeData.data(), RangeSize));
+					TEST_CHECK(std::equal(RangeData.begin(), RangeData.end(), File.Content.begin() + Offset));
+				}
+
+				uint8_t Byte = 0;
+				TEST_CHECK(!PackageArchive->ReadEntryRange(*Entry, File.Content.size(), &Byte, 1));
+			}
+
+			TEST_CHECK(ZstdCount == 2);
+
+			/* Big seekable entries are split by frames between workers */
+			for (size_t ThreadsCount : { 1, 4 }) {
+				PackageManager Manager("");
+				Manager.SetThreadsCount(ThreadsCount);
+				PackageInfo Info = MakePackageInfo(Folder, PackagePath, "Plugin" + std::to_string(ThreadsCount));
+				TEST_CHECK(Manager.InstallPackage(Info, TestPlatform, nullptr) == ReturnCodes::NoError);
+				TEST_CHECK(IsPackageTreeValid(Package, GetPluginPath(Folder, Info.PluginName)));
+			}
+		}
+
+		return true;
+	}
+
+	/* Seek table is read from payload, frame size which doesn't fit entry fails ranges without buffer of its size */
+	XPACKAGE_TEST(ZstdForgedFrameSizeRejected)
+	{
+		if (!IsZstdSupported()) {
+			std::printf("zstd isn't built in, test skipped\n");
+			return true;
+		}
+
+		TestFolder Folder;
+		TestPackage Package;
+		Package.Method = CompressionMethod::Zstd;
+		Package.Level = 3;
+		Package.Files.push_back({ "presets/frame.xml", MakeContent(1024 * 1024, 3) });
+		std::string PackagePath = Folder.GetPath("package.zip");
+		std::vector<uint8_t> PackageData;
+		TEST_CHECK(WriteTestPackage(Package, PackagePath) && ReadWholeFile(PackagePath, PackageData));
+
+		/* Seek table footer: frames count, flags and magic, entries of one frame are right before it */
+		const uint8_t SeekableMagic[] = { 0xB1, 0xEA, 0x92, 0x8F };
+		auto MagicIt = std::search(PackageData.begin(), PackageData.end(), std::begin(SeekableMagic), std::end(SeekableMagic));
+		TEST_CHECK(MagicIt != PackageData.end());
+		size_t FooterOffset = static_cast<size_t>(MagicIt - PackageData.begin()) - 5;
+		size_t TableEntrySize = (PackageData[FooterOffset + 4] & 0x80) ? 12 : 8;
+		TEST_CHECK(PackageData[FooterOffset] == 1);
+
+		for (uint32_t FrameSize : { 1024u * 1024u + 1u, 0xFFFFFF00u }) {
+			std::memcpy(PackageData.data() + FooterOffset - TableEntrySize + 4, &FrameSize, sizeof(FrameSize));
+			TEST_CHECK(WriteWholeFile(PackagePath, PackageData));
+
+			auto PackageArchive = OpenArchive(PackagePath);
+			const ArchiveEntry* Entry = PackageArchive != nullptr ? PackageArchive->FindEntry("presets/frame.xml") : nullptr;
+			TEST_CHECK(Entry != nullptr && Entry->Method == static_cast<uint16_t>(CompressionMethod::Zstd));
+
+			std::vector<uint8_t> RangeData(100);
+			TEST_CHECK(!PackageArchive->ReadEntryRange(*Entry, 10, RangeData.data(), RangeData.size()));
+		}
+
+		return true;
+	}
+
+	/* gzip stream of whole content, empty on failure */
+	static std::vector<uint8_t>
+	MakeGzipData(const std::vector<uint8_t>& Content)
+	{
+		z_stream Stream = {};
+		std::vector<uint8_t> GzipData(compressBound(static_cast<uLong>(Content.size())) + 32);
+		if (deflateInit2(&Stream, 6, Z_DEFLATED, GzipWindow, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+			return {};
+		}
+
+		Stream.next_in = const_cast<Bytef*>(Content.data());
+		Stream.avail_in = static_cast<uInt>(Content.size());
+		Stream.next_out = GzipData.data();
+		Stream.avail_out = static_cast<uInt>(GzipData.size());
+		int Result = deflate(&Stream, Z_FINISH);
+		GzipData.resize(Stream.total_out);
+		deflateEnd(&Stream);
+		return Result == Z_STREAM_END ? GzipData : std::vector<uint8_t>();
+	}
+
+	/* Trailer size is checked by inflate at the end of stream, damaged one fails unpack without buffer of its size */
+	XPACKAGE_TEST(GzipTrailerSizeNotTrusted)
+	{
+		TestFolder Folder;
+		std::string GzipPath = Folder.GetPath("package.gz");
+		std::vector<uint8_t> Content = MakeContent(200 * 1024, 1);
+		std::vector<uint8_t> GzipData = MakeGzipData(Content);
+		TEST_CHECK(!GzipData.empty());
+
+		std::vector<uint8_t> UnpackedData;
+		TEST_CHECK(WriteWholeFile(GzipPath, GzipData));
+		{
+			FileHandle GzipFile(GzipPath, false);
+			TEST_CHECK(UnpackDeflateFile(GzipFile, UnpackedData, 4096) && UnpackedData == Content);
+		}
+
+		for (uint32_t TrailerSize : { 1u, 1000u, 0xFFFFFFF0u }) {
+			std::memcpy(GzipData.data() + GzipData.size() - 4, &TrailerSize, sizeof(TrailerSize));
+			TEST_CHECK(WriteWholeFile(GzipPath, GzipData));
+			FileHandle GzipFile(GzipPath, false);
+			UnpackedData = std::vector<uint8_t>();
+			TEST_CHECK(!UnpackDeflateFile(GzipFile, UnpackedData, 4096));
+			TEST_CHECK(UnpackedData.capacity() < 16 * 1024 * 1024);
+		}
+
+		return true;
+	}
+
+	XPACKAGE_TEST(MalformedZipRejected)
+	{
+		std::vector<uint8_t> PackageData;
+		TEST_CHECK(ReadPackageData(MakeSmallPackage(ArchiveFormat::Zip), PackageData));
+		TEST_CHECK(IsPackageAccepted(PackageData));
+
+		size_t EndOffset = PackageData.size() - EndOfDirectorySize;
+		size_t DirectoryOffset = ReadTestField<uint32_t>(PackageData, EndOffset + 16);
+		TEST_CHECK(ReadTestField<uint32_t>(PackageData, EndOffset) == EndOfDirectorySignature);
+		TEST_CHECK(ReadTestField<uint32_t>(PackageData, DirectoryOffset) == CentralHeaderSignature);
+
+		/* Not an archive at all */
+		TEST_CHECK(IsPackageRejected({}, true));
+		TEST_CHECK(IsPackageRejected(MakeContent(100, 1, false), true));
+		TEST_CHECK(IsPackageRejected(std::vector<uint8_t>(PackageData.begin(), PackageData.begin() + PackageData.size() / 2), true));
+		TEST_CHECK(IsPackageRejected(std::vector<uint8_t>(PackageData.begin(), PackageData.end() - 1), true));
+
+		/* Directory out of file, wrapped by its size or with more entries than it fits */
+		std::vector<uint8_t> Damaged = PackageData;
+		WriteTestField<uint32_t>(Damaged, EndOffset + 16, 0xFFFFFFF0);
+		TEST_CHECK(IsPackageRejected(Damaged, true));
+
+		Damaged = PackageData;
+		WriteTestField<uint32_t>(Damaged, EndOffset + 12, 0xFFFFFFFF);
+		TEST_CHECK(IsPackageRejected(Damaged, true));
+
+		Damaged = PackageData;
+		WriteTestField<uint16_t>(Damaged, EndOffset + 10, 0xFFFF);
+		TEST_CHECK(IsPackageRejected(Damaged, true));
+
+		/* Name of central header runs past directory */
+		Damaged = PackageData;
+		WriteTestField<uint16_t>(Damaged, DirectoryOffset + 28, 0xFFFF);
+		TEST_CHECK(IsPackageRejected(Damaged, true));
+
+		/* Entry with local header or payload out of file */
+		Damaged = PackageData;
+		WriteTestField<uint32_t>(Damaged, DirectoryOffset + 42, 0xFFFFFFF0);
+		TEST_CHECK(IsPackageRejected(Damaged, false));
+
+		Damaged = PackageData;
+		WriteTestField<uint32_t>(Damaged, DirectoryOffset + 20, 0xFFFFFFFE);
+		TEST_CHECK(IsPackageRejected(Damaged, false));
+
+		Damaged = PackageData;
+		WriteTestField<uint16_t>(Damaged, 26, 0xFFFF);
+		WriteTestField<uint16_t>(Damaged, 28, 0xFFFF);
+		TEST_CHECK(IsPackageRejected(Damaged, false));
+
+		/* ZIP64 locator pointing out of file, and ZIP64 record with directory range which wraps */
+		std::vector<uint8_t> Locator(Zip64LocatorSize);
+		WriteTestField<uint32_t>(Locator, 0, Zip64LocatorSignature);
+		WriteTestField<uint64_t>(Locator, 8, 0xFFFFFFFFFFFFFFF0ull);
+		Damaged.assign(PackageData.begin(), PackageData.begin() + EndOffset);
+		Damaged.insert(Damaged.end(), Locator.begin(), Locator.end());
+		Damaged.insert(Damaged.end(), PackageData.begin() + EndOffset, PackageData.end());
+		TEST_CHECK(IsPackageRejected(Damaged, true));
+
+		std::vector<uint8_t> Zip64Record(Zip64EndOfDirectorySize);
+		WriteTestField<uint32_t>(Zip64Record, 0, Zip64EndOfDirectorySignature);
+		WriteTestField<uint64_t>(Zip64Record, 32, 3);
+		WriteTestField<uint64_t>(Zip64Record, 40, 0x1000);
+		WriteTestField<uint64_t>(Zip64Record, 48, 0xFFFFFFFFFFFFF800ull);
+		WriteTestField<uint64_t>(Locator, 8, EndOffset);
+		Damaged.assign(PackageData.begin(), PackageData.begin() + EndOffset);
+		Damaged.insert(Damaged.end(), Zip64Record.begin(), Zip64Record.end());
+		Damaged.insert(Damaged.end(), Locator.begin(), Locator.end());
+		Damaged.insert(Damaged.end(), PackageData.begin() + EndOffset, PackageData.end());
+		TEST_CHECK(IsPackageRejected(Damaged, true));
+
+		/* The same record with right range is read */
+		WriteTestField<uint64_t>(Damaged, EndOffset + 40, EndOffset - DirectoryOffset);
+		WriteTestField<uint64_t>(Damaged, EndOffset + 48, DirectoryOffset);
+		TEST_CHECK(IsPackageAccepted(Damaged));
+		return true;
+	}
+
+	/* Index checksum is recomputed, so range checks behind it are reached */
+	static void
+	UpdateIndexCrc(std::vector<uint8_t>& PackageData)
+	{
+		NativeHeader Header = ReadTestField<NativeHeader>(PackageData, 0);
+		size_t BucketsSize = ((size_t(1) << Header.BucketBits) + 1) * sizeof(uint32_t);
+		uint32_t IndexCrc = UpdateCrc32(0, PackageData.data() + Header.IndexOffset, static_cast<size_t>(Header.EntriesCount) * sizeof(NativeIndexEntry));
+		IndexCrc = UpdateCrc32(IndexCrc, PackageData.data() + Header.BucketsOffset, BucketsSize);
+		Header.IndexCrc = UpdateCrc32(IndexCrc, PackageData.data() + Header.NamesOffset, static_cast<size_t>(Header.NamesSize));
+		WriteTestField(PackageData, 0, Header);
+	}
+
+	XPACKAGE_TEST(MalformedNativeRejected)
+	{
+		std::vector<uint8_t> PackageData;
+		TEST_CHECK(ReadPackageData(MakeSmallPackage(ArchiveFormat::Native), PackageData));
+		TEST_CHECK(IsPackageAccepted(PackageData));
+
+		NativeHeader Header = ReadTestField<NativeHeader>(PackageData, 0);
+		TEST_CHECK(Header.Signature == NativeSignature && Header.EntriesCount == 3);
+		size_t IndexOffset = static_cast<size_t>(Header.IndexOffset);
+
+		/* Truncated package and header of other version */
+		TEST_CHECK(IsPackageRejected(std::vector<uint8_t>(PackageData.begin(), PackageData.begin() + sizeof(NativeHeader)), true));
+		TEST_CHECK(IsPackageRejected(std::vector<uint8_t>(PackageData.begin(), PackageData.begin() + IndexOffset), true));
+
+		std::vector<uint8_t> Damaged = PackageData;
+		WriteTestField<uint16_t>(Damaged, offsetof(NativeHeader, Version), NativeVersion + 1);
+		TEST_CHECK(IsPackageRejected(Damaged, true));
+
+		/* Index which doesn't match its checksum */
+		Damaged = PackageData;
+		Damaged[IndexOffset + offsetof(NativeIndexEntry, Crc32)] ^= 1;
+		TEST_CHECK(IsPackageRejected(Damaged, true));
+
+		/* Header ranges out of file or wrapping around */
+		const std::pair<size_t, uint64_t> HeaderFields[] = {
+			{ offsetof(NativeHeader, IndexOffset), 0xFFFFFFFFFFFFFFF0ull },
+			{ offsetof(NativeHeader, EntriesCount), 0x100000000ull },
+			{ offsetof(NativeHeader, BucketsOffset), 0xFFFFFFFFFFFFFFFCull },
+			{ offsetof(NativeHeader, NamesOffset), PackageData.size() + 1 },
+			{ offsetof(NativeHeader, NamesSize), 0xFFFFFFFFFFFFFFFFull }
+		};
+
+		for (auto& [FieldOffset, FieldValue] : HeaderFields) {
+			Damaged = PackageData;
+			WriteTestField<uint64_t>(Damaged, FieldOffset, FieldValue);
+			TEST_CHECK(IsPackageRejected(Damaged, true));
+		}
+
+		Damaged = PackageData;
+		WriteTestField<uint32_t>(Damaged, offsetof(NativeHeader, BucketBits), 40);
+		TEST_CHECK(IsPackageRejected(Damaged, true));
+
+		/* Entries with right checksum, but payload or name out of range */
+		const std::pair<size_t, uint64_t> EntryFields[] = {
+			{ offsetof(NativeIndexEntry, DataOffset), PackageData.size() + 1 },
+			{ offsetof(NativeIndexEntry, DataOffset), 16 },
+			{ offsetof(NativeIndexEntry, CompressedSize), 0xFFFFFFFFFFFFFFF0ull }
+		};
+
+		for (auto& [FieldOffset, FieldValue] : EntryFields) {
+			Damaged = PackageData;
+			WriteTestField<uint64_t>(Damaged, IndexOffset + FieldOffset, FieldValue);
+			UpdateIndexCrc(Damaged);
+			TEST_CHECK(IsPackageRejected(Damaged, true));
+		}
+
+		Damaged = PackageData;
+		WriteTestField<uint32_t>(Damaged, IndexOffset + offsetof(NativeIndexEntry, NameOffset), 0xFFFFFFF0);
+		UpdateIndexCrc(Damaged);
+		TEST_CHECK(IsPackageRejected(Damaged, true));
+
+		/* Index must be sorted by name hash, lookups rely on it */
+		Damaged = PackageData;
+		std::swap_ranges(Damaged.begin() + IndexOffset, Damaged.begin() + IndexOffset + sizeof(NativeIndexEntry), Damaged.begin() + IndexOffset + sizeof(NativeIndexEntry));
+		UpdateIndexCrc(Damaged);
+		TEST_CHECK(IsPackageRejected(Damaged, true));
+		return true;
+	}
+}
@@ -0,0 +1,200 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: test cases registry and package helpers
+*********************************************************/
+#include "test_common.h"
+#include <atomic>
+#include <chrono>
+#include <random>
+
+namespace fs = std::filesystem;
+
+namespace xpckg
+{
+	std::vector<TestCase>&
+	GetTestCases()
+	{
+		static std::vector<TestCase> TestCases;
+		return TestCases;
+	}
+
+	TestRegistrar::TestRegistrar(const char* Name, TestFunction Function)
+	{
+		GetTestCases().push_back({ Name, Function });
+	}
+
+	TestFolder::TestFolder()
+	{
+		/* Tick and counter make name unique between tests and parallel runs */
+		static std::atomic<uint32_t> FoldersCount = { 0 };
+		auto Tick = std::chrono::steady_clock::now().time_since_epoch().count();
+		std::string FolderName = "xpackage-test-" + std::to_string(Tick) + "-" + std::to_string(FoldersCount.fetch_add(1));
+
+		FolderPath = fs::temp_directory_path() / FolderName;
+		if (!fs::create_directories(FolderPath)) {
+			throw std::exception();
+		}
+	}
+
+	TestFolder::~TestFolder()
+	{
+		std::error_code RemoveError;
+		fs::remove_all(FolderPath, RemoveError);
+	}
+
+	std::string
+	TestFolder::GetPath(const std::string& RelativePath)
+	{
+		return RelativePath.empty() ? FolderPath.u8string() : (FolderPath / fs::u8path(RelativePath)).u8string();
+	}
+
+	std::vector<uint8_t>
+	MakeContent(size_t ContentSize, uint32_t Seed, bool bCompressible)
+	{
+		static const char FillerText[] = "<param id=\"gain\" min=\"0.0\" max=\"1.0\" default=\"0.5\"/> ";
+		std::mt19937 Random(Seed);
+		std::vector<uint8_t> Content(ContentSize);
+		for (size_t i = 0; i < ContentSize; i++) {
+			Content[i] = bCompressible ? static_cast<uint8_t>(FillerText[(i + Seed) % (sizeof(FillerText) - 1)]) : static_cast<uint8_t>(Random());
+		}
+
+		return Content;
+	}
+
+	std::string
+	DigestToHex(const Sha256Digest& Digest)
+	{
+		static const char HexDigits[] = "0123456789abcdef";
+		std::string HexString;
+		for (uint8_t Byte : Digest) {
+			HexString += HexDigits[Byte >> 4];
+			HexString += HexDigits[Byte & 0xF];
+		}
+
+		return HexString;
+	}
+
+	bool
+	WriteTestPackage(const TestPackage& Package, const std::string& PackagePath)
+	{
+		std::shared_ptr<ArchiveWriter> Writer;
+		try {
+			Writer = std::make_shared<ArchiveWriter>(std::make_shared<FileHandle>(PackagePath, true), Package.Format);
+		}
+		catch (...) {
+			return false;
+		}
+
+		if (!Writer->SetCompression(Package.Method)) {
+			return false;
+		}
+
+		std::string Manifest = "{\"id\":" + std::to_string(Package.Id) + ",\"name\":\"Test\",\"version\":\"" + Package.Version + "\",\"platforms\":{\"win_x64\":[";
+		std::vector<WriterEntry> Entries;
+		for (auto& File : Package.Files) {
+			WriterEntry Entry;
+			Entry.Name = File.Name;
+			Entry.SourceData = File.Content;
+			Entry.PlatformMask = static_cast<uint32_t>(TestPlatform);
+			Manifest += (Entries.empty() ? "\"" : ",\"") + File.Name + "\"";
+			Entries.push_back(std::move(Entry));
+		}
+
+		Manifest += "]}";
+		if (!Package.DigestNames.empty()) {
+			Manifest += ",\"sha256\":{";
+			for (size_t i = 0; i < Package.DigestNames.size(); i++) {
+				Sha256 Hasher;
+				Sha256Digest Digest = {};
+				auto FileIt = std::find_if(Package.Files.begin(), Package.Files.end(), [&](const TestFile& File) {
+					return File.Name == Package.DigestNames[i];
+				});
+
+				if (FileIt != Package.Files.end()) {
+					Hasher.Update(FileIt->Content.data(), FileIt->Content.size());
+				}
+
+				Hasher.Finish(Digest);
+				Manifest += (i == 0 ? "\"" : ",\"") + Package.DigestNames[i] + "\":\"" + DigestToHex(Digest) + "\"";
+			}
+
+			Manifest += "}";
+		}
+
+		Manifest += Package.ExtraManifest + "}";
+
+		WriterEntry ManifestEntry;
+		ManifestEntry.Name = "package.json";
+		ManifestEntry.SourceData.assign(Manifest.begin(), Manifest.end());
+		Entries.push_back(std::move(ManifestEntry));
+
+		bool IsWritten = Writer->AddEntries(Entries, nullptr, Package.Level) && Writer->Finish();
+		Writer = nullptr;
+		return IsWritten;
+	}
+
+	PackageInfo
+	MakePackageInfo(TestFolder& Folder, const std::string& PackagePath, const std::string& PluginName)
+	{
+		PackageInfo Info = {};
+		Info.CompanyName = "Test";
+		Info.PluginName = PluginName;
+		Info.InstallDirectory = Folder.GetPath("install");
+		Info.SymlinkDirectory = Folder.GetPath("symlinks");
+		Info.SourceDirectory = PackagePath;
+		return Info;
+	}
+
+	std::string
+	GetPluginPath(TestFolder& Folder, const std::string& PluginName)
+	{
+		return Folder.GetPath("install/Test/" + PluginName);
+	}
+
+	bool
+	ReadWholeFile(const std::string& FilePath, std::vector<uint8_t>& OutData)
+	{
+		try {
+			FileHandle SourceFile(FilePath, false);
+			OutData.resize(SourceFile.GetFileSize());
+			return OutData.empty() || SourceFile.ReadFromFile(OutData.data(), OutData.size(), 0) == OutData.size();
+		}
+		catch (...) {
+			return false;
+		}
+	}
+
+	bool
+	WriteWholeFile(const std::string& FilePath, const std::vector<uint8_t>& Data)
+	{
+		try {
+			FileHandle TargetFile(FilePath, true);
+			return Data.empty() || TargetFile.WriteToFile(Data.data(), Data.size(), 0) == Data.size();
+		}
+		catch (...) {
+			return false;
+		}
+	}
+
+	bool
+	IsPackageTreeValid(const TestPackage& Package, const std::string& PluginPath)
+	{
+		std::vector<uint8_t> FileData;
+		for (auto& File : Package.Files) {
+			if (!ReadWholeFile((fs::u8path(PluginPath) / fs::u8path(File.Name)).u8string(), FileData) || FileData != File.Content) {
+				return false;
+			}
+		}
+
+		std::error_code WalkError;
+		size_t FilesCount = 0;
+		for (auto It = fs::recursive_directory_iterator(fs::u8path(PluginPath), WalkError); !WalkError && It != fs::recursive_directory_iterator(); It.increment(WalkError)) {
+			FilesCount += It->is_regular_file() ? 1 : 0;
+		}
+
+		return !WalkError && FilesCount == Package.Files.size();
+	}
+}
@@ -0,0 +1,94 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: test cases registry and package helpers
+*********************************************************/
+#pragma once
+#include "xpackage_internal.h"
+#include <cstdio>
+#include <filesystem>
+
+namespace xpckg
+{
+	/* Test returns false on first failed check, checks print their place and condition */
+	using TestFunction = bool(*)();
+
+	struct TestCase
+	{
+		const char* Name;
+		TestFunction Function;
+	};
+
+	std::vector<TestCase>& GetTestCases();
+
+	/* Static object of test file, adds case to list before "main()" runs */
+	struct TestRegistrar
+	{
+		TestRegistrar(const char* Name, TestFunction Function);
+	};
+
+#define XPACKAGE_TEST(Name) \
+	static bool Name(); \
+	static xpckg::TestRegistrar Name##Registrar(#Name, Name); \
+	static bool Name()
+
+#define TEST_CHECK(Condition) \
+	do { \
+		if (!(Condition)) { \
+			std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #Condition); \
+			return false; \
+		} \
+	} while (0)
+
+	/* Empty temporary folder of one test, removed with all content at destruction */
+	class TestFolder
+	{
+	private:
+		std::filesystem::path FolderPath;
+
+	public:
+		TestFolder();
+		~TestFolder();
+
+		std::string GetPath(const std::string& RelativePath = "");
+	};
+
+	struct TestFile
+	{
+		std::string Name;					// archive path with '/' separators
+		std::vector<uint8_t> Content;
+	};
+
+	/* Package with manifest listing all files for "win_x64" platform */
+	struct TestPackage
+	{
+		uint64_t Id = 1;
+		std::string Version = "1.0";
+		std::vector<TestFile> Files;
+		std::vector<std::string> DigestNames;	// files which get "sha256" record in manifest
+		std::string ExtraManifest;				// raw fields appended to manifest object
+		ArchiveFormat Format = ArchiveFormat::Zip;
+		CompressionMethod Method = CompressionMethod::Deflated;
+		int Level = 6;							// zero stores all entries
+	};
+
+	constexpr PackageBinaries TestPlatform = PackageBinaries::BinariesWindows_x64;
+
+	/* Deterministic content: text-like if compressible, pseudo-random otherwise */
+	std::vector<uint8_t> MakeContent(size_t ContentSize, uint32_t Seed, bool bCompressible = true);
+
+	std::string DigestToHex(const Sha256Digest& Digest);
+	bool WriteTestPackage(const TestPackage& Package, const std::string& PackagePath);
+
+	/* Install arguments for plugin "Test/<PluginName>" inside of test folder */
+	PackageInfo MakePackageInfo(TestFolder& Folder, const std::string& PackagePath, const std::string& PluginName = "Plugin");
+	std::string GetPluginPath(TestFolder& Folder, const std::string& PluginName = "Plugin");
+
+	bool ReadWholeFile(const std::string& FilePath, std::vector<uint8_t>& OutData);
+	bool WriteWholeFile(const std::string& FilePath, const std::vector<uint8_t>& Data);
+
+	/* Every file of package is installed with its content and plugin folder has nothing else */
+	bool IsPackageTreeValid(const TestPackage& Package, const std::string& PluginPath);
+}
@@ -0,0 +1,249 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: ProximaFlake text codec and generator
+*********************************************************/
+#include "test_common.h"
+#include "proximaflake.h"
+#include <charconv>
+#include <thread>
+#include <unordered_map>
+
+namespace xpckg
+{
+	/* Edge values of every decimal length and random ones of every bit length */
+	static std::vector<uint64_t>
+	MakeTestFlakes()
+	{
+		std::vector<uint64_t> Flakes = { 0, 1, 9, 10, UINT64_MAX - 1, UINT64_MAX };
+		uint64_t Power = 1;
+		for (size_t i = 0; i < 19; i++) {
+			Power *= 10;
+			Flakes.insert(Flakes.end(), { Power - 1, Power, Power + 1 });
+		}
+
+		std::mt19937_64 Random(7);
+		for (size_t i = 0; i < 100000; i++) {
+			Flakes.push_back(Random() >> (i % 64));
+		}
+
+		return Flakes;
+	}
+
+	XPACKAGE_TEST(FlakeDecimalRoundTrip)
+	{
+		char Buffer[64];
+		char Expected[64];
+		for (uint64_t Flake : MakeTestFlakes()) {
+			size_t Length = CProximaFlakeCodec::EncodeDecimal(Flake, Buffer, sizeof(Buffer));
+			auto ExpectedEnd = std::to_chars(Expected, Expected + sizeof(Expected), Flake).ptr;
+			TEST_CHECK(std::string_view(Buffer, Length) == std::string_view(Expected, ExpectedEnd - Expected));
+
+			uint64_t Decoded = 0;
+			TEST_CHECK(CProximaFlakeCodec::DecodeDecimal(Buffer, Length, Decoded) == Length && Decoded == Flake);
+
+			/* Buffer of exact size is enough, shorter one isn't touched */
+			std::memset(Buffer, '#', sizeof(Buffer));
+			TEST_CHECK(CProximaFlakeCodec::EncodeDecimal(Flake, Buffer, Length) == Length);
+			TEST_CHECK(CProximaFlakeCodec::EncodeDecimal(Flake, Buffer + 32, Length - 1) == 0 && Buffer[32] == '#');
+		}
+
+		return true;
+	}
+
+	XPACKAGE_TEST(FlakeDecimalRejectsMalformed)
+	{
+		const char* Malformed[] = { "", "a", "-1", " 1", "18446744073709551616", "99999999999999999999", "184467440737095516150" };
+		uint64_t Decoded = 0;
+		for (const char* String : Malformed) {
+			TEST_CHECK(CProximaFlakeCodec::DecodeDecimal(String, std::strlen(String), Decoded) == 0);
+		}
+
+		/* Digits are parsed up to the first other char, leading zeros don't count as overflow */
+		TEST_CHECK(CProximaFlakeCodec::DecodeDecimal("18446744073709551615,", 21, Decoded) == 20 && Decoded == UINT64_MAX);
+		TEST_CHECK(CProximaFlakeCodec::DecodeDecimal("000000000000000000000000000042x", 31, Decoded) == 30 && Decoded == 42);
+		TEST_CHECK(CProximaFlakeCodec::DecodeDecimal("123456789012345678,1", 20, Decoded) == 18 && Decoded == 123456789012345678ull);
+
+		/* Length bounds parsing, char after it isn't read */
+		TEST_CHECK(CProximaFlakeCodec::DecodeDecimal("12345", 3, Decoded) == 3 && Decoded == 123);
+		return true;
+	}
+
+	XPACKAGE_TEST(FlakeBase62RoundTrip)
+	{
+		char Buffer[64];
+		std::vector<uint64_t> Flakes = MakeTestFlakes();
+		std::vector<std::string> Strings;
+		for (uint64_t Flake : Flakes) {
+			TEST_CHECK(CProximaFlakeCodec::EncodeBase62(Flake, Buffer, sizeof(Buffer)) == 11);
+
+			uint64_t Decoded = 0;
+			TEST_CHECK(CProximaFlakeCodec::DecodeBase62(Buffer, 11, Decoded) == 11 && Decoded == Flake);
+			TEST_CHECK(CProximaFlakeCodec::EncodeBase62(Flake, Buffer, 10) == 0);
+			Strings.emplace_back(Buffer, 11);
+		}
+
+		/* Fixed width keeps numeric order of flakes */
+		std::sort(Flakes.begin(), Flakes.end());
+		std::sort(Strings.begin(), Strings.end());
+		for (size_t i = 0; i < Flakes.size(); i++) {
+			uint64_t Decoded = 0;
+			TEST_CHECK(CProximaFlakeCodec::DecodeBase62(Strings[i].data(), Strings[i].size(), Decoded) == 11 && Decoded == Flakes[i]);
+		}
+
+		return true;
+	}
+
+	XPACKAGE_TEST(FlakeBase62RejectsMalformed)
+	{
+		uint64_t Decoded = 0;
+		TEST_CHECK(CProximaFlakeCodec::DecodeBase62("LygHa16AHYF", 11, Decoded) == 11 && Decoded == UINT64_MAX);
+		TEST_CHECK(CProximaFlakeCodec::DecodeBase62("LygHa16AHYG", 11, Decoded) == 0);
+		TEST_CHECK(CProximaFlakeCodec::DecodeBase62("zzzzzzzzzzz", 11, Decoded) == 0);
+		TEST_CHECK(CProximaFlakeCodec::DecodeBase62("000000000001", 12, Decoded) == 0);
+		TEST_CHECK(CProximaFlakeCodec::DecodeBase62("-1", 2, Decoded) == 0);
+		TEST_CHECK(CProximaFlakeCodec::DecodeBase62("", 0, Decoded) == 0);
+
+		/* Shorter strings are numbers without leading zeros */
+		TEST_CHECK(CProximaFlakeCodec::DecodeBase62("z-", 2, Decoded) == 1 && Decoded == 61);
+		TEST_CHECK(CProximaFlakeCodec::DecodeBase62("10", 2, Decoded) == 2 && Decoded == 62);
+		return true;
+	}
+
+	XPACKAGE_TEST(FlakeBatchRoundTrip)
+	{
+		std::vector<uint64_t> Flakes = MakeTestFlakes();
+		std::vector<uint64_t> Decoded;
+
+		std::vector<char> Text(CProximaFlakeCodec::GetDecimalBatchSize(Flakes.size()));
+		size_t Length = CProximaFlakeCodec::EncodeDecimalBatch(Flakes.data(), Flakes.size(), ',', Text.data(), Text.size());
+		TEST_CHECK(Length != 0 && CProximaFlakeCodec::DecodeDecimalBatch(Text.data(), Length, ',', Decoded) && Decoded == Flakes);
+
+		/* Exact buffer fits, one byte less fails the whole batch */
+		TEST_CHECK(CProximaFlakeCodec::EncodeDecimalBatch(Flakes.data(), Flakes.size(), ',', Text.data(), Length) == Length);
+		TEST_CHECK(CProximaFlakeCodec::EncodeDecimalBatch(Flakes.data(), Flakes.size(), ',', Text.data(), Length - 1) == 0);
+
+		/* Separator after the last flake is allowed, other separator isn't */
+		Text[Length] = ',';
+		Decoded.clear();
+		TEST_CHECK(CProximaFlakeCodec::DecodeDecimalBatch(Text.data(), Length + 1, ',', Decoded) && Decoded == Flakes);
+		Decoded.clear();
+		TEST_CHECK(!CProximaFlakeCodec::DecodeDecimalBatch(Text.data(), Length, ';', Decoded));
+
+		Text.resize(CProximaFlakeCodec::GetBase62BatchSize(Flakes.size()));
+		Length = CProximaFlakeCodec::EncodeBase62Batch(Flakes.data(), Flakes.size(), '\n', Text.data(), Text.size());
+		TEST_CHECK(Length == Flakes.size() * 12 - 1);
+		TEST_CHECK(CProximaFlakeCodec::EncodeBase62Batch(Flakes.data(), Flakes.size(), '\n', Text.data(), Length - 1) == 0);
+		Decoded.clear();
+		TEST_CHECK(CProximaFlakeCodec::DecodeBase62Batch(Text.data(), Length, '\n', Decoded) && Decoded == Flakes);
+
+		/* Overflowing flake in the middle fails batch */
+		std::string Overflowed = "1,18446744073709551616,2";
+		Decoded.clear();
+		TEST_CHECK(!CProximaFlakeCodec::DecodeDecimalBatch(Overflowed.data(), Overflowed.size(), ',', Decoded));
+		return true;
+	}
+
+	XPACKAGE_TEST(FlakeFieldsExtraction)
+	{
+		std::vector<uint64_t> Flakes = MakeTestFlakes();
+
+		/* Counts around vector widths check tails */
+		for (size_t Count : { 0, 1, 7, 8, 15, 16, 17, 1000 }) {
+			std::vector<uint64_t> Timestamps(Count);
+			std::vector<uint16_t> MachineIds(Count);
+			std::vector<uint8_t> ObjectTypes(Count);
+			CProximaFlakeCodec::ExtractTimestamps(Flakes.data(), Count, Timestamps.data());
+			CProximaFlakeCodec::ExtractMachineIds(Flakes.data(), Count, MachineIds.data());
+			CProximaFlakeCodec::ExtractObjectTypes(Flakes.data(), Count, ObjectTypes.data());
+			for (size_t i = 0; i < Count; i++) {
+				ProximaFlakeData Data = {};
+				std::memcpy(&Data, &Flakes[i], sizeof(Data));
+				TEST_CHECK(Timestamps[i] == Data.Timestamp && MachineIds[i] == Data.MachineId && ObjectTypes[i] == Data.ObjectType);
+			}
+		}
+
+		return true;
+	}
+
+	XPACKAGE_TEST(FlakeGeneratorRejectsMachineIds)
+	{
+		auto IsRejected = [](uint64_t FirstMachineId, size_t MachineIdsCount) {
+			try {
+				CProximaFlakeGenerator Generator(FirstMachineId, MachineIdsCount);
+			}
+			catch (...) {
+				return true;
+			}
+
+			return false;
+		};
+
+		TEST_CHECK(IsRejected(0, 0));
+		TEST_CHECK(IsRejected(CProximaFlakeGenerator::MaxMachineId, 1));
+		TEST_CHECK(IsRejected(CProximaFlakeGenerator::MaxMachineId - 1, 2));
+		TEST_CHECK(!IsRejected(CProximaFlakeGenerator::MaxMachineId - 1, 1));
+		TEST_CHECK(!IsRejected(0, CProximaFlakeGenerator::MaxMachineId));
+		return true;
+	}
+
+	/* Threads take single flakes and batches of random sizes, more of them than one tick has per shard */
+	XPACKAGE_TEST(FlakeGeneratorUniqueAcrossThreads)
+	{
+		constexpr uint64_t FirstMachineId = 100;
+		constexpr size_t MachineIdsCount = 3;
+		constexpr size_t ThreadsCount = 8;
+		constexpr size_t FlakesPerThread = 8000;
+
+		uint64_t StartTick = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()) / 10 - ProximaEpoch;
+		CProximaFlakeGenerator Generator(FirstMachineId, MachineIdsCount);
+		std::vector<std::vector<uint64_t>> ThreadFlakes(ThreadsCount);
+		std::vector<std::thread> Threads;
+		for (size_t ThreadIndex = 0; ThreadIndex < ThreadsCount; ThreadIndex++) {
+			Threads.emplace_back([&, ThreadIndex]() {
+				std::mt19937 Random(static_cast<uint32_t>(ThreadIndex));
+				std::vector<uint64_t>& Flakes = ThreadFlakes[ThreadIndex];
+				while (Flakes.size() < FlakesPerThread) {
+					size_t BatchSize = std::min<size_t>(Random() % 300 + 1, FlakesPerThread - Flakes.size());
+					if (BatchSize % 4 == 0) {
+						Flakes.push_back(Generator.Generate(CProximaFlake::ObjectType::PackageObject).GetFlake());
+					} else {
+						Generator.GenerateBatch(CProximaFlake::ObjectType::PackageObject, Flakes, BatchSize);
+					}
+				}
+			});
+		}
+
+		for (auto& Thread : Threads) {
+			Thread.join();
+		}
+
+		uint64_t EndTick = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()) / 10 - ProximaEpoch;
+		std::vector<uint64_t> AllFlakes;
+		for (auto& Flakes : ThreadFlakes) {
+			/* Time and sequence of one shard taken by one thread only grow */
+			std::unordered_map<uint64_t, uint64_t> LastCounters;
+			for (uint64_t Flake : Flakes) {
+				ProximaFlakeData Data = {};
+				std::memcpy(&Data, &Flake, sizeof(Data));
+				TEST_CHECK(Data.MachineId >= FirstMachineId && Data.MachineId < FirstMachineId + MachineIdsCount);
+				TEST_CHECK(Data.ObjectType == static_cast<uint64_t>(CProximaFlake::ObjectType::PackageObject));
+				TEST_CHECK(Data.Timestamp + 1 >= StartTick && Data.Timestamp <= EndTick + CProximaFlakeGenerator::MaxBorrowTicks + 1);
+
+				uint64_t Counter = Data.Timestamp * CProximaFlakeGenerator::SequenceCount + Data.Sequence + 1;
+				uint64_t& LastCounter = LastCounters[Data.MachineId];
+				TEST_CHECK(LastCounter < Counter);
+				LastCounter = Counter;
+			}
+
+			AllFlakes.insert(AllFlakes.end(), Flakes.begin(), Flakes.end());
+		}
+
+		std::sort(AllFlakes.begin(), AllFlakes.end());
+		TEST_CHECK(AllFlakes.size() == ThreadsCount * FlakesPerThread);
+		TEST_CHECK(std::adjacent_find(AllFlakes.begin(), AllFlakes.end()) == AllFlakes.end());
+		return true;
+	}
+}
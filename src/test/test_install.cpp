@@ -0,0 +1,603 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: install, upgrade and removal of packages
+*********************************************************/
+#include "test_common.h"
+#include <future>
+
+namespace xpckg
+{
+	using ReturnCodes = PackageManager::ReturnCodes;
+
+	/* Nested folders, empty file and mix of compressible and random content */
+	static TestPackage
+	MakePluginPackage(ArchiveFormat Format, uint32_t Seed)
+	{
+		TestPackage Package;
+		Package.Format = Format;
+		Package.Files.push_back({ "bin/plugin.dll", MakeContent(2 * 1024 * 1024 + 5, Seed, false) });
+		Package.Files.push_back({ "bin/plugin.pdb", MakeContent(300 * 1024, Seed + 1) });
+		Package.Files.push_back({ "presets/factory/default.xml", MakeContent(700, Seed + 2) });
+		Package.Files.push_back({ "presets/factory/empty.xml", {} });
+		Package.Files.push_back({ "readme.txt", MakeContent(64, Seed + 3) });
+		return Package;
+	}
+
+	XPACKAGE_TEST(InstallWritesPackageTree)
+	{
+		for (ArchiveFormat Format : { ArchiveFormat::Zip, ArchiveFormat::Native }) {
+			for (size_t ThreadsCount : { 1, 4 }) {
+				TestFolder Folder;
+				TestPackage Package = MakePluginPackage(Format, 1);
+				std::string PackagePath = Folder.GetPath("package.zip");
+				TEST_CHECK(WriteTestPackage(Package, PackagePath));
+
+				PackageManager Manager("");
+				Manager.SetThreadsCount(ThreadsCount);
+				TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, PackagePath), TestPlatform, nullptr) == ReturnCodes::NoError);
+				TEST_CHECK(IsPackageTreeValid(Package, GetPluginPath(Folder)));
+				TEST_CHECK(std::filesystem::is_symlink(Folder.GetPath("symlinks/Test/Plugin")));
+			}
+		}
+
+		return true;
+	}
+
+	/* Second version changes one file, drops one and adds one, the rest is the same */
+	static TestPackage
+	MakeUpgradePackage(const TestPackage& Package)
+	{
+		TestPackage Upgrade = Package;
+		Upgrade.Version = "1.1";
+		Upgrade.Files[2].Content = MakeContent(900, 20);
+		Upgrade.Files.erase(Upgrade.Files.begin() + 4);
+		Upgrade.Files.push_back({ "presets/user/new.xml", MakeContent(300, 21) });
+		return Upgrade;
+	}
+
+	/* Changed files of upgrade written next to old ones, none must be left after install */
+	static size_t
+	CountPendingFiles(const std::string& PluginPath)
+	{
+		std::error_code WalkError;
+		size_t PendingCount = 0;
+		for (auto It = std::filesystem::recursive_directory_iterator(std::filesystem::u8path(PluginPath), WalkError); !WalkError && It != std::filesystem::recursive_directory_iterator(); It.increment(WalkError)) {
+			PendingCount += It->path().extension() == PendingSuffix ? 1 : 0;
+		}
+
+		return PendingCount;
+	}
+
+	static bool
+	IsIncrementalUpgradeValid(PackageManager::DurabilityLevel Durability)
+	{
+		TestFolder Folder;
+		TestPackage Package = MakePluginPackage(ArchiveFormat::Zip, 1);
+		TestPackage Upgrade = MakeUpgradePackage(Package);
+		std::string PackagePath = Folder.GetPath("package.zip");
+		std::string UpgradePath = Folder.GetPath("upgrade.zip");
+		std::string PluginPath = GetPluginPath(Folder);
+		TEST_CHECK(WriteTestPackage(Package, PackagePath) && WriteTestPackage(Upgrade, UpgradePath));
+
+		PackageManager Manager(Folder.GetPath("registry"));
+		Manager.SetIncrementalInstall(true);
+		Manager.SetDurability(Durability);
+		TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, PackagePath), TestPlatform, nullptr) == ReturnCodes::NoError);
+
+		/* Old modification time marks files which upgrade doesn't write */
+		auto OldTime = std::filesystem::file_time_type::clock::now() - std::chrono::hours(24 * 365);
+		for (auto& File : Package.Files) {
+			std::filesystem::last_write_time(std::filesystem::u8path(PluginPath + "/" + File.Name), OldTime);
+		}
+
+		TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, UpgradePath), TestPlatform, nullptr) == ReturnCodes::NoError);
+		TEST_CHECK(IsPackageTreeValid(Upgrade, PluginPath));
+		TEST_CHECK(CountPendingFiles(PluginPath) == 0);
+		TEST_CHECK(std::filesystem::last_write_time(std::filesystem::u8path(PluginPath + "/bin/plugin.dll")) == OldTime);
+		TEST_CHECK(std::filesystem::last_write_time(std::filesystem::u8path(PluginPath + "/presets/factory/empty.xml")) == OldTime);
+		TEST_CHECK(std::filesystem::last_write_time(std::filesystem::u8path(PluginPath + "/presets/factory/default.xml")) != OldTime);
+
+		InstalledPackage Record = {};
+		TEST_CHECK(Manager.GetInstalledPackage(Upgrade.Id, Record));
+		TEST_CHECK(Record.Version == Upgrade.Version && Record.Files.size() == Upgrade.Files.size());
+
+		/* File changed on disk since install is written again */
+		TEST_CHECK(WriteWholeFile(PluginPath + "/bin/plugin.pdb", MakeContent(10, 30)));
+		TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, UpgradePath), TestPlatform, nullptr) == ReturnCodes::NoError);
+		TEST_CHECK(IsPackageTreeValid(Upgrade, PluginPath));
+		return true;
+	}
+
+	XPACKAGE_TEST(InstallIncrementalSkipsUnchanged)
+	{
+		TEST_CHECK(IsIncrementalUpgradeValid(PackageManager::DurabilityLevel::None));
+		TEST_CHECK(IsIncrementalUpgradeValid(PackageManager::DurabilityLevel::Batched));
+		TEST_CHECK(IsIncrementalUpgradeValid(PackageManager::DurabilityLevel::Strict));
+		return true;
+	}
+
+	/*
+		Upgrade which fails on changed entry doesn't remove files dropped by it. Batched one
+		also keeps old versions of changed files, so old record still describes the folder.
+	*/
+	static bool
+	IsFailedUpgradeKept(PackageManager::DurabilityLevel Durability)
+	{
+		TestFolder Folder;
+		TestPackage Package = MakePluginPackage(ArchiveFormat::Zip, 1);
+		TestPackage Upgrade = MakeUpgradePackage(Package);
+		Upgrade.Files[2].Content = MakeContent(900, 20, false);
+		Upgrade.Level = 0;
+		std::string PackagePath = Folder.GetPath("package.zip");
+		std::string UpgradePath = Folder.GetPath("upgrade.zip");
+		std::string PluginPath = GetPluginPath(Folder);
+		TEST_CHECK(WriteTestPackage(Package, PackagePath) && WriteTestPackage(Upgrade, UpgradePath));
+
+		std::vector<uint8_t> PackageData;
+		const std::vector<uint8_t>& ChangedContent = Upgrade.Files[2].Content;
+		TEST_CHECK(ReadWholeFile(UpgradePath, PackageData));
+		auto ContentIt = std::search(PackageData.begin(), PackageData.end(), ChangedContent.begin(), ChangedContent.end());
+		TEST_CHECK(ContentIt != PackageData.end());
+		ContentIt[ChangedContent.size() / 2] ^= 0x5A;
+		TEST_CHECK(WriteWholeFile(UpgradePath, PackageData));
+
+		PackageManager Manager(Folder.GetPath("registry"));
+		Manager.SetIncrementalInstall(true);
+		Manager.SetDurability(Durability);
+		TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, PackagePath), TestPlatform, nullptr) == ReturnCodes::NoError);
+		TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, UpgradePath), TestPlatform, nullptr) == ReturnCodes::IntegrityCheckFailed);
+
+		std::vector<uint8_t> FileData;
+		TEST_CHECK(ReadWholeFile(PluginPath + "/readme.txt", FileData) && FileData == Package.Files[4].Content);
+		if (Durability == PackageManager::DurabilityLevel::Batched) {
+			InstalledPackage Record = {};
+			TEST_CHECK(IsPackageTreeValid(Package, PluginPath));
+			TEST_CHECK(CountPendingFiles(PluginPath) == 0);
+			TEST_CHECK(Manager.GetInstalledPackage(Package.Id, Record) && Record.Version == Package.Version);
+		}
+
+		return true;
+	}
+
+	XPACKAGE_TEST(InstallIncrementalFailureKeepsDropped)
+	{
+		TEST_CHECK(IsFailedUpgradeKept(PackageManager::DurabilityLevel::None));
+		TEST_CHECK(IsFailedUpgradeKept(PackageManager::DurabilityLevel::Batched));
+		return true;
+	}
+
+	/* Without config file there is nothing to compare with, so upgrade writes every file again */
+	XPACKAGE_TEST(InstallIncrementalWithoutRegistry)
+	{
+		TestFolder Folder;
+		TestPackage Package = MakePluginPackage(ArchiveFormat::Zip, 1);
+		TestPackage Upgrade = MakeUpgradePackage(Package);
+		std::string PackagePath = Folder.GetPath("package.zip");
+		std::string UpgradePath = Folder.GetPath("upgrade.zip");
+		std::string PluginPath = GetPluginPath(Folder);
+		TEST_CHECK(WriteTestPackage(Package, PackagePath) && WriteTestPackage(Upgrade, UpgradePath));
+
+		PackageManager Manager("");
+		Manager.SetIncrementalInstall(true);
+		TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, PackagePath), TestPlatform, nullptr) == ReturnCodes::NoError);
+
+		auto OldTime = std::filesystem::file_time_type::clock::now() - std::chrono::hours(24 * 365);
+		std::filesystem::last_write_time(std::filesystem::u8path(PluginPath + "/bin/plugin.dll"), OldTime);
+		TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, UpgradePath), TestPlatform, nullptr) == ReturnCodes::NoError);
+		TEST_CHECK(std::filesystem::last_write_time(std::filesystem::u8path(PluginPath + "/bin/plugin.dll")) != OldTime);
+
+		std::vector<uint8_t> FileData;
+		for (auto& File : Upgrade.Files) {
+			TEST_CHECK(ReadWholeFile(PluginPath + "/" + File.Name, FileData) && FileData == File.Content);
+		}
+
+		return true;
+	}
+
+	static bool
+	RefuseDelete(PackageInfo*, PackageBinaries)
+	{
+		return false;
+	}
+
+	/* Folder entries of company which belong to plugin, removed ones included */
+	static size_t
+	CountPluginFolders(const std::string& CompanyPath)
+	{
+		std::error_code WalkError;
+		size_t FoldersCount = 0;
+		for (auto It = std::filesystem::directory_iterator(std::filesystem::u8path(CompanyPath), WalkError); !WalkError && It != std::filesystem::directory_iterator(); It.increment(WalkError)) {
+			FoldersCount += It->path().filename().u8string().rfind("Plugin", 0) == 0 ? 1 : 0;
+		}
+
+		return FoldersCount;
+	}
+
+	static bool
+	IsDeleteValid(bool bRegistry)
+	{
+		TestFolder Folder;
+		TestPackage Package = MakePluginPackage(ArchiveFormat::Zip, 1);
+		std::string PackagePath = Folder.GetPath("package.zip");
+		std::string PluginPath = GetPluginPath(Folder);
+		TEST_CHECK(WriteTestPackage(Package, PackagePath));
+
+		{
+			PackageManager Manager(bRegistry ? Folder.GetPath("registry") : "");
+			PackageInfo Info = MakePackageInfo(Folder, PackagePath);
+			TEST_CHECK(Manager.InstallPackage(Info, TestPlatform, nullptr) == ReturnCodes::NoError);
+
+			/* Callback can refuse removal, then nothing is touched */
+			TEST_CHECK(Manager.DeletePackage(Info, TestPlatform, RefuseDelete) == ReturnCodes::AfterInstallationOperationFailed);
+			TEST_CHECK(IsPackageTreeValid(Package, PluginPath));
+
+			/* File added by user isn't in installed list, but goes with the folder */
+			TEST_CHECK(WriteWholeFile(PluginPath + "/presets/user.xml", MakeContent(10, 40)));
+			TEST_CHECK(Manager.DeletePackage(Info, TestPlatform) == ReturnCodes::NoError);
+			TEST_CHECK(!std::filesystem::exists(std::filesystem::u8path(PluginPath)));
+			TEST_CHECK(!std::filesystem::exists(std::filesystem::symlink_status(std::filesystem::u8path(Folder.GetPath("symlinks/Test/Plugin")))));
+			TEST_CHECK(!Manager.IsPackageInstalled(Package.Id));
+
+			/* Package which isn't installed is already deleted */
+			TEST_CHECK(Manager.DeletePackage(Info, TestPlatform) == ReturnCodes::NoError);
+		}
+
+		/* Manager destruction waits for background removal */
+		TEST_CHECK(CountPluginFolders(Folder.GetPath("install/Test")) == 0);
+		return true;
+	}
+
+	XPACKAGE_TEST(DeleteRemovesPackage)
+	{
+		TEST_CHECK(IsDeleteValid(true));
+		TEST_CHECK(IsDeleteValid(false));
+		return true;
+	}
+
+	/* Install right after delete gets empty name, folder being removed doesn't get in the way */
+	XPACKAGE_TEST(DeleteThenReinstall)
+	{
+		TestFolder Folder;
+		TestPackage Package = MakePluginPackage(ArchiveFormat::Zip, 1);
+		std::string PackagePath = Folder.GetPath("package.zip");
+		TEST_CHECK(WriteTestPackage(Package, PackagePath));
+
+		{
+			PackageManager Manager(Folder.GetPath("registry"));
+			PackageInfo Info = MakePackageInfo(Folder, PackagePath);
+			for (size_t i = 0; i < 4; i++) {
+				TEST_CHECK(Manager.InstallPackage(Info, TestPlatform, nullptr) == ReturnCodes::NoError);
+				TEST_CHECK(Manager.DeletePackage(Info, TestPlatform) == ReturnCodes::NoError);
+			}
+
+			TEST_CHECK(Manager.InstallPackage(Info, TestPlatform, nullptr) == ReturnCodes::NoError);
+			TEST_CHECK(IsPackageTreeValid(Package, GetPluginPath(Folder)));
+			TEST_CHECK(Manager.IsPackageInstalled(Package.Id));
+		}
+
+		TEST_CHECK(CountPluginFolders(Folder.GetPath("install/Test")) == 1);
+		return true;
+	}
+
+	static InstallRequest
+	MakeInstallRequest(TestFolder& Folder, const std::string& PackagePath, const std::string& PluginName = "Plugin")
+	{
+		InstallRequest Request;
+		Request.PathToPackage = MakePackageInfo(Folder, PackagePath, PluginName);
+		Request.BinaryType = TestPlatform;
+		return Request;
+	}
+
+	/* Many big random files, so extraction takes long enough to be cancelled in the middle */
+	static TestPackage
+	MakeSlowPackage()
+	{
+		TestPackage Package;
+		for (uint32_t i = 0; i < 48; i++) {
+			Package.Files.push_back({ "data/file" + std::to_string(i) + ".bin", MakeContent(1024 * 1024, 100 + i, false) });
+		}
+
+		return Package;
+	}
+
+	XPACKAGE_TEST(AsyncReportsProgress)
+	{
+		TestFolder Folder;
+		TestPackage Package = MakePluginPackage(ArchiveFormat::Zip, 1);
+		std::string PackagePath = Folder.GetPath("package.zip");
+		TEST_CHECK(WriteTestPackage(Package, PackagePath));
+
+		uint64_t PackageSize = 0;
+		for (auto& File : Package.Files) {
+			PackageSize += File.Content.size();
+		}
+
+		PackageManager Manager("");
+		auto Control = std::make_shared<InstallControl>();
+		TEST_CHECK(Manager.InstallPackageAsync(MakeInstallRequest(Folder, PackagePath), Control).get() == ReturnCodes::NoError);
+		TEST_CHECK(Control->BytesTotal.load() == PackageSize && Control->BytesDone.load() == PackageSize);
+		TEST_CHECK(IsPackageTreeValid(Package, GetPluginPath(Folder)));
+
+		/* Control is optional */
+		TEST_CHECK(Manager.InstallPackageAsync(MakeInstallRequest(Folder, PackagePath, "Other")).get() == ReturnCodes::NoError);
+		TEST_CHECK(IsPackageTreeValid(Package, GetPluginPath(Folder, "Other")));
+		return true;
+	}
+
+	XPACKAGE_TEST(AsyncCancelBeforeStart)
+	{
+		TestFolder Folder;
+		TestPackage Package = MakePluginPackage(ArchiveFormat::Zip, 1);
+		std::string PackagePath = Folder.GetPath("package.zip");
+		TEST_CHECK(WriteTestPackage(Package, PackagePath));
+
+		PackageManager Manager(Folder.GetPath("registry"));
+		auto Control = std::make_shared<InstallControl>();
+		Control->Cancel();
+		TEST_CHECK(Manager.InstallPackageAsync(MakeInstallRequest(Folder, PackagePath), Control).get() == ReturnCodes::Cancelled);
+		TEST_CHECK(!std::filesystem::exists(std::filesystem::u8path(GetPluginPath(Folder))));
+		TEST_CHECK(!std::filesystem::exists(std::filesystem::symlink_status(std::filesystem::u8path(Folder.GetPath("symlinks/Test/Plugin")))));
+		TEST_CHECK(!Manager.IsPackageInstalled(Package.Id));
+		return true;
+	}
+
+	/*
+		Cancel races with extraction: install is either cancelled and leaves previous state,
+		or it has finished before request and package is complete. Upgrade keeps old version
+		and its record whatever durability is.
+	*/
+	static bool
+	IsCancelDuringExtractValid(PackageManager::DurabilityLevel Durability, bool bUpgrade, bool bIncremental)
+	{
+		TestFolder Folder;
+		TestPackage OldPackage = MakePluginPackage(ArchiveFormat::Zip, 1);
+		TestPackage Package = MakeSlowPackage();
+		std::string OldPath = Folder.GetPath("old.zip");
+		std::string PackagePath = Folder.GetPath("package.zip");
+		std::string PluginPath = GetPluginPath(Folder);
+		TEST_CHECK(WriteTestPackage(OldPackage, OldPath) && WriteTestPackage(Package, PackagePath));
+
+		PackageManager Manager(Folder.GetPath("registry"));
+		Manager.SetThreadsCount(1);
+		Manager.SetDurability(Durability);
+		Manager.SetIncrementalInstall(bIncremental);
+		if (bUpgrade) {
+			TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, OldPath), TestPlatform, nullptr) == ReturnCodes::NoError);
+		}
+
+		auto Control = std::make_shared<InstallControl>();
+		auto Result = Manager.InstallPackageAsync(MakeInstallRequest(Folder, PackagePath), Control);
+		while (Control->BytesDone.load() == 0 && Result.wait_for(std::chrono::microseconds(100)) != std::future_status::ready) {
+		}
+
+		Control->Cancel();
+		ReturnCodes ReturnValue = Result.get();
+		TEST_CHECK(ReturnValue == ReturnCodes::Cancelled || ReturnValue == ReturnCodes::NoError);
+		if (ReturnValue == ReturnCodes::NoError) {
+			TEST_CHECK(IsPackageTreeValid(Package, PluginPath));
+			return true;
+		}
+
+		TEST_CHECK(Control->BytesDone.load() < Control->BytesTotal.load());
+		if (!bUpgrade) {
+			TEST_CHECK(!std::filesystem::exists(std::filesystem::u8path(PluginPath)));
+			TEST_CHECK(!Manager.IsPackageInstalled(Package.Id));
+		} else {
+			TEST_CHECK(IsPackageTreeValid(OldPackage, PluginPath) && CountPendingFiles(PluginPath) == 0);
+			TEST_CHECK(Manager.IsPackageInstalled(OldPackage.Id));
+		}
+
+		TEST_CHECK(!std::filesystem::exists(std::filesystem::u8path(PluginPath + StagingSuffix)));
+		return true;
+	}
+
+	XPACKAGE_TEST(AsyncCancelDuringExtract)
+	{
+		for (auto Durability : { PackageManager::DurabilityLevel::None, PackageManager::DurabilityLevel::Batched, PackageManager::DurabilityLevel::Strict }) {
+			TEST_CHECK(IsCancelDuringExtractValid(Durability, false, false));
+			TEST_CHECK(IsCancelDuringExtractValid(Durability, true, false));
+			TEST_CHECK(IsCancelDuringExtractValid(Durability, true, true));
+		}
+
+		return true;
+	}
+
+	/* Failed request doesn't stop others, codes come in order of requests */
+	XPACKAGE_TEST(BatchInstallKeepsOrder)
+	{
+		TestFolder Folder;
+		std::vector<InstallRequest> Requests;
+		std::vector<TestPackage> Packages;
+		for (uint32_t i = 0; i < 6; i++) {
+			Packages.push_back(MakePluginPackage(i % 2 == 0 ? ArchiveFormat::Zip : ArchiveFormat::Native, i * 10));
+			Packages.back().Id = i + 1;
+			std::string PackagePath = Folder.GetPath("package" + std::to_string(i) + ".zip");
+			TEST_CHECK(WriteTestPackage(Packages.back(), PackagePath));
+			Requests.push_back(MakeInstallRequest(Folder, PackagePath, "Plugin" + std::to_string(i)));
+		}
+
+		Requests[2].PathToPackage.SourceDirectory = Folder.GetPath("missing.zip");
+		TEST_CHECK(WriteWholeFile(Folder.GetPath("broken.zip"), MakeContent(1000, 50, false)));
+		Requests[4].PathToPackage.SourceDirectory = Folder.GetPath("broken.zip");
+
+		PackageManager Manager(Folder.GetPath("registry"));
+		std::vector<ReturnCodes> ReturnValues = Manager.InstallPackages(Requests);
+		TEST_CHECK(ReturnValues.size() == Requests.size());
+		for (size_t i = 0; i < Requests.size(); i++) {
+			bool IsBroken = i == 2 || i == 4;
+			TEST_CHECK((ReturnValues[i] == ReturnCodes::NoError) != IsBroken);
+			TEST_CHECK(IsBroken || IsPackageTreeValid(Packages[i], GetPluginPath(Folder, "Plugin" + std::to_string(i))));
+			TEST_CHECK(Manager.IsPackageInstalled(Packages[i].Id) != IsBroken);
+		}
+
+		TEST_CHECK(ReturnValues[4] == ReturnCodes::PackageDamaged);
+		TEST_CHECK(Manager.InstallPackages({}).empty());
+		return true;
+	}
+
+	/* Every object of store is named by SHA-256 of its content, there is one read-only object per content */
+	static bool
+	IsStoreValid(const std::string& StorePath, size_t ContentsCount)
+	{
+		std::error_code WalkError;
+		std::vector<uint8_t> ObjectData;
+		size_t ObjectsCount = 0;
+		for (auto It = std::filesystem::recursive_directory_iterator(std::filesystem::u8path(StorePath), WalkError); !WalkError && It != std::filesystem::recursive_directory_iterator(); It.increment(WalkError)) {
+			if (!It->is_regular_file()) {
+				continue;
+			}
+
+			/* Index file keeps digest of existing object */
+			if (It->path().parent_path().filename() == "index") {
+				TEST_CHECK(ReadWholeFile(It->path().u8string(), ObjectData) && ObjectData.size() == sizeof(Sha256Digest));
+				std::string ObjectName = DigestToHex(*reinterpret_cast<const Sha256Digest*>(ObjectData.data()));
+				TEST_CHECK(std::filesystem::exists(std::filesystem::u8path(StorePath) / ObjectName.substr(0, 2) / ObjectName));
+				continue;
+			}
+
+			TEST_CHECK((It->status().permissions() & std::filesystem::perms::owner_write) == std::filesystem::perms::none);
+			Sha256 Hasher;
+			Sha256Digest Digest = {};
+			TEST_CHECK(ReadWholeFile(It->path().u8string(), ObjectData));
+			Hasher.Update(ObjectData.data(), ObjectData.size());
+			Hasher.Finish(Digest);
+			std::string ObjectName = DigestToHex(Digest);
+			TEST_CHECK(It->path().filename().u8string() == ObjectName);
+			TEST_CHECK(It->path().parent_path().filename().u8string() == ObjectName.substr(0, 2));
+			ObjectsCount++;
+		}
+
+		TEST_CHECK(!WalkError && ObjectsCount == ContentsCount);
+		return true;
+	}
+
+	XPACKAGE_TEST(StoreSharesEqualFiles)
+	{
+		TestFolder Folder;
+		TestPackage FirstPackage = MakePluginPackage(ArchiveFormat::Zip, 1);
+		FirstPackage.DigestNames = { "bin/plugin.dll" };
+		TestPackage SecondPackage = MakeUpgradePackage(FirstPackage);
+		SecondPackage.Id = 2;
+		SecondPackage.Format = ArchiveFormat::Native;
+		std::string FirstPath = Folder.GetPath("first.zip");
+		std::string SecondPath = Folder.GetPath("second.xpkg");
+		std::string StorePath = Folder.GetPath("store");
+		TEST_CHECK(WriteTestPackage(FirstPackage, FirstPath) && WriteTestPackage(SecondPackage, SecondPath));
+
+		{
+			PackageManager Manager(Folder.GetPath("registry"));
+			TEST_CHECK(Manager.SetSharedStore(StorePath));
+			TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, FirstPath, "First"), TestPlatform, nullptr) == ReturnCodes::NoError);
+			TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, SecondPath, "Second"), TestPlatform, nullptr) == ReturnCodes::NoError);
+			TEST_CHECK(IsPackageTreeValid(FirstPackage, GetPluginPath(Folder, "First")));
+			TEST_CHECK(IsPackageTreeValid(SecondPackage, GetPluginPath(Folder, "Second")));
+
+			/* Store and both plugins share one file, installing the same package again adds nothing */
+			TEST_CHECK(std::filesystem::hard_link_count(std::filesystem::u8path(GetPluginPath(Folder, "First") + "/bin/plugin.pdb")) == 3);
+			TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, FirstPath, "First"), TestPlatform, nullptr) == ReturnCodes::NoError);
+			TEST_CHECK(IsStoreValid(StorePath, FirstPackage.Files.size() + 2));
+
+			/* Plugins don't depend on each other */
+			TEST_CHECK(Manager.DeletePackage(MakePackageInfo(Folder, FirstPath, "First"), TestPlatform) == ReturnCodes::NoError);
+		}
+
+		TEST_CHECK(IsPackageTreeValid(SecondPackage, GetPluginPath(Folder, "Second")));
+		return true;
+	}
+
+	/* Content without declared digest is found by CRC32 and size, nothing is extracted for second plugin */
+	XPACKAGE_TEST(StoreFindsUndeclaredByIndex)
+	{
+		TestFolder Folder;
+		TestPackage Package = MakePluginPackage(ArchiveFormat::Zip, 1);
+		std::string PackagePath = Folder.GetPath("package.zip");
+		std::string StorePath = Folder.GetPath("store");
+		TEST_CHECK(WriteTestPackage(Package, PackagePath));
+
+		PackageManager Manager("");
+		TEST_CHECK(Manager.SetSharedStore(StorePath));
+		TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, PackagePath, "First"), TestPlatform, nullptr) == ReturnCodes::NoError);
+		TEST_CHECK(IsStoreValid(StorePath, Package.Files.size()));
+
+		std::vector<InstallStats> Stats;
+		Manager.SetInstallStats(true);
+		TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, PackagePath, "Second"), TestPlatform, nullptr) == ReturnCodes::NoError);
+		Manager.GetInstallStats(Stats);
+		TEST_CHECK(Stats.size() == 1 && Stats[0].IsSucceeded);
+		TEST_CHECK(Stats[0].Phases[static_cast<size_t>(InstallPhase::Extract)].BytesWritten == 0);
+		TEST_CHECK(IsPackageTreeValid(Package, GetPluginPath(Folder, "Second")));
+		TEST_CHECK(std::filesystem::hard_link_count(std::filesystem::u8path(GetPluginPath(Folder, "Second") + "/bin/plugin.dll")) == 3);
+
+		/* Index pointing to removed object is ignored */
+		for (auto& StoreItem : std::filesystem::directory_iterator(std::filesystem::u8path(StorePath))) {
+			if (StoreItem.path().filename() != "index") {
+				std::filesystem::remove_all(StoreItem.path());
+			}
+		}
+
+		TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, PackagePath, "Third"), TestPlatform, nullptr) == ReturnCodes::NoError);
+		TEST_CHECK(IsPackageTreeValid(Package, GetPluginPath(Folder, "Third")));
+		return true;
+	}
+
+	/* Batched mode swaps whole folder, so upgrade leaves exactly new tree even without registry */
+	XPACKAGE_TEST(DurabilityLevelsInstallTree)
+	{
+		for (auto Durability : { PackageManager::DurabilityLevel::Batched, PackageManager::DurabilityLevel::Strict }) {
+			TestFolder Folder;
+			TestPackage Package = MakePluginPackage(ArchiveFormat::Zip, 1);
+			TestPackage Upgrade = MakeUpgradePackage(Package);
+			std::string PackagePath = Folder.GetPath("package.zip");
+			std::string UpgradePath = Folder.GetPath("upgrade.zip");
+			std::string PluginPath = GetPluginPath(Folder);
+			TEST_CHECK(WriteTestPackage(Package, PackagePath) && WriteTestPackage(Upgrade, UpgradePath));
+
+			PackageManager Manager("");
+			Manager.SetThreadsCount(4);
+			Manager.SetDurability(Durability);
+			TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, PackagePath), TestPlatform, nullptr) == ReturnCodes::NoError);
+			TEST_CHECK(IsPackageTreeValid(Package, PluginPath));
+			TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, UpgradePath), TestPlatform, nullptr) == ReturnCodes::NoError);
+			TEST_CHECK(!std::filesystem::exists(std::filesystem::u8path(PluginPath + StagingSuffix)));
+
+			std::vector<uint8_t> FileData;
+			for (auto& File : Upgrade.Files) {
+				TEST_CHECK(ReadWholeFile(PluginPath + "/" + File.Name, FileData) && FileData == File.Content);
+			}
+
+			TEST_CHECK(Durability != PackageManager::DurabilityLevel::Batched || IsPackageTreeValid(Upgrade, PluginPath));
+		}
+
+		return true;
+	}
+
+	/* Small files go by kernel batches where it's supported, the rest through pool; result is the same */
+	XPACKAGE_TEST(BatchedWritesInstallTree)
+	{
+		TestPackage Package = MakePluginPackage(ArchiveFormat::Zip, 1);
+		for (uint32_t i = 0; i < 600; i++) {
+			Package.Files.push_back({ "small/f" + std::to_string(i % 7) + "/file" + std::to_string(i) + ".txt", MakeContent(i * 13 % 5000, 200 + i, i % 3 != 0) });
+		}
+
+		for (auto Durability : { PackageManager::DurabilityLevel::None, PackageManager::DurabilityLevel::Batched }) {
+			TestFolder Folder;
+			std::string PackagePath = Folder.GetPath("package.zip");
+			TEST_CHECK(WriteTestPackage(Package, PackagePath));
+
+			PackageManager Manager("");
+			Manager.SetBatchedWrites(true);
+			Manager.SetDurability(Durability);
+			TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, PackagePath), TestPlatform, nullptr) == ReturnCodes::NoError);
+			TEST_CHECK(IsPackageTreeValid(Package, GetPluginPath(Folder)));
+
+			/* Files of existing install are replaced, not appended to */
+			TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, PackagePath), TestPlatform, nullptr) == ReturnCodes::NoError);
+			TEST_CHECK(IsPackageTreeValid(Package, GetPluginPath(Folder)));
+		}
+
+		return true;
+	}
+}
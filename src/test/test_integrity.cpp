@@ -0,0 +1,163 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: CRC32 and SHA-256 checks of extracted entries
+*********************************************************/
+#include "test_common.h"
+
+namespace xpckg
+{
+	using ReturnCodes = PackageManager::ReturnCodes;
+
+	/* Flip one byte in the middle of stored content inside of package file */
+	static bool
+	CorruptStoredContent(const std::string& PackagePath, const std::vector<uint8_t>& Content)
+	{
+		std::vector<uint8_t> PackageData;
+		if (!ReadWholeFile(PackagePath, PackageData)) {
+			return false;
+		}
+
+		auto ContentIt = std::search(PackageData.begin(), PackageData.end(), Content.begin(), Content.end());
+		if (ContentIt == PackageData.end()) {
+			return false;
+		}
+
+		ContentIt[Content.size() / 2] ^= 0x5A;
+		return WriteWholeFile(PackagePath, PackageData);
+	}
+
+	/* Small files and one big enough to be streamed by several chunks */
+	static TestPackage
+	MakeStoredPackage(ArchiveFormat Format)
+	{
+		TestPackage Package;
+		Package.Format = Format;
+		Package.Level = 0;
+		Package.Files.push_back({ "bin/plugin.dll", MakeContent(3 * 1024 * 1024 + 17, 1, false) });
+		Package.Files.push_back({ "presets/default.xml", MakeContent(4096, 2, false) });
+		Package.Files.push_back({ "readme.txt", MakeContent(100, 3, false) });
+		return Package;
+	}
+
+	static std::string
+	MakeDigestManifest(const std::string& EntryName, const std::vector<uint8_t>& Content)
+	{
+		Sha256 Hasher;
+		Sha256Digest Digest = {};
+		Hasher.Update(Content.data(), Content.size());
+		Hasher.Finish(Digest);
+		return ",\"sha256\":{\"" + EntryName + "\":\"" + DigestToHex(Digest) + "\"}";
+	}
+
+	static bool
+	IsCrcMismatchRejected(ArchiveFormat Format, size_t ThreadsCount, size_t CorruptedIndex)
+	{
+		TestFolder Folder;
+		TestPackage Package = MakeStoredPackage(Format);
+		std::string PackagePath = Folder.GetPath("package.zip");
+		TEST_CHECK(WriteTestPackage(Package, PackagePath));
+		TEST_CHECK(CorruptStoredContent(PackagePath, Package.Files[CorruptedIndex].Content));
+
+		PackageManager Manager("");
+		Manager.SetThreadsCount(ThreadsCount);
+		TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, PackagePath), TestPlatform, nullptr) == ReturnCodes::IntegrityCheckFailed);
+		TEST_CHECK(!std::filesystem::exists(GetPluginPath(Folder)));
+		return true;
+	}
+
+	XPACKAGE_TEST(IntegrityWrongCrcFailsInstall)
+	{
+		for (ArchiveFormat Format : { ArchiveFormat::Zip, ArchiveFormat::Native }) {
+			for (size_t ThreadsCount : { 1, 4 }) {
+				for (size_t CorruptedIndex = 0; CorruptedIndex < 3; CorruptedIndex++) {
+					TEST_CHECK(IsCrcMismatchRejected(Format, ThreadsCount, CorruptedIndex));
+				}
+			}
+		}
+
+		return true;
+	}
+
+	XPACKAGE_TEST(IntegrityWrongManifestCrcFailsInstall)
+	{
+		TestFolder Folder;
+		TestPackage Package = MakeStoredPackage(ArchiveFormat::Zip);
+		std::string PackagePath = Folder.GetPath("package.zip");
+		std::string ManifestPart = "\"platforms\":{\"win_x64\":";
+		TEST_CHECK(WriteTestPackage(Package, PackagePath));
+		TEST_CHECK(CorruptStoredContent(PackagePath, std::vector<uint8_t>(ManifestPart.begin(), ManifestPart.end())));
+
+		PackageManager Manager("");
+		TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, PackagePath), TestPlatform, nullptr) == ReturnCodes::IntegrityCheckFailed);
+		return true;
+	}
+
+	/* Content matches CRC of entry, but not digest declared by manifest */
+	static bool
+	IsDigestMismatchRejected(ArchiveFormat Format, bool bSharedStore)
+	{
+		TestFolder Folder;
+		TestPackage Package = MakeStoredPackage(Format);
+		Package.Level = 6;
+		Package.ExtraManifest = MakeDigestManifest("presets/default.xml", MakeContent(4096, 4, false));
+		std::string PackagePath = Folder.GetPath("package.zip");
+		TEST_CHECK(WriteTestPackage(Package, PackagePath));
+
+		PackageManager Manager("");
+		TEST_CHECK(!bSharedStore || Manager.SetSharedStore(Folder.GetPath("store")));
+		TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, PackagePath), TestPlatform, nullptr) == ReturnCodes::IntegrityCheckFailed);
+		TEST_CHECK(!std::filesystem::exists(GetPluginPath(Folder)));
+
+		/* The same package with right digest passes */
+		Package.ExtraManifest = MakeDigestManifest("presets/default.xml", Package.Files[1].Content);
+		TEST_CHECK(WriteTestPackage(Package, PackagePath));
+		TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, PackagePath), TestPlatform, nullptr) == ReturnCodes::NoError);
+		TEST_CHECK(IsPackageTreeValid(Package, GetPluginPath(Folder)));
+		return true;
+	}
+
+	XPACKAGE_TEST(IntegrityWrongSha256FailsInstall)
+	{
+		TEST_CHECK(IsDigestMismatchRejected(ArchiveFormat::Zip, false));
+		TEST_CHECK(IsDigestMismatchRejected(ArchiveFormat::Native, false));
+		return true;
+	}
+
+	XPACKAGE_TEST(IntegrityWrongSha256FailsStoreInstall)
+	{
+		TEST_CHECK(IsDigestMismatchRejected(ArchiveFormat::Zip, true));
+		return true;
+	}
+
+	/* Store hit links object without extraction, object name is its digest, so file still matches manifest */
+	XPACKAGE_TEST(IntegrityStoreHitKeepsDigest)
+	{
+		TestFolder Folder;
+		TestPackage Package = MakeStoredPackage(ArchiveFormat::Zip);
+		Package.DigestNames = { "presets/default.xml" };
+		std::string PackagePath = Folder.GetPath("package.zip");
+		TEST_CHECK(WriteTestPackage(Package, PackagePath));
+
+		PackageManager Manager("");
+		TEST_CHECK(Manager.SetSharedStore(Folder.GetPath("store")));
+		TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, PackagePath, "First"), TestPlatform, nullptr) == ReturnCodes::NoError);
+
+		/* Entry of second package differs from its declared digest, which is digest of stored object */
+		TestPackage OtherPackage = Package;
+		OtherPackage.Files[1].Content = MakeContent(4096, 5, false);
+		OtherPackage.DigestNames.clear();
+		OtherPackage.ExtraManifest = MakeDigestManifest("presets/default.xml", Package.Files[1].Content);
+		std::string OtherPath = Folder.GetPath("other.zip");
+		TEST_CHECK(WriteTestPackage(OtherPackage, OtherPath));
+		TEST_CHECK(Manager.InstallPackage(MakePackageInfo(Folder, OtherPath, "Second"), TestPlatform, nullptr) == ReturnCodes::NoError);
+
+		std::vector<uint8_t> FileData;
+		TEST_CHECK(ReadWholeFile(GetPluginPath(Folder, "Second") + "/presets/default.xml", FileData));
+		TEST_CHECK(FileData == Package.Files[1].Content);
+		TEST_CHECK(IsPackageTreeValid(Package, GetPluginPath(Folder, "First")));
+		return true;
+	}
+}
@@ -0,0 +1,253 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: log and snapshot of registry of installed packages
+*********************************************************/
+#include "test_common.h"
+#include <atomic>
+#include <thread>
+
+namespace xpckg
+{
+	/* Version tells which put of package record comes from */
+	static InstalledPackage
+	MakeRecord(uint64_t Id, uint32_t Revision)
+	{
+		InstalledPackage Package = {};
+		Package.Id = Id;
+		Package.Version = std::to_string(Id) + "." + std::to_string(Revision);
+		Package.Platform = TestPlatform;
+		Package.InstallDirectory = "/plugins/Test/Plugin" + std::to_string(Id);
+		for (uint32_t i = 0; i <= Id % 4; i++) {
+			Package.Files.push_back({ "bin/file" + std::to_string(i) + ".dll", Id * 100 + i, static_cast<uint32_t>(Id ^ Revision ^ i) });
+		}
+
+		return Package;
+	}
+
+	static bool
+	IsRecordEqual(const InstalledPackage& Found, uint64_t Id, uint32_t Revision)
+	{
+		InstalledPackage Expected = MakeRecord(Id, Revision);
+		TEST_CHECK(Found.Id == Id && Found.Version == Expected.Version && Found.Platform == Expected.Platform);
+		TEST_CHECK(Found.InstallDirectory == Expected.InstallDirectory && Found.Files.size() == Expected.Files.size());
+		for (size_t i = 0; i < Found.Files.size(); i++) {
+			TEST_CHECK(Found.Files[i].Path == Expected.Files[i].Path);
+			TEST_CHECK(Found.Files[i].Size == Expected.Files[i].Size && Found.Files[i].Crc32 == Expected.Files[i].Crc32);
+		}
+
+		return true;
+	}
+
+	static bool
+	IsRecordFound(PackageRegistry& Registry, uint64_t Id, uint32_t Revision)
+	{
+		InstalledPackage Found = {};
+		TEST_CHECK(Registry.ContainsPackage(Id) && Registry.FindPackage(Id, Found));
+		return IsRecordEqual(Found, Id, Revision);
+	}
+
+	/* Ids from 1 have given revisions, zero revision means package isn't there */
+	static bool
+	IsRegistryContent(PackageRegistry& Registry, const std::vector<uint32_t>& Revisions)
+	{
+		size_t InstalledCount = 0;
+		for (uint64_t Id = 1; Id < Revisions.size(); Id++) {
+			if (Revisions[Id] == 0) {
+				InstalledPackage Found = {};
+				TEST_CHECK(!Registry.ContainsPackage(Id) && !Registry.FindPackage(Id, Found));
+				continue;
+			}
+
+			TEST_CHECK(IsRecordFound(Registry, Id, Revisions[Id]));
+			InstalledCount++;
+		}
+
+		std::vector<uint64_t> Ids;
+		Registry.GetPackagesIds(Ids);
+		TEST_CHECK(Ids.size() == InstalledCount);
+		return true;
+	}
+
+	static bool
+	IsReopenValid(bool bCompact)
+	{
+		TestFolder Folder;
+		std::string RegistryPath = Folder.GetPath("registry");
+		std::vector<uint32_t> Revisions(21);
+		{
+			PackageRegistry Registry(RegistryPath);
+			for (uint64_t Id = 1; Id < Revisions.size(); Id++) {
+				Revisions[Id] = 1;
+				TEST_CHECK(Registry.PutPackage(MakeRecord(Id, 1)));
+			}
+
+			if (bCompact) {
+				TEST_CHECK(Registry.Compact());
+			}
+		}
+
+		/* Second session updates records of the first one, both ones from log and snapshot */
+		{
+			PackageRegistry Registry(RegistryPath);
+			TEST_CHECK(IsRegistryContent(Registry, Revisions));
+			for (uint64_t Id = 1; Id < Revisions.size(); Id += 3) {
+				Revisions[Id] = 2;
+				TEST_CHECK(Registry.PutPackage(MakeRecord(Id, 2)));
+			}
+
+			TEST_CHECK(IsRegistryContent(Registry, Revisions));
+		}
+
+		PackageRegistry Registry(RegistryPath);
+		TEST_CHECK(IsRegistryContent(Registry, Revisions));
+		TEST_CHECK(Registry.Compact());
+		TEST_CHECK(IsRegistryContent(Registry, Revisions));
+		return true;
+	}
+
+	XPACKAGE_TEST(RegistryReopenKeepsRecords)
+	{
+		TEST_CHECK(IsReopenValid(false));
+		TEST_CHECK(IsReopenValid(true));
+		return true;
+	}
+
+	XPACKAGE_TEST(RegistryRemoveRecords)
+	{
+		TestFolder Folder;
+		std::string RegistryPath = Folder.GetPath("registry");
+		std::vector<uint32_t> Revisions(11, 1);
+		Revisions[0] = 0;
+		{
+			PackageRegistry Registry(RegistryPath);
+			for (uint64_t Id = 1; Id < Revisions.size(); Id++) {
+				TEST_CHECK(Registry.PutPackage(MakeRecord(Id, 1)));
+			}
+
+			/* Removed from snapshot, from log, and removed package which comes back */
+			TEST_CHECK(Registry.Compact());
+			TEST_CHECK(Registry.PutPackage(MakeRecord(20, 1)));
+			TEST_CHECK(Registry.RemovePackage(2) && Registry.RemovePackage(20) && Registry.RemovePackage(5));
+			TEST_CHECK(Registry.PutPackage(MakeRecord(5, 3)));
+			Revisions[2] = 0;
+			Revisions[5] = 3;
+			Revisions.resize(21);
+			TEST_CHECK(IsRegistryContent(Registry, Revisions));
+
+			/* Package which isn't there can be removed too */
+			TEST_CHECK(Registry.RemovePackage(15));
+			TEST_CHECK(IsRegistryContent(Registry, Revisions));
+		}
+
+		PackageRegistry Registry(RegistryPath);
+		TEST_CHECK(IsRegistryContent(Registry, Revisions));
+		TEST_CHECK(Registry.Compact());
+		TEST_CHECK(IsRegistryContent(Registry, Revisions));
+		return true;
+	}
+
+	/* Damaged last record is dropped on open and overwritten by next append */
+	static bool
+	IsDamagedTailIgnored(bool bTorn)
+	{
+		TestFolder Folder;
+		std::string RegistryPath = Folder.GetPath("registry");
+		std::vector<uint32_t> Revisions(4, 1);
+		Revisions[0] = 0;
+		{
+			PackageRegistry Registry(RegistryPath);
+			for (uint64_t Id = 1; Id < Revisions.size(); Id++) {
+				TEST_CHECK(Registry.PutPackage(MakeRecord(Id, 1)));
+			}
+		}
+
+		std::vector<uint8_t> RegistryData;
+		TEST_CHECK(ReadWholeFile(RegistryPath, RegistryData));
+		if (bTorn) {
+			RegistryData.resize(RegistryData.size() - 7);
+		} else {
+			RegistryData[RegistryData.size() - 2] ^= 0x5A;
+		}
+
+		TEST_CHECK(WriteWholeFile(RegistryPath, RegistryData));
+		Revisions[3] = 0;
+		{
+			PackageRegistry Registry(RegistryPath);
+			TEST_CHECK(IsRegistryContent(Registry, Revisions));
+			TEST_CHECK(Registry.PutPackage(MakeRecord(4, 1)));
+			Revisions.push_back(1);
+		}
+
+		PackageRegistry Registry(RegistryPath);
+		TEST_CHECK(IsRegistryContent(Registry, Revisions));
+		return true;
+	}
+
+	XPACKAGE_TEST(RegistryIgnoresDamagedTail)
+	{
+		TEST_CHECK(IsDamagedTailIgnored(true));
+		TEST_CHECK(IsDamagedTailIgnored(false));
+		return true;
+	}
+
+	/* Appends start background compactions, lookups and appends go on meanwhile */
+	XPACKAGE_TEST(RegistryLookupsDuringCompaction)
+	{
+		constexpr size_t WritersCount = 4;
+		constexpr uint32_t RevisionsCount = 40;
+		constexpr uint64_t IdsPerWriter = 16;
+		TestFolder Folder;
+		std::string RegistryPath = Folder.GetPath("registry");
+		std::vector<uint32_t> Revisions(WritersCount * IdsPerWriter + 1, RevisionsCount);
+		Revisions[0] = 0;
+		{
+			PackageRegistry Registry(RegistryPath);
+			std::atomic<bool> IsFailed = { false };
+			std::atomic<size_t> WritersLeft = { WritersCount };
+			std::vector<std::thread> Threads;
+			for (size_t Writer = 0; Writer < WritersCount; Writer++) {
+				Threads.emplace_back([&, Writer]() {
+					for (uint32_t Revision = 1; Revision <= RevisionsCount; Revision++) {
+						for (uint64_t Id = Writer * IdsPerWriter + 1; Id <= (Writer + 1) * IdsPerWriter; Id++) {
+							IsFailed = IsFailed || !Registry.PutPackage(MakeRecord(Id, Revision));
+						}
+					}
+
+					WritersLeft--;
+				});
+			}
+
+			/* Reader sees every package it has seen once, never older revision than before */
+			Threads.emplace_back([&]() {
+				std::vector<uint32_t> SeenRevisions(Revisions.size());
+				while (WritersLeft.load() != 0 && !IsFailed) {
+					for (uint64_t Id = 1; Id < Revisions.size(); Id++) {
+						InstalledPackage Found = {};
+						if (!Registry.FindPackage(Id, Found)) {
+							IsFailed = IsFailed || SeenRevisions[Id] != 0;
+							continue;
+						}
+
+						uint32_t Revision = static_cast<uint32_t>(std::stoul(Found.Version.substr(Found.Version.find('.') + 1)));
+						IsFailed = IsFailed || Revision < SeenRevisions[Id] || !IsRecordEqual(Found, Id, Revision);
+						SeenRevisions[Id] = Revision;
+					}
+				}
+			});
+
+			for (auto& Thread : Threads) {
+				Thread.join();
+			}
+
+			TEST_CHECK(!IsFailed);
+			TEST_CHECK(IsRegistryContent(Registry, Revisions));
+		}
+
+		PackageRegistry Registry(RegistryPath);
+		TEST_CHECK(IsRegistryContent(Registry, Revisions));
+		return true;
+	}
+}
@@ -0,0 +1,1294 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: POSIX implementation of package manager
+*********************************************************/
+#include "xpackage_internal.h"
+#include "xpackage_uring_unix.h"
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/sendfile.h>
+#endif
+
+namespace xpckg
+{
+	static inline int
+	HandleToDescriptor(RawHandle Handle)
+	{
+		return static_cast<int>(reinterpret_cast<intptr_t>(Handle));
+	}
+
+	static inline RawHandle
+	DescriptorToHandle(int Descriptor)
+	{
+		return reinterpret_cast<RawHandle>(static_cast<intptr_t>(Descriptor));
+	}
+
+	/* Owner of directory descriptor, closes it on scope exit */
+	struct DirectoryDescriptor
+	{
+		int Descriptor = -1;
+
+		DirectoryDescriptor() = default;
+		explicit DirectoryDescriptor(int NewDescriptor) : Descriptor(NewDescriptor) {}
+		DirectoryDescriptor(const DirectoryDescriptor&) = delete;
+		DirectoryDescriptor& operator=(const DirectoryDescriptor&) = delete;
+
+		~DirectoryDescriptor()
+		{
+			Reset(-1);
+		}
+
+		void Reset(int NewDescriptor)
+		{
+			if (Descriptor >= 0) {
+				close(Descriptor);
+			}
+
+			Descriptor = NewDescriptor;
+		}
+
+		bool IsValid() const
+		{
+			return Descriptor >= 0;
+		}
+	};
+
+	/*
+		Open directory by path relative to base descriptor. Every path component is opened
+		with "openat()" relative to parent one, so we never build absolute path strings and
+		never limited by fixed-size path buffers. With "bCreate" missing components are created.
+	*/
+	static int
+	OpenDirectoryAt(int BaseDescriptor, const std::string& Path, bool bCreate)
+	{
+		size_t Offset = 0;
+		int CurrentDescriptor = -1;
+		if (!Path.empty() && Path[0] == '/') {
+			CurrentDescriptor = open("/", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			Offset = 1;
+		} else {
+			CurrentDescriptor = openat(BaseDescriptor, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		}
+
+		while (CurrentDescriptor >= 0 && Offset < Path.size()) {
+			size_t NextOffset = Path.find('/', Offset);
+			if (NextOffset == std::string::npos) {
+				NextOffset = Path.size();
+			}
+
+			std::string Component = Path.substr(Offset, NextOffset - Offset);
+			Offset = NextOffset + 1;
+			if (Component.empty() || Component == ".") {
+				continue;
+			}
+
+			CountSystemCalls(bCreate ? 3 : 2);
+
+			if (bCreate && mkdirat(CurrentDescriptor, Component.c_str(), 0755) != 0 && errno != EEXIST) {
+				int SavedError = errno;
+				close(CurrentDescriptor);
+				errno = SavedError;
+				return -1;
+			}
+
+			int NextDescriptor = openat(CurrentDescriptor, Component.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			int SavedError = errno;
+			close(CurrentDescriptor);
+			errno = SavedError;
+			CurrentDescriptor = NextDescriptor;
+		}
+
+		return CurrentDescriptor;
+	}
+
+	bool
+	DirectoryTree::CreateFolder(TreeNode& Node, bool bKeepHandle)
+	{
+		/* Without parent handle folder is addressed by full path from root */
+		RawHandle ParentHandle = Nodes[Node.Parent].Handle;
+		std::string FolderName(ParentHandle != nullptr ? Node.Path.substr(Node.Path.find_last_of('/') + 1) : Node.Path);
+		int ParentDescriptor = HandleToDescriptor(ParentHandle != nullptr ? ParentHandle : RootHandle);
+		if (FolderName.empty()) {
+			FolderName = ".";
+		}
+
+		/* EEXIST means folder is already there, file with the same name fails on open below */
+		CountSystemCalls(bKeepHandle ? 2 : 3);
+		if (FolderName != "." && mkdirat(ParentDescriptor, FolderName.c_str(), 0755) != 0 && errno != EEXIST) {
+			return false;
+		}
+
+		int Descriptor = openat(ParentDescriptor, FolderName.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (Descriptor < 0) {
+			return false;
+		}
+
+		if (bKeepHandle) {
+			Node.Handle = DescriptorToHandle(Descriptor);
+		} else {
+			close(Descriptor);
+		}
+
+		return true;
+	}
+
+	void
+	DirectoryTree::CloseFolder(TreeNode& Node)
+	{
+		if (Node.Handle != nullptr) {
+			CountSystemCalls(1);
+			close(HandleToDescriptor(Node.Handle));
+			Node.Handle = nullptr;
+		}
+	}
+
+	bool
+	DirectoryTree::FlushTree()
+	{
+		CountSystemCalls(1);
+		bool IsFlushed = fsync(HandleToDescriptor(RootHandle)) == 0;
+		for (size_t i = 1; i < Nodes.size(); i++) {
+			CountSystemCalls(Nodes[i].Handle != nullptr ? 1 : 3);
+			if (Nodes[i].Handle != nullptr) {
+				IsFlushed &= fsync(HandleToDescriptor(Nodes[i].Handle)) == 0;
+				continue;
+			}
+
+			DirectoryDescriptor Folder(openat(HandleToDescriptor(RootHandle), std::string(Nodes[i].Path).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+			IsFlushed &= Folder.IsValid() && fsync(Folder.Descriptor) == 0;
+		}
+
+		return IsFlushed;
+	}
+
+	/* Recursive removing of file, symlink or directory relative to parent descriptor, items removed meanwhile by others are fine */
+	static bool
+	RemoveTreeAt(int ParentDescriptor, const char* Name)
+	{
+		struct stat FileStat = {};
+		CountSystemCalls(1);
+		if (fstatat(ParentDescriptor, Name, &FileStat, AT_SYMLINK_NOFOLLOW) != 0) {
+			return errno == ENOENT;
+		}
+
+		CountSystemCalls(1);
+		if (!S_ISDIR(FileStat.st_mode)) {
+			return unlinkat(ParentDescriptor, Name, 0) == 0 || errno == ENOENT;
+		}
+
+		int DirDescriptor = openat(ParentDescriptor, Name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if (DirDescriptor < 0) {
+			return errno == ENOENT;
+		}
+
+		/* "fdopendir()" takes ownership of descriptor */
+		DIR* DirStream = fdopendir(DirDescriptor);
+		if (DirStream == nullptr) {
+			close(DirDescriptor);
+			return false;
+		}
+
+		bool IsRemoved = true;
+		while (struct dirent* DirEntry = readdir(DirStream)) {
+			if (!strcmp(DirEntry->d_name, ".") || !strcmp(DirEntry->d_name, "..")) {
+				continue;
+			}
+
+			IsRemoved &= RemoveTreeAt(dirfd(DirStream), DirEntry->d_name);
+		}
+
+		closedir(DirStream);
+		return IsRemoved && (unlinkat(ParentDescriptor, Name, AT_REMOVEDIR) == 0 || errno == ENOENT);
+	}
+
+	void ConvertToNativeStyle(std::string& CurrentString)
+	{
+		for (auto& StringElem : CurrentString) {
+			if (StringElem == '\\') {
+				StringElem = '/';
+			}
+		}
+	}
+
+	bool
+	FileHandle::IsInvalid()
+	{
+		return HandleToDescriptor(CurrentHandle) < 0;
+	}
+
+	FileHandle::FileHandle(std::string PathToFile, bool bNewFile)
+		: FileHandle(DescriptorToHandle(AT_FDCWD), PathToFile, bNewFile)
+	{
+	}
+
+	FileHandle::FileHandle(RawHandle BaseDirectory, std::string PathToFile, bool bNewFile)
+	{
+		int BaseDescriptor = HandleToDescriptor(BaseDirectory);
+		int OpenFlags = O_CLOEXEC | (bNewFile ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDWR);
+
+		CountSystemCalls(2);
+		int Descriptor = openat(BaseDescriptor, PathToFile.c_str(), OpenFlags, 0644);
+		if (Descriptor < 0 && !bNewFile && (errno == EACCES || errno == EROFS || errno == EPERM)) {
+			/* Packages can be placed on read-only media, so read access is enough for them */
+			CountSystemCalls(1);
+			Descriptor = openat(BaseDescriptor, PathToFile.c_str(), O_RDONLY | O_CLOEXEC);
+		}
+
+		CurrentHandle = DescriptorToHandle(Descriptor);
+		if (IsInvalid()) {
+			throw std::exception();
+		}
+
+		struct stat FileStat = {};
+		if (fstat(Descriptor, &FileStat) != 0) {
+			int SavedError = errno;
+			close(Descriptor);
+			errno = SavedError;
+			throw std::exception();
+		}
+
+		FileName = PathToFile;
+		FileSize = static_cast<size_t>(FileStat.st_size);
+	}
+
+	FileHandle::~FileHandle()
+	{
+		UnmapFile();
+		if (!IsInvalid()) {
+			CountSystemCalls(1);
+			close(HandleToDescriptor(CurrentHandle));
+		}
+	}
+
+	std::string
+	FileHandle::GetFileName()
+	{
+		return SplitName(FileName);
+	}
+
+	std::string
+	FileHandle::GetFileExtension()
+	{
+		return SplitExtension(FileName);
+	}
+
+	xpckg::RawHandle
+	FileHandle::GetRawPointer()
+	{
+		return CurrentHandle;
+	}
+
+	size_t
+	FileHandle::GetFileSize()
+	{
+		return FileSize;
+	}
+
+	size_t
+	FileHandle::ReadFromFile(std::shared_ptr<std::vector<uint8_t>> OutMemory, size_t SizeToRead)
+	{
+		if (OutMemory->size() < SizeToRead) {
+			OutMemory->resize(SizeToRead);
+		}
+
+		return ReadFromFile(OutMemory->data(), SizeToRead);
+	}
+
+	size_t
+	FileHandle::ReadFromFile(void* OutMemory, size_t SizeToRead)
+	{
+		size_t readedSize = ReadFromFile(OutMemory, SizeToRead, FileSeek);
+		if (readedSize != static_cast<size_t>(-1)) {
+			FileSeek += readedSize;
+		}
+
+		return readedSize;
+	}
+
+	size_t
+	FileHandle::WriteToFile(std::shared_ptr<std::vector<uint8_t>> InMemory)
+	{
+		return WriteToFile(InMemory->data(), InMemory->size());
+	}
+
+	size_t
+	FileHandle::WriteToFile(void* InMemory, size_t SizeToWrite)
+	{
+		size_t writedSize = WriteToFile(InMemory, SizeToWrite, FileSeek);
+		if (writedSize != static_cast<size_t>(-1)) {
+			FileSeek += writedSize;
+		}
+
+		return writedSize;
+	}
+
+	size_t
+	FileHandle::ReadFromFile(void* OutMemory, size_t SizeToRead, size_t FilePosition)
+	{
+		int Descriptor = HandleToDescriptor(CurrentHandle);
+		uint8_t* OutBytes = static_cast<uint8_t*>(OutMemory);
+		size_t readedSize = 0;
+
+		/* "pread()" can return less than requested, so loop until EOF or full buffer */
+		while (readedSize < SizeToRead) {
+			CountSystemCalls(1);
+			ssize_t ReturnSize = pread(Descriptor, OutBytes + readedSize, SizeToRead - readedSize, FilePosition + readedSize);
+			if (ReturnSize < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+
+				return -1;
+			}
+
+			if (ReturnSize == 0) {
+				break;
+			}
+
+			readedSize += static_cast<size_t>(ReturnSize);
+		}
+
+		CountBytesRead(readedSize);
+		return readedSize;
+	}
+
+	size_t
+	FileHandle::WriteToFile(const void* InMemory, size_t SizeToWrite, size_t FilePosition)
+	{
+		int Descriptor = HandleToDescriptor(CurrentHandle);
+		const uint8_t* InBytes = static_cast<const uint8_t*>(InMemory);
+		size_t writedSize = 0;
+
+		TraceTimer WriteTimer(&TraceCounters::WriteTime);
+		while (writedSize < SizeToWrite) {
+			CountSystemCalls(1);
+			ssize_t ReturnSize = pwrite(Descriptor, InBytes + writedSize, SizeToWrite - writedSize, FilePosition + writedSize);
+			if (ReturnSize < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+
+				return -1;
+			}
+
+			writedSize += static_cast<size_t>(ReturnSize);
+		}
+
+		if (FilePosition + writedSize > FileSize) {
+			FileSize = FilePosition + writedSize;
+		}
+
+		CountBytesWritten(writedSize);
+		return writedSize;
+	}
+
+	size_t
+	FileHandle::CopyFromFile(FileHandle& SourceFile, size_t SourcePosition, size_t SizeToCopy, size_t FilePosition)
+	{
+		size_t CopiedSize = 0;
+#ifdef __linux__
+		int SourceDescriptor = HandleToDescriptor(SourceFile.GetRawPointer());
+		int TargetDescriptor = HandleToDescriptor(CurrentHandle);
+
+		/*
+			"copy_file_range()" never leaves kernel and can even share extents or offload copy
+			to server, but it fails across filesystems on older kernels. Then "sendfile()"
+			still copies through page cache only, it writes at current offset of target.
+		*/
+		TraceTimer WriteTimer(&TraceCounters::WriteTime);
+		bool IsRangeCopy = true;
+		bool IsSendFile = lseek(TargetDescriptor, static_cast<off_t>(FilePosition), SEEK_SET) >= 0;
+		CountSystemCalls(1);
+		while (CopiedSize < SizeToCopy && (IsRangeCopy || IsSendFile)) {
+			CountSystemCalls(1);
+			off_t SourceOffset = static_cast<off_t>(SourcePosition + CopiedSize);
+			off_t TargetOffset = static_cast<off_t>(FilePosition + CopiedSize);
+			ssize_t ReturnSize = -1;
+			if (IsRangeCopy) {
+				ReturnSize = copy_file_range(SourceDescriptor, &SourceOffset, TargetDescriptor, &TargetOffset, SizeToCopy - CopiedSize, 0);
+				if (ReturnSize < 0 && errno != EINTR) {
+					IsRangeCopy = false;
+					IsSendFile = IsSendFile && lseek(TargetDescriptor, static_cast<off_t>(FilePosition + CopiedSize), SEEK_SET) >= 0;
+					continue;
+				}
+			} else {
+				ReturnSize = sendfile(TargetDescriptor, SourceDescriptor, &SourceOffset, SizeToCopy - CopiedSize);
+				if (ReturnSize < 0 && errno != EINTR) {
+					IsSendFile = false;
+					continue;
+				}
+			}
+
+			if (ReturnSize == 0) {
+				break;
+			}
+
+			if (ReturnSize > 0) {
+				CopiedSize += static_cast<size_t>(ReturnSize);
+			}
+		}
+
+		if (FilePosition + CopiedSize > FileSize) {
+			FileSize = FilePosition + CopiedSize;
+		}
+
+		CountBytesWritten(CopiedSize);
+		if (CopiedSize == SizeToCopy || IsRangeCopy || IsSendFile) {
+			return CopiedSize;
+		}
+#endif
+		size_t RestSize = CopyFileData(SourceFile, SourcePosition + CopiedSize, *this, FilePosition + CopiedSize, SizeToCopy - CopiedSize);
+		return RestSize == static_cast<size_t>(-1) ? RestSize : CopiedSize + RestSize;
+	}
+
+	bool
+	FileHandle::FlushFile()
+	{
+		/* "fdatasync()" skips timestamps, but still writes size which is needed to read data back */
+		CountSystemCalls(1);
+#ifdef __linux__
+		return fdatasync(HandleToDescriptor(CurrentHandle)) == 0;
+#else
+		return fsync(HandleToDescriptor(CurrentHandle)) == 0;
+#endif
+	}
+
+	bool
+	FileHandle::AllocateFile(size_t SizeToAllocate)
+	{
+#ifdef __linux__
+		/* Keep size, so reader of half-written file never sees zero tail as data */
+		CountSystemCalls(1);
+		return fallocate(HandleToDescriptor(CurrentHandle), FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(SizeToAllocate)) == 0;
+#else
+		return false;
+#endif
+	}
+
+	const uint8_t*
+	FileHandle::MapFile()
+	{
+		if (MappedMemory != nullptr || FileSize == 0) {
+			return MappedMemory;
+		}
+
+		CountSystemCalls(1);
+		void* MappedPointer = mmap(nullptr, FileSize, PROT_READ, MAP_SHARED, HandleToDescriptor(CurrentHandle), 0);
+		if (MappedPointer == MAP_FAILED) {
+			return nullptr;
+		}
+
+		MappedMemory = static_cast<const uint8_t*>(MappedPointer);
+		MappedSize = FileSize;
+		return MappedMemory;
+	}
+
+	void
+	FileHandle::UnmapFile()
+	{
+		if (MappedMemory != nullptr) {
+			CountSystemCalls(1);
+			munmap(const_cast<uint8_t*>(MappedMemory), MappedSize);
+			MappedMemory = nullptr;
+			MappedSize = 0;
+		}
+	}
+
+	bool
+	FileHandle::SeekFile(size_t FilePosition)
+	{
+		FileSeek = FilePosition;
+		return true;
+	}
+
+	bool
+	ContentStore::SealObject(const std::string& TempPath)
+	{
+		/* Installed files are hardlinks of object, write through any of them would change all others */
+		CountSystemCalls(1);
+		return chmod(TempPath.c_str(), S_IRUSR | S_IRGRP | S_IROTH) == 0;
+	}
+
+	bool
+	ContentStore::MaterializeObject(const std::string& ObjectPath, RawHandle BaseDirectory, const std::string& TargetPath)
+	{
+		int BaseDescriptor = HandleToDescriptor(BaseDirectory);
+
+		/* Hardlink costs one metadata update, but works only inside one filesystem */
+		if (linkat(AT_FDCWD, ObjectPath.c_str(), BaseDescriptor, TargetPath.c_str(), 0) == 0) {
+			return true;
+		}
+
+		try {
+			FileHandle SourceFile(ObjectPath, false);
+			FileHandle TargetFile(BaseDirectory, TargetPath, true);
+#ifdef FICLONE
+			/* Copy-on-write filesystems can share extents between files on different mounts of volume */
+			if (ioctl(HandleToDescriptor(TargetFile.GetRawPointer()), FICLONE, HandleToDescriptor(SourceFile.GetRawPointer())) == 0) {
+				return true;
+			}
+#endif
+			size_t ObjectSize = SourceFile.GetFileSize();
+			return TargetFile.CopyFromFile(SourceFile, 0, ObjectSize, 0) == ObjectSize;
+		}
+		catch (...) {
+			return false;
+		}
+	}
+
+	bool
+	PackageManager::IsElevatedProcess()
+	{
+		return geteuid() == 0;
+	}
+
+	/* Flush everything written to filesystem of descriptor, one call instead of flush per file */
+	static bool
+	SyncFileSystem(int Descriptor)
+	{
+		CountSystemCalls(1);
+#ifdef __linux__
+		return syncfs(Descriptor) == 0;
+#else
+		sync();
+		return true;
+#endif
+	}
+
+	/* Swap two folders of the same parent, atomically where kernel allows it */
+	static bool
+	ExchangeFolders(int ParentDescriptor, const std::string& FirstName, const std::string& SecondName)
+	{
+		CountSystemCalls(1);
+#if defined(__linux__) && defined(SYS_renameat2)
+		if (syscall(SYS_renameat2, ParentDescriptor, FirstName.c_str(), ParentDescriptor, SecondName.c_str(), RENAME_EXCHANGE) == 0) {
+			return true;
+		}
+#endif
+		/* Without exchange there is short moment when second folder doesn't exist */
+		std::string TempName = SecondName + ".old";
+		RemoveTreeAt(ParentDescriptor, TempName.c_str());
+		if (renameat(ParentDescriptor, SecondName.c_str(), ParentDescriptor, TempName.c_str()) != 0) {
+			return false;
+		}
+
+		if (renameat(ParentDescriptor, FirstName.c_str(), ParentDescriptor, SecondName.c_str()) != 0) {
+			renameat(ParentDescriptor, TempName.c_str(), ParentDescriptor, SecondName.c_str());
+			return false;
+		}
+
+		return renameat(ParentDescriptor, TempName.c_str(), ParentDescriptor, FirstName.c_str()) == 0;
+	}
+
+	PackageManager::ReturnCodes
+	PackageManager::CheckInstallRights()
+	{
+		/*
+			Unlike Windows we don't require root for every install: per-user prefixes are
+			common there. Only access errors are reported as request to promote.
+		*/
+		return ReturnCodes::NoError;
+	}
+
+	PackageManager::ReturnCodes
+	PackageManager::AccessErrorCode(ReturnCodes DefaultCode)
+	{
+		if ((errno == EACCES || errno == EPERM) && !IsElevatedProcess()) {
+			return ReturnCodes::PromoteToAdmin;
+		}
+
+		return DefaultCode;
+	}
+
+	/* Symlink target must be absolute, otherwise it resolves relative to symlink folder */
+	static bool
+	GetFullPluginDir(const PackageInfo& PathToPackage, std::string& OutPath)
+	{
+		OutPath = PathToPackage.InstallDirectory + "/" + PathToPackage.CompanyName + "/" + PathToPackage.PluginName;
+		if (OutPath[0] != '/') {
+			/* Current directory can be longer than PATH_MAX, filesystem library grows its buffer as needed */
+			std::error_code PathError;
+			std::filesystem::path CurrentDirectory = std::filesystem::current_path(PathError);
+			if (PathError) {
+				return false;
+			}
+
+			OutPath = CurrentDirectory.string() + "/" + OutPath;
+		}
+
+		return true;
+	}
+
+#ifdef XPACKAGE_IO_URING
+	constexpr uint64_t BatchedFileSize = 64 * 1024;
+	constexpr size_t BatchedFilesCount = 256;
+
+	/*
+		Write small entries in batches through io_uring. Batch N+1 is inflated to memory while
+		kernel writes batch N. Everything not written this way (big entries, failed batches,
+		missing io_uring) is returned in "OutRestEntries" for regular extraction.
+	*/
+	static void
+	WriteEntriesBatched(Archive& SourceArchive, DirectoryTree& PluginFolders, const EntriesList& Entries, EntriesList& OutRestEntries)
+	{
+		EntriesList SmallEntries;
+		for (auto& Entry : Entries) {
+			if (Entry.first->UncompressedSize <= BatchedFileSize && !(Entry.first->Flags & 0x1)) {
+				SmallEntries.push_back(Entry);
+			} else {
+				OutRestEntries.push_back(Entry);
+			}
+		}
+
+		/* Ring setup isn't free, few small files are faster through the pool */
+		if (SmallEntries.size() < BatchedFilesCount / 4) {
+			OutRestEntries.insert(OutRestEntries.end(), SmallEntries.begin(), SmallEntries.end());
+			return;
+		}
+
+		std::unique_ptr<UringWriter> Writer;
+		try {
+			Writer = std::make_unique<UringWriter>(static_cast<unsigned>(BatchedFilesCount));
+		}
+		catch (...) {
+			OutRestEntries.insert(OutRestEntries.end(), SmallEntries.begin(), SmallEntries.end());
+			return;
+		}
+
+		struct WriteBatch
+		{
+			std::vector<std::vector<uint8_t>> Data;
+			std::vector<size_t> Entries;
+		};
+
+		WriteBatch Batches[2];
+		Batches[0].Data.resize(BatchedFilesCount);
+		Batches[1].Data.resize(BatchedFilesCount);
+
+		/*
+			Buffers of batch are in use by kernel until this wait. Files of failed batch go to
+			regular extraction, and so do all the next ones: writer isn't reused after failure.
+		*/
+		bool IsWriterBroken = false;
+		auto WaitForBatch = [&Writer, &SmallEntries, &OutRestEntries, &IsWriterBroken](WriteBatch& Batch) {
+			bool IsWritten = Writer->Wait();
+			IsWriterBroken = IsWriterBroken || !IsWritten;
+			for (size_t BatchIndex : Batch.Entries) {
+				if (IsWritten) {
+					AddInstallProgress(SmallEntries[BatchIndex].first->UncompressedSize);
+				} else {
+					OutRestEntries.push_back(SmallEntries[BatchIndex]);
+				}
+			}
+		};
+
+		bool IsInFlight = false;
+		size_t CurrentBatch = 0;
+		size_t EntryIndex = 0;
+		while (EntryIndex < SmallEntries.size() && !IsWriterBroken && !IsInstallCancelled()) {
+			WriteBatch& Batch = Batches[CurrentBatch];
+			Batch.Entries.clear();
+			for (; EntryIndex < SmallEntries.size() && Batch.Entries.size() < BatchedFilesCount; EntryIndex++) {
+				if (!SourceArchive.ExtractEntryToMemory(*SmallEntries[EntryIndex].first, Batch.Data[Batch.Entries.size()])) {
+					OutRestEntries.push_back(SmallEntries[EntryIndex]);
+					continue;
+				}
+
+				Batch.Entries.push_back(EntryIndex);
+			}
+
+			if (IsInFlight) {
+				WaitForBatch(Batches[CurrentBatch ^ 1]);
+			}
+
+			IsInFlight = false;
+			if (IsWriterBroken) {
+				for (size_t BatchIndex : Batch.Entries) {
+					OutRestEntries.push_back(SmallEntries[BatchIndex]);
+				}
+
+				break;
+			}
+
+			/* Batch keeps only files which were queued, buffers stay at their places */
+			size_t QueuedCount = 0;
+			for (size_t i = 0; i < Batch.Entries.size(); i++) {
+				/* Names are tails of entry paths, so they stay alive and zero-terminated */
+				std::string_view EntryName;
+				RawHandle FolderHandle = PluginFolders.GetEntryFolder(SmallEntries[Batch.Entries[i]].second, EntryName);
+				if (!Writer->AddFile(HandleToDescriptor(FolderHandle), EntryName.data(), Batch.Data[i].data(), Batch.Data[i].size())) {
+					OutRestEntries.push_back(SmallEntries[Batch.Entries[i]]);
+					continue;
+				}
+
+				Batch.Entries[QueuedCount++] = Batch.Entries[i];
+			}
+
+			Batch.Entries.resize(QueuedCount);
+			IsWriterBroken = !Writer->Submit();
+			IsInFlight = true;
+			CurrentBatch ^= 1;
+		}
+
+		if (IsInFlight) {
+			WaitForBatch(Batches[CurrentBatch ^ 1]);
+		}
+
+		for (; EntryIndex < SmallEntries.size(); EntryIndex++) {
+			OutRestEntries.push_back(SmallEntries[EntryIndex]);
+		}
+	}
+#endif
+
+	PackageManager::ReturnCodes
+	PackageManager::ExtractPackage(InstallTask& Task)
+	{
+		PhaseScope FoldersPhase(Task.Stats.get(), InstallPhase::Folders);
+		PackageInfo& PathToPackage = Task.PathToPackage;
+		ConvertToNativeStyle(PathToPackage.InstallDirectory);
+		ConvertToNativeStyle(PathToPackage.SymlinkDirectory);
+
+		/* Open (and create if needed) install and company folders */
+		DirectoryDescriptor CompanyDir;
+		{
+			DirectoryDescriptor InstallDir(OpenDirectoryAt(AT_FDCWD, PathToPackage.InstallDirectory, true));
+			if (!InstallDir.IsValid()) {
+				return AccessErrorCode(ReturnCodes::IoFailed);
+			}
+
+			CompanyDir.Reset(OpenDirectoryAt(InstallDir.Descriptor, PathToPackage.CompanyName, true));
+			if (!CompanyDir.IsValid()) {
+				return AccessErrorCode(ReturnCodes::IoFailed);
+			}
+		}
+
+		/* If plugin path is a file or dangling symlink - delete it, we need folder here */
+		const char* PluginName = PathToPackage.PluginName.c_str();
+		struct stat PluginStat = {};
+		bool IsPluginFound = fstatat(CompanyDir.Descriptor, PluginName, &PluginStat, AT_SYMLINK_NOFOLLOW) == 0;
+		if (IsPluginFound && !S_ISDIR(PluginStat.st_mode)) {
+			if (!RemoveTreeAt(CompanyDir.Descriptor, PluginName)) {
+				return AccessErrorCode(ReturnCodes::IoFailed);
+			}
+		}
+
+		Task.IsNewPluginDir = !IsPluginFound || !S_ISDIR(PluginStat.st_mode);
+		Task.IsOldVersionStaged = false;
+
+		DirectoryDescriptor PluginDir(OpenDirectoryAt(CompanyDir.Descriptor, PathToPackage.PluginName, true));
+		if (!PluginDir.IsValid()) {
+			return AccessErrorCode(ReturnCodes::IoFailed);
+		}
+
+		if (!GetFullPluginDir(PathToPackage, Task.FullPluginDir)) {
+			if (Task.IsNewPluginDir) {
+				unlinkat(CompanyDir.Descriptor, PluginName, AT_REMOVEDIR);
+			}
+
+			return ReturnCodes::OtherError;
+		}
+
+		/* On upgrade only changed entries are written, files dropped by new version are removed */
+		EntriesList ChangedEntries;
+		auto IsFileUnchanged = [&PluginDir](const InstalledFile& File) -> bool {
+			struct stat FileStat = {};
+			CountSystemCalls(1);
+			return fstatat(PluginDir.Descriptor, File.Path.c_str(), &FileStat, AT_SYMLINK_NOFOLLOW) == 0 &&
+				S_ISREG(FileStat.st_mode) && static_cast<uint64_t>(FileStat.st_size) == File.Size;
+		};
+
+		bool IsIncremental = GetChangedEntries(Task, IsFileUnchanged, ChangedEntries, Task.ObsoleteFiles);
+
+		/*
+			Fresh install with batched durability is assembled in staging folder next to plugin one.
+			It's flushed once and swapped with plugin folder, so crash leaves either old or new
+			version. Old version stays under staging name till package is linked, so failed
+			install doesn't damage it at all.
+			Other upgrades write files under pending names next to old ones, and rename them over
+			old ones when all are written (and flushed, if durability asks for it). So failed or
+			cancelled install leaves old version with its record, and crash after flush leaves
+			every file either old or new.
+		*/
+		bool IsStaged = Durability == DurabilityLevel::Batched && !IsIncremental;
+		bool IsPending = !IsStaged && !Task.IsNewPluginDir;
+		bool IsPendingMoved = false;
+		std::string StagingName = PathToPackage.PluginName + StagingSuffix;
+		DirectoryDescriptor StagingDir;
+		if (IsStaged) {
+			RemoveTreeAt(CompanyDir.Descriptor, StagingName.c_str());
+			StagingDir.Reset(OpenDirectoryAt(CompanyDir.Descriptor, StagingName, true));
+			if (!StagingDir.IsValid()) {
+				return AccessErrorCode(ReturnCodes::IoFailed);
+			}
+		}
+
+		const EntriesList* EntriesToWrite = IsIncremental ? &ChangedEntries : &Task.BinariesList;
+		EntriesList PendingEntries;
+		if (IsPending) {
+			PendingEntries.reserve(EntriesToWrite->size());
+			for (auto& [Entry, EntryPath] : *EntriesToWrite) {
+				PendingEntries.emplace_back(Entry, EntryPath + PendingSuffix);
+			}
+		}
+
+		/* Only what this install created is removed, see "InstallTask" */
+		auto RemoveTarget = [this, &Task, &CompanyDir, &PluginDir, &StagingName, &PendingEntries, &IsPendingMoved, PluginName, IsStaged]() {
+			if (IsStaged) {
+				RemoveTreeAt(CompanyDir.Descriptor, StagingName.c_str());
+			}
+
+			CountSystemCalls(PendingEntries.size());
+			for (auto& [Entry, PendingPath] : PendingEntries) {
+				unlinkat(PluginDir.Descriptor, PendingPath.c_str(), 0);
+			}
+
+			if (Task.IsNewPluginDir) {
+				RemoveTreeAt(CompanyDir.Descriptor, PluginName);
+			} else if (!IsStaged && (PendingEntries.empty() || IsPendingMoved)) {
+				ForgetInstalledPackage(Task.FullPluginDir);
+			}
+		};
+
+		/* Pending files replace old ones in place, the first rename makes folder differ from old record */
+		auto MovePendingFiles = [&PluginDir, EntriesToWrite, &PendingEntries, &IsPendingMoved]() -> bool {
+			IsPendingMoved = true;
+			CountSystemCalls(PendingEntries.size());
+			for (size_t i = 0; i < PendingEntries.size(); i++) {
+				if (renameat(PluginDir.Descriptor, PendingEntries[i].second.c_str(), PluginDir.Descriptor, (*EntriesToWrite)[i].second.c_str()) != 0) {
+					return false;
+				}
+			}
+
+			return true;
+		};
+
+		/* All folders of package are created up front, workers only open files in them */
+		int TargetDescriptor = IsStaged ? StagingDir.Descriptor : PluginDir.Descriptor;
+		const EntriesList* EntriesToExtract = IsPending ? &PendingEntries : EntriesToWrite;
+		DirectoryTree PluginFolders(DescriptorToHandle(TargetDescriptor), Task.FullPluginDir);
+		PluginFolders.AddEntries(*EntriesToExtract);
+		BeginInstallProgress(*EntriesToExtract);
+		if (!PluginFolders.CreateTree()) {
+			ReturnCodes ReturnValue = AccessErrorCode(ReturnCodes::IoFailed);
+			RemoveTarget();
+			return ReturnValue;
+		}
+
+		FoldersPhase.AddEntries(PluginFolders.GetFoldersCount());
+		FoldersPhase.Stop();
+		PhaseScope ExtractPhase(Task.Stats.get(), InstallPhase::Extract);
+		ExtractPhase.AddEntries(EntriesToExtract->size());
+
+		/* Try to create and stream binaries data to files on install directory, in parallel if allowed */
+		std::atomic<bool> IsAccessDenied = { false };
+		std::atomic<bool> IsFlushFailed = { false };
+		auto PrepareTarget = [&PluginFolders, &IsAccessDenied](const std::string& EntryPath) -> bool {
+			/* Old file can be hardlink to shared store object, so it's replaced instead of truncated */
+			std::string_view EntryName;
+			int FolderDescriptor = HandleToDescriptor(PluginFolders.GetEntryFolder(EntryPath, EntryName));
+			CountSystemCalls(1);
+			if (unlinkat(FolderDescriptor, EntryName.data(), 0) != 0 && errno != ENOENT) {
+				IsAccessDenied = IsAccessDenied || errno == EACCES || errno == EPERM;
+				return false;
+			}
+
+			return true;
+		};
+
+		bool IsStrict = Durability == DurabilityLevel::Strict;
+		auto OpenTarget = [&PluginFolders, &IsAccessDenied, &IsFlushFailed, &PrepareTarget, IsStrict](const ArchiveEntry&, const std::string& EntryPath) -> FilePointer {
+			if (!PrepareTarget(EntryPath)) {
+				return nullptr;
+			}
+
+			try {
+				std::string_view EntryName;
+				RawHandle FolderHandle = PluginFolders.GetEntryFolder(EntryPath, EntryName);
+				FilePointer TargetFile = std::make_shared<FileHandle>(FolderHandle, std::string(EntryName), true);
+				return IsStrict ? FlushOnClose(std::move(TargetFile), IsFlushFailed) : TargetFile;
+			}
+			catch (...) {
+				IsAccessDenied = IsAccessDenied || errno == EACCES || errno == EPERM;
+				return nullptr;
+			}
+		};
+
+		ArchivePointer SourceArchive = Task.PackageToInstall->GetArchive();
+#ifdef XPACKAGE_IO_URING
+		/* Store links files instead of writing them, strict mode flushes every file, so batches don't fit both */
+		EntriesList RestEntries;
+		if (IsBatchedWrites && SharedStore == nullptr && !IsStrict) {
+			WriteEntriesBatched(*SourceArchive, PluginFolders, *EntriesToExtract, RestEntries);
+			EntriesToExtract = &RestEntries;
+		}
+#endif
+		bool IsExtracted = SharedStore != nullptr ?
+			SharedStore->InstallEntries(*SourceArchive, *EntriesToExtract, DescriptorToHandle(TargetDescriptor), PrepareTarget, GetExtractPool(), BufferSize) :
+			SourceArchive->ExtractEntries(*EntriesToExtract, OpenTarget, GetExtractPool(), BufferSize);
+
+		if (!IsExtracted) {
+			RemoveTarget();
+			if (SourceArchive->IsIntegrityFailed()) {
+				return ReturnCodes::IntegrityCheckFailed;
+			}
+
+			return (IsAccessDenied && !IsElevatedProcess()) ? ReturnCodes::PromoteToAdmin : ReturnCodes::IoFailed;
+		}
+
+		ExtractPhase.Stop();
+		PhaseScope FlushPhase(Task.Stats.get(), InstallPhase::Flush);
+
+		/* Store links have nothing to flush per file, their data is flushed with filesystem */
+		bool IsDurable = true;
+		switch (Durability) {
+		case DurabilityLevel::Strict:
+			IsDurable = !IsFlushFailed && (SharedStore == nullptr || SyncFileSystem(TargetDescriptor)) &&
+				(!IsPending || MovePendingFiles()) && PluginFolders.FlushTree() && fsync(CompanyDir.Descriptor) == 0;
+			break;
+		case DurabilityLevel::Batched:
+			IsDurable = SyncFileSystem(TargetDescriptor);
+			if (IsDurable && IsStaged) {
+				/* After exchange staging name holds old version, link stage removes it */
+				Task.IsOldVersionStaged = ExchangeFolders(CompanyDir.Descriptor, StagingName, PathToPackage.PluginName);
+				IsDurable = Task.IsOldVersionStaged && fsync(CompanyDir.Descriptor) == 0;
+			}
+
+			if (IsDurable && IsPending) {
+				IsDurable = MovePendingFiles() && SyncFileSystem(TargetDescriptor);
+			}
+			break;
+		default:
+			IsDurable = !IsPending || MovePendingFiles();
+			break;
+		}
+
+		if (!IsDurable) {
+			ReturnCodes ReturnValue = AccessErrorCode(ReturnCodes::IoFailed);
+			if (Task.IsOldVersionStaged && ExchangeFolders(CompanyDir.Descriptor, StagingName, PathToPackage.PluginName)) {
+				Task.IsOldVersionStaged = false;
+			}
+
+			/* New version which can't be swapped back stays in place, but without record */
+			if (Task.IsOldVersionStaged) {
+				ForgetInstalledPackage(Task.FullPluginDir);
+			} else {
+				RemoveTarget();
+			}
+
+			return ReturnValue;
+		}
+
+		return ReturnCodes::NoError;
+	}
+
+	PackageManager::ReturnCodes
+	PackageManager::LinkPackage(InstallTask& Task)
+	{
+		PhaseScope Phase(Task.Stats.get(), InstallPhase::Link);
+		PackageInfo& PathToPackage = Task.PathToPackage;
+		const char* PluginName = PathToPackage.PluginName.c_str();
+
+		/* Plugin folder is addressed by absolute path here, extract stage has already closed its descriptors */
+		size_t LastSlash = Task.FullPluginDir.find_last_of('/');
+		DirectoryDescriptor CompanyDir(OpenDirectoryAt(AT_FDCWD, Task.FullPluginDir.substr(0, LastSlash), false));
+		std::string StagingName = PathToPackage.PluginName + StagingSuffix;
+
+		/* Undo install as "InstallTask" says, true if plugin folder existed before and is still there */
+		auto RevertPluginDir = [this, &Task, &CompanyDir, &StagingName, PluginName]() -> bool {
+			if (!CompanyDir.IsValid()) {
+				return false;
+			}
+
+			if (Task.IsOldVersionStaged && ExchangeFolders(CompanyDir.Descriptor, StagingName, PluginName)) {
+				Task.IsOldVersionStaged = false;
+				RemoveTreeAt(CompanyDir.Descriptor, StagingName.c_str());
+				if (Task.IsNewPluginDir) {
+					unlinkat(CompanyDir.Descriptor, PluginName, AT_REMOVEDIR);
+				}
+
+				return !Task.IsNewPluginDir;
+			}
+
+			if (Task.IsNewPluginDir && !Task.IsOldVersionStaged) {
+				RemoveTreeAt(CompanyDir.Descriptor, PluginName);
+				return false;
+			}
+
+			ForgetInstalledPackage(Task.FullPluginDir);
+			return !Task.IsNewPluginDir;
+		};
+
+		DirectoryDescriptor SymlinkCompanyDir;
+		{
+			DirectoryDescriptor SymlinkDir(OpenDirectoryAt(AT_FDCWD, PathToPackage.SymlinkDirectory, true));
+			if (SymlinkDir.IsValid()) {
+				SymlinkCompanyDir.Reset(OpenDirectoryAt(SymlinkDir.Descriptor, PathToPackage.CompanyName, true));
+			}
+
+			if (!SymlinkCompanyDir.IsValid()) {
+				ReturnCodes ReturnValue = AccessErrorCode(ReturnCodes::OtherError);
+				RevertPluginDir();
+				return ReturnValue;
+			}
+		}
+
+		/* Old link is put back if install fails from here on, but plugin folder stays */
+		std::error_code LinkError;
+		std::filesystem::path OldLinkTarget = std::filesystem::read_symlink(std::filesystem::u8path(PathToPackage.SymlinkDirectory + "/" +
+			PathToPackage.CompanyName + "/" + PathToPackage.PluginName), LinkError);
+
+		auto RevertInstall = [&RevertPluginDir, &SymlinkCompanyDir, &OldLinkTarget, PluginName]() {
+			RemoveTreeAt(SymlinkCompanyDir.Descriptor, PluginName);
+			if (RevertPluginDir() && !OldLinkTarget.empty()) {
+				CountSystemCalls(1);
+				symlinkat(OldLinkTarget.c_str(), SymlinkCompanyDir.Descriptor, PluginName);
+			}
+		};
+
+		/*
+			Check for already exist folder on symlink folder path. We must delete this symlink/folder
+			anyway to create new symlink
+		*/
+		if (!RemoveTreeAt(SymlinkCompanyDir.Descriptor, PluginName)) {
+			ReturnCodes ReturnValue = AccessErrorCode(ReturnCodes::OtherError);
+			RevertPluginDir();
+			return ReturnValue;
+		}
+
+		/* Create symlink to installation path of package and process it */
+		CountSystemCalls(1);
+		if (symlinkat(Task.FullPluginDir.c_str(), SymlinkCompanyDir.Descriptor, PluginName) != 0) {
+			ReturnCodes ReturnValue = AccessErrorCode(ReturnCodes::OtherError);
+			RevertInstall();
+			return ReturnValue;
+		}
+
+		/* Custom process callback from plugin's company holder */
+		if (Task.CustomCallback) {
+			if (!Task.CustomCallback(&PathToPackage, Task.BinaryType)) {
+				RevertInstall();
+				return ReturnCodes::AfterInstallationOperationFailed;
+			}
+		}
+
+		/* Old version isn't needed any more */
+		if (Task.IsOldVersionStaged && CompanyDir.IsValid()) {
+			RemoveTreeAt(CompanyDir.Descriptor, StagingName.c_str());
+			Task.IsOldVersionStaged = false;
+		}
+
+		/* Failed install keeps files of old version, they go only now, right before new record */
+		if (!Task.ObsoleteFiles.empty() && CompanyDir.IsValid()) {
+			DirectoryDescriptor PluginDir(OpenDirectoryAt(CompanyDir.Descriptor, PathToPackage.PluginName, false));
+			CountSystemCalls(Task.ObsoleteFiles.size());
+			for (auto& ObsoleteFile : Task.ObsoleteFiles) {
+				unlinkat(PluginDir.Descriptor, ObsoleteFile.c_str(), 0);
+			}
+		}
+
+		/* Remember what was installed; failure here doesn't break already installed package */
+		RegisterPackage(Task.PackageToInstall, Task.BinaryType, Task.FullPluginDir, Task.BinariesList);
+
+		Phase.AddEntries(1);
+		return ReturnCodes::NoError;
+	}
+
+	/* Folder renamed aside by package deletion, its parts are removed by different pool tasks */
+	struct RemovedFolder
+	{
+		std::shared_ptr<DirectoryDescriptor> ParentDir;
+		std::string Name;
+		DirectoryDescriptor RootDir;
+		std::vector<std::string> Parts;		// installed files or top-level items of folder
+		bool IsFilesList = false;
+		std::atomic<size_t> BatchesLeft = { 0 };
+	};
+
+	static void
+	RemoveFolderParts(RemovedFolder& Folder, size_t FirstPart, size_t LastPart)
+	{
+		if (!Folder.IsFilesList) {
+			for (size_t i = FirstPart; i < LastPart; i++) {
+				RemoveTreeAt(Folder.RootDir.Descriptor, Folder.Parts[i].c_str());
+			}
+
+			return;
+		}
+
+		/* Files are sorted, so files of one folder mostly go in a row and folder is opened once for them */
+		DirectoryDescriptor ParentDir;
+		std::string_view ParentPath;
+		for (size_t i = FirstPart; i < LastPart; i++) {
+			const std::string& FilePath = Folder.Parts[i];
+			size_t LastSlash = FilePath.find_last_of('/');
+			std::string_view FolderPath(FilePath.data(), LastSlash == std::string::npos ? 0 : LastSlash);
+			if (i == FirstPart || FolderPath != ParentPath) {
+				ParentPath = FolderPath;
+				ParentDir.Reset(openat(Folder.RootDir.Descriptor, FolderPath.empty() ? "." : std::string(FolderPath).c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+			}
+
+			if (ParentDir.IsValid()) {
+				unlinkat(ParentDir.Descriptor, FilePath.c_str() + (LastSlash == std::string::npos ? 0 : LastSlash + 1), 0);
+			}
+		}
+	}
+
+	/*
+		Remove folder in background: listed files (or top-level items if there is no list) are
+		split into batches for pool workers, the last finished batch removes what is left -
+		folders and files which were created after install. Errors are ignored, folder is
+		hidden already and next deletion of the same plugin picks up leftovers.
+	*/
+	static void
+	ReclaimFolder(ThreadPool* Pool, std::shared_ptr<DirectoryDescriptor> ParentDir, const std::string& Name, std::vector<std::string> Files)
+	{
+		auto Folder = std::make_shared<RemovedFolder>();
+		Folder->ParentDir = std::move(ParentDir);
+		Folder->Name = Name;
+		Folder->RootDir.Reset(openat(Folder->ParentDir->Descriptor, Name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+		Folder->IsFilesList = !Files.empty();
+		Folder->Parts = std::move(Files);
+		if (Folder->RootDir.IsValid() && !Folder->IsFilesList) {
+			DIR* DirStream = fdopendir(openat(Folder->RootDir.Descriptor, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+			while (DirStream != nullptr) {
+				struct dirent* DirEntry = readdir(DirStream);
+				if (DirEntry == nullptr) {
+					closedir(DirStream);
+					break;
+				}
+
+				if (strcmp(DirEntry->d_name, ".") && strcmp(DirEntry->d_name, "..")) {
+					Folder->Parts.emplace_back(DirEntry->d_name);
+				}
+			}
+		}
+
+		if (!Folder->RootDir.IsValid()) {
+			Folder->Parts.clear();
+		}
+
+		std::sort(Folder->Parts.begin(), Folder->Parts.end());
+		size_t BatchesCount = (Folder->Parts.size() + RemoveBatchSize - 1) / RemoveBatchSize;
+		Folder->BatchesLeft = std::max<size_t>(BatchesCount, 1);
+
+		auto RemoveBatch = [Folder](size_t BatchIndex) {
+			size_t FirstPart = BatchIndex * RemoveBatchSize;
+			RemoveFolderParts(*Folder, FirstPart, std::min(FirstPart + RemoveBatchSize, Folder->Parts.size()));
+			if (--Folder->BatchesLeft == 0) {
+				Folder->RootDir.Reset(-1);
+				RemoveTreeAt(Folder->ParentDir->Descriptor, Folder->Name.c_str());
+			}
+		};
+
+		if (BatchesCount == 0) {
+			Pool->Submit([RemoveBatch]() { RemoveBatch(0); });
+		}
+
+		for (size_t i = 0; i < BatchesCount; i++) {
+			Pool->Submit([RemoveBatch, i]() { RemoveBatch(i); });
+		}
+	}
+
+	PackageManager::ReturnCodes
+	PackageManager::DeletePackage(PackageInfo PathToPackage, xpckg::PackageBinaries BinaryType, DeleteCallback CustomCallback)
+	{
+		ReturnCodes ReturnValue = CheckInstallRights();
+		if (ReturnValue != ReturnCodes::NoError) {
+			return ReturnValue;
+		}
+
+		ConvertToNativeStyle(PathToPackage.InstallDirectory);
+		ConvertToNativeStyle(PathToPackage.SymlinkDirectory);
+
+		std::string FullPluginDir;
+		if (!GetFullPluginDir(PathToPackage, FullPluginDir)) {
+			return ReturnCodes::OtherError;
+		}
+
+		if (CustomCallback && !CustomCallback(&PathToPackage, BinaryType)) {
+			return ReturnCodes::AfterInstallationOperationFailed;
+		}
+
+		/* Only symlink is removed, folder or file with that name wasn't created by us */
+		const char* PluginName = PathToPackage.PluginName.c_str();
+		{
+			DirectoryDescriptor SymlinkCompanyDir(OpenDirectoryAt(AT_FDCWD, PathToPackage.SymlinkDirectory + "/" + PathToPackage.CompanyName, false));
+			struct stat LinkStat = {};
+			if (SymlinkCompanyDir.IsValid() && fstatat(SymlinkCompanyDir.Descriptor, PluginName, &LinkStat, AT_SYMLINK_NOFOLLOW) == 0 &&
+				S_ISLNK(LinkStat.st_mode) && unlinkat(SymlinkCompanyDir.Descriptor, PluginName, 0) != 0) {
+				return AccessErrorCode(ReturnCodes::OtherError);
+			}
+		}
+
+		InstalledPackage PackageRecord = {};
+		bool IsRegistered = FindInstalledPackage(FullPluginDir, PackageRecord);
+		auto CompanyDir = std::make_shared<DirectoryDescriptor>(OpenDirectoryAt(AT_FDCWD, PathToPackage.InstallDirectory + "/" + PathToPackage.CompanyName, false));
+		if (CompanyDir->IsValid()) {
+			/* Rename onto empty leftover folder replaces it, non-empty one is skipped */
+			std::string RemovedName;
+			bool IsMoved = false;
+			for (size_t i = 0; i < MaxRemovedFolders; i++) {
+				RemovedName = PathToPackage.PluginName + RemovedSuffix + std::to_string(i);
+				IsMoved = renameat(CompanyDir->Descriptor, PluginName, CompanyDir->Descriptor, RemovedName.c_str()) == 0;
+				if (IsMoved || (errno != EEXIST && errno != ENOTEMPTY)) {
+					break;
+				}
+			}
+
+			if (!IsMoved && errno != ENOENT) {
+				return AccessErrorCode(ReturnCodes::IoFailed);
+			}
+
+			/* Folders left by crashed process or failed removal are reclaimed too, by walking them */
+			std::vector<std::string> RemovedFolders;
+			DIR* DirStream = fdopendir(openat(CompanyDir->Descriptor, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+			while (DirStream != nullptr) {
+				struct dirent* DirEntry = readdir(DirStream);
+				if (DirEntry == nullptr) {
+					closedir(DirStream);
+					break;
+				}
+
+				if (IsRemovedFolder(DirEntry->d_name, PathToPackage.PluginName) && (!IsMoved || RemovedName != DirEntry->d_name)) {
+					RemovedFolders.emplace_back(DirEntry->d_name);
+				}
+			}
+
+			std::vector<std::string> RemovedFiles;
+			if (IsMoved) {
+				if (IsRegistered) {
+					RemovedFiles.reserve(PackageRecord.Files.size());
+					for (auto& File : PackageRecord.Files) {
+						RemovedFiles.push_back(File.Path);
+					}
+				}
+
+				ReclaimFolder(GetRemovePool(), CompanyDir, RemovedName, std::move(RemovedFiles));
+			}
+
+			for (auto& FolderName : RemovedFolders) {
+				ReclaimFolder(GetRemovePool(), CompanyDir, FolderName, {});
+			}
+		}
+
+		if (IsRegistered) {
+			ConfigRegistry->RemovePackage(PackageRecord.Id);
+		}
+
+		return ReturnCodes::NoError;
+	}
+}
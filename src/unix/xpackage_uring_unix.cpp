@@ -0,0 +1,294 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: io_uring batch writer of small files
+*********************************************************/
+#include "xpackage_uring_unix.h"
+
+#ifdef XPACKAGE_IO_URING
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <vector>
+#include <linux/io_uring.h>
+
+namespace xpckg
+{
+	/* Every file takes 4 requests, kind of request is kept in low bits of user data */
+	constexpr unsigned RequestsPerFile = 4;
+	constexpr uint64_t RequestUnlink = 0;
+	constexpr uint64_t RequestOpen = 1;
+	constexpr uint64_t RequestWrite = 2;
+	constexpr uint64_t RequestClose = 3;
+
+	UringWriter::UringWriter(unsigned MaxFilesCount)
+	{
+		FilesCount = std::max(MaxFilesCount, 1u);
+
+		io_uring_params Params = {};
+		RingDescriptor = static_cast<int>(syscall(__NR_io_uring_setup, FilesCount * RequestsPerFile, &Params));
+		if (RingDescriptor < 0) {
+			throw std::exception();
+		}
+
+		/* Rings are shared with kernel through mapping of ring descriptor */
+		SubmitQueue.RingSize = Params.sq_off.array + Params.sq_entries * sizeof(unsigned);
+		CompleteQueue.RingSize = Params.cq_off.cqes + Params.cq_entries * sizeof(io_uring_cqe);
+		if (Params.features & IORING_FEAT_SINGLE_MMAP) {
+			SubmitQueue.RingSize = std::max(SubmitQueue.RingSize, CompleteQueue.RingSize);
+		}
+
+		SubmitQueue.RingMemory = mmap(nullptr, SubmitQueue.RingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RingDescriptor, IORING_OFF_SQ_RING);
+		if (SubmitQueue.RingMemory == MAP_FAILED) {
+			SubmitQueue.RingMemory = nullptr;
+			this->~UringWriter();
+			throw std::exception();
+		}
+
+		if (Params.features & IORING_FEAT_SINGLE_MMAP) {
+			CompleteQueue.RingMemory = SubmitQueue.RingMemory;
+		} else {
+			CompleteQueue.RingMemory = mmap(nullptr, CompleteQueue.RingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RingDescriptor, IORING_OFF_CQ_RING);
+			if (CompleteQueue.RingMemory == MAP_FAILED) {
+				CompleteQueue.RingMemory = nullptr;
+				this->~UringWriter();
+				throw std::exception();
+			}
+		}
+
+		SubmitEntriesSize = Params.sq_entries * sizeof(io_uring_sqe);
+		SubmitEntries = mmap(nullptr, SubmitEntriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RingDescriptor, IORING_OFF_SQES);
+		if (SubmitEntries == MAP_FAILED) {
+			SubmitEntries = nullptr;
+			this->~UringWriter();
+			throw std::exception();
+		}
+
+		uint8_t* SubmitRing = static_cast<uint8_t*>(SubmitQueue.RingMemory);
+		SubmitQueue.Head = reinterpret_cast<unsigned*>(SubmitRing + Params.sq_off.head);
+		SubmitQueue.Tail = reinterpret_cast<unsigned*>(SubmitRing + Params.sq_off.tail);
+		SubmitQueue.RingMask = reinterpret_cast<unsigned*>(SubmitRing + Params.sq_off.ring_mask);
+		SubmitQueue.Array = reinterpret_cast<unsigned*>(SubmitRing + Params.sq_off.array);
+
+		uint8_t* CompleteRing = static_cast<uint8_t*>(CompleteQueue.RingMemory);
+		CompleteQueue.Head = reinterpret_cast<unsigned*>(CompleteRing + Params.cq_off.head);
+		CompleteQueue.Tail = reinterpret_cast<unsigned*>(CompleteRing + Params.cq_off.tail);
+		CompleteQueue.RingMask = reinterpret_cast<unsigned*>(CompleteRing + Params.cq_off.ring_mask);
+		CompleteEntries = CompleteRing + Params.cq_off.cqes;
+
+		/*
+			Ring of old kernel can lack some opcodes. Opening into direct descriptor has no opcode
+			of its own, it came in 5.15 together with IORING_OP_LINKAT, so that one marks it.
+		*/
+		std::vector<uint8_t> ProbeMemory(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+		io_uring_probe* Probe = reinterpret_cast<io_uring_probe*>(ProbeMemory.data());
+		if (syscall(__NR_io_uring_register, RingDescriptor, IORING_REGISTER_PROBE, Probe, 256) != 0) {
+			this->~UringWriter();
+			throw std::exception();
+		}
+
+		for (unsigned Opcode : { IORING_OP_UNLINKAT, IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_CLOSE, IORING_OP_LINKAT }) {
+			if (Opcode > Probe->last_op || !(Probe->ops[Opcode].flags & IO_URING_OP_SUPPORTED)) {
+				this->~UringWriter();
+				throw std::exception();
+			}
+		}
+
+		/* Empty table of direct descriptors, one slot per file of batch */
+		std::vector<int> EmptySlots(FilesCount, -1);
+		if (syscall(__NR_io_uring_register, RingDescriptor, IORING_REGISTER_FILES, EmptySlots.data(), FilesCount) != 0) {
+			this->~UringWriter();
+			throw std::exception();
+		}
+	}
+
+	UringWriter::~UringWriter()
+	{
+		if (SubmitEntries != nullptr) {
+			munmap(SubmitEntries, SubmitEntriesSize);
+			SubmitEntries = nullptr;
+		}
+
+		if (CompleteQueue.RingMemory != nullptr && CompleteQueue.RingMemory != SubmitQueue.RingMemory) {
+			munmap(CompleteQueue.RingMemory, CompleteQueue.RingSize);
+		}
+
+		CompleteQueue.RingMemory = nullptr;
+		if (SubmitQueue.RingMemory != nullptr) {
+			munmap(SubmitQueue.RingMemory, SubmitQueue.RingSize);
+			SubmitQueue.RingMemory = nullptr;
+		}
+
+		/* Closing ring waits for requests in flight and closes direct descriptors */
+		if (RingDescriptor >= 0) {
+			close(RingDescriptor);
+			RingDescriptor = -1;
+		}
+	}
+
+	unsigned
+	UringWriter::GetMaxFilesCount()
+	{
+		return FilesCount;
+	}
+
+	void*
+	UringWriter::GetSubmitEntry()
+	{
+		/* Ring is sized for full batch and we are the only producer, so there is always space */
+		unsigned Tail = *SubmitQueue.Tail;
+		unsigned Index = Tail & *SubmitQueue.RingMask;
+		io_uring_sqe* Entry = static_cast<io_uring_sqe*>(SubmitEntries) + Index;
+		std::memset(Entry, 0, sizeof(*Entry));
+		SubmitQueue.Array[Index] = Index;
+		__atomic_store_n(SubmitQueue.Tail, Tail + 1, __ATOMIC_RELEASE);
+		return Entry;
+	}
+
+	bool
+	UringWriter::AddFile(int DirDescriptor, const char* FilePath, const uint8_t* FileData, size_t FileSize)
+	{
+		if (IsFailed || QueuedFiles == FilesCount || PendingRequests != 0 || FileSize > 0x7FFFF000) {
+			return false;
+		}
+
+		uint64_t FileIndex = QueuedFiles++;
+		uint64_t UserData = FileIndex * RequestsPerFile;
+
+		/*
+			Target can be hardlink to shared store, so it's unlinked and created anew. ENOENT
+			must not break chain, so link is hard; open with O_EXCL fails if unlink did.
+		*/
+		io_uring_sqe* Entry = static_cast<io_uring_sqe*>(GetSubmitEntry());
+		Entry->opcode = IORING_OP_UNLINKAT;
+		Entry->fd = DirDescriptor;
+		Entry->addr = reinterpret_cast<uint64_t>(FilePath);
+		Entry->flags = IOSQE_IO_HARDLINK;
+		Entry->user_data = UserData + RequestUnlink;
+
+		/* Direct descriptors can't have O_CLOEXEC, they aren't visible for exec anyway */
+		Entry = static_cast<io_uring_sqe*>(GetSubmitEntry());
+		Entry->opcode = IORING_OP_OPENAT;
+		Entry->fd = DirDescriptor;
+		Entry->addr = reinterpret_cast<uint64_t>(FilePath);
+		Entry->open_flags = O_WRONLY | O_CREAT | O_EXCL;
+		Entry->len = 0644;
+		Entry->file_index = static_cast<uint32_t>(FileIndex + 1);
+		Entry->flags = IOSQE_IO_LINK;
+		Entry->user_data = UserData + RequestOpen;
+
+		/* Close is hardlinked, so slot is freed even after failed write */
+		Entry = static_cast<io_uring_sqe*>(GetSubmitEntry());
+		Entry->opcode = IORING_OP_WRITE;
+		Entry->fd = static_cast<int>(FileIndex);
+		Entry->addr = reinterpret_cast<uint64_t>(FileData);
+		Entry->len = static_cast<uint32_t>(FileSize);
+		Entry->off = 0;
+		Entry->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+		Entry->user_data = UserData + RequestWrite;
+
+		Entry = static_cast<io_uring_sqe*>(GetSubmitEntry());
+		Entry->opcode = IORING_OP_CLOSE;
+		Entry->file_index = static_cast<uint32_t>(FileIndex + 1);
+		Entry->user_data = UserData + RequestClose;
+
+		/* Expected size of write is kept to check completion */
+		if (WriteSizes.size() < QueuedFiles) {
+			WriteSizes.resize(QueuedFiles);
+		}
+
+		WriteSizes[FileIndex] = FileSize;
+		return true;
+	}
+
+	bool
+	UringWriter::Submit()
+	{
+		unsigned RequestsCount = QueuedFiles * RequestsPerFile;
+		unsigned SubmittedCount = 0;
+		while (SubmittedCount < RequestsCount) {
+			CountSystemCalls(1);
+			long ReturnValue = syscall(__NR_io_uring_enter, RingDescriptor, RequestsCount - SubmittedCount, 0, 0, nullptr, 0);
+			if (ReturnValue < 0) {
+				if (errno == EINTR || errno == EAGAIN) {
+					continue;
+				}
+
+				/* Not submitted requests are still in ring, caller must not reuse writer */
+				IsFailed = true;
+				PendingRequests += SubmittedCount;
+				QueuedFiles = 0;
+				return false;
+			}
+
+			SubmittedCount += static_cast<unsigned>(ReturnValue);
+		}
+
+		PendingRequests += SubmittedCount;
+		QueuedFiles = 0;
+		return true;
+	}
+
+	bool
+	UringWriter::Wait()
+	{
+		/* Kernel writes files between submit and this wait, so waiting is the visible part of writes */
+		TraceTimer WriteTimer(&TraceCounters::WriteTime);
+		bool IsSuccess = !IsFailed;
+		while (PendingRequests != 0) {
+			unsigned Head = *CompleteQueue.Head;
+			unsigned Tail = __atomic_load_n(CompleteQueue.Tail, __ATOMIC_ACQUIRE);
+			if (Head == Tail) {
+				CountSystemCalls(1);
+				long ReturnValue = syscall(__NR_io_uring_enter, RingDescriptor, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+				if (ReturnValue < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+					/*
+						Requests in flight still use caller buffers, so we can't return. Kernel posts
+						completions to ring without our call, they are polled till all are here.
+					*/
+					IsFailed = true;
+					IsSuccess = false;
+					usleep(1000);
+				}
+
+				continue;
+			}
+
+			for (; Head != Tail; Head++) {
+				const io_uring_cqe& Completion = static_cast<const io_uring_cqe*>(CompleteEntries)[Head & *CompleteQueue.RingMask];
+				uint64_t FileIndex = Completion.user_data / RequestsPerFile;
+				switch (Completion.user_data % RequestsPerFile) {
+				case RequestUnlink:
+					IsSuccess &= Completion.res >= 0 || Completion.res == -ENOENT;
+					break;
+				case RequestOpen:
+					IsSuccess &= Completion.res >= 0;
+					break;
+				case RequestWrite:
+					IsSuccess &= Completion.res >= 0 && static_cast<size_t>(Completion.res) == WriteSizes[FileIndex];
+					CountBytesWritten(Completion.res > 0 ? static_cast<uint64_t>(Completion.res) : 0);
+					break;
+				case RequestClose:
+					/* Close of slot after failed open fails too, open has reported it already */
+					break;
+				default:
+					break;
+				}
+
+				PendingRequests--;
+			}
+
+			__atomic_store_n(CompleteQueue.Head, Head, __ATOMIC_RELEASE);
+		}
+
+		IsFailed = IsFailed || !IsSuccess;
+		return IsSuccess;
+	}
+}
+#endif
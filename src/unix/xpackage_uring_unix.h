@@ -0,0 +1,81 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: io_uring batch writer of small files
+*********************************************************/
+#pragma once
+#include "xpackage_internal.h"
+
+/*
+	Opcodes and fields used here are enum members and struct fields, not macros, so they're
+	checked by version of kernel headers: opening into direct descriptors ("file_index") and
+	IORING_OP_UNLINKAT are both in 5.15 headers. Running kernel is checked by probe.
+*/
+#if defined(__linux__) && __has_include(<linux/io_uring.h>) && __has_include(<linux/version.h>)
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 15, 0)
+#define XPACKAGE_IO_URING
+#endif
+#endif
+
+#ifdef XPACKAGE_IO_URING
+
+namespace xpckg
+{
+	/*
+		Every file is one linked chain of requests: unlinkat -> openat -> write -> close.
+		Files are opened into registered (direct) descriptors, so chain runs entirely in
+		kernel, and whole batch of files costs one "io_uring_enter()" for submit and wait.
+		Constructor throws if kernel doesn't have io_uring (or some of used opcodes) or it's
+		forbidden by sandbox.
+	*/
+	class UringWriter
+	{
+	private:
+		struct RingQueue
+		{
+			void* RingMemory = nullptr;
+			size_t RingSize = 0;
+			unsigned* Head = nullptr;
+			unsigned* Tail = nullptr;
+			unsigned* RingMask = nullptr;
+			unsigned* Array = nullptr;
+		};
+
+		int RingDescriptor = -1;
+		RingQueue SubmitQueue;
+		RingQueue CompleteQueue;
+		void* SubmitEntries = nullptr;
+		size_t SubmitEntriesSize = 0;
+		void* CompleteEntries = nullptr;
+		unsigned FilesCount = 0;
+		unsigned QueuedFiles = 0;
+		unsigned PendingRequests = 0;
+		std::vector<size_t> WriteSizes;
+		bool IsFailed = false;
+
+		void* GetSubmitEntry();
+
+	public:
+		UringWriter(unsigned MaxFilesCount);
+		~UringWriter();
+
+		unsigned GetMaxFilesCount();
+
+		/* Path and data are used by kernel until Wait(), so they must stay alive till then */
+		bool AddFile(int DirDescriptor, const char* FilePath, const uint8_t* FileData, size_t FileSize);
+
+		/* Hand queued files to kernel without waiting, caller can prepare next batch meanwhile */
+		bool Submit();
+
+		/*
+			Wait for submitted files, false if any of them wasn't written completely. Returns only
+			when kernel is done with all submitted requests, so their buffers can be reused.
+			After failure writer must not be used for next batches.
+		*/
+		bool Wait();
+	};
+}
+#endif
@@ -5,13 +5,8 @@
 **********************************************************
 * Module Name: Windows implementation of package manager
 *********************************************************/
-#include "xpackage.h"
+#include "xpackage_internal.h"
 #include <windows.h>
-#include "zlib.h"
-#include <zipper/unzipper.h>
-#include <zipper/zipper.h>
-
-#define CHUNK_SIZE 4096
 
 namespace xpckg
 {
@@ -24,27 +19,183 @@ namespace xpckg
 		}
 	}
 
-	std::unordered_map<std::string, PackageBinaries> BinaryPlatformsMap = {
-		{ "win_x86", PackageBinaries::BinariesWindows_x86 },
-		{ "win_x64", PackageBinaries::BinariesWindows_x64 },
-		{ "win_arm64", PackageBinaries::BinariesWindows_ARM64},
-		{ "macOS_x86", PackageBinaries::BinariesMacOS_x86 },
-		{ "macOS_x64", PackageBinaries::BinariesMacOS_x64 },
-		{ "macOS_arm64", PackageBinaries::BinariesMacOS_ARM64 },
-		{ "macOS_uni_x64_arm", PackageBinaries::UniversalMacOS_x64_ARM64 },
-		{ "macOS_uni_x64_x86" , PackageBinaries::UniversalMacOS_x64_x86 }
-	};
+	void ConvertToNativeStyle(std::string& CurrentString)
+	{
+		ConvertToWindowsStyle(CurrentString);
+	}
 
-	std::unordered_map<PackageBinaries, std::string> PlatformsStringMap = {
-		{ PackageBinaries::BinariesWindows_x86, "win_x86" },
-		{ PackageBinaries::BinariesWindows_x64, "win_x64" },
-		{ PackageBinaries::BinariesWindows_ARM64, "win_arm64" },
-		{ PackageBinaries::BinariesMacOS_x86, "macOS_x86" },
-		{ PackageBinaries::BinariesMacOS_x64, "macOS_x64" },
-		{ PackageBinaries::BinariesMacOS_ARM64, "macOS_arm64" },
-		{ PackageBinaries::UniversalMacOS_x64_ARM64, "macOS_uni_x64_arm" },
-		{ PackageBinaries::UniversalMacOS_x64_x86, "macOS_uni_x64_x86" }
-	};
+	/*
+		"RemoveDirectoryW()" function needy only for non-recursive folders deleting. To process
+		more complex solution we must use "SHFileOperationW()" function with `FO_DELETE` argument.
+		Also, we must select flag for silent install because user can cancel operation.
+		It returns zero on success, and path list for it ends with double null.
+	*/
+	static bool
+	RemoveDirectoryTree(wchar_t* PathToRemove)
+	{
+		if (!RemoveDirectoryW(PathToRemove)) {
+			std::wstring PathList = PathToRemove;
+			PathList.push_back(L'\0');
+			SHFILEOPSTRUCTW ShellOperation = { nullptr, FO_DELETE, PathList.c_str(), nullptr, FOF_SILENT | FOF_NOERRORUI | FOF_NOCONFIRMATION, FALSE, nullptr, nullptr };
+			if (SHFileOperationW(&ShellOperation) != 0 || ShellOperation.fAnyOperationsAborted) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	bool
+	ContentStore::SealObject(const std::string& TempPath)
+	{
+		/* Read-only attribute is shared by hardlinks and blocks their deletion, so objects keep default one */
+		return true;
+	}
+
+	bool
+	ContentStore::MaterializeObject(const std::string& ObjectPath, RawHandle BaseDirectory, const std::string& TargetPath)
+	{
+		wchar_t StaticObjectString[2048] = {};
+		wchar_t StaticTargetString[2048] = {};
+		if (MultiByteToWideChar(CP_UTF8, 0, ObjectPath.c_str(), -1, StaticObjectString, ARRAYSIZE(StaticObjectString)) <= 0 ||
+			MultiByteToWideChar(CP_UTF8, 0, TargetPath.c_str(), -1, StaticTargetString, ARRAYSIZE(StaticTargetString)) <= 0) {
+			return false;
+		}
+
+		/* Hardlinks work only inside one volume, otherwise file is copied (block cloned on ReFS) */
+		if (CreateHardLinkW(StaticTargetString, StaticObjectString, nullptr)) {
+			return true;
+		}
+
+		return CopyFileW(StaticObjectString, StaticTargetString, TRUE);
+	}
+
+	bool
+	DirectoryTree::CreateFolder(TreeNode& Node, bool bKeepHandle)
+	{
+		/* Parents are created before children, so single call per folder is enough */
+		std::string FolderPath = RootPath + "\\" + std::string(Node.Path);
+		int WideLength = MultiByteToWideChar(CP_UTF8, 0, FolderPath.c_str(), -1, nullptr, 0);
+		if (WideLength <= 0) {
+			return false;
+		}
+
+		std::wstring WidePath(static_cast<size_t>(WideLength), L'\0');
+		if (MultiByteToWideChar(CP_UTF8, 0, FolderPath.c_str(), -1, WidePath.data(), WideLength) <= 0) {
+			return false;
+		}
+
+		CountSystemCalls(1);
+		if (CreateDirectoryW(WidePath.c_str(), nullptr)) {
+			return true;
+		}
+
+		if (GetLastError() != ERROR_ALREADY_EXISTS) {
+			return false;
+		}
+
+		/* Something exists there, it's fine only if it's folder */
+		DWORD dwAttrib = GetFileAttributesW(WidePath.c_str());
+		return dwAttrib != INVALID_FILE_ATTRIBUTES && (dwAttrib & FILE_ATTRIBUTE_DIRECTORY);
+	}
+
+	void
+	DirectoryTree::CloseFolder(TreeNode& Node)
+	{
+		/* Folders are created by path here, there are no handles to close */
+	}
+
+	bool
+	DirectoryTree::FlushTree()
+	{
+		/* NTFS journals folder changes, flushed file brings its own metadata to disk */
+		return true;
+	}
+
+	static bool
+	FlushFileByPath(const std::string& PathToFile)
+	{
+		try {
+			FileHandle FileToFlush(PathToFile, false);
+			return FileToFlush.FlushFile();
+		}
+		catch (...) {
+			return false;
+		}
+	}
+
+	/* Put new folder in place of old one, old version is removed only when new one is already there */
+	static bool
+	ConvertToWidePath(const std::string& Path, std::wstring& OutPath)
+	{
+		int WideLength = MultiByteToWideChar(CP_UTF8, 0, Path.c_str(), -1, nullptr, 0);
+		if (WideLength <= 0) {
+			return false;
+		}
+
+		OutPath.assign(static_cast<size_t>(WideLength), L'\0');
+		if (MultiByteToWideChar(CP_UTF8, 0, Path.c_str(), -1, OutPath.data(), WideLength) <= 0) {
+			return false;
+		}
+
+		/* Terminator is kept inside string: shell operations want list of paths ended by two zeros */
+		OutPath.push_back(L'\0');
+		return true;
+	}
+
+	/* Swap two folders by three moves: there is short moment when second folder doesn't exist */
+	static bool
+	ExchangeFolders(const std::string& FirstFolder, const std::string& SecondFolder)
+	{
+		std::wstring WideFirst;
+		std::wstring WideSecond;
+		std::wstring WideTemp;
+		if (!ConvertToWidePath(FirstFolder, WideFirst) || !ConvertToWidePath(SecondFolder, WideSecond) ||
+			!ConvertToWidePath(SecondFolder + ".old", WideTemp)) {
+			return false;
+		}
+
+		RemoveDirectoryTree(WideTemp.data());
+		if (!MoveFileExW(WideSecond.c_str(), WideTemp.c_str(), MOVEFILE_WRITE_THROUGH)) {
+			return false;
+		}
+
+		if (!MoveFileExW(WideFirst.c_str(), WideSecond.c_str(), MOVEFILE_WRITE_THROUGH)) {
+			MoveFileExW(WideTemp.c_str(), WideSecond.c_str(), MOVEFILE_WRITE_THROUGH);
+			return false;
+		}
+
+		return MoveFileExW(WideTemp.c_str(), WideFirst.c_str(), MOVEFILE_WRITE_THROUGH);
+	}
+
+	/* Pending files replace old ones in place, false on first file which can't be moved */
+	static bool
+	MovePendingFiles(const std::string& FolderPath, const EntriesList& PendingEntries, const EntriesList& Entries)
+	{
+		for (size_t i = 0; i < PendingEntries.size(); i++) {
+			std::wstring WidePending;
+			std::wstring WideTarget;
+			if (!ConvertToWidePath(FolderPath + "\\" + PendingEntries[i].second, WidePending) || !ConvertToWidePath(FolderPath + "\\" + Entries[i].second, WideTarget)) {
+				return false;
+			}
+
+			CountSystemCalls(1);
+			if (!MoveFileExW(WidePending.c_str(), WideTarget.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	static void
+	RemoveFolderByPath(const std::string& FolderPath)
+	{
+		std::wstring WidePath;
+		if (ConvertToWidePath(FolderPath, WidePath)) {
+			RemoveDirectoryTree(WidePath.data());
+		}
+	}
 
 	bool 
 	FileHandle::IsInvalid()
@@ -62,6 +213,7 @@ namespace xpckg
 			throw std::exception();
 		}
 
+		CountSystemCalls(2);
 		CurrentHandle = CreateFileW(StaticString, GenericFlags, FILE_SHARE_READ, nullptr, SharedFlags, 0, nullptr);
 		if (IsInvalid()) {
 			throw std::exception();
@@ -72,12 +224,36 @@ namespace xpckg
 			throw std::exception();
 		}
 
+		FileName = PathToFile;
 		FileSize = largeNumber.QuadPart;
 	}
 
+	FileHandle::FileHandle(RawHandle BaseDirectory, std::string PathToFile, bool bNewFile)
+		: FileHandle([BaseDirectory, &PathToFile]() -> std::string {
+			/* Windows has no public "open at" API, so resolve directory handle to path */
+			wchar_t StaticString[4096] = {};
+			DWORD PathLength = GetFinalPathNameByHandleW(BaseDirectory, StaticString, ARRAYSIZE(StaticString), FILE_NAME_NORMALIZED);
+			if (PathLength == 0 || PathLength >= ARRAYSIZE(StaticString)) {
+				throw std::exception();
+			}
+
+			char StaticPath[4096 * 3] = {};
+			if (WideCharToMultiByte(CP_UTF8, 0, StaticString, -1, StaticPath, sizeof(StaticPath), nullptr, nullptr) <= 0) {
+				throw std::exception();
+			}
+
+			std::string FullPath = StaticPath;
+			ConvertToWindowsStyle(PathToFile);
+			return FullPath + "\\" + PathToFile;
+		}(), bNewFile)
+	{
+	}
+
 	FileHandle::~FileHandle()
 	{
+		UnmapFile();
 		if (!IsInvalid()) {
+			CountSystemCalls(1);
 			CloseHandle(CurrentHandle);
 		}
 	}
@@ -115,10 +291,12 @@ namespace xpckg
 		}
 
 		DWORD readedSize = 0;
+		CountSystemCalls(1);
 		if (!ReadFile(CurrentHandle, OutMemory->data(), SizeToRead, &readedSize, nullptr)) {
 			return -1;
 		}
 
+		CountBytesRead(readedSize);
 		return readedSize;
 	}
 
@@ -126,258 +304,164 @@ namespace xpckg
 	FileHandle::ReadFromFile(void* OutMemory, size_t SizeToRead)
 	{
 		DWORD readedSize = 0;
+		CountSystemCalls(1);
 		if (!ReadFile(CurrentHandle, OutMemory, SizeToRead, &readedSize, nullptr)) {
 			return -1;
 		}
 
+		CountBytesRead(readedSize);
 		return readedSize;
 	}
 
 	size_t
 	FileHandle::WriteToFile(std::shared_ptr<std::vector<uint8_t>> InMemory)
 	{
+		TraceTimer WriteTimer(&TraceCounters::WriteTime);
 		DWORD writedSize = 0;
+		CountSystemCalls(1);
 		if (!WriteFile(CurrentHandle, InMemory->data(), InMemory->size(), &writedSize, nullptr)) {
 			return -1;
 		}
 
+		CountBytesWritten(writedSize);
 		return writedSize;
 	}
 
 	size_t
 	FileHandle::WriteToFile(void* InMemory, size_t SizeToWrite)
 	{
+		TraceTimer WriteTimer(&TraceCounters::WriteTime);
 		DWORD writedSize = 0;
+		CountSystemCalls(1);
 		if (!WriteFile(CurrentHandle, InMemory, SizeToWrite, &writedSize, nullptr)) {
 			return -1;
 		}
 
+		CountBytesWritten(writedSize);
 		return writedSize;
 	}
 
-	bool
-	FileHandle::SeekFile(size_t FilePosition)
+	size_t
+	FileHandle::ReadFromFile(void* OutMemory, size_t SizeToRead, size_t FilePosition)
 	{
-		LARGE_INTEGER largeNumber = {};
-		largeNumber.QuadPart = FilePosition;
+		OVERLAPPED Overlapped = {};
+		Overlapped.Offset = static_cast<DWORD>(FilePosition);
+		Overlapped.OffsetHigh = static_cast<DWORD>(static_cast<uint64_t>(FilePosition) >> 32);
 
-		DWORD ReturnValue = SetFilePointer(CurrentHandle, largeNumber.LowPart, &largeNumber.HighPart, FILE_BEGIN);
-		if (ReturnValue == INVALID_SET_FILE_POINTER) {
-			if (GetLastError() != NO_ERROR) {
-				SetLastError(0);
-			}
-
-			return false;
+		DWORD readedSize = 0;
+		CountSystemCalls(1);
+		if (!ReadFile(CurrentHandle, OutMemory, SizeToRead, &readedSize, &Overlapped)) {
+			return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
 		}
 
-		return true;
+		CountBytesRead(readedSize);
+		return readedSize;
 	}
 
-
-	Package::Package(std::shared_ptr<zipper::Unzipper> ZipFile, std::shared_ptr<simdjson::dom::element> jsonElem)
+	size_t
+	FileHandle::WriteToFile(const void* InMemory, size_t SizeToWrite, size_t FilePosition)
 	{
-		PackageZip = ZipFile;
-		PackageJson = jsonElem;
-	}
+		OVERLAPPED Overlapped = {};
+		Overlapped.Offset = static_cast<DWORD>(FilePosition);
+		Overlapped.OffsetHigh = static_cast<DWORD>(static_cast<uint64_t>(FilePosition) >> 32);
 
-	Package::~Package()
-	{
+		TraceTimer WriteTimer(&TraceCounters::WriteTime);
+		DWORD writedSize = 0;
+		CountSystemCalls(1);
+		if (!WriteFile(CurrentHandle, InMemory, SizeToWrite, &writedSize, &Overlapped)) {
+			return -1;
+		}
+
+		if (FilePosition + writedSize > FileSize) {
+			FileSize = FilePosition + writedSize;
+		}
 
+		CountBytesWritten(writedSize);
+		return writedSize;
 	}
 
-	PackageInformation
-	Package::GetPackageInformation()
+	size_t
+	FileHandle::CopyFromFile(FileHandle& SourceFile, size_t SourcePosition, size_t SizeToCopy, size_t FilePosition)
 	{
-		return PackageInformation();
+		/* There is no ranged kernel copy between opened handles, so copy goes through buffer */
+		return CopyFileData(SourceFile, SourcePosition, *this, FilePosition, SizeToCopy);
 	}
 
 	bool
-	Package::GetPlatformBinary(xpckg::PackageBinaries BinaryType, std::list<std::pair<std::vector<uint8_t>, std::string>>& BinariesList)
+	FileHandle::FlushFile()
 	{
-		try {
-			std::list<std::string> PathsList;
-			if (!GetInstallPackageName(BinaryType, PathsList)) {
-				return false;
-			}
-
-			for (auto elemPackage : PathsList) {
-				std::string TempString = elemPackage;
-				ConvertToWindowsStyle(TempString);
-				BinariesList.push_back({ {}, TempString });
-
-				auto CurrentElem = BinariesList.end();
-				CurrentElem--;
-				if (!PackageZip->extractEntryToMemory(elemPackage, CurrentElem->first)) {
-					return false;
-				}
-
-			}
-		}
-		catch (...) {
-			return false;
-		}
-
-		return true;
+		CountSystemCalls(1);
+		return !!FlushFileBuffers(CurrentHandle);
 	}
 
 	bool
-	Package::GetInstallPackageName(xpckg::PackageBinaries BinaryType, std::list<std::string>& PathsList)
+	FileHandle::AllocateFile(size_t SizeToAllocate)
 	{
-		
-		try {
-			std::string PlatformString = PlatformsStringMap[BinaryType];
-			auto* valuePtr = PackageJson.get();
-			auto PackagesPaths = (*valuePtr)["platforms"];
-			auto elemType = PackagesPaths.type();
-			if (!PackagesPaths.is_object()) {
-				return false;
-			}
-
-			auto FoundedPlatformArrayObject = PackagesPaths[PlatformString];
-			if (!FoundedPlatformArrayObject.is_array()) {
-				return false;
-			}
-
-			auto arrayPlatformList = FoundedPlatformArrayObject.get_array();
-			for (auto elem : arrayPlatformList) {
-				std::string tempString = elem.get_c_str().first;
-				PathsList.push_back(tempString);
-			}
-		}
-		catch (...) {
-			return false;
-		}
-
-		return true;
+		/* Allocation size doesn't change end of file, written data does */
+		FILE_ALLOCATION_INFO AllocationInfo = {};
+		AllocationInfo.AllocationSize.QuadPart = static_cast<LONGLONG>(SizeToAllocate);
+		CountSystemCalls(1);
+		return !!SetFileInformationByHandle(CurrentHandle, FileAllocationInfo, &AllocationInfo, sizeof(AllocationInfo));
 	}
 
-
-	PackageManager::PackageManager(std::string PathToConfig)
+	const uint8_t*
+	FileHandle::MapFile()
 	{
-		if (!PathToConfig.empty()) {
-			ConfigHandle = std::make_shared<FileHandle>(PathToConfig, false);
+		if (MappedMemory != nullptr || FileSize == 0) {
+			return MappedMemory;
 		}
-	}
-
-	PackageManager::~PackageManager()
-	{
 
-	}
-
-	bool 
-	PackageManager::UnpackFile(std::vector<uint8_t>& UnpackedData, FilePointer PackageHandle)
-	{
-		uint8_t InputBuffer[CHUNK_SIZE] = {};
-		uint8_t OutputBuffer[CHUNK_SIZE] = {};
-		z_stream stream = { 0 };
-		if (!PackageHandle) {
-			return false;
+		CountSystemCalls(2);
+		MappingHandle = CreateFileMappingW(CurrentHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (MappingHandle == nullptr) {
+			return nullptr;
 		}
 
-		int result = inflateInit(&stream);
-		if (result != Z_OK) {
-			return false;
+		MappedMemory = static_cast<const uint8_t*>(MapViewOfFile(MappingHandle, FILE_MAP_READ, 0, 0, 0));
+		if (MappedMemory == nullptr) {
+			CloseHandle(MappingHandle);
+			MappingHandle = nullptr;
 		}
 
-		while (result != Z_STREAM_END) {
-			size_t ReturnSize = PackageHandle->ReadFromFile(InputBuffer, CHUNK_SIZE);
-			if (ReturnSize == -1) {
-				inflateEnd(&stream);
-				return false;
-			}
-
-			if (ReturnSize == 0) {
-				break;
-			}
+		MappedSize = MappedMemory != nullptr ? FileSize : 0;
 
-			stream.next_in = InputBuffer;
-			while (stream.avail_out == 0) {
-				stream.avail_out = CHUNK_SIZE;
-				stream.next_out = OutputBuffer;
-				result = inflate(&stream, Z_NO_FLUSH);
-				if (result == Z_NEED_DICT || result == Z_DATA_ERROR || result == Z_MEM_ERROR) {
-					inflateEnd(&stream);
-					return false;
-				}
-
-				uint32_t nbytes = CHUNK_SIZE - stream.avail_out;
-				UnpackedData.reserve(UnpackedData.size() + nbytes);
-				for (size_t i = 0; i < nbytes; i++) {
-					UnpackedData.push_back(OutputBuffer[i]);
-				}
-			}
-		}
-
-		inflateEnd(&stream);
-		return result == Z_STREAM_END;
+		return MappedMemory;
 	}
 
-	bool
-	PackageManager::UnzipFile(FilePointer ZipPointer, std::shared_ptr<zipper::Unzipper>& UnzippedData)
+	void
+	FileHandle::UnmapFile()
 	{
-		std::vector<uint8_t> dataToRead;
-		dataToRead.resize(ZipPointer->GetFileSize());
-		if (ZipPointer->ReadFromFile(dataToRead.data(), dataToRead.size()) == -1) {
-			return false;
+		if (MappedMemory != nullptr) {
+			CountSystemCalls(2);
+			UnmapViewOfFile(MappedMemory);
+			MappedMemory = nullptr;
+			MappedSize = 0;
 		}
 
-		try {
-			UnzippedData = std::make_shared<zipper::Unzipper>(dataToRead);
-		}
-		catch (...) {
-			return false;
+		if (MappingHandle != nullptr) {
+			CloseHandle(MappingHandle);
+			MappingHandle = nullptr;
 		}
-
-		return true;
 	}
 
-
-	bool 
-	PackageManager::ParseJson(
-		std::shared_ptr<simdjson::dom::element>& ParsedElement, 
-		simdjson::dom::parser& customParser,
-		std::vector<uint8_t>& UnpackedData
-	)
+	bool
+	FileHandle::SeekFile(size_t FilePosition)
 	{
-		simdjson::dom::element elem;
-
-		try {
-			elem = customParser.parse(UnpackedData.data(), UnpackedData.size());
-		}
-		catch (...) {
-			return false;
-		}
+		LARGE_INTEGER largeNumber = {};
+		largeNumber.QuadPart = FilePosition;
 
-		if (!elem.is_object()) {
-			return false;
-		}
+		DWORD ReturnValue = SetFilePointer(CurrentHandle, largeNumber.LowPart, &largeNumber.HighPart, FILE_BEGIN);
+		if (ReturnValue == INVALID_SET_FILE_POINTER) {
+			if (GetLastError() != NO_ERROR) {
+				SetLastError(0);
+			}
 
-		auto PluginId = elem["id"];
-		if (PluginId.error() || !PluginId.is_uint64()) {
 			return false;
 		}
 
-		CProximaFlake baseflake(PluginId.get_uint64());
-		//if (baseflake.GetObjectType() != CProximaFlake::ObjectType::PackageObject) {
-		//	return false;
-		//}
-
-		ParsedElement = std::make_shared<simdjson::dom::element>(elem);
 		return true;
 	}
 
-	bool 
-	PackageManager::OpenFilePackage(FilePointer& OutPointer, std::string PathToFile)
-	{
-		try {
-			OutPointer = std::make_shared<FileHandle>(PathToFile, false);
-		}
-		catch (...) {
-			return false;
-		}
-
-		return true;
-	}
 
 	bool
 	PackageManager::IsElevatedProcess()
@@ -407,86 +491,35 @@ namespace xpckg
 	}
 
 	PackageManager::ReturnCodes
-	PackageManager::InstallPackage(PackageInfo PathToPackage, xpckg::PackageBinaries BinaryType, PackagePointer PackageToInstall, PackageCallback CustomCallback)
+	PackageManager::CheckInstallRights()
 	{
-		simdjson::dom::parser thisParser;
-		std::shared_ptr<zipper::Unzipper> outZipper;
-		std::shared_ptr<simdjson::dom::element> outElem;
-		std::string PackageJsonName = "package.json";
-		std::vector<uint8_t> TempReader;
-		FilePointer PackageOutFile;
-
 		if (!IsElevatedProcess()) {
 			return ReturnCodes::PromoteToAdmin;
 		}
 
-		ConvertStringsToWindowsStyle(PathToPackage);
-
-		/* Create lambda for delete duplicate code for deleting folders */
-		auto RemoveDirs = [this](wchar_t* StaticSymlinkString) -> PackageManager::ReturnCodes {
-			/* 
-				"RemoveDirectoryW()" function needy only for non-recursive folders deleting. To process
-				more complex solution we must use "SHFileOperationW()" function with `FO_DELETE` argument.
-				Also, we must select flag for silent install because user can cancel operation.
-			*/
-			if (!RemoveDirectoryW(StaticSymlinkString)) {
-				SHFILEOPSTRUCTW ShellOperation = { nullptr, FO_DELETE, StaticSymlinkString, nullptr, FOF_SILENT | FOF_NOERRORUI | FOF_NOCONFIRMATION, FALSE, nullptr, nullptr };
-				if (!SHFileOperationW(&ShellOperation)) {
-					DWORD Error = GetLastError();
-					if (!IsElevatedProcess() && Error == ERROR_ACCESS_DENIED) {
-						return ReturnCodes::PromoteToAdmin;
-					}
-
-					return ReturnCodes::OtherError;
-				}
-			}
-
-			return ReturnCodes::NoError;
-		};
-
-		/* Open file handle to ZIP archive of package */
-		if (!OpenFilePackage(PackageOutFile, PathToPackage.SourceDirectory)) {
-			if (!IsElevatedProcess() && GetLastError() == ERROR_ACCESS_DENIED) {
-				return ReturnCodes::PromoteToAdmin;
-			}
-
-			return ReturnCodes::OtherError;
-		}
-
-		/* Unzip and unpack package to process data */
-		if (!UnzipFile(PackageOutFile, outZipper)) {
-			return ReturnCodes::PackageDamaged;
-		}
-
-		/* Try to find "package.json" file to process information about package */
-		bool IsFounded = false;
-		for (auto& entry : outZipper->entries()) {
-			if (!entry.name.compare(PackageJsonName)) {
-				IsFounded = true;
-			}
-		}
-
-		if (!IsFounded) {
-			return ReturnCodes::IsNotPackage;
-		}
+		return ReturnCodes::NoError;
+	}
 
-		if (!outZipper->extractEntryToMemory(PackageJsonName, TempReader)) {
-			return ReturnCodes::PackageDamaged;
+	PackageManager::ReturnCodes
+	PackageManager::AccessErrorCode(ReturnCodes DefaultCode)
+	{
+		if (!IsElevatedProcess() && GetLastError() == ERROR_ACCESS_DENIED) {
+			return ReturnCodes::PromoteToAdmin;
 		}
 
-		if (!ParseJson(outElem, thisParser, TempReader)) {
-			return ReturnCodes::JsonDamaged;
-		}
+		return DefaultCode;
+	}
 
-		if (PackageToInstall == nullptr) {
-			PackageToInstall = std::make_shared<Package>(outZipper, outElem);
-		}
+	PackageManager::ReturnCodes
+	PackageManager::ExtractPackage(InstallTask& Task)
+	{
+		PhaseScope FoldersPhase(Task.Stats.get(), InstallPhase::Folders);
+		PackageInfo& PathToPackage = Task.PathToPackage;
+		ConvertStringsToWindowsStyle(PathToPackage);
 
-		/* Try to get full list of plugins and binaries */
-		std::list<std::pair<std::vector<uint8_t>, std::string>> BinariesList;
-		if (!PackageToInstall->GetPlatformBinary(BinaryType, BinariesList) || BinariesList.empty()) {
-			return ReturnCodes::PackageDamaged;
-		}
+		auto RemoveDirs = [this](wchar_t* PathToRemove) -> PackageManager::ReturnCodes {
+			return RemoveDirectoryTree(PathToRemove) ? ReturnCodes::NoError : AccessErrorCode(ReturnCodes::OtherError);
+		};
 
 		/* Splil full path to string and convert to wide char */
 		std::string FullPluginDir = PathToPackage.InstallDirectory + "\\" + PathToPackage.CompanyName + "\\" + PathToPackage.PluginName;
@@ -497,6 +530,8 @@ namespace xpckg
 
 		/* Check for full path to plugin */
 		DWORD dwAttrib = GetFileAttributesW(StaticPluginString);
+		Task.IsNewPluginDir = dwAttrib == INVALID_FILE_ATTRIBUTES || !(dwAttrib & FILE_ATTRIBUTE_DIRECTORY);
+		Task.IsOldVersionStaged = false;
 		if (dwAttrib == INVALID_FILE_ATTRIBUTES) {
 			/* If doesn't exist - check for install folder */
 			FullPluginDir = PathToPackage.InstallDirectory;
@@ -552,68 +587,215 @@ namespace xpckg
 			}
 		}
 
-		auto CreateCustomDirectory = [](std::string BaseDirectory, std::string& ParsedString) -> bool {
-			std::vector<std::string> SubdirsToCreate;
+		std::string FullPathToPlugin = PathToPackage.InstallDirectory + "\\" + PathToPackage.CompanyName + "\\" + PathToPackage.PluginName;
+		Task.FullPluginDir = FullPathToPlugin;
 
-			auto CreateDirIfNotExist = [](std::string& PathDir) -> bool {
-				wchar_t TempString[2048] = {};
-				if (MultiByteToWideChar(CP_UTF8, 0, PathDir.c_str(), -1, TempString, ARRAYSIZE(TempString)) <= 0) {
-					return false;
-				}
+		/* On upgrade only changed entries are written, files dropped by new version are removed */
+		EntriesList ChangedEntries;
+		auto IsFileUnchanged = [&FullPathToPlugin](const InstalledFile& File) -> bool {
+			wchar_t StaticFileString[2048] = {};
+			std::string FullPathToFile = FullPathToPlugin + "\\" + File.Path;
+			if (MultiByteToWideChar(CP_UTF8, 0, FullPathToFile.c_str(), -1, StaticFileString, ARRAYSIZE(StaticFileString)) <= 0) {
+				return false;
+			}
 
-				DWORD dwAttrib = GetFileAttributesW(TempString);
-				if (dwAttrib == INVALID_FILE_ATTRIBUTES) {
-					if (!CreateDirectoryW(TempString, nullptr)) {
-						return false;
-					}
-				}
+			WIN32_FILE_ATTRIBUTE_DATA FileData = {};
+			if (!GetFileAttributesExW(StaticFileString, GetFileExInfoStandard, &FileData) || (FileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+				return false;
+			}
 
-				return true;
-			};
+			return ((static_cast<uint64_t>(FileData.nFileSizeHigh) << 32) | FileData.nFileSizeLow) == File.Size;
+		};
 
-			size_t ElemSize = 0;
-			size_t IndexBegin = 0;
-			for (size_t i = 0; i < ParsedString.size(); i++) {
-				if ((ParsedString[i] == '\\') && ElemSize > 0) {
-					const char* PtrToString = &ParsedString[IndexBegin];
-					SubdirsToCreate.push_back(std::string(PtrToString, ElemSize));
+		bool IsIncremental = GetChangedEntries(Task, IsFileUnchanged, ChangedEntries, Task.ObsoleteFiles);
 
-					IndexBegin = i + 1;
-					ElemSize = 0;
-					continue;
-				}
+		/*
+			Fresh install with batched durability is assembled in staging folder and swapped with plugin one.
+			Other upgrades write files under pending names and move them over old ones when all are written,
+			so failed or cancelled install leaves old version with its record.
+		*/
+		bool IsStaged = Durability == DurabilityLevel::Batched && !IsIncremental;
+		bool IsPending = !IsStaged && !Task.IsNewPluginDir;
+		bool IsPendingMoved = false;
+		const EntriesList& EntriesToWrite = IsIncremental ? ChangedEntries : Task.BinariesList;
+		EntriesList PendingEntries;
+		if (IsPending) {
+			PendingEntries.reserve(EntriesToWrite.size());
+			for (auto& [Entry, EntryPath] : EntriesToWrite) {
+				PendingEntries.emplace_back(Entry, EntryPath + PendingSuffix);
+			}
+		}
+
+		std::string TargetPath = IsStaged ? FullPathToPlugin + StagingSuffix : FullPathToPlugin;
+		wchar_t StaticTargetString[2048] = {};
+		if (MultiByteToWideChar(CP_UTF8, 0, TargetPath.c_str(), -1, StaticTargetString, ARRAYSIZE(StaticTargetString) - 1) <= 0) {
+			return ReturnCodes::OtherError;
+		}
 
-				ElemSize++;
+		if (IsStaged) {
+			RemoveDirectoryTree(StaticTargetString);
+			if (!CreateDirectoryW(StaticTargetString, nullptr)) {
+				return AccessErrorCode(ReturnCodes::IoFailed);
 			}
+		}
 
-			std::string NewPathToDir = BaseDirectory;
-			for (size_t o = 0; o < SubdirsToCreate.size(); o++) {
-				NewPathToDir += "\\";
-				NewPathToDir += SubdirsToCreate[o];
-				CreateDirIfNotExist(NewPathToDir);
+		/* All folders of package are created up front, workers only open files in them */
+		const EntriesList& EntriesToExtract = IsPending ? PendingEntries : EntriesToWrite;
+		DirectoryTree PluginFolders(nullptr, TargetPath);
+		PluginFolders.AddEntries(EntriesToExtract);
+		BeginInstallProgress(EntriesToExtract);
+		if (!PluginFolders.CreateTree()) {
+			ReturnCodes ReturnValue = AccessErrorCode(ReturnCodes::IoFailed);
+			if (IsStaged) {
+				RemoveDirectoryTree(StaticTargetString);
 			}
 
-			return true;
+			return ReturnValue;
+		}
+
+		FoldersPhase.AddEntries(PluginFolders.GetFoldersCount());
+		FoldersPhase.Stop();
+		PhaseScope ExtractPhase(Task.Stats.get(), InstallPhase::Extract);
+		ExtractPhase.AddEntries(EntriesToExtract.size());
+
+		/* Try to create and stream binaries data to files on install directory, in parallel if allowed */
+		auto PrepareTarget = [&TargetPath](const std::string& EntryPath) -> bool {
+			/* Old file can be hardlink to shared store object, so it's replaced instead of truncated */
+			wchar_t StaticFileString[2048] = {};
+			std::string FullPathToFile = TargetPath + "\\" + EntryPath;
+			if (MultiByteToWideChar(CP_UTF8, 0, FullPathToFile.c_str(), -1, StaticFileString, ARRAYSIZE(StaticFileString)) <= 0) {
+				return false;
+			}
+
+			CountSystemCalls(1);
+			return DeleteFileW(StaticFileString) || GetLastError() == ERROR_FILE_NOT_FOUND;
 		};
 
-		/* Try to create and flush binaries data to files on install directory */
-		for (auto& elem : BinariesList) {
-			std::string FullPathToObject = PathToPackage.InstallDirectory + "\\" + PathToPackage.CompanyName + "\\" + PathToPackage.PluginName;
-			CreateCustomDirectory(FullPathToObject, elem.second);
-			FullPathToObject += "\\";
-			FullPathToObject += elem.second;
+		std::atomic<bool> IsFlushFailed = { false };
+		bool IsStrict = Durability == DurabilityLevel::Strict;
+		auto OpenTarget = [&TargetPath, &PrepareTarget, &IsFlushFailed, IsStrict](const ArchiveEntry&, const std::string& EntryPath) -> FilePointer {
+			if (!PrepareTarget(EntryPath)) {
+				return nullptr;
+			}
 
-			FileHandle ThisFile = FileHandle(FullPathToObject, true);
-			if (ThisFile.WriteToFile(elem.first.data(), elem.first.size()) == -1) {
-				return ReturnCodes::IoFailed;
+			FilePointer TargetFile = std::make_shared<FileHandle>(TargetPath + "\\" + EntryPath, true);
+			return IsStrict ? FlushOnClose(std::move(TargetFile), IsFlushFailed) : TargetFile;
+		};
+
+		/* Without directory handles store gets full paths of targets */
+		EntriesList StoreEntries;
+		ArchivePointer SourceArchive = Task.PackageToInstall->GetArchive();
+		bool IsExtracted = false;
+		if (SharedStore != nullptr) {
+			auto PrepareStoreTarget = [&TargetPath, &PrepareTarget](const std::string& FullTargetPath) -> bool {
+				return PrepareTarget(FullTargetPath.substr(TargetPath.size() + 1));
+			};
+
+			StoreEntries.reserve(EntriesToExtract.size());
+			for (auto& [Entry, EntryPath] : EntriesToExtract) {
+				StoreEntries.emplace_back(Entry, TargetPath + "\\" + EntryPath);
+			}
+
+			IsExtracted = SharedStore->InstallEntries(*SourceArchive, StoreEntries, nullptr, PrepareStoreTarget, GetExtractPool(), BufferSize);
+		} else {
+			IsExtracted = SourceArchive->ExtractEntries(EntriesToExtract, OpenTarget, GetExtractPool(), BufferSize);
+		}
+
+		ExtractPhase.Stop();
+		PhaseScope FlushPhase(Task.Stats.get(), InstallPhase::Flush);
+
+		/*
+			Regular user can't flush whole volume, so batched mode flushes written files one
+			after another at the end: most of data is already on its way to disk by then.
+			Store targets are links or copies made by system, they are flushed the same way.
+		*/
+		bool IsDurable = IsExtracted;
+		bool IsFlushByPath = Durability == DurabilityLevel::Batched || (IsStrict && SharedStore != nullptr);
+		if (IsDurable && IsFlushByPath) {
+			for (auto& [Entry, EntryPath] : EntriesToExtract) {
+				IsDurable = IsDurable && FlushFileByPath(TargetPath + "\\" + EntryPath);
 			}
 		}
 
+		/* After exchange staging folder holds old version, link stage removes it */
+		IsDurable = IsDurable && !IsFlushFailed;
+		if (IsDurable && IsStaged) {
+			IsDurable = ExchangeFolders(TargetPath, FullPathToPlugin);
+			Task.IsOldVersionStaged = IsDurable;
+		}
+
+		/* The first move makes folder differ from old record */
+		if (IsDurable && IsPending) {
+			IsPendingMoved = true;
+			IsDurable = MovePendingFiles(TargetPath, PendingEntries, EntriesToWrite);
+		}
+
+		/* Only what this install created is removed, see "InstallTask" */
+		if (!IsDurable) {
+			if (IsStaged) {
+				RemoveDirectoryTree(StaticTargetString);
+			}
+
+			for (auto& [Entry, PendingPath] : PendingEntries) {
+				wchar_t StaticFileString[2048] = {};
+				std::string FullPathToFile = TargetPath + "\\" + PendingPath;
+				if (MultiByteToWideChar(CP_UTF8, 0, FullPathToFile.c_str(), -1, StaticFileString, ARRAYSIZE(StaticFileString)) > 0) {
+					DeleteFileW(StaticFileString);
+				}
+			}
+
+			if (Task.IsNewPluginDir) {
+				RemoveFolderByPath(FullPathToPlugin);
+			} else if (!IsStaged && (PendingEntries.empty() || IsPendingMoved)) {
+				ForgetInstalledPackage(FullPathToPlugin);
+			}
+
+			return SourceArchive->IsIntegrityFailed() ? ReturnCodes::IntegrityCheckFailed : ReturnCodes::IoFailed;
+		}
+
+		return ReturnCodes::NoError;
+	}
+
+	PackageManager::ReturnCodes
+	PackageManager::LinkPackage(InstallTask& Task)
+	{
+		PhaseScope Phase(Task.Stats.get(), InstallPhase::Link);
+		PackageInfo& PathToPackage = Task.PathToPackage;
+		auto RemoveDirs = [this](wchar_t* PathToRemove) -> PackageManager::ReturnCodes {
+			return RemoveDirectoryTree(PathToRemove) ? ReturnCodes::NoError : AccessErrorCode(ReturnCodes::OtherError);
+		};
+
+		wchar_t StaticPluginString[2048] = {};
+		if (MultiByteToWideChar(CP_UTF8, 0, Task.FullPluginDir.c_str(), -1, StaticPluginString, ARRAYSIZE(StaticPluginString)) <= 0) {
+			return ReturnCodes::OtherError;
+		}
+
+		/* Undo install as "InstallTask" says: old version is put back, new folder is removed */
+		std::string StagingPath = Task.FullPluginDir + StagingSuffix;
+		auto RevertPluginDir = [this, &Task, &StagingPath]() {
+			if (Task.IsOldVersionStaged && ExchangeFolders(StagingPath, Task.FullPluginDir)) {
+				Task.IsOldVersionStaged = false;
+				RemoveFolderByPath(StagingPath);
+				if (Task.IsNewPluginDir) {
+					RemoveFolderByPath(Task.FullPluginDir);
+				}
+
+				return;
+			}
+
+			if (Task.IsNewPluginDir && !Task.IsOldVersionStaged) {
+				RemoveFolderByPath(Task.FullPluginDir);
+			} else {
+				ForgetInstalledPackage(Task.FullPluginDir);
+			}
+		};
+
+		DWORD dwAttrib = 0;
 		wchar_t StaticSymlinkString[2048] = {};
 
 		std::string SymlinkCompanyDir = PathToPackage.SymlinkDirectory;
 		if (MultiByteToWideChar(CP_UTF8, 0, SymlinkCompanyDir.c_str(), -1, StaticSymlinkString, ARRAYSIZE(StaticSymlinkString)) <= 0) {
-			RemoveDirs(StaticPluginString);
+			RevertPluginDir();
 			return ReturnCodes::OtherError;
 		}
 
@@ -630,7 +812,7 @@ namespace xpckg
 
 		SymlinkCompanyDir = PathToPackage.SymlinkDirectory + "\\" + PathToPackage.CompanyName;
 		if (MultiByteToWideChar(CP_UTF8, 0, SymlinkCompanyDir.c_str(), -1, StaticSymlinkString, ARRAYSIZE(StaticSymlinkString)) <= 0) {
-			RemoveDirs(StaticPluginString);
+			RevertPluginDir();
 			return ReturnCodes::OtherError;
 		}
 
@@ -648,7 +830,7 @@ namespace xpckg
 		/* Convert UTF-8 symlink path to UTF-16 */
 		std::string FullSymlink = PathToPackage.SymlinkDirectory + "\\" + PathToPackage.CompanyName + "\\" + PathToPackage.PluginName;
 		if (MultiByteToWideChar(CP_UTF8, 0, FullSymlink.c_str(), -1, StaticSymlinkString, ARRAYSIZE(StaticSymlinkString)) <= 0) {
-			RemoveDirs(StaticPluginString);
+			RevertPluginDir();
 			return ReturnCodes::OtherError;
 		}
 
@@ -660,12 +842,13 @@ namespace xpckg
 		if (dwAttrib != INVALID_FILE_ATTRIBUTES && (dwAttrib & FILE_ATTRIBUTE_DIRECTORY)) {
 			auto ret = RemoveDirs(StaticSymlinkString);
 			if (ret != ReturnCodes::NoError) {
-				RemoveDirs(StaticPluginString);
+				RevertPluginDir();
 				return ret;
 			}
 		}
 
 		/* Create symlink to installation path of package and process it */
+		CountSystemCalls(1);
 		if (!CreateSymbolicLinkW(StaticSymlinkString, StaticPluginString, SYMBOLIC_LINK_FLAG_DIRECTORY)) {
 			DWORD Error = GetLastError();
 			ReturnCodes ReturnValue = ReturnCodes::NoError;
@@ -675,26 +858,228 @@ namespace xpckg
 				ReturnValue = ReturnCodes::OtherError;
 			}
 
-			RemoveDirs(StaticPluginString);
+			RevertPluginDir();
 			RemoveDirs(StaticSymlinkString);
 			return ReturnValue;
 		}
 
 		/* Custom process callback from plugin's company holder */
-		if (CustomCallback) {
-			if (!CustomCallback(&PathToPackage, BinaryType)) {
-				RemoveDirs(StaticPluginString);
+		if (Task.CustomCallback) {
+			if (!Task.CustomCallback(&PathToPackage, Task.BinaryType)) {
+				RevertPluginDir();
 				RemoveDirs(StaticSymlinkString);
 				return ReturnCodes::AfterInstallationOperationFailed;
 			}
 		}
 
+		/* Old version isn't needed any more */
+		if (Task.IsOldVersionStaged) {
+			RemoveFolderByPath(StagingPath);
+			Task.IsOldVersionStaged = false;
+		}
+
+		/* Failed install keeps files of old version, they go only now, right before new record */
+		for (auto& ObsoleteFile : Task.ObsoleteFiles) {
+			wchar_t StaticFileString[2048] = {};
+			std::string FullPathToFile = Task.FullPluginDir + "\\" + ObsoleteFile;
+			if (MultiByteToWideChar(CP_UTF8, 0, FullPathToFile.c_str(), -1, StaticFileString, ARRAYSIZE(StaticFileString)) > 0) {
+				DeleteFileW(StaticFileString);
+			}
+		}
+
+		/* Remember what was installed; failure here doesn't break already installed package */
+		RegisterPackage(Task.PackageToInstall, Task.BinaryType, Task.FullPluginDir, Task.BinariesList);
+
+		Phase.AddEntries(1);
 		return ReturnCodes::NoError;
 	}
 
+	/* Names of files and folders inside folder, without "." and ".." */
+	static void
+	ListFolderItems(const std::string& FolderPath, std::vector<std::string>& OutItems)
+	{
+		std::wstring WideMask;
+		if (!ConvertToWidePath(FolderPath + "\\*", WideMask)) {
+			return;
+		}
+
+		WIN32_FIND_DATAW FindData = {};
+		HANDLE FindHandle = FindFirstFileExW(WideMask.c_str(), FindExInfoBasic, &FindData, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+		if (FindHandle == INVALID_HANDLE_VALUE) {
+			return;
+		}
+
+		do {
+			if (!wcscmp(FindData.cFileName, L".") || !wcscmp(FindData.cFileName, L"..")) {
+				continue;
+			}
+
+			char StaticNameString[1024] = {};
+			if (WideCharToMultiByte(CP_UTF8, 0, FindData.cFileName, -1, StaticNameString, ARRAYSIZE(StaticNameString), nullptr, nullptr) > 0) {
+				OutItems.emplace_back(StaticNameString);
+			}
+		} while (FindNextFileW(FindHandle, &FindData));
+
+		FindClose(FindHandle);
+	}
+
+	/* Folder renamed aside by package deletion, its parts are removed by different pool tasks */
+	struct RemovedFolder
+	{
+		std::string Path;
+		std::vector<std::string> Parts;		// installed files or top-level items of folder
+		bool IsFilesList = false;
+		std::atomic<size_t> BatchesLeft = { 0 };
+	};
+
+	static void
+	RemoveFolderParts(RemovedFolder& Folder, size_t FirstPart, size_t LastPart)
+	{
+		for (size_t i = FirstPart; i < LastPart; i++) {
+			std::wstring WidePath;
+			if (!ConvertToWidePath(Folder.Path + "\\" + Folder.Parts[i], WidePath)) {
+				continue;
+			}
+
+			/* Read-only files stay, shell removal of what is left handles them */
+			DWORD dwAttrib = Folder.IsFilesList ? 0 : GetFileAttributesW(WidePath.c_str());
+			if (dwAttrib == INVALID_FILE_ATTRIBUTES) {
+				continue;
+			}
+
+			if (!(dwAttrib & FILE_ATTRIBUTE_DIRECTORY)) {
+				DeleteFileW(WidePath.c_str());
+			} else if (dwAttrib & FILE_ATTRIBUTE_REPARSE_POINT) {
+				RemoveDirectoryW(WidePath.c_str());
+			} else {
+				RemoveDirectoryTree(WidePath.data());
+			}
+		}
+	}
+
+	/*
+		Remove folder in background: listed files (or top-level items if there is no list) are
+		split into batches for pool workers, the last finished batch removes what is left -
+		folders and files which were created after install. Errors are ignored, folder is
+		hidden already and next deletion of the same plugin picks up leftovers.
+	*/
+	static void
+	ReclaimFolder(ThreadPool* Pool, const std::string& FolderPath, std::vector<std::string> Files)
+	{
+		auto Folder = std::make_shared<RemovedFolder>();
+		Folder->Path = FolderPath;
+		Folder->IsFilesList = !Files.empty();
+		Folder->Parts = std::move(Files);
+		if (!Folder->IsFilesList) {
+			ListFolderItems(FolderPath, Folder->Parts);
+		}
+
+		size_t BatchesCount = (Folder->Parts.size() + RemoveBatchSize - 1) / RemoveBatchSize;
+		Folder->BatchesLeft = std::max<size_t>(BatchesCount, 1);
+
+		auto RemoveBatch = [Folder](size_t BatchIndex) {
+			size_t FirstPart = BatchIndex * RemoveBatchSize;
+			RemoveFolderParts(*Folder, FirstPart, std::min(FirstPart + RemoveBatchSize, Folder->Parts.size()));
+			std::wstring WideFolderPath;
+			if (--Folder->BatchesLeft == 0 && ConvertToWidePath(Folder->Path, WideFolderPath)) {
+				RemoveDirectoryTree(WideFolderPath.data());
+			}
+		};
+
+		if (BatchesCount == 0) {
+			Pool->Submit([RemoveBatch]() { RemoveBatch(0); });
+		}
+
+		for (size_t i = 0; i < BatchesCount; i++) {
+			Pool->Submit([RemoveBatch, i]() { RemoveBatch(i); });
+		}
+	}
+
 	PackageManager::ReturnCodes
 	PackageManager::DeletePackage(PackageInfo PathToPackage, xpckg::PackageBinaries BinaryType, DeleteCallback CustomCallback)
 	{
+		ReturnCodes ReturnValue = CheckInstallRights();
+		if (ReturnValue != ReturnCodes::NoError) {
+			return ReturnValue;
+		}
+
+		ConvertStringsToWindowsStyle(PathToPackage);
+		std::string CompanyPath = PathToPackage.InstallDirectory + "\\" + PathToPackage.CompanyName;
+		std::string FullPluginDir = CompanyPath + "\\" + PathToPackage.PluginName;
+		std::wstring WidePluginPath;
+		std::wstring WideSymlinkPath;
+		if (!ConvertToWidePath(FullPluginDir, WidePluginPath) ||
+			!ConvertToWidePath(PathToPackage.SymlinkDirectory + "\\" + PathToPackage.CompanyName + "\\" + PathToPackage.PluginName, WideSymlinkPath)) {
+			return ReturnCodes::OtherError;
+		}
+
+		if (CustomCallback && !CustomCallback(&PathToPackage, BinaryType)) {
+			return ReturnCodes::AfterInstallationOperationFailed;
+		}
+
+		/* Only symlink is removed, folder or file with that name wasn't created by us */
+		DWORD dwAttrib = GetFileAttributesW(WideSymlinkPath.c_str());
+		if (dwAttrib != INVALID_FILE_ATTRIBUTES && (dwAttrib & FILE_ATTRIBUTE_REPARSE_POINT)) {
+			bool IsUnlinked = !!((dwAttrib & FILE_ATTRIBUTE_DIRECTORY) ? RemoveDirectoryW(WideSymlinkPath.c_str()) : DeleteFileW(WideSymlinkPath.c_str()));
+			if (!IsUnlinked) {
+				return AccessErrorCode(ReturnCodes::OtherError);
+			}
+		}
+
+		/* Move to existing folder fails, so every leftover folder just takes one more attempt */
+		InstalledPackage PackageRecord = {};
+		bool IsRegistered = FindInstalledPackage(FullPluginDir, PackageRecord);
+		std::string RemovedName;
+		bool IsMoved = false;
+		DWORD MoveError = ERROR_SUCCESS;
+		for (size_t i = 0; i < MaxRemovedFolders; i++) {
+			std::wstring WideRemovedPath;
+			RemovedName = PathToPackage.PluginName + RemovedSuffix + std::to_string(i);
+			if (!ConvertToWidePath(CompanyPath + "\\" + RemovedName, WideRemovedPath)) {
+				return ReturnCodes::OtherError;
+			}
+
+			IsMoved = !!MoveFileExW(WidePluginPath.c_str(), WideRemovedPath.c_str(), 0);
+			MoveError = IsMoved ? ERROR_SUCCESS : GetLastError();
+			if (IsMoved || (MoveError != ERROR_ALREADY_EXISTS && MoveError != ERROR_FILE_EXISTS)) {
+				break;
+			}
+		}
+
+		if (!IsMoved && MoveError != ERROR_FILE_NOT_FOUND && MoveError != ERROR_PATH_NOT_FOUND) {
+			return AccessErrorCode(ReturnCodes::IoFailed);
+		}
+
+		/* Folders left by crashed process or failed removal are reclaimed too, by walking them */
+		std::vector<std::string> RemovedFolders;
+		std::vector<std::string> CompanyItems;
+		ListFolderItems(CompanyPath, CompanyItems);
+		for (auto& ItemName : CompanyItems) {
+			if (IsRemovedFolder(ItemName, PathToPackage.PluginName) && (!IsMoved || ItemName != RemovedName)) {
+				RemovedFolders.push_back(ItemName);
+			}
+		}
+
+		if (IsMoved) {
+			std::vector<std::string> RemovedFiles;
+			if (IsRegistered) {
+				RemovedFiles.reserve(PackageRecord.Files.size());
+				for (auto& File : PackageRecord.Files) {
+					RemovedFiles.push_back(File.Path);
+				}
+			}
+
+			ReclaimFolder(GetRemovePool(), CompanyPath + "\\" + RemovedName, std::move(RemovedFiles));
+		}
+
+		for (auto& FolderName : RemovedFolders) {
+			ReclaimFolder(GetRemovePool(), CompanyPath + "\\" + FolderName, {});
+		}
+
+		if (IsRegistered) {
+			ConfigRegistry->RemovePackage(PackageRecord.Id);
+		}
+
 		return ReturnCodes::NoError;
 	}
 };
@@ -1 +1,1017 @@
-#include "xpackage.h"
\ No newline at end of file
+/*********************************************************
+* Copyright (C) Suirless, 2020-2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: platform independent part of package manager
+*********************************************************/
+#include "xpackage_internal.h"
+#include "zlib.h"
+
+namespace xpckg
+{
+	/* Packages waiting between two install stages, every one of them keeps mapped archive */
+	constexpr size_t InstallQueueDepth = 2;
+
+	/* Asynchronous installs running at once, their extraction is spread over extract pool anyway */
+	constexpr size_t AsyncInstallsCount = 4;
+
+	/* Files of package are complete after this stage, install can't be cancelled later */
+	constexpr size_t ExtractStageIndex = 3;
+
+	/* Removal is bound by file system metadata locks, more threads only fight for them */
+	constexpr size_t RemoveThreadsCount = 4;
+
+	thread_local InstallControl* CurrentControl = nullptr;
+
+	/* Manifest values of render systems and hosts, lists are short so lookup is linear */
+	static const std::pair<std::string_view, RenderSystems> RenderSystemsList[] = {
+		{ "gdi", RenderSystems::SoftwareGDI },
+		{ "nsview", RenderSystems::SoftwareNSView },
+		{ "d3d9", RenderSystems::Direct3D9 },
+		{ "d3d10", RenderSystems::Direct3D10 },
+		{ "d3d11", RenderSystems::Direct3D11 },
+		{ "opengl", RenderSystems::OpenGL },
+		{ "vulkan", RenderSystems::Vulkan },
+		{ "metal", RenderSystems::Metal }
+	};
+
+	static const std::pair<std::string_view, Hosts> HostsList[] = {
+		{ "vst", Hosts::VST },
+		{ "vst3", Hosts::VST3 },
+		{ "aax", Hosts::AAX },
+		{ "au", Hosts::AU }
+	};
+
+	/* Document of parsed manifest, element handed out to users shares ownership of it */
+	struct ManifestDocument
+	{
+		simdjson::dom::document Document;
+		simdjson::dom::element Root;
+	};
+
+	std::unordered_map<std::string, PackageBinaries> BinaryPlatformsMap = {
+		{ "win_x86", PackageBinaries::BinariesWindows_x86 },
+		{ "win_x64", PackageBinaries::BinariesWindows_x64 },
+		{ "win_arm64", PackageBinaries::BinariesWindows_ARM64},
+		{ "macOS_x86", PackageBinaries::BinariesMacOS_x86 },
+		{ "macOS_x64", PackageBinaries::BinariesMacOS_x64 },
+		{ "macOS_arm64", PackageBinaries::BinariesMacOS_ARM64 },
+		{ "macOS_uni_x64_arm", PackageBinaries::UniversalMacOS_x64_ARM64 },
+		{ "macOS_uni_x64_x86" , PackageBinaries::UniversalMacOS_x64_x86 }
+	};
+
+	std::unordered_map<PackageBinaries, std::string> PlatformsStringMap = {
+		{ PackageBinaries::BinariesWindows_x86, "win_x86" },
+		{ PackageBinaries::BinariesWindows_x64, "win_x64" },
+		{ PackageBinaries::BinariesWindows_ARM64, "win_arm64" },
+		{ PackageBinaries::BinariesMacOS_x86, "macOS_x86" },
+		{ PackageBinaries::BinariesMacOS_x64, "macOS_x64" },
+		{ PackageBinaries::BinariesMacOS_ARM64, "macOS_arm64" },
+		{ PackageBinaries::UniversalMacOS_x64_ARM64, "macOS_uni_x64_arm" },
+		{ PackageBinaries::UniversalMacOS_x64_x86, "macOS_uni_x64_x86" }
+	};
+
+	bool
+	IsSafeEntryPath(std::string_view Path)
+	{
+		if (Path.empty() || (Path.size() >= 2 && Path[1] == ':')) {
+			return false;
+		}
+
+		size_t Offset = 0;
+		while (Offset <= Path.size()) {
+			size_t NextOffset = Path.find('/', Offset);
+			if (NextOffset == std::string_view::npos) {
+				NextOffset = Path.size();
+			}
+
+			std::string_view Component = Path.substr(Offset, NextOffset - Offset);
+			if (Component.empty() || Component == "." || Component == ".." || Component.find('\\') != std::string_view::npos) {
+				return false;
+			}
+
+			Offset = NextOffset + 1;
+		}
+
+		return true;
+	}
+
+	Package::Package(ArchivePointer ZipFile, std::shared_ptr<simdjson::dom::element> jsonElem)
+	{
+		PackageArchive = ZipFile;
+		PackageJson = jsonElem;
+	}
+
+	Package::~Package()
+	{
+
+	}
+
+	PackageInformation
+	Package::GetPackageInformation()
+	{
+		if (Information == nullptr) {
+			Information = std::make_shared<PackageInformation>(PackageJson);
+		}
+
+		return *Information;
+	}
+
+	bool
+	Package::GetPlatformBinary(xpckg::PackageBinaries BinaryType, std::list<std::pair<std::vector<uint8_t>, std::string>>& BinariesList)
+	{
+		try {
+			std::list<std::string> PathsList;
+			if (!GetInstallPackageName(BinaryType, PathsList)) {
+				return false;
+			}
+
+			for (auto elemPackage : PathsList) {
+				if (!IsSafeEntryPath(elemPackage)) {
+					return false;
+				}
+
+				std::string TempString = elemPackage;
+				ConvertToNativeStyle(TempString);
+				BinariesList.push_back({ {}, TempString });
+
+				auto CurrentElem = BinariesList.end();
+				CurrentElem--;
+				if (!PackageArchive->ExtractEntryToMemory(elemPackage, CurrentElem->first)) {
+					return false;
+				}
+
+			}
+		}
+		catch (...) {
+			return false;
+		}
+
+		return true;
+	}
+
+	bool
+	Package::GetPlatformEntries(xpckg::PackageBinaries BinaryType, EntriesList& OutEntries)
+	{
+		std::list<std::string> PathsList;
+		if (!GetInstallPackageName(BinaryType, PathsList)) {
+			return false;
+		}
+
+		OutEntries.reserve(OutEntries.size() + PathsList.size());
+		for (auto& elemPackage : PathsList) {
+			/* Name is joined to plugin folder, so it must not point outside of it */
+			if (!IsSafeEntryPath(elemPackage)) {
+				return false;
+			}
+
+			/* Native index knows platforms of entry, manifest which disagrees with it belongs to other package */
+			const ArchiveEntry* Entry = PackageArchive->FindEntry(elemPackage);
+			if (Entry == nullptr || (Entry->PlatformMask != 0 && !(Entry->PlatformMask & static_cast<uint32_t>(BinaryType)))) {
+				return false;
+			}
+
+			ConvertToNativeStyle(elemPackage);
+			OutEntries.emplace_back(Entry, std::move(elemPackage));
+		}
+
+		return true;
+	}
+
+	ArchivePointer
+	Package::GetArchive()
+	{
+		return PackageArchive;
+	}
+
+	std::shared_ptr<simdjson::dom::element>
+	Package::GetManifest()
+	{
+		return PackageJson;
+	}
+
+	bool
+	Package::GetInstallPackageName(xpckg::PackageBinaries BinaryType, std::list<std::string>& PathsList)
+	{
+
+		try {
+			std::string PlatformString = PlatformsStringMap[BinaryType];
+			auto* valuePtr = PackageJson.get();
+			auto PackagesPaths = (*valuePtr)["platforms"];
+			if (!PackagesPaths.is_object()) {
+				return false;
+			}
+
+			auto FoundedPlatformArrayObject = PackagesPaths[PlatformString];
+			if (!FoundedPlatformArrayObject.is_array()) {
+				return false;
+			}
+
+			auto arrayPlatformList = FoundedPlatformArrayObject.get_array();
+			for (auto elem : arrayPlatformList) {
+				std::string tempString = elem.get_c_str().value();
+				PathsList.push_back(tempString);
+			}
+		}
+		catch (...) {
+			return false;
+		}
+
+		return true;
+	}
+
+
+	PackageInformation::PackageInformation(std::shared_ptr<simdjson::dom::element> ManifestElement)
+	{
+		Manifest = ManifestElement;
+		simdjson::dom::object ManifestObject;
+		if (Manifest == nullptr || Manifest->get(ManifestObject)) {
+			return;
+		}
+
+		/* Fields are optional, missing or mistyped ones stay empty */
+		auto GetField = [&ManifestObject](const char* FieldName, auto& OutValue) {
+			if (ManifestObject[FieldName].get(OutValue) != simdjson::SUCCESS) {
+				OutValue = {};
+			}
+		};
+
+		GetField("id", Id);
+		GetField("name", Name);
+		GetField("description", Description);
+		GetField("version", Version);
+
+		/* Every platform key gives binary type, and system is derived from it */
+		simdjson::dom::object PlatformsObject;
+		if (!ManifestObject["platforms"].get(PlatformsObject)) {
+			for (auto [PlatformKey, PlatformValue] : PlatformsObject) {
+				for (auto& [PlatformString, BinaryType] : BinaryPlatformsMap) {
+					if (PlatformKey != PlatformString) {
+						continue;
+					}
+
+					Binaries |= static_cast<size_t>(BinaryType);
+					Systems |= static_cast<size_t>(PlatformString.compare(0, 4, "win_") == 0 ? PackageSystems::WindowsPlatform : PackageSystems::MacOSPlatform);
+				}
+			}
+		}
+
+		auto CollectMask = [&ManifestObject](const char* FieldName, const auto& ValuesList) -> size_t {
+			size_t Mask = 0;
+			simdjson::dom::array ValuesArray;
+			if (ManifestObject[FieldName].get(ValuesArray)) {
+				return Mask;
+			}
+
+			for (auto ArrayElement : ValuesArray) {
+				std::string_view ValueString;
+				if (ArrayElement.get(ValueString)) {
+					continue;
+				}
+
+				for (auto& [ListString, ListValue] : ValuesList) {
+					if (ValueString == ListString) {
+						Mask |= static_cast<size_t>(ListValue);
+					}
+				}
+			}
+
+			return Mask;
+		};
+
+		Renders = CollectMask("renders", RenderSystemsList);
+		Hosts = CollectMask("hosts", HostsList);
+	}
+
+	uint64_t
+	PackageInformation::GetId()
+	{
+		return Id;
+	}
+
+	std::string_view
+	PackageInformation::GetName()
+	{
+		return Name;
+	}
+
+	std::string_view
+	PackageInformation::GetDescription()
+	{
+		return Description;
+	}
+
+	std::string_view
+	PackageInformation::GetVersion()
+	{
+		return Version;
+	}
+
+	size_t
+	PackageInformation::GetBinaries()
+	{
+		return Binaries;
+	}
+
+	size_t
+	PackageInformation::GetSystems()
+	{
+		return Systems;
+	}
+
+	size_t
+	PackageInformation::GetRenders()
+	{
+		return Renders;
+	}
+
+	size_t
+	PackageInformation::GetHosts()
+	{
+		return Hosts;
+	}
+
+	PackageManager::PackageManager(std::string PathToConfig)
+	{
+		if (PathToConfig.empty()) {
+			return;
+		}
+
+		/*
+			Config file of older versions isn't a registry. It's left as is and database
+			is kept next to it; without any database manager still installs packages.
+		*/
+		try {
+			ConfigRegistry = std::make_shared<PackageRegistry>(PathToConfig);
+		}
+		catch (...) {
+			try {
+				ConfigRegistry = std::make_shared<PackageRegistry>(PathToConfig + ".registry");
+			}
+			catch (...) {
+				ConfigRegistry = nullptr;
+			}
+		}
+	}
+
+	PackageManager::~PackageManager()
+	{
+		/* Pending asynchronous installs and removals finish while the rest of manager is still alive */
+		AsyncPool = nullptr;
+		RemovePool = nullptr;
+	}
+
+	bool
+	PackageManager::RegisterPackage(PackagePointer PackageToRegister, xpckg::PackageBinaries BinaryType, const std::string& FullPluginDir, const EntriesList& InstalledEntries)
+	{
+		if (ConfigRegistry == nullptr) {
+			return true;
+		}
+
+		PackageInformation Information = PackageToRegister->GetPackageInformation();
+		InstalledPackage NewPackage = {};
+		NewPackage.Id = Information.GetId();
+		NewPackage.Version = std::string(Information.GetVersion());
+		NewPackage.Platform = BinaryType;
+		NewPackage.InstallDirectory = FullPluginDir;
+		NewPackage.Files.reserve(InstalledEntries.size());
+		for (auto& [Entry, EntryPath] : InstalledEntries) {
+			NewPackage.Files.push_back(InstalledFile{ EntryPath, Entry->UncompressedSize, Entry->Crc32 });
+		}
+
+		return ConfigRegistry->PutPackage(NewPackage);
+	}
+
+	bool
+	PackageManager::GetChangedEntries(InstallTask& Task, const std::function<bool(const InstalledFile& File)>& IsFileUnchanged, EntriesList& OutEntries, std::vector<std::string>& OutObsoleteFiles)
+	{
+		if (!IsIncrementalInstall || ConfigRegistry == nullptr) {
+			return false;
+		}
+
+		/* Previous record is useful only if it describes the same platform in the same folder */
+		InstalledPackage PreviousPackage = {};
+		uint64_t PackageId = Task.PackageToInstall->GetPackageInformation().GetId();
+		if (!ConfigRegistry->FindPackage(PackageId, PreviousPackage) || PreviousPackage.Platform != Task.BinaryType ||
+			PreviousPackage.InstallDirectory != Task.FullPluginDir) {
+			return false;
+		}
+
+		std::unordered_map<std::string_view, const InstalledFile*> PreviousFiles;
+		PreviousFiles.reserve(PreviousPackage.Files.size());
+		for (auto& File : PreviousPackage.Files) {
+			PreviousFiles.emplace(File.Path, &File);
+		}
+
+		/* Central directory already has size and CRC, so unchanged entry costs lookup and stat only */
+		for (auto& [Entry, EntryPath] : Task.BinariesList) {
+			auto FileIt = PreviousFiles.find(EntryPath);
+			if (FileIt == PreviousFiles.end()) {
+				OutEntries.emplace_back(Entry, EntryPath);
+				continue;
+			}
+
+			const InstalledFile& File = *FileIt->second;
+			PreviousFiles.erase(FileIt);
+			if (File.Size != Entry->UncompressedSize || File.Crc32 != Entry->Crc32 || !IsFileUnchanged(File)) {
+				OutEntries.emplace_back(Entry, EntryPath);
+			}
+		}
+
+		for (auto& [FilePath, File] : PreviousFiles) {
+			OutObsoleteFiles.emplace_back(FilePath);
+		}
+
+		return true;
+	}
+
+	bool
+	PackageManager::FindInstalledPackage(const std::string& FullPluginDir, InstalledPackage& OutPackage)
+	{
+		if (ConfigRegistry == nullptr) {
+			return false;
+		}
+
+		/* Registry is keyed by id, but deletion knows only folder, so records are checked one by one */
+		std::vector<uint64_t> PackagesIds;
+		ConfigRegistry->GetPackagesIds(PackagesIds);
+		for (uint64_t PackageId : PackagesIds) {
+			if (ConfigRegistry->FindPackage(PackageId, OutPackage) && OutPackage.InstallDirectory == FullPluginDir) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void
+	PackageManager::ForgetInstalledPackage(const std::string& FullPluginDir)
+	{
+		InstalledPackage OldPackage = {};
+		if (FindInstalledPackage(FullPluginDir, OldPackage)) {
+			ConfigRegistry->RemovePackage(OldPackage.Id);
+		}
+	}
+
+	bool
+	IsRemovedFolder(std::string_view FolderName, std::string_view PluginName)
+	{
+		std::string_view Suffix = RemovedSuffix;
+		if (FolderName.size() <= PluginName.size() + Suffix.size() || FolderName.substr(0, PluginName.size()) != PluginName ||
+			FolderName.substr(PluginName.size(), Suffix.size()) != Suffix) {
+			return false;
+		}
+
+		std::string_view Number = FolderName.substr(PluginName.size() + Suffix.size());
+		return std::all_of(Number.begin(), Number.end(), [](char Symbol) { return Symbol >= '0' && Symbol <= '9'; });
+	}
+
+	bool
+	PackageManager::IsPackageInstalled(uint64_t PackageId)
+	{
+		return ConfigRegistry != nullptr && ConfigRegistry->ContainsPackage(PackageId);
+	}
+
+	bool
+	PackageManager::GetInstalledPackage(uint64_t PackageId, InstalledPackage& OutPackage)
+	{
+		return ConfigRegistry != nullptr && ConfigRegistry->FindPackage(PackageId, OutPackage);
+	}
+
+	void
+	PackageManager::GetInstalledPackages(std::vector<uint64_t>& OutIds)
+	{
+		if (ConfigRegistry != nullptr) {
+			ConfigRegistry->GetPackagesIds(OutIds);
+		}
+	}
+
+	void
+	PackageManager::SetThreadsCount(size_t NewThreadsCount)
+	{
+		ThreadsCount = NewThreadsCount;
+		ExtractPool = nullptr;
+	}
+
+	FilePointer
+	FlushOnClose(FilePointer TargetFile, std::atomic<bool>& IsFlushFailed)
+	{
+		/* Deleter owns real pointer, so file is flushed when the last user drops it */
+		FileHandle* RawFile = TargetFile.get();
+		return FilePointer(RawFile, [Owner = std::move(TargetFile), &IsFlushFailed](FileHandle* File) mutable {
+			if (!File->FlushFile()) {
+				IsFlushFailed = true;
+			}
+
+			Owner.reset();
+		});
+	}
+
+	ThreadPool*
+	PackageManager::GetExtractPool()
+	{
+		if (ThreadsCount == 1) {
+			return nullptr;
+		}
+
+		if (ExtractPool == nullptr) {
+			ExtractPool = std::make_shared<ThreadPool>(ThreadsCount);
+		}
+
+		return ExtractPool.get();
+	}
+
+	ThreadPool*
+	PackageManager::GetRemovePool()
+	{
+		if (RemovePool == nullptr) {
+			RemovePool = std::make_shared<ThreadPool>(RemoveThreadsCount);
+		}
+
+		return RemovePool.get();
+	}
+
+	void
+	PackageManager::SetBufferSize(size_t NewBufferSize)
+	{
+		BufferSize = std::max<size_t>(NewBufferSize, 64 * 1024);
+	}
+
+	void
+	PackageManager::SetIncrementalInstall(bool bIncremental)
+	{
+		IsIncrementalInstall = bIncremental;
+	}
+
+	void
+	PackageManager::SetBatchedWrites(bool bBatched)
+	{
+		IsBatchedWrites = bBatched;
+	}
+
+	void
+	PackageManager::SetDurability(DurabilityLevel NewDurability)
+	{
+		Durability = NewDurability;
+	}
+
+	void
+	PackageManager::SetInstallStats(bool bEnabled)
+	{
+		IsInstallStats = bEnabled;
+	}
+
+	void
+	PackageManager::GetInstallStats(std::vector<InstallStats>& OutStats)
+	{
+		std::lock_guard<std::mutex> Lock(StatsMutex);
+		OutStats = std::move(CollectedStats);
+		CollectedStats.clear();
+	}
+
+	void
+	PackageManager::CollectInstallStats(InstallTask& Task)
+	{
+		if (Task.Stats == nullptr) {
+			return;
+		}
+
+		Task.Stats->IsSucceeded = Task.Result == ReturnCodes::NoError;
+		std::lock_guard<std::mutex> Lock(StatsMutex);
+		CollectedStats.push_back(std::move(*Task.Stats));
+		Task.Stats = nullptr;
+	}
+
+	bool
+	PackageManager::SetSharedStore(std::string PathToStore)
+	{
+		SharedStore = nullptr;
+		if (PathToStore.empty()) {
+			return true;
+		}
+
+		try {
+			SharedStore = std::make_shared<ContentStore>(PathToStore);
+		}
+		catch (...) {
+			return false;
+		}
+
+		return true;
+	}
+
+	bool
+	UnpackDeflateFile(FileHandle& PackageFile, std::vector<uint8_t>& UnpackedData, size_t BufferSize)
+	{
+		/* Prefer mapping: compressed data is read by kernel directly, without buffer refills */
+		size_t InputSize = PackageFile.GetFileSize();
+		const uint8_t* InputData = PackageFile.MapFile();
+		std::vector<uint8_t> InputBuffer;
+		if (InputData == nullptr) {
+			InputBuffer.resize(InputSize);
+			if (InputSize != 0 && PackageFile.ReadFromFile(InputBuffer.data(), InputSize, 0) != InputSize) {
+				return false;
+			}
+
+			InputData = InputBuffer.data();
+		}
+
+		if (InputSize == 0) {
+			return false;
+		}
+
+		int WindowBits = DetectDeflateWindow(InputData, InputSize);
+
+		/*
+			gzip trailer keeps size of uncompressed data (modulo 4 GB), so single-shot inflate is possible.
+			Trailer isn't checked by anything before inflate, so size which deflate can't reach
+			from this input is not trusted for allocation.
+		*/
+		if (WindowBits == GzipWindow && InputSize >= 18) {
+			uint32_t TrailerSize = 0;
+			std::memcpy(&TrailerSize, InputData + InputSize - 4, sizeof(TrailerSize));
+
+			size_t BaseSize = UnpackedData.size();
+			size_t OutputWritten = 0;
+			if (TrailerSize != 0 && TrailerSize / MaxDeflateRatio <= InputSize) {
+				UnpackedData.resize(BaseSize + TrailerSize);
+				if (InflateBuffer(InputData, InputSize, UnpackedData.data() + BaseSize, TrailerSize, WindowBits, OutputWritten)) {
+					UnpackedData.resize(BaseSize + OutputWritten);
+					return true;
+				}
+
+				UnpackedData.resize(BaseSize);
+			}
+		}
+
+		/* Size is unknown (or gzip size wrapped around 4 GB): grow output, starting from usual ratio */
+		size_t GrowStep = std::max(BufferSize, InputSize * 4);
+		return InflateToVector(InputData, InputSize, UnpackedData, WindowBits, GrowStep);
+	}
+
+	bool
+	PackageManager::UnpackFile(std::vector<uint8_t>& UnpackedData, FilePointer PackageHandle)
+	{
+		if (!PackageHandle) {
+			return false;
+		}
+
+		return UnpackDeflateFile(*PackageHandle, UnpackedData, BufferSize);
+	}
+
+	bool
+	PackageManager::UnzipFile(FilePointer ZipPointer, ArchivePointer& UnzippedData)
+	{
+		/*
+			Archive maps package file and parses central directory in place, so we don't
+			keep any copy of archive in memory: entries are inflated straight from mapping.
+		*/
+		try {
+			UnzippedData = std::make_shared<Archive>(ZipPointer);
+		}
+		catch (...) {
+			return false;
+		}
+
+		return true;
+	}
+
+
+	bool
+	ParseManifest(simdjson::dom::parser& Parser, std::vector<uint8_t>& ManifestData, std::shared_ptr<simdjson::dom::element>& ParsedElement)
+	{
+		/* Document is separate from parser, so parser can be reused right after parsing */
+		auto Manifest = std::make_shared<ManifestDocument>();
+		bool IsParsed = !Parser.parse_into_document(Manifest->Document, ManifestData.data(), ManifestData.size()).get(Manifest->Root);
+
+		simdjson::dom::element& elem = Manifest->Root;
+		if (!IsParsed || !elem.is_object()) {
+			return false;
+		}
+
+		auto PluginId = elem["id"];
+		if (PluginId.error() || !PluginId.is_uint64()) {
+			return false;
+		}
+
+		CProximaFlake baseflake(PluginId.get_uint64());
+		//if (baseflake.GetObjectType() != CProximaFlake::ObjectType::PackageObject) {
+		//	return false;
+		//}
+
+		ParsedElement = std::shared_ptr<simdjson::dom::element>(Manifest, &Manifest->Root);
+		return true;
+	}
+
+	bool
+	PackageManager::ParseJson(std::shared_ptr<simdjson::dom::element>& ParsedElement, std::vector<uint8_t>& UnpackedData)
+	{
+		/* Take parser from pool: its buffers are already allocated by previous manifests */
+		std::unique_ptr<simdjson::dom::parser> CurrentParser;
+		{
+			std::lock_guard<std::mutex> Lock(ParsersMutex);
+			if (!ParsersPool.empty()) {
+				CurrentParser = std::move(ParsersPool.back());
+				ParsersPool.pop_back();
+			}
+		}
+
+		if (CurrentParser == nullptr) {
+			CurrentParser = std::make_unique<simdjson::dom::parser>();
+		}
+
+		bool IsParsed = ParseManifest(*CurrentParser, UnpackedData, ParsedElement);
+		{
+			std::lock_guard<std::mutex> Lock(ParsersMutex);
+			ParsersPool.push_back(std::move(CurrentParser));
+		}
+
+		return IsParsed;
+	}
+
+	bool
+	PackageManager::OpenFilePackage(FilePointer& OutPointer, std::string PathToFile)
+	{
+		try {
+			OutPointer = std::make_shared<FileHandle>(PathToFile, false);
+		}
+		catch (...) {
+			return false;
+		}
+
+		return true;
+	}
+
+	PackageManager::ReturnCodes
+	PackageManager::RunInstallStage(size_t StageIndex, InstallTask& Task)
+	{
+		try {
+			switch (StageIndex) {
+			case 0: return MapPackage(Task);
+			case 1: return ReadManifest(Task);
+			case 2: return PrefetchPackage(Task);
+			case 3: return ExtractPackage(Task);
+			case 4: return LinkPackage(Task);
+			default: break;
+			}
+		}
+		catch (...) {
+			/* Stages can run on pipeline threads, exception must not escape from there */
+		}
+
+		return ReturnCodes::OtherError;
+	}
+
+	PackageManager::ReturnCodes
+	PackageManager::MapPackage(InstallTask& Task)
+	{
+		PhaseScope Phase(Task.Stats.get(), InstallPhase::Open);
+
+		/* Open file handle to ZIP archive of package */
+		if (!OpenFilePackage(Task.PackageFile, Task.PathToPackage.SourceDirectory)) {
+			return AccessErrorCode(ReturnCodes::OtherError);
+		}
+
+		/* Map archive and read its central directory */
+		if (!UnzipFile(Task.PackageFile, Task.PackageArchive)) {
+			return ReturnCodes::PackageDamaged;
+		}
+
+		Phase.AddEntries(Task.PackageArchive->GetEntries().size());
+		return ReturnCodes::NoError;
+	}
+
+	/* Optional "sha256" object of manifest: archive path to hex digest, every listed entry must exist */
+	static bool
+	ReadEntryDigests(Archive& PackageArchive, simdjson::dom::element& Manifest)
+	{
+		simdjson::dom::object Digests;
+		auto DigestsField = Manifest["sha256"];
+		if (DigestsField.error() == simdjson::NO_SUCH_FIELD) {
+			return true;
+		}
+
+		if (DigestsField.get(Digests)) {
+			return false;
+		}
+
+		for (auto [EntryName, DigestElement] : Digests) {
+			std::string_view DigestString;
+			Sha256Digest Digest = {};
+			const ArchiveEntry* Entry = PackageArchive.FindEntry(EntryName);
+			if (Entry == nullptr || DigestElement.get(DigestString) || !ParseSha256Digest(DigestString, Digest)) {
+				return false;
+			}
+
+			PackageArchive.SetEntryDigest(*Entry, Digest);
+		}
+
+		return true;
+	}
+
+	PackageManager::ReturnCodes
+	PackageManager::ReadManifest(InstallTask& Task)
+	{
+		PhaseScope Phase(Task.Stats.get(), InstallPhase::Manifest);
+		std::shared_ptr<simdjson::dom::element> outElem;
+		std::vector<uint8_t> TempReader;
+
+		/* Try to find "package.json" file to process information about package */
+		const ArchiveEntry* PackageJsonEntry = Task.PackageArchive->FindEntry("package.json");
+		if (PackageJsonEntry == nullptr) {
+			return ReturnCodes::IsNotPackage;
+		}
+
+		if (!Task.PackageArchive->ExtractEntryToMemory(*PackageJsonEntry, TempReader)) {
+			return Task.PackageArchive->IsIntegrityFailed() ? ReturnCodes::IntegrityCheckFailed : ReturnCodes::PackageDamaged;
+		}
+
+		if (!ParseJson(outElem, TempReader)) {
+			return ReturnCodes::JsonDamaged;
+		}
+
+		if (Task.PackageToInstall == nullptr) {
+			Task.PackageToInstall = std::make_shared<Package>(Task.PackageArchive, outElem);
+		}
+
+		if (!ReadEntryDigests(*Task.PackageToInstall->GetArchive(), *Task.PackageToInstall->GetManifest())) {
+			return ReturnCodes::JsonDamaged;
+		}
+
+		/* Try to get full list of plugins and binaries */
+		if (!Task.PackageToInstall->GetPlatformEntries(Task.BinaryType, Task.BinariesList) || Task.BinariesList.empty()) {
+			return ReturnCodes::PackageDamaged;
+		}
+
+		Phase.AddEntries(Task.BinariesList.size());
+		return ReturnCodes::NoError;
+	}
+
+	PackageManager::ReturnCodes
+	PackageManager::PrefetchPackage(InstallTask& Task)
+	{
+		/* Upgrade usually rewrites few entries, reading all of them ahead would cost more than it saves */
+		if (IsIncrementalInstall) {
+			return ReturnCodes::NoError;
+		}
+
+		/* Read compressed payload while previous package is inflated, extract stage then works from page cache */
+		PhaseScope Phase(Task.Stats.get(), InstallPhase::Prefetch);
+		ArchivePointer SourceArchive = Task.PackageToInstall->GetArchive();
+		for (auto& [Entry, EntryPath] : Task.BinariesList) {
+			SourceArchive->PrefetchEntry(*Entry);
+		}
+
+		Phase.AddEntries(Task.BinariesList.size());
+
+		return ReturnCodes::NoError;
+	}
+
+	PackageManager::ReturnCodes
+	PackageManager::RunInstallTask(InstallTask& Task)
+	{
+		ReturnCodes ReturnValue = CheckInstallRights();
+		if (ReturnValue != ReturnCodes::NoError) {
+			return ReturnValue;
+		}
+
+		if (IsInstallStats) {
+			Task.Stats = std::make_unique<InstallStats>();
+			Task.Stats->PackagePath = Task.PathToPackage.SourceDirectory;
+		}
+
+		ControlContext Context(Task.Control.get());
+		for (size_t StageIndex = 0; StageIndex < InstallStagesCount; StageIndex++) {
+			if (StageIndex <= ExtractStageIndex && IsInstallCancelled()) {
+				ReturnValue = ReturnCodes::Cancelled;
+				break;
+			}
+
+			ReturnValue = RunInstallStage(StageIndex, Task);
+			if (ReturnValue != ReturnCodes::NoError) {
+				/* Extraction stopped by cancel request has already removed its output */
+				if (StageIndex <= ExtractStageIndex && IsInstallCancelled()) {
+					ReturnValue = ReturnCodes::Cancelled;
+				}
+
+				break;
+			}
+		}
+
+		Task.Result = ReturnValue;
+		CollectInstallStats(Task);
+		return ReturnValue;
+	}
+
+	PackageManager::ReturnCodes
+	PackageManager::InstallPackage(PackageInfo PathToPackage, xpckg::PackageBinaries BinaryType, PackagePointer PackageToInstall, PackageCallback CustomCallback)
+	{
+		InstallTask Task;
+		Task.PathToPackage = PathToPackage;
+		Task.BinaryType = BinaryType;
+		Task.PackageToInstall = PackageToInstall;
+		Task.CustomCallback = CustomCallback;
+		return RunInstallTask(Task);
+	}
+
+	std::future<PackageManager::ReturnCodes>
+	PackageManager::InstallPackageAsync(InstallRequest Request, ControlPointer Control)
+	{
+		/* Pools are created on caller thread, installs on executor only use them */
+		GetExtractPool();
+		if (AsyncPool == nullptr) {
+			AsyncPool = std::make_shared<ThreadPool>(AsyncInstallsCount);
+		}
+
+		auto InstallResult = std::make_shared<std::promise<ReturnCodes>>();
+		std::future<ReturnCodes> FutureResult = InstallResult->get_future();
+		AsyncPool->Submit([this, Request = std::move(Request), Control = std::move(Control), InstallResult]() {
+			InstallTask Task;
+			Task.PathToPackage = Request.PathToPackage;
+			Task.BinaryType = Request.BinaryType;
+			Task.PackageToInstall = Request.PackageToInstall;
+			Task.CustomCallback = Request.CustomCallback;
+			Task.Control = Control;
+			InstallResult->set_value(RunInstallTask(Task));
+		});
+
+		return FutureResult;
+	}
+
+	std::vector<PackageManager::ReturnCodes>
+	PackageManager::InstallPackages(const std::vector<InstallRequest>& Requests)
+	{
+		/* Rights are the same for every package, so check them once for whole batch */
+		std::vector<ReturnCodes> Results(Requests.size(), CheckInstallRights());
+		if (Requests.empty() || Results[0] != ReturnCodes::NoError) {
+			return Results;
+		}
+
+		/*
+			Queue N feeds stage N + 1. Every stage except last one has own thread, last stage
+			runs on calling thread. Failed task isn't processed by next stages, but still goes
+			through queues, so every stage sees tasks in order of requests.
+		*/
+		using TaskPointer = std::unique_ptr<InstallTask>;
+		std::vector<std::unique_ptr<BoundedQueue<TaskPointer>>> StageQueues;
+		for (size_t i = 0; i + 1 < InstallStagesCount; i++) {
+			StageQueues.push_back(std::make_unique<BoundedQueue<TaskPointer>>(InstallQueueDepth));
+		}
+
+		auto ProcessTask = [this](size_t StageIndex, InstallTask& Task) {
+			if (Task.Result == ReturnCodes::NoError) {
+				Task.Result = RunInstallStage(StageIndex, Task);
+			}
+		};
+
+		std::vector<std::thread> StageThreads;
+		StageThreads.emplace_back([this, &Requests, &StageQueues, &ProcessTask]() {
+			for (size_t i = 0; i < Requests.size(); i++) {
+				TaskPointer Task = std::make_unique<InstallTask>();
+				Task->RequestIndex = i;
+				Task->PathToPackage = Requests[i].PathToPackage;
+				Task->BinaryType = Requests[i].BinaryType;
+				Task->PackageToInstall = Requests[i].PackageToInstall;
+				Task->CustomCallback = Requests[i].CustomCallback;
+				if (IsInstallStats) {
+					Task->Stats = std::make_unique<InstallStats>();
+					Task->Stats->PackagePath = Requests[i].PathToPackage.SourceDirectory;
+				}
+
+				ProcessTask(0, *Task);
+				StageQueues[0]->Push(std::move(Task));
+			}
+
+			StageQueues[0]->Close();
+		});
+
+		for (size_t StageIndex = 1; StageIndex + 1 < InstallStagesCount; StageIndex++) {
+			StageThreads.emplace_back([StageIndex, &StageQueues, &ProcessTask]() {
+				TaskPointer Task;
+				while (StageQueues[StageIndex - 1]->Pop(Task)) {
+					ProcessTask(StageIndex, *Task);
+					StageQueues[StageIndex]->Push(std::move(Task));
+				}
+
+				StageQueues[StageIndex]->Close();
+			});
+		}
+
+		TaskPointer Task;
+		while (StageQueues.back()->Pop(Task)) {
+			ProcessTask(InstallStagesCount - 1, *Task);
+			Results[Task->RequestIndex] = Task->Result;
+			CollectInstallStats(*Task);
+
+			/* Release archive mapping right away, so only packages in flight stay mapped */
+			Task = nullptr;
+		}
+
+		for (auto& StageThread : StageThreads) {
+			StageThread.join();
+		}
+
+		return Results;
+	}
+}
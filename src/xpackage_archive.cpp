@@ -0,0 +1,1020 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: memory mapped package archive reader
+*********************************************************/
+#include "xpackage_internal.h"
+#include "zlib.h"
+#include <climits>
+#include <numeric>
+
+namespace xpckg
+{
+	/* Deflated entries from this size get disk space reserved before streaming */
+	constexpr uint64_t PreallocateThreshold = 1024 * 1024;
+
+	/* Seekable zstd entries from this size are decoded by parts of about this size on many workers */
+	constexpr uint64_t SplitEntryThreshold = 8 * 1024 * 1024;
+	constexpr uint64_t SplitPartSize = 4 * 1024 * 1024;
+
+	/* Part of split entry: run of whole frames, CRC of parts is combined when the last one is done */
+	struct SplitPart
+	{
+		size_t FirstFrame = 0;
+		size_t FramesCount = 0;
+		uint64_t Size = 0;
+		uint32_t Crc = 0;
+	};
+
+	struct SplitEntry
+	{
+		size_t EntryIndex = 0;
+		const uint8_t* Payload = nullptr;
+		FilePointer TargetFile;
+		std::vector<ZstdFrame> Frames;
+		std::vector<SplitPart> Parts;
+		std::atomic<size_t> PartsLeft = { 0 };
+	};
+
+	/* ZIP is little-endian and has no alignment guarantees, so read fields through memcpy */
+	template<typename T>
+	static inline T
+	ReadField(const uint8_t* Pointer)
+	{
+		T Value = 0;
+		std::memcpy(&Value, Pointer, sizeof(T));
+		return Value;
+	}
+
+	ExtractStream::ExtractStream(size_t ChunkSize, size_t ChunksCount, bool bBackgroundWriter)
+	{
+		Chunks.resize(std::max<size_t>(ChunksCount, bBackgroundWriter ? 2 : 1));
+		for (size_t i = 0; i < Chunks.size(); i++) {
+			Chunks[i].Data.resize(ChunkSize);
+			FreeChunks.push_back(i);
+		}
+
+		z_stream* stream = new z_stream();
+		if (inflateInit2(stream, -MAX_WBITS) != Z_OK) {
+			delete stream;
+			throw std::exception();
+		}
+
+		InflateState = stream;
+		if (bBackgroundWriter) {
+			WriterThread = std::thread(&ExtractStream::WriterProc, this);
+		}
+	}
+
+	ExtractStream::~ExtractStream()
+	{
+		{
+			std::lock_guard<std::mutex> Lock(StreamMutex);
+			IsTerminating = true;
+		}
+
+		StreamEvent.notify_all();
+		if (WriterThread.joinable()) {
+			WriterThread.join();
+		}
+
+		z_stream* stream = static_cast<z_stream*>(InflateState);
+		inflateEnd(stream);
+		delete stream;
+	}
+
+	void
+	ExtractStream::WriterProc()
+	{
+		std::unique_lock<std::mutex> Lock(StreamMutex);
+		while (true) {
+			StreamEvent.wait(Lock, [this]() { return IsTerminating || !FilledChunks.empty(); });
+			if (FilledChunks.empty()) {
+				return;
+			}
+
+			size_t ChunkIndex = FilledChunks.front();
+			FilledChunks.pop_front();
+
+			/* Write without lock, so producer can fill other chunks meanwhile */
+			StreamChunk& Chunk = Chunks[ChunkIndex];
+			bool IsFailed = IsWriteFailed;
+			Lock.unlock();
+			HashChunk(Chunk);
+			{
+				TraceContext Context(Chunk.Counters);
+				if (!IsFailed && Chunk.TargetFile->WriteToFile(Chunk.Data.data(), Chunk.DataSize, Chunk.FileOffset) != Chunk.DataSize) {
+					IsFailed = true;
+				}
+			}
+
+			Lock.lock();
+			IsWriteFailed |= IsFailed;
+			FreeChunks.push_back(ChunkIndex);
+			StreamEvent.notify_all();
+		}
+	}
+
+	void
+	ExtractStream::BeginEntry(bool bHashSha256)
+	{
+		EntryCrc = 0;
+		EntryHasher = bHashSha256 ? std::make_unique<Sha256>() : nullptr;
+	}
+
+	void
+	ExtractStream::HashChunk(const StreamChunk& Chunk)
+	{
+		EntryCrc = UpdateCrc32(EntryCrc, Chunk.Data.data(), Chunk.DataSize);
+		if (EntryHasher != nullptr) {
+			EntryHasher->Update(Chunk.Data.data(), Chunk.DataSize);
+		}
+	}
+
+	size_t
+	ExtractStream::AcquireChunk()
+	{
+		std::unique_lock<std::mutex> Lock(StreamMutex);
+		StreamEvent.wait(Lock, [this]() { return !FreeChunks.empty(); });
+		size_t ChunkIndex = FreeChunks.front();
+		FreeChunks.pop_front();
+		return ChunkIndex;
+	}
+
+	void
+	ExtractStream::SubmitChunk(size_t ChunkIndex)
+	{
+		if (!WriterThread.joinable()) {
+			StreamChunk& Chunk = Chunks[ChunkIndex];
+			HashChunk(Chunk);
+			if (!IsWriteFailed && Chunk.TargetFile->WriteToFile(Chunk.Data.data(), Chunk.DataSize, Chunk.FileOffset) != Chunk.DataSize) {
+				IsWriteFailed = true;
+			}
+
+			std::lock_guard<std::mutex> Lock(StreamMutex);
+			FreeChunks.push_back(ChunkIndex);
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> Lock(StreamMutex);
+			FilledChunks.push_back(ChunkIndex);
+		}
+
+		StreamEvent.notify_all();
+	}
+
+	bool
+	ExtractStream::WaitForWrites()
+	{
+		std::unique_lock<std::mutex> Lock(StreamMutex);
+		StreamEvent.wait(Lock, [this]() { return FreeChunks.size() == Chunks.size(); });
+
+		/* Error belongs to current entry only, stream stays reusable */
+		bool IsSuccess = !IsWriteFailed;
+		IsWriteFailed = false;
+		return IsSuccess;
+	}
+
+	Archive::Archive(FilePointer ZipFile)
+	{
+		ArchiveFile = ZipFile;
+		ArchiveSize = ZipFile->GetFileSize();
+		ArchiveData = ZipFile->MapFile();
+		if (ArchiveData == nullptr) {
+			throw std::exception();
+		}
+
+		/* ZIP can't start with native signature: it begins with local header or with data of self-extractor */
+		if (ArchiveSize >= sizeof(NativeHeader) && ReadField<uint32_t>(ArchiveData) == NativeSignature) {
+			if (!ReadNativeIndex()) {
+				throw std::exception();
+			}
+
+			return;
+		}
+
+		if (!ReadCentralDirectory()) {
+			throw std::exception();
+		}
+
+		BuildIndex();
+	}
+
+	Archive::~Archive()
+	{
+
+	}
+
+	bool
+	Archive::ReadCentralDirectory()
+	{
+		if (ArchiveSize < EndOfDirectorySize) {
+			return false;
+		}
+
+		/* End of central directory record is followed only by comment (up to 64 KB) */
+		size_t MinimalOffset = ArchiveSize > (EndOfDirectorySize + 0xFFFF) ? ArchiveSize - (EndOfDirectorySize + 0xFFFF) : 0;
+		size_t EndOffset = ArchiveSize - EndOfDirectorySize;
+		while (ReadField<uint32_t>(ArchiveData + EndOffset) != EndOfDirectorySignature) {
+			if (EndOffset == MinimalOffset) {
+				return false;
+			}
+
+			EndOffset--;
+		}
+
+		const uint8_t* EndRecord = ArchiveData + EndOffset;
+		uint64_t EntriesCount = ReadField<uint16_t>(EndRecord + 10);
+		uint64_t DirectorySize = ReadField<uint32_t>(EndRecord + 12);
+		uint64_t DirectoryOffset = ReadField<uint32_t>(EndRecord + 16);
+
+		/* ZIP64 archives keep real values in additional record placed before locator */
+		if (EndOffset >= Zip64LocatorSize && ReadField<uint32_t>(EndRecord - Zip64LocatorSize) == Zip64LocatorSignature) {
+			uint64_t Zip64EndOffset = ReadField<uint64_t>(EndRecord - Zip64LocatorSize + 8);
+			if (Zip64EndOffset > ArchiveSize || Zip64EndOfDirectorySize > ArchiveSize - Zip64EndOffset) {
+				return false;
+			}
+
+			const uint8_t* Zip64EndRecord = ArchiveData + Zip64EndOffset;
+			if (ReadField<uint32_t>(Zip64EndRecord) != Zip64EndOfDirectorySignature) {
+				return false;
+			}
+
+			EntriesCount = ReadField<uint64_t>(Zip64EndRecord + 32);
+			DirectorySize = ReadField<uint64_t>(Zip64EndRecord + 40);
+			DirectoryOffset = ReadField<uint64_t>(Zip64EndRecord + 48);
+		}
+
+		/* Values are 64-bit fields of archive, so ranges are checked by subtraction which can't wrap */
+		if (DirectoryOffset > ArchiveSize || DirectorySize > ArchiveSize - DirectoryOffset || EntriesCount > DirectorySize / CentralHeaderSize) {
+			return false;
+		}
+
+		Entries.reserve(static_cast<size_t>(EntriesCount));
+		const uint8_t* CurrentHeader = ArchiveData + DirectoryOffset;
+		const uint8_t* DirectoryEnd = CurrentHeader + DirectorySize;
+		for (uint64_t i = 0; i < EntriesCount; i++) {
+			size_t DirectoryRest = static_cast<size_t>(DirectoryEnd - CurrentHeader);
+			if (DirectoryRest < CentralHeaderSize || ReadField<uint32_t>(CurrentHeader) != CentralHeaderSignature) {
+				return false;
+			}
+
+			uint16_t NameLength = ReadField<uint16_t>(CurrentHeader + 28);
+			uint16_t ExtraLength = ReadField<uint16_t>(CurrentHeader + 30);
+			uint16_t CommentLength = ReadField<uint16_t>(CurrentHeader + 32);
+			if (static_cast<size_t>(NameLength) + ExtraLength + CommentLength > DirectoryRest - CentralHeaderSize) {
+				return false;
+			}
+
+			const uint8_t* NamePointer = CurrentHeader + CentralHeaderSize;
+			const uint8_t* ExtraPointer = NamePointer + NameLength;
+			const uint8_t* NextHeader = ExtraPointer + ExtraLength + CommentLength;
+
+			ArchiveEntry NewEntry = {};
+			NewEntry.Name = std::string_view(reinterpret_cast<const char*>(NamePointer), NameLength);
+			NewEntry.Flags = ReadField<uint16_t>(CurrentHeader + 8);
+			NewEntry.Method = ReadField<uint16_t>(CurrentHeader + 10);
+			NewEntry.Crc32 = ReadField<uint32_t>(CurrentHeader + 16);
+			NewEntry.CompressedSize = ReadField<uint32_t>(CurrentHeader + 20);
+			NewEntry.UncompressedSize = ReadField<uint32_t>(CurrentHeader + 24);
+			NewEntry.LocalHeaderOffset = ReadField<uint32_t>(CurrentHeader + 42);
+
+			/* ZIP64 extended information: only saturated fields are present, in fixed order */
+			const uint8_t* ExtraEnd = ExtraPointer + ExtraLength;
+			while (ExtraPointer + 4 <= ExtraEnd) {
+				uint16_t FieldId = ReadField<uint16_t>(ExtraPointer);
+				uint16_t FieldSize = ReadField<uint16_t>(ExtraPointer + 2);
+				const uint8_t* FieldData = ExtraPointer + 4;
+				const uint8_t* FieldEnd = FieldData + FieldSize;
+				if (FieldEnd > ExtraEnd) {
+					break;
+				}
+
+				if (FieldId == Zip64ExtraTag) {
+					if (NewEntry.UncompressedSize == 0xFFFFFFFF && FieldData + 8 <= FieldEnd) {
+						NewEntry.UncompressedSize = ReadField<uint64_t>(FieldData);
+						FieldData += 8;
+					}
+
+					if (NewEntry.CompressedSize == 0xFFFFFFFF && FieldData + 8 <= FieldEnd) {
+						NewEntry.CompressedSize = ReadField<uint64_t>(FieldData);
+						FieldData += 8;
+					}
+
+					if (NewEntry.LocalHeaderOffset == 0xFFFFFFFF && FieldData + 8 <= FieldEnd) {
+						NewEntry.LocalHeaderOffset = ReadField<uint64_t>(FieldData);
+					}
+				}
+
+				ExtraPointer = FieldEnd;
+			}
+
+			Entries.push_back(NewEntry);
+			CurrentHeader = NextHeader;
+		}
+
+		return true;
+	}
+
+	bool
+	Archive::ReadNativeIndex()
+	{
+		/* Mapping is page aligned, so header, index and buckets (aligned by writer) are used in place */
+		const NativeHeader* Header = reinterpret_cast<const NativeHeader*>(ArchiveData);
+		uint64_t BucketsCount = (1ull << std::min<uint32_t>(Header->BucketBits, 32)) + 1;
+		if (Header->Version != NativeVersion || Header->HeaderSize < sizeof(NativeHeader) || Header->BucketBits == 0 || Header->BucketBits > 32 ||
+			Header->EntriesCount > UINT32_MAX || Header->IndexOffset % alignof(NativeIndexEntry) != 0 || Header->BucketsOffset % alignof(uint32_t) != 0 ||
+			Header->IndexOffset > ArchiveSize || Header->EntriesCount > (ArchiveSize - Header->IndexOffset) / sizeof(NativeIndexEntry) ||
+			Header->BucketsOffset > ArchiveSize || BucketsCount > (ArchiveSize - Header->BucketsOffset) / sizeof(uint32_t) ||
+			Header->NamesOffset > ArchiveSize || Header->NamesSize > ArchiveSize - Header->NamesOffset || Header->NamesSize > UINT32_MAX) {
+			return false;
+		}
+
+		size_t EntriesCount = static_cast<size_t>(Header->EntriesCount);
+		size_t IndexSize = EntriesCount * sizeof(NativeIndexEntry);
+		size_t BucketsSize = static_cast<size_t>(BucketsCount) * sizeof(uint32_t);
+		uint32_t IndexCrc = UpdateCrc32(0, ArchiveData + Header->IndexOffset, IndexSize);
+		IndexCrc = UpdateCrc32(IndexCrc, ArchiveData + Header->BucketsOffset, BucketsSize);
+		IndexCrc = UpdateCrc32(IndexCrc, ArchiveData + Header->NamesOffset, static_cast<size_t>(Header->NamesSize));
+		if (IndexCrc != Header->IndexCrc) {
+			return false;
+		}
+
+		/* Checksum doesn't prove that writer was right, so ranges and order are still checked once here */
+		const NativeIndexEntry* Index = reinterpret_cast<const NativeIndexEntry*>(ArchiveData + Header->IndexOffset);
+		const uint32_t* Buckets = reinterpret_cast<const uint32_t*>(ArchiveData + Header->BucketsOffset);
+		uint32_t BucketShift = 64 - Header->BucketBits;
+		if (Buckets[0] != 0 || Buckets[BucketsCount - 1] != EntriesCount) {
+			return false;
+		}
+
+		for (uint64_t i = 1; i < BucketsCount; i++) {
+			if (Buckets[i] < Buckets[i - 1]) {
+				return false;
+			}
+		}
+
+		const uint8_t* Names = ArchiveData + Header->NamesOffset;
+		Entries.reserve(EntriesCount);
+		for (size_t i = 0; i < EntriesCount; i++) {
+			const NativeIndexEntry& IndexEntry = Index[i];
+			uint64_t Bucket = IndexEntry.NameHash >> BucketShift;
+			if (static_cast<uint64_t>(IndexEntry.NameOffset) + IndexEntry.NameLength > Header->NamesSize ||
+				IndexEntry.DataOffset < Header->HeaderSize || IndexEntry.DataOffset > ArchiveSize || IndexEntry.CompressedSize > ArchiveSize - IndexEntry.DataOffset ||
+				(i != 0 && IndexEntry.NameHash < Index[i - 1].NameHash) || i < Buckets[Bucket] || i >= Buckets[Bucket + 1]) {
+				Entries.clear();
+				return false;
+			}
+
+			ArchiveEntry NewEntry = {};
+			NewEntry.Name = std::string_view(reinterpret_cast<const char*>(Names + IndexEntry.NameOffset), IndexEntry.NameLength);
+			NewEntry.DataOffset = IndexEntry.DataOffset;
+			NewEntry.CompressedSize = IndexEntry.CompressedSize;
+			NewEntry.UncompressedSize = IndexEntry.UncompressedSize;
+			NewEntry.Crc32 = IndexEntry.Crc32;
+			NewEntry.PlatformMask = IndexEntry.PlatformMask;
+			NewEntry.Method = IndexEntry.Method;
+			Entries.push_back(NewEntry);
+		}
+
+		NativeIndex = Index;
+		NativeBuckets = Buckets;
+		NativeBucketShift = BucketShift;
+		return true;
+	}
+
+	void
+	Archive::BuildIndex()
+	{
+		/* Power of two with load factor <= 0.5 keeps probe sequences short */
+		size_t IndexSize = 16;
+		while (IndexSize < Entries.size() * 2) {
+			IndexSize <<= 1;
+		}
+
+		EntriesIndex.assign(IndexSize, IndexSlot{ 0, 0 });
+		IndexMask = IndexSize - 1;
+
+		for (size_t i = 0; i < Entries.size(); i++) {
+			uint64_t Hash = HashString(Entries[i].Name);
+			uint32_t HashTag = static_cast<uint32_t>(Hash >> 32);
+			size_t SlotIndex = static_cast<size_t>(Hash) & IndexMask;
+			while (EntriesIndex[SlotIndex].EntryIndex != 0) {
+				/* Duplicated names are possible in ZIP, first one wins like in sequential scan */
+				const IndexSlot& Slot = EntriesIndex[SlotIndex];
+				if (Slot.HashTag == HashTag && Entries[Slot.EntryIndex - 1].Name == Entries[i].Name) {
+					break;
+				}
+
+				SlotIndex = (SlotIndex + 1) & IndexMask;
+			}
+
+			if (EntriesIndex[SlotIndex].EntryIndex == 0) {
+				EntriesIndex[SlotIndex] = IndexSlot{ HashTag, static_cast<uint32_t>(i + 1) };
+			}
+		}
+	}
+
+	const std::vector<ArchiveEntry>&
+	Archive::GetEntries()
+	{
+		return Entries;
+	}
+
+	ArchiveFormat
+	Archive::GetFormat()
+	{
+		return NativeIndex != nullptr ? ArchiveFormat::Native : ArchiveFormat::Zip;
+	}
+
+	const ArchiveEntry*
+	Archive::FindEntry(std::string_view EntryName)
+	{
+		uint64_t Hash = HashString(EntryName);
+		if (NativeIndex != nullptr) {
+			/* Equal hashes are ordered by name, so the first matching one wins like in ZIP */
+			size_t Bucket = static_cast<size_t>(Hash >> NativeBucketShift);
+			for (size_t i = NativeBuckets[Bucket]; i < NativeBuckets[Bucket + 1]; i++) {
+				if (Entries[i].Name == EntryName) {
+					return &Entries[i];
+				}
+			}
+
+			return nullptr;
+		}
+
+		uint32_t HashTag = static_cast<uint32_t>(Hash >> 32);
+		size_t SlotIndex = static_cast<size_t>(Hash) & IndexMask;
+		while (EntriesIndex[SlotIndex].EntryIndex != 0) {
+			const IndexSlot& Slot = EntriesIndex[SlotIndex];
+			if (Slot.HashTag == HashTag && Entries[Slot.EntryIndex - 1].Name == EntryName) {
+				return &Entries[Slot.EntryIndex - 1];
+			}
+
+			SlotIndex = (SlotIndex + 1) & IndexMask;
+		}
+
+		return nullptr;
+	}
+
+	const uint8_t*
+	Archive::GetEntryData(const ArchiveEntry& Entry)
+	{
+		/* Native payload ranges are checked when index is read */
+		if (Entry.DataOffset != 0) {
+			return ArchiveData + Entry.DataOffset;
+		}
+
+		if (Entry.LocalHeaderOffset > ArchiveSize || LocalHeaderSize > ArchiveSize - Entry.LocalHeaderOffset) {
+			return nullptr;
+		}
+
+		const uint8_t* LocalHeader = ArchiveData + Entry.LocalHeaderOffset;
+		if (ReadField<uint32_t>(LocalHeader) != LocalHeaderSignature) {
+			return nullptr;
+		}
+
+		/* Local header can have different extra field than central one, so take its own sizes */
+		uint64_t DataOffset = Entry.LocalHeaderOffset + LocalHeaderSize + ReadField<uint16_t>(LocalHeader + 26) + ReadField<uint16_t>(LocalHeader + 28);
+		if (DataOffset > ArchiveSize || Entry.CompressedSize > ArchiveSize - DataOffset) {
+			return nullptr;
+		}
+
+		return ArchiveData + DataOffset;
+	}
+
+	const Sha256Digest*
+	Archive::GetEntryDigest(const ArchiveEntry& Entry)
+	{
+		auto DigestIt = EntryDigests.find(&Entry);
+		return DigestIt != EntryDigests.end() ? &DigestIt->second : nullptr;
+	}
+
+	bool
+	Archive::VerifyEntry(const ArchiveEntry& Entry, uint32_t Crc, Sha256* Hasher, Sha256Digest* OutDigest)
+	{
+		bool IsValid = Crc == Entry.Crc32;
+		const Sha256Digest* ExpectedDigest = GetEntryDigest(Entry);
+		if (IsValid && (ExpectedDigest != nullptr || OutDigest != nullptr)) {
+			Sha256Digest ActualDigest = {};
+			Hasher->Finish(ActualDigest);
+			IsValid = ExpectedDigest == nullptr || ActualDigest == *ExpectedDigest;
+			if (OutDigest != nullptr) {
+				*OutDigest = ActualDigest;
+			}
+		}
+
+		if (!IsValid) {
+			IsMismatchFound = true;
+		}
+
+		return IsValid;
+	}
+
+	void
+	Archive::SetEntryDigest(const ArchiveEntry& Entry, const Sha256Digest& Digest)
+	{
+		EntryDigests[&Entry] = Digest;
+	}
+
+	bool
+	Archive::IsIntegrityFailed()
+	{
+		return IsMismatchFound;
+	}
+
+	void
+	Archive::PrefetchEntry(const ArchiveEntry& Entry)
+	{
+		const uint8_t* EntryData = GetEntryData(Entry);
+		if (EntryData == nullptr) {
+			return;
+		}
+
+		/* One read per page is enough to bring it into page cache, volatile keeps reads alive */
+		CountBytesRead(Entry.CompressedSize);
+		volatile uint8_t PageByte = 0;
+		for (uint64_t Offset = 0; Offset < Entry.CompressedSize; Offset += 4096) {
+			PageByte = EntryData[Offset];
+		}
+
+		(void)PageByte;
+	}
+
+	/* Decode frames of seekable entry and write them at their offsets: -1 on damaged data, 0 on write error or cancel */
+	static int
+	WriteZstdFrames(const uint8_t* Payload, const ZstdFrame* Frames, size_t FramesCount, FileHandle& OutFile, std::vector<uint8_t>& Buffer, uint32_t& OutCrc)
+	{
+		OutCrc = 0;
+		for (size_t i = 0; i < FramesCount; i++) {
+			if (IsInstallCancelled()) {
+				return 0;
+			}
+
+			const ZstdFrame& Frame = Frames[i];
+			Buffer.resize(std::max<size_t>(Buffer.size(), Frame.DecompressedSize));
+			size_t OutputWritten = 0;
+			{
+				TraceTimer InflateTimer(&TraceCounters::InflateTime);
+				if (!DecompressZstd(Payload + Frame.CompressedOffset, Frame.CompressedSize, Buffer.data(), Frame.DecompressedSize, OutputWritten) ||
+					OutputWritten != Frame.DecompressedSize) {
+					return -1;
+				}
+			}
+
+			OutCrc = UpdateCrc32(OutCrc, Buffer.data(), OutputWritten);
+			if (OutFile.WriteToFile(Buffer.data(), OutputWritten, static_cast<size_t>(Frame.DecompressedOffset)) != OutputWritten) {
+				return 0;
+			}
+
+			AddInstallProgress(OutputWritten);
+		}
+
+		return 1;
+	}
+
+	bool
+	Archive::ReadEntryRange(const ArchiveEntry& Entry, uint64_t Offset, uint8_t* OutData, size_t DataSize)
+	{
+		const uint8_t* EntryData = GetEntryData(Entry);
+		if (EntryData == nullptr || (Entry.Flags & 0x1) || Offset > Entry.UncompressedSize || DataSize > Entry.UncompressedSize - Offset) {
+			return false;
+		}
+
+		if (DataSize == 0) {
+			return true;
+		}
+
+		CountBytesRead(DataSize);
+		if (Entry.Method == static_cast<uint16_t>(CompressionMethod::Stored)) {
+			if (Entry.CompressedSize != Entry.UncompressedSize) {
+				return false;
+			}
+
+			std::memcpy(OutData, EntryData + Offset, DataSize);
+			return true;
+		}
+
+		std::vector<ZstdFrame> Frames;
+		if (Entry.Method != static_cast<uint16_t>(CompressionMethod::Zstd) || !ReadSeekTable(EntryData, Entry.CompressedSize, Entry.UncompressedSize, Frames)) {
+			return false;
+		}
+
+		/* Frames inside range are decoded straight to output, only the edge ones go through buffer */
+		auto FrameIt = std::upper_bound(Frames.begin(), Frames.end(), Offset, [](uint64_t Value, const ZstdFrame& Frame) {
+			return Value < Frame.DecompressedOffset + Frame.DecompressedSize;
+		});
+
+		uint64_t RangeEnd = Offset + DataSize;
+		uint64_t CopiedSize = 0;
+		std::vector<uint8_t> FrameData;
+		for (; FrameIt != Frames.end() && FrameIt->DecompressedOffset < RangeEnd; ++FrameIt) {
+			uint64_t FrameEnd = FrameIt->DecompressedOffset + FrameIt->DecompressedSize;
+			uint64_t CopyStart = std::max(Offset, FrameIt->DecompressedOffset);
+			uint64_t CopyEnd = std::min(RangeEnd, FrameEnd);
+			bool IsWholeFrame = CopyStart == FrameIt->DecompressedOffset && CopyEnd == FrameEnd;
+			uint8_t* FrameOutput = OutData + (CopyStart - Offset);
+			if (!IsWholeFrame) {
+				FrameData.resize(FrameIt->DecompressedSize);
+				FrameOutput = FrameData.data();
+			}
+
+			size_t OutputWritten = 0;
+			TraceTimer InflateTimer(&TraceCounters::InflateTime);
+			if (!DecompressZstd(EntryData + FrameIt->CompressedOffset, FrameIt->CompressedSize, FrameOutput, FrameIt->DecompressedSize, OutputWritten) ||
+				OutputWritten != FrameIt->DecompressedSize) {
+				return false;
+			}
+
+			if (!IsWholeFrame) {
+				std::memcpy(OutData + (CopyStart - Offset), FrameData.data() + (CopyStart - FrameIt->DecompressedOffset), static_cast<size_t>(CopyEnd - CopyStart));
+			}
+
+			CopiedSize += CopyEnd - CopyStart;
+		}
+
+		return CopiedSize == DataSize;
+	}
+
+	bool
+	Archive::ExtractEntryToMemory(const ArchiveEntry& Entry, std::vector<uint8_t>& OutData)
+	{
+		/* Encrypted entries are not supported */
+		if (Entry.Flags & 0x1) {
+			return false;
+		}
+
+		const uint8_t* EntryData = GetEntryData(Entry);
+		if (EntryData == nullptr) {
+			return false;
+		}
+
+		CountBytesRead(Entry.CompressedSize);
+		OutData.resize(static_cast<size_t>(Entry.UncompressedSize));
+		if (Entry.Method == static_cast<uint16_t>(CompressionMethod::Stored)) {
+			if (Entry.CompressedSize != Entry.UncompressedSize) {
+				return false;
+			}
+
+			if (!OutData.empty()) {
+				std::memcpy(OutData.data(), EntryData, OutData.size());
+			}
+		} else {
+			bool IsZstd = Entry.Method == static_cast<uint16_t>(CompressionMethod::Zstd);
+			if ((Entry.Method != static_cast<uint16_t>(CompressionMethod::Deflated) && !IsZstd) || (IsZstd && !IsZstdSupported())) {
+				return false;
+			}
+
+			/* Decode straight from mapped region into presized output, without staging copies */
+			if (Entry.UncompressedSize != 0) {
+				TraceTimer InflateTimer(&TraceCounters::InflateTime);
+				size_t OutputWritten = 0;
+				bool IsSuccess = IsZstd ?
+					DecompressZstd(EntryData, static_cast<size_t>(Entry.CompressedSize), OutData.data(), OutData.size(), OutputWritten) :
+					InflateBuffer(EntryData, static_cast<size_t>(Entry.CompressedSize), OutData.data(), OutData.size(), RawDeflateWindow, OutputWritten);
+				if (!IsSuccess || OutputWritten != Entry.UncompressedSize) {
+					IsMismatchFound = true;
+					return false;
+				}
+			}
+		}
+
+		/* Output was just written, so it's hashed from cache */
+		Sha256 Hasher;
+		if (GetEntryDigest(Entry) != nullptr) {
+			Hasher.Update(OutData.data(), OutData.size());
+		}
+
+		return VerifyEntry(Entry, UpdateCrc32(0, OutData.data(), OutData.size()), &Hasher);
+	}
+
+	bool
+	Archive::ExtractEntryToMemory(std::string_view EntryName, std::vector<uint8_t>& OutData)
+	{
+		const ArchiveEntry* Entry = FindEntry(EntryName);
+		if (Entry == nullptr) {
+			return false;
+		}
+
+		return ExtractEntryToMemory(*Entry, OutData);
+	}
+
+	bool
+	Archive::ExtractEntryToFile(const ArchiveEntry& Entry, FileHandle& OutFile, ExtractStream& Stream, Sha256Digest* OutDigest)
+	{
+		if ((Entry.Flags & 0x1) || IsInstallCancelled()) {
+			return false;
+		}
+
+		const uint8_t* EntryData = GetEntryData(Entry);
+		if (EntryData == nullptr) {
+			return false;
+		}
+
+		/* Stored data is copied from archive file to target by kernel, it never touches our memory */
+		CountBytesRead(Entry.CompressedSize);
+		if (Entry.Method == static_cast<uint16_t>(CompressionMethod::Stored)) {
+			if (Entry.CompressedSize != Entry.UncompressedSize) {
+				return false;
+			}
+
+			/* Checked from mapping before copy, payload is in page cache after prefetch anyway */
+			size_t SizeToCopy = static_cast<size_t>(Entry.UncompressedSize);
+			Sha256 Hasher;
+			if (GetEntryDigest(Entry) != nullptr || OutDigest != nullptr) {
+				Hasher.Update(EntryData, SizeToCopy);
+			}
+
+			if (!VerifyEntry(Entry, UpdateCrc32(0, EntryData, SizeToCopy), &Hasher, OutDigest)) {
+				return false;
+			}
+
+			size_t DataOffset = static_cast<size_t>(EntryData - ArchiveData);
+			if (SizeToCopy != 0 && OutFile.CopyFromFile(*ArchiveFile, DataOffset, SizeToCopy, 0) != SizeToCopy) {
+				return false;
+			}
+
+			AddInstallProgress(SizeToCopy);
+			return true;
+		}
+
+		bool IsZstd = Entry.Method == static_cast<uint16_t>(CompressionMethod::Zstd);
+		if ((Entry.Method != static_cast<uint16_t>(CompressionMethod::Deflated) && !IsZstd) || (IsZstd && !IsZstdSupported())) {
+			return false;
+		}
+
+		/* Large files are written by many chunks, without reservation they can end up fragmented */
+		if (Entry.UncompressedSize >= PreallocateThreshold) {
+			OutFile.AllocateFile(static_cast<size_t>(Entry.UncompressedSize));
+		}
+
+		/* Decoder fills output as much as it can: -1 on broken data, 1 at the end of stream, 0 if output is full */
+		std::function<int(uint8_t*& Output, size_t& OutputLeft)> DecodeChunk;
+		const uint8_t* Input = EntryData;
+		size_t InputLeft = static_cast<size_t>(Entry.CompressedSize);
+		if (IsZstd) {
+			if (Stream.ZstdState == nullptr) {
+				Stream.ZstdState = std::make_unique<ZstdStream>();
+			}
+
+			ZstdStream* Decoder = Stream.ZstdState.get();
+			Decoder->Reset();
+			DecodeChunk = [Decoder, &Input, &InputLeft](uint8_t*& Output, size_t& OutputLeft) -> int {
+				return Decoder->Decode(Input, InputLeft, Output, OutputLeft);
+			};
+		} else {
+			z_stream* stream = static_cast<z_stream*>(Stream.InflateState);
+			if (inflateReset(stream) != Z_OK) {
+				return false;
+			}
+
+			stream->next_in = const_cast<Bytef*>(EntryData);
+			stream->avail_in = 0;
+			DecodeChunk = [stream, &InputLeft](uint8_t*& Output, size_t& OutputLeft) -> int {
+				stream->next_out = Output;
+				stream->avail_out = static_cast<uInt>(std::min<size_t>(OutputLeft, UINT_MAX));
+				uInt OutputSize = stream->avail_out;
+				int result = Z_OK;
+				while (result == Z_OK && stream->avail_out != 0) {
+					if (stream->avail_in == 0) {
+						stream->avail_in = static_cast<uInt>(std::min<size_t>(InputLeft, UINT_MAX));
+						InputLeft -= stream->avail_in;
+					}
+
+					result = inflate(stream, Z_NO_FLUSH);
+					if (result == Z_BUF_ERROR && stream->avail_in == 0 && InputLeft == 0) {
+						/* Truncated input */
+						break;
+					}
+
+					if (result == Z_BUF_ERROR) {
+						result = Z_OK;
+					}
+				}
+
+				Output += OutputSize - stream->avail_out;
+				OutputLeft -= OutputSize - stream->avail_out;
+				return result == Z_STREAM_END ? 1 : (result == Z_OK ? 0 : -1);
+			};
+		}
+
+		uint64_t FileOffset = 0;
+		Stream.BeginEntry(GetEntryDigest(Entry) != nullptr || OutDigest != nullptr);
+
+		/* Cancelled entry stops at chunk boundary, result stays short of stream end */
+		int DecodeResult = 0;
+		while (DecodeResult == 0 && !IsInstallCancelled()) {
+			size_t ChunkIndex = Stream.AcquireChunk();
+			ExtractStream::StreamChunk& Chunk = Stream.Chunks[ChunkIndex];
+			uint8_t* Output = Chunk.Data.data();
+			size_t OutputLeft = Chunk.Data.size();
+
+			/* Fill whole chunk before handing it to writer, so writes stay large */
+			{
+				TraceTimer InflateTimer(&TraceCounters::InflateTime);
+				DecodeResult = DecodeChunk(Output, OutputLeft);
+			}
+
+			Chunk.DataSize = Chunk.Data.size() - OutputLeft;
+			Chunk.FileOffset = static_cast<size_t>(FileOffset);
+			Chunk.TargetFile = &OutFile;
+			Chunk.Counters = CurrentCounters;
+			FileOffset += Chunk.DataSize;
+			AddInstallProgress(Chunk.DataSize);
+			Stream.SubmitChunk(ChunkIndex);
+		}
+
+		/* Broken compressed stream is damaged data as well as checksum mismatch, cancel and write errors are not */
+		bool IsWritten = Stream.WaitForWrites();
+		if (!IsWritten || IsInstallCancelled()) {
+			return false;
+		}
+
+		if (DecodeResult != 1 || FileOffset != Entry.UncompressedSize) {
+			IsMismatchFound = true;
+			return false;
+		}
+
+		return VerifyEntry(Entry, Stream.EntryCrc, Stream.EntryHasher.get(), OutDigest);
+	}
+
+	bool
+	Archive::ExtractEntries(const EntriesList& Entries, const EntryTarget& OpenTarget, ThreadPool* Pool, size_t ChunkSize, std::vector<Sha256Digest>* OutDigests)
+	{
+		if (OutDigests != nullptr) {
+			OutDigests->assign(Entries.size(), Sha256Digest{});
+		}
+
+		/* Every entry has its own digest slot, so workers don't share anything */
+		auto ExtractSingle = [this, &Entries, &OpenTarget, OutDigests](size_t EntryIndex, ExtractStream& Stream) -> bool {
+			try {
+				const ArchiveEntry& Entry = *Entries[EntryIndex].first;
+				FilePointer TargetFile = OpenTarget(Entry, Entries[EntryIndex].second);
+				Sha256Digest* OutDigest = OutDigests != nullptr ? &(*OutDigests)[EntryIndex] : nullptr;
+				return TargetFile != nullptr && ExtractEntryToFile(Entry, *TargetFile, Stream, OutDigest);
+			}
+			catch (...) {
+				return false;
+			}
+		};
+
+		/*
+			Big seekable zstd entries are split into parts of whole frames. SHA-256 can't be
+			combined from parts like CRC, and it's slower than decode anyway, so entries with
+			declared digest (or digest requested by caller) stay whole. Entries with damaged
+			seek table are left to streaming.
+		*/
+		bool IsParallel = Pool != nullptr && Pool->GetThreadsCount() >= 2;
+		std::vector<std::unique_ptr<SplitEntry>> SplitEntries;
+		std::vector<bool> IsSplitEntry(Entries.size());
+		for (size_t i = 0; i < Entries.size() && IsParallel && IsZstdSupported() && OutDigests == nullptr; i++) {
+			const ArchiveEntry& Entry = *Entries[i].first;
+			if (Entry.Method != static_cast<uint16_t>(CompressionMethod::Zstd) || Entry.UncompressedSize < SplitEntryThreshold ||
+				(Entry.Flags & 0x1) || GetEntryDigest(Entry) != nullptr) {
+				continue;
+			}
+
+			auto NewSplit = std::make_unique<SplitEntry>();
+			NewSplit->EntryIndex = i;
+			NewSplit->Payload = GetEntryData(Entry);
+			if (NewSplit->Payload == nullptr || !ReadSeekTable(NewSplit->Payload, Entry.CompressedSize, Entry.UncompressedSize, NewSplit->Frames) ||
+				NewSplit->Frames.size() < 2) {
+				continue;
+			}
+
+			for (size_t FrameIndex = 0; FrameIndex < NewSplit->Frames.size(); FrameIndex++) {
+				const ZstdFrame& Frame = NewSplit->Frames[FrameIndex];
+				if (NewSplit->Parts.empty() || NewSplit->Parts.back().Size >= SplitPartSize) {
+					NewSplit->Parts.push_back(SplitPart{ FrameIndex, 0, 0, 0 });
+				}
+
+				NewSplit->Parts.back().FramesCount++;
+				NewSplit->Parts.back().Size += Frame.DecompressedSize;
+			}
+
+			NewSplit->PartsLeft = NewSplit->Parts.size();
+			IsSplitEntry[i] = true;
+			SplitEntries.push_back(std::move(NewSplit));
+		}
+
+		if (!IsParallel || (Entries.size() < 2 && SplitEntries.empty())) {
+			ExtractStream Stream(ChunkSize);
+			for (size_t i = 0; i < Entries.size(); i++) {
+				if (!ExtractSingle(i, Stream)) {
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		/* Biggest entries go first, so they don't become long tail at the end of install */
+		std::vector<size_t> EntriesOrder(Entries.size());
+		std::iota(EntriesOrder.begin(), EntriesOrder.end(), 0);
+		EntriesOrder.erase(std::remove_if(EntriesOrder.begin(), EntriesOrder.end(), [&IsSplitEntry](size_t EntryIndex) {
+			return IsSplitEntry[EntryIndex];
+		}), EntriesOrder.end());
+
+		std::stable_sort(EntriesOrder.begin(), EntriesOrder.end(), [&Entries](size_t Left, size_t Right) {
+			return Entries[Left].first->UncompressedSize > Entries[Right].first->UncompressedSize;
+		});
+
+		/* Every worker owns its stream, workers already run in parallel so writes are inline */
+		std::vector<std::unique_ptr<ExtractStream>> WorkerStreams(Pool->GetThreadsCount());
+		std::vector<std::vector<uint8_t>> WorkerBuffers(Pool->GetThreadsCount());
+		std::atomic<bool> IsFailed = { false };
+		std::mutex DoneMutex;
+		std::condition_variable DoneEvent;
+		size_t TasksLeft = EntriesOrder.size();
+		for (auto& Split : SplitEntries) {
+			TasksLeft += Split->Parts.size();
+		}
+
+		auto FinishTask = [&]() {
+			std::lock_guard<std::mutex> Lock(DoneMutex);
+			if (--TasksLeft == 0) {
+				DoneEvent.notify_all();
+			}
+		};
+
+		/* Parts of split entries are the biggest work, they go first; target is opened here, parts write to it by offsets */
+		std::vector<std::function<void()>> Tasks;
+		Tasks.reserve(TasksLeft);
+		for (auto& Split : SplitEntries) {
+			const ArchiveEntry& Entry = *Entries[Split->EntryIndex].first;
+			try {
+				Split->TargetFile = OpenTarget(Entry, Entries[Split->EntryIndex].second);
+			}
+			catch (...) {
+				Split->TargetFile = nullptr;
+			}
+
+			if (Split->TargetFile == nullptr) {
+				IsFailed = true;
+			} else {
+				Split->TargetFile->AllocateFile(static_cast<size_t>(Entry.UncompressedSize));
+				CountBytesRead(Entry.CompressedSize);
+			}
+
+			for (size_t PartIndex = 0; PartIndex < Split->Parts.size(); PartIndex++) {
+				Tasks.push_back([&, Split = Split.get(), PartIndex]() {
+					SplitPart& Part = Split->Parts[PartIndex];
+					if (!IsFailed.load(std::memory_order_relaxed)) {
+						auto& Buffer = WorkerBuffers[ThreadPool::GetWorkerIndex()];
+						int Result = WriteZstdFrames(Split->Payload, &Split->Frames[Part.FirstFrame], Part.FramesCount, *Split->TargetFile, Buffer, Part.Crc);
+						if (Result < 0) {
+							IsMismatchFound = true;
+						}
+
+						if (Result != 1) {
+							IsFailed = true;
+						}
+					}
+
+					/* Last part checks whole entry and closes target, so flush on close happens on worker too */
+					if (--Split->PartsLeft == 0) {
+						if (!IsFailed) {
+							uint32_t EntryCrc = Split->Parts[0].Crc;
+							for (size_t i = 1; i < Split->Parts.size(); i++) {
+								EntryCrc = static_cast<uint32_t>(crc32_combine(EntryCrc, Split->Parts[i].Crc, static_cast<z_off_t>(Split->Parts[i].Size)));
+							}
+
+							if (!VerifyEntry(*Entries[Split->EntryIndex].first, EntryCrc, nullptr)) {
+								IsFailed = true;
+							}
+						}
+
+						Split->TargetFile = nullptr;
+					}
+
+					FinishTask();
+				});
+			}
+		}
+
+		for (size_t EntryIndex : EntriesOrder) {
+			Tasks.push_back([&, EntryIndex]() {
+				if (!IsFailed.load(std::memory_order_relaxed)) {
+					auto& Stream = WorkerStreams[ThreadPool::GetWorkerIndex()];
+					if (Stream == nullptr) {
+						Stream = std::make_unique<ExtractStream>(ChunkSize, 1, false);
+					}
+
+					if (!ExtractSingle(EntryIndex, *Stream)) {
+						IsFailed = true;
+					}
+				}
+
+				FinishTask();
+			});
+		}
+
+		Pool->SubmitBatch(Tasks);
+		std::unique_lock<std::mutex> Lock(DoneMutex);
+		DoneEvent.wait(Lock, [&TasksLeft]() { return TasksLeft == 0; });
+		return !IsFailed;
+	}
+}
@@ -0,0 +1,495 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: ZIP and native archive writer
+*********************************************************/
+#include "xpackage_internal.h"
+#include "zlib.h"
+#include <filesystem>
+
+namespace xpckg
+{
+	/* zlib counters are 32-bit, so big inputs are fed by steps */
+	constexpr size_t MaxZlibStep = 1u << 30;
+
+	/* Entries ahead of writer are limited by count per thread and by source bytes */
+	constexpr size_t PendingPerThread = 4;
+	constexpr uint64_t MaxPendingBytes = 512ull * 1024 * 1024;
+
+	constexpr uint16_t UnicodeNameFlag = 0x0800;
+	constexpr uint16_t DefaultVersion = 20;
+	constexpr uint16_t Zip64Version = 45;
+	constexpr uint16_t ZstdVersion = 63;
+
+	/* 1980-01-01 00:00 in MS-DOS format, fixed so the same input gives the same archive */
+	constexpr uint32_t FixedDosTime = 0x00210000;
+
+	/* Compressed (or mapped) content of entry, waits here until writer reaches it */
+	struct PackedEntry
+	{
+		FilePointer SourceFile;
+		std::vector<uint8_t> Compressed;
+		const uint8_t* Payload = nullptr;
+		uint64_t PayloadSize = 0;
+		uint64_t UncompressedSize = 0;
+		uint32_t Crc32 = 0;
+		uint16_t Method = 0;
+		bool IsReady = false;
+		bool IsFailed = false;
+	};
+
+	static void
+	PutValue(std::vector<uint8_t>& Output, uint64_t Value, size_t Size)
+	{
+		for (size_t i = 0; i < Size; i++) {
+			Output.push_back(static_cast<uint8_t>(Value >> (i * 8)));
+		}
+	}
+
+	static uint16_t
+	GetVersionNeeded(uint16_t Method, bool bZip64)
+	{
+		if (Method == static_cast<uint16_t>(CompressionMethod::Zstd)) {
+			return ZstdVersion;
+		}
+
+		return bZip64 ? Zip64Version : DefaultVersion;
+	}
+
+	/* Raw deflate into buffer of input size, false if stream doesn't fit (entry is stored then) */
+	static bool
+	DeflateBuffer(const uint8_t* Input, size_t InputSize, int Level, std::vector<uint8_t>& Output)
+	{
+		z_stream Stream = {};
+		if (InputSize == 0 || deflateInit2(&Stream, Level, Z_DEFLATED, RawDeflateWindow, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+			return false;
+		}
+
+		Output.resize(InputSize);
+		size_t InputOffset = 0;
+		size_t OutputOffset = 0;
+		int Result = Z_OK;
+		while (Result == Z_OK && OutputOffset < Output.size()) {
+			size_t InputStep = std::min(InputSize - InputOffset, MaxZlibStep);
+			size_t OutputStep = std::min(Output.size() - OutputOffset, MaxZlibStep);
+			Stream.next_in = const_cast<uint8_t*>(Input + InputOffset);
+			Stream.avail_in = static_cast<uInt>(InputStep);
+			Stream.next_out = Output.data() + OutputOffset;
+			Stream.avail_out = static_cast<uInt>(OutputStep);
+			Result = deflate(&Stream, InputOffset + InputStep == InputSize ? Z_FINISH : Z_NO_FLUSH);
+			InputOffset += InputStep - Stream.avail_in;
+			OutputOffset += OutputStep - Stream.avail_out;
+		}
+
+		deflateEnd(&Stream);
+		if (Result != Z_STREAM_END) {
+			Output.clear();
+			return false;
+		}
+
+		Output.resize(OutputOffset);
+		return true;
+	}
+
+	static void
+	PackEntry(WriterEntry& Entry, CompressionMethod Method, int Level, size_t FrameSize, PackedEntry& OutEntry)
+	{
+		const uint8_t* Source = Entry.SourceData.data();
+		size_t SourceSize = Entry.SourceData.size();
+		if (!Entry.SourcePath.empty()) {
+			try {
+				OutEntry.SourceFile = std::make_shared<FileHandle>(Entry.SourcePath, false);
+			}
+			catch (...) {
+				OutEntry.IsFailed = true;
+				return;
+			}
+
+			SourceSize = OutEntry.SourceFile->GetFileSize();
+			Source = OutEntry.SourceFile->MapFile();
+			if (Source == nullptr && SourceSize != 0) {
+				OutEntry.IsFailed = true;
+				return;
+			}
+		}
+
+		OutEntry.UncompressedSize = SourceSize;
+		OutEntry.Crc32 = UpdateCrc32(0, Source, SourceSize);
+		bool IsCompressed = false;
+		if (!Entry.IsStored && Level != 0) {
+			IsCompressed = Method == CompressionMethod::Zstd ?
+				CompressSeekable(Source, SourceSize, Level, FrameSize, OutEntry.Compressed) :
+				DeflateBuffer(Source, SourceSize, Level, OutEntry.Compressed);
+		}
+
+		if (IsCompressed) {
+			OutEntry.Method = static_cast<uint16_t>(Method);
+			OutEntry.Payload = OutEntry.Compressed.data();
+			OutEntry.PayloadSize = OutEntry.Compressed.size();
+
+			/* Mapping isn't needed anymore, don't keep it until writer gets here */
+			OutEntry.SourceFile = nullptr;
+		} else {
+			OutEntry.Method = static_cast<uint16_t>(CompressionMethod::Stored);
+			OutEntry.Payload = Source;
+			OutEntry.PayloadSize = SourceSize;
+		}
+	}
+
+	ArchiveWriter::ArchiveWriter(FilePointer TargetFile, ArchiveFormat NewFormat)
+		: ArchiveFile(TargetFile), Format(NewFormat)
+	{
+		if (ArchiveFile == nullptr) {
+			throw std::exception();
+		}
+
+		/* Native header is written by "Finish()", when index position is known */
+		if (Format == ArchiveFormat::Native) {
+			ArchiveOffset = NativePageSize;
+		}
+	}
+
+	bool
+	ArchiveWriter::SetCompression(CompressionMethod NewMethod, size_t NewFrameSize)
+	{
+		if (NewMethod == CompressionMethod::Zstd && !IsZstdSupported()) {
+			return false;
+		}
+
+		Method = NewMethod;
+		FrameSize = std::clamp<size_t>(NewFrameSize, MinZstdFrameSize, MaxZstdFrameSize);
+		return true;
+	}
+
+	bool
+	ArchiveWriter::WriteData(const void* Data, size_t DataSize)
+	{
+		const uint8_t* DataPointer = static_cast<const uint8_t*>(Data);
+		while (DataSize != 0 && !IsFailed) {
+			size_t WrittenSize = ArchiveFile->WriteToFile(DataPointer, std::min(DataSize, MaxZlibStep), static_cast<size_t>(ArchiveOffset));
+			IsFailed = WrittenSize == 0;
+			DataPointer += WrittenSize;
+			DataSize -= WrittenSize;
+			ArchiveOffset += WrittenSize;
+		}
+
+		return !IsFailed;
+	}
+
+	bool
+	ArchiveWriter::AddEntries(std::vector<WriterEntry>& Entries, ThreadPool* Pool, int Level)
+	{
+		/* Zero stores everything for both methods, zstd levels above 19 need much more memory to decode */
+		Level = std::clamp(Level, 0, Method == CompressionMethod::Zstd ? 19 : 9);
+		std::vector<PackedEntry> Packed(Entries.size());
+		std::mutex PackedMutex;
+		std::condition_variable PackedEvent;
+
+		/* Writer thread is this one, workers only compress: entries order in file doesn't depend on timing */
+		size_t MaxPending = Pool != nullptr ? Pool->GetThreadsCount() * PendingPerThread : 1;
+		size_t NextSubmit = 0;
+		size_t PendingCount = 0;
+		uint64_t PendingBytes = 0;
+		std::vector<uint64_t> SubmittedBytes(Entries.size());
+
+		auto SubmitEntries = [&]() {
+			while (NextSubmit < Entries.size() && !IsFailed && (PendingCount == 0 || (PendingCount < MaxPending && PendingBytes < MaxPendingBytes))) {
+				size_t EntryIndex = NextSubmit++;
+				SubmittedBytes[EntryIndex] = Entries[EntryIndex].SourceData.size();
+				if (!Entries[EntryIndex].SourcePath.empty()) {
+					std::error_code SizeError;
+					uintmax_t FileSize = std::filesystem::file_size(std::filesystem::u8path(Entries[EntryIndex].SourcePath), SizeError);
+					SubmittedBytes[EntryIndex] = SizeError ? 0 : static_cast<uint64_t>(FileSize);
+				}
+
+				PendingCount++;
+				PendingBytes += SubmittedBytes[EntryIndex];
+				auto PackTask = [&, EntryIndex]() {
+					PackedEntry Result;
+					try {
+						PackEntry(Entries[EntryIndex], Method, Level, FrameSize, Result);
+					}
+					catch (...) {
+						Result = PackedEntry();
+						Result.IsFailed = true;
+					}
+
+					Result.IsReady = true;
+
+					std::lock_guard<std::mutex> Lock(PackedMutex);
+					Packed[EntryIndex] = std::move(Result);
+					PackedEvent.notify_all();
+				};
+
+				if (Pool != nullptr) {
+					Pool->Submit(PackTask);
+				} else {
+					PackTask();
+				}
+			}
+		};
+
+		size_t WrittenIndex = 0;
+		for (; WrittenIndex < Entries.size() && !IsFailed; WrittenIndex++) {
+			SubmitEntries();
+
+			PackedEntry Current;
+			{
+				std::unique_lock<std::mutex> Lock(PackedMutex);
+				PackedEvent.wait(Lock, [&]() { return Packed[WrittenIndex].IsReady; });
+				Current = std::move(Packed[WrittenIndex]);
+			}
+
+			PendingCount--;
+			PendingBytes -= SubmittedBytes[WrittenIndex];
+			if (Current.IsFailed) {
+				IsFailed = true;
+				break;
+			}
+
+			WrittenEntry NewEntry = {};
+			NewEntry.Name = Entries[WrittenIndex].Name;
+			NewEntry.LocalHeaderOffset = ArchiveOffset;
+			NewEntry.CompressedSize = Current.PayloadSize;
+			NewEntry.UncompressedSize = Current.UncompressedSize;
+			NewEntry.Crc32 = Current.Crc32;
+			NewEntry.PlatformMask = Entries[WrittenIndex].PlatformMask;
+			NewEntry.Method = Current.Method;
+
+			/* Padding isn't written: positional writes leave holes, which read as zeros */
+			if (Format == ArchiveFormat::Native) {
+				uint64_t Alignment = NewEntry.CompressedSize >= NativePageSize ? NativePageSize : NativeSmallAlignment;
+				ArchiveOffset = (ArchiveOffset + Alignment - 1) & ~(Alignment - 1);
+				NewEntry.LocalHeaderOffset = ArchiveOffset;
+				if (WriteData(Current.Payload, static_cast<size_t>(Current.PayloadSize))) {
+					WrittenEntries.push_back(std::move(NewEntry));
+				}
+
+				continue;
+			}
+
+			/* Local header gets ZIP64 sizes only when they are saturated, offset is central directory business */
+			bool IsZip64 = NewEntry.CompressedSize >= UINT32_MAX || NewEntry.UncompressedSize >= UINT32_MAX;
+			std::vector<uint8_t> Header;
+			PutValue(Header, LocalHeaderSignature, 4);
+			PutValue(Header, GetVersionNeeded(NewEntry.Method, IsZip64), 2);
+			PutValue(Header, UnicodeNameFlag, 2);
+			PutValue(Header, NewEntry.Method, 2);
+			PutValue(Header, FixedDosTime, 4);
+			PutValue(Header, NewEntry.Crc32, 4);
+			PutValue(Header, IsZip64 ? UINT32_MAX : NewEntry.CompressedSize, 4);
+			PutValue(Header, IsZip64 ? UINT32_MAX : NewEntry.UncompressedSize, 4);
+			PutValue(Header, NewEntry.Name.size(), 2);
+			PutValue(Header, IsZip64 ? 20 : 0, 2);
+			Header.insert(Header.end(), NewEntry.Name.begin(), NewEntry.Name.end());
+			if (IsZip64) {
+				PutValue(Header, Zip64ExtraTag, 2);
+				PutValue(Header, 16, 2);
+				PutValue(Header, NewEntry.UncompressedSize, 8);
+				PutValue(Header, NewEntry.CompressedSize, 8);
+			}
+
+			if (WriteData(Header.data(), Header.size()) && WriteData(Current.Payload, static_cast<size_t>(Current.PayloadSize))) {
+				WrittenEntries.push_back(std::move(NewEntry));
+			}
+		}
+
+		/* Workers still reference entries and results, nothing can leave before they finish */
+		std::unique_lock<std::mutex> Lock(PackedMutex);
+		for (size_t i = WrittenIndex; i < NextSubmit; i++) {
+			PackedEvent.wait(Lock, [&]() { return Packed[i].IsReady; });
+		}
+
+		return !IsFailed;
+	}
+
+	bool
+	ArchiveWriter::Finish()
+	{
+		if (IsFailed) {
+			return false;
+		}
+
+		if (Format == ArchiveFormat::Native) {
+			return FinishNative();
+		}
+
+		uint64_t DirectoryOffset = ArchiveOffset;
+		std::vector<uint8_t> Directory;
+		for (auto& Entry : WrittenEntries) {
+			std::vector<uint8_t> Extra;
+			if (Entry.UncompressedSize >= UINT32_MAX) {
+				PutValue(Extra, Entry.UncompressedSize, 8);
+			}
+
+			if (Entry.CompressedSize >= UINT32_MAX) {
+				PutValue(Extra, Entry.CompressedSize, 8);
+			}
+
+			if (Entry.LocalHeaderOffset >= UINT32_MAX) {
+				PutValue(Extra, Entry.LocalHeaderOffset, 8);
+			}
+
+			uint16_t Version = GetVersionNeeded(Entry.Method, !Extra.empty());
+			PutValue(Directory, CentralHeaderSignature, 4);
+			PutValue(Directory, Version, 2);
+			PutValue(Directory, Version, 2);
+			PutValue(Directory, UnicodeNameFlag, 2);
+			PutValue(Directory, Entry.Method, 2);
+			PutValue(Directory, FixedDosTime, 4);
+			PutValue(Directory, Entry.Crc32, 4);
+			PutValue(Directory, std::min<uint64_t>(Entry.CompressedSize, UINT32_MAX), 4);
+			PutValue(Directory, std::min<uint64_t>(Entry.UncompressedSize, UINT32_MAX), 4);
+			PutValue(Directory, Entry.Name.size(), 2);
+			PutValue(Directory, Extra.empty() ? 0 : Extra.size() + 4, 2);
+			PutValue(Directory, 0, 2);				// comment
+			PutValue(Directory, 0, 2);				// disk
+			PutValue(Directory, 0, 2);				// internal attributes
+			PutValue(Directory, 0, 4);				// external attributes
+			PutValue(Directory, std::min<uint64_t>(Entry.LocalHeaderOffset, UINT32_MAX), 4);
+			Directory.insert(Directory.end(), Entry.Name.begin(), Entry.Name.end());
+			if (!Extra.empty()) {
+				PutValue(Directory, Zip64ExtraTag, 2);
+				PutValue(Directory, Extra.size(), 2);
+				Directory.insert(Directory.end(), Extra.begin(), Extra.end());
+			}
+		}
+
+		uint64_t DirectorySize = Directory.size();
+		uint64_t EntriesCount = WrittenEntries.size();
+		bool IsZip64 = EntriesCount >= UINT16_MAX || DirectorySize >= UINT32_MAX || DirectoryOffset >= UINT32_MAX;
+		if (IsZip64) {
+			uint64_t Zip64EndOffset = DirectoryOffset + DirectorySize;
+			PutValue(Directory, Zip64EndOfDirectorySignature, 4);
+			PutValue(Directory, Zip64EndOfDirectorySize - 12, 8);
+			PutValue(Directory, Zip64Version, 2);
+			PutValue(Directory, Zip64Version, 2);
+			PutValue(Directory, 0, 4);				// disk
+			PutValue(Directory, 0, 4);				// disk with directory
+			PutValue(Directory, EntriesCount, 8);
+			PutValue(Directory, EntriesCount, 8);
+			PutValue(Directory, DirectorySize, 8);
+			PutValue(Directory, DirectoryOffset, 8);
+
+			PutValue(Directory, Zip64LocatorSignature, 4);
+			PutValue(Directory, 0, 4);
+			PutValue(Directory, Zip64EndOffset, 8);
+			PutValue(Directory, 1, 4);				// disks count
+		}
+
+		PutValue(Directory, EndOfDirectorySignature, 4);
+		PutValue(Directory, 0, 2);
+		PutValue(Directory, 0, 2);
+		PutValue(Directory, std::min<uint64_t>(EntriesCount, UINT16_MAX), 2);
+		PutValue(Directory, std::min<uint64_t>(EntriesCount, UINT16_MAX), 2);
+		PutValue(Directory, std::min<uint64_t>(DirectorySize, UINT32_MAX), 4);
+		PutValue(Directory, std::min<uint64_t>(DirectoryOffset, UINT32_MAX), 4);
+		PutValue(Directory, 0, 2);
+
+		return WriteData(Directory.data(), Directory.size());
+	}
+
+	bool
+	ArchiveWriter::FinishNative()
+	{
+		/* Buckets keep entry positions as 32-bit values */
+		if (WrittenEntries.size() > UINT32_MAX) {
+			IsFailed = true;
+			return false;
+		}
+
+		/* Sorted by hash and then by name, stable for duplicates, so reader probes buckets in place */
+		std::vector<std::pair<uint64_t, size_t>> SortedEntries(WrittenEntries.size());
+		for (size_t i = 0; i < WrittenEntries.size(); i++) {
+			SortedEntries[i] = { HashString(WrittenEntries[i].Name), i };
+		}
+
+		std::stable_sort(SortedEntries.begin(), SortedEntries.end(), [this](const auto& Left, const auto& Right) {
+			return Left.first != Right.first ? Left.first < Right.first : WrittenEntries[Left.second].Name < WrittenEntries[Right.second].Name;
+		});
+
+		std::vector<NativeIndexEntry> Index(WrittenEntries.size());
+		std::string Names;
+		for (size_t i = 0; i < SortedEntries.size(); i++) {
+			const WrittenEntry& Entry = WrittenEntries[SortedEntries[i].second];
+			if (Entry.Name.size() > UINT16_MAX || Names.size() + Entry.Name.size() > UINT32_MAX) {
+				IsFailed = true;
+				return false;
+			}
+
+			NativeIndexEntry& IndexEntry = Index[i];
+			IndexEntry = {};
+			IndexEntry.NameHash = SortedEntries[i].first;
+			IndexEntry.DataOffset = Entry.LocalHeaderOffset;
+			IndexEntry.CompressedSize = Entry.CompressedSize;
+			IndexEntry.UncompressedSize = Entry.UncompressedSize;
+			IndexEntry.NameOffset = static_cast<uint32_t>(Names.size());
+			IndexEntry.NameLength = static_cast<uint16_t>(Entry.Name.size());
+			IndexEntry.Method = Entry.Method;
+			IndexEntry.Crc32 = Entry.Crc32;
+			IndexEntry.PlatformMask = Entry.PlatformMask;
+			Names += Entry.Name;
+		}
+
+		/* About one entry per bucket, bucket of hash is its top bits */
+		uint32_t BucketBits = 1;
+		while (BucketBits < 32 && (1ull << BucketBits) < Index.size()) {
+			BucketBits++;
+		}
+
+		std::vector<uint32_t> Buckets((1ull << BucketBits) + 1);
+		for (size_t Bucket = 0, i = 0; Bucket < Buckets.size(); Bucket++) {
+			while (i < Index.size() && (Index[i].NameHash >> (64 - BucketBits)) < Bucket) {
+				i++;
+			}
+
+			Buckets[Bucket] = static_cast<uint32_t>(i);
+		}
+
+		size_t IndexSize = Index.size() * sizeof(NativeIndexEntry);
+		size_t BucketsSize = Buckets.size() * sizeof(uint32_t);
+		uint32_t IndexCrc = UpdateCrc32(0, reinterpret_cast<const uint8_t*>(Index.data()), IndexSize);
+		IndexCrc = UpdateCrc32(IndexCrc, reinterpret_cast<const uint8_t*>(Buckets.data()), BucketsSize);
+
+		NativeHeader Header = {};
+		Header.Signature = NativeSignature;
+		Header.Version = NativeVersion;
+		Header.HeaderSize = sizeof(NativeHeader);
+		Header.PageSize = static_cast<uint32_t>(NativePageSize);
+		Header.IndexCrc = UpdateCrc32(IndexCrc, reinterpret_cast<const uint8_t*>(Names.data()), Names.size());
+		Header.EntriesCount = Index.size();
+		Header.IndexOffset = (ArchiveOffset + alignof(NativeIndexEntry) - 1) & ~static_cast<uint64_t>(alignof(NativeIndexEntry) - 1);
+		Header.BucketsOffset = Header.IndexOffset + IndexSize;
+		Header.NamesOffset = Header.BucketsOffset + BucketsSize;
+		Header.NamesSize = Names.size();
+		Header.BucketBits = BucketBits;
+
+		/* Header goes last: file with zero signature isn't taken for package if writer dies midway */
+		ArchiveOffset = Header.IndexOffset;
+		if (!WriteData(Index.data(), IndexSize) || !WriteData(Buckets.data(), BucketsSize) || !WriteData(Names.data(), Names.size())) {
+			return false;
+		}
+
+		uint64_t ArchiveSize = ArchiveOffset;
+		ArchiveOffset = 0;
+		bool IsWritten = WriteData(&Header, sizeof(Header));
+		ArchiveOffset = ArchiveSize;
+		return IsWritten;
+	}
+
+	uint64_t
+	ArchiveWriter::GetArchiveSize()
+	{
+		return ArchiveOffset;
+	}
+
+	size_t
+	ArchiveWriter::GetStoredCount()
+	{
+		return static_cast<size_t>(std::count_if(WrittenEntries.begin(), WrittenEntries.end(), [](const WrittenEntry& Entry) {
+			return Entry.Method == static_cast<uint16_t>(CompressionMethod::Stored);
+		}));
+	}
+}
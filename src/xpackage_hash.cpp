@@ -0,0 +1,279 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: checksums of package data
+*********************************************************/
+#include "xpackage_internal.h"
+#include "zlib.h"
+#include <climits>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define XPACKAGE_CRC32_CLMUL
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CLMUL_TARGET
+#else
+#define CLMUL_TARGET __attribute__((target("pclmul,sse4.1")))
+#endif
+#endif
+
+namespace xpckg
+{
+	static uint32_t
+	UpdateCrc32Portable(uint32_t Crc, const uint8_t* Data, size_t DataSize)
+	{
+		uLong CurrentCrc = Crc;
+		while (DataSize != 0) {
+			uInt StepSize = static_cast<uInt>(std::min<size_t>(DataSize, UINT_MAX));
+			CurrentCrc = crc32(CurrentCrc, Data, StepSize);
+			Data += StepSize;
+			DataSize -= StepSize;
+		}
+
+		return static_cast<uint32_t>(CurrentCrc);
+	}
+
+#ifdef XPACKAGE_CRC32_CLMUL
+	static bool
+	IsClmulSupported()
+	{
+#ifdef _MSC_VER
+		int CpuInfo[4] = {};
+		__cpuid(CpuInfo, 1);
+		return (CpuInfo[2] & (1 << 1)) != 0 && (CpuInfo[2] & (1 << 19)) != 0;
+#else
+		/* Runs from static initializer, CPU model may be not initialized yet */
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#endif
+	}
+
+	static const bool IsClmulCrc = IsClmulSupported();
+
+	/*
+		Folding of CRC with carry-less multiplication ("Fast CRC Computation for Generic
+		Polynomials Using PCLMULQDQ", Intel). Constants are for bit-reflected ZIP polynomial.
+		Input is at least 64 bytes and multiple of 16, CRC is passed and returned inverted.
+	*/
+	alignas(16) static const uint64_t FoldBy4Keys[2] = { 0x0154442bd4, 0x01c6e41596 };
+	alignas(16) static const uint64_t FoldBy1Keys[2] = { 0x01751997d0, 0x00ccaa009e };
+	alignas(16) static const uint64_t FoldTo64Keys[2] = { 0x0163cd6124, 0x0000000000 };
+	alignas(16) static const uint64_t BarrettKeys[2] = { 0x01db710641, 0x01f7011641 };
+
+	CLMUL_TARGET static uint32_t
+	FoldCrc32Clmul(uint32_t Crc, const uint8_t* Data, size_t DataSize)
+	{
+		__m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Data + 0x00));
+		__m128i x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Data + 0x10));
+		__m128i x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Data + 0x20));
+		__m128i x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Data + 0x30));
+		x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(Crc)));
+		__m128i x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(FoldBy4Keys));
+		Data += 64;
+		DataSize -= 64;
+
+		/* Four independent lanes hide latency of multiplication */
+		while (DataSize >= 64) {
+			__m128i x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+			__m128i x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+			__m128i x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+			__m128i x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+			x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+			x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+			x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+			x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+			x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(reinterpret_cast<const __m128i*>(Data + 0x00)));
+			x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(reinterpret_cast<const __m128i*>(Data + 0x10)));
+			x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(reinterpret_cast<const __m128i*>(Data + 0x20)));
+			x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(reinterpret_cast<const __m128i*>(Data + 0x30)));
+			Data += 64;
+			DataSize -= 64;
+		}
+
+		/* Lanes are folded into one, then the rest is folded by 16 bytes */
+		x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(FoldBy1Keys));
+		__m128i Lanes[3] = { x2, x3, x4 };
+		for (__m128i& Lane : Lanes) {
+			__m128i x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+			x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+			x1 = _mm_xor_si128(_mm_xor_si128(x1, Lane), x5);
+		}
+
+		while (DataSize >= 16) {
+			__m128i x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+			x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+			x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(Data))), x5);
+			Data += 16;
+			DataSize -= 16;
+		}
+
+		/* 128 bits to 64, then Barrett reduction to 32 */
+		__m128i Mask = _mm_setr_epi32(~0, 0, ~0, 0);
+		x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+		x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+		x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(FoldTo64Keys));
+		x2 = _mm_srli_si128(x1, 4);
+		x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, Mask), x0, 0x00);
+		x1 = _mm_xor_si128(x1, x2);
+
+		x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(BarrettKeys));
+		x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, Mask), x0, 0x10);
+		x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, Mask), x0, 0x00);
+		x1 = _mm_xor_si128(x1, x2);
+		return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+	}
+#endif
+
+	uint32_t
+	UpdateCrc32(uint32_t Crc, const uint8_t* Data, size_t DataSize)
+	{
+#ifdef XPACKAGE_CRC32_CLMUL
+		if (IsClmulCrc && DataSize >= 64) {
+			size_t FoldedSize = DataSize & ~static_cast<size_t>(15);
+			Crc = ~FoldCrc32Clmul(~Crc, Data, FoldedSize);
+			Data += FoldedSize;
+			DataSize -= FoldedSize;
+		}
+#endif
+		return DataSize != 0 ? UpdateCrc32Portable(Crc, Data, DataSize) : Crc;
+	}
+
+	static const uint32_t Sha256Constants[64] = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+	};
+
+	static inline uint32_t
+	RotateRight(uint32_t Value, int Shift)
+	{
+		return (Value >> Shift) | (Value << (32 - Shift));
+	}
+
+	Sha256::Sha256()
+	{
+		static const uint32_t InitialState[8] = {
+			0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+		};
+
+		std::memcpy(State, InitialState, sizeof(State));
+	}
+
+	void
+	Sha256::ProcessBlocks(const uint8_t* Data, size_t BlocksCount)
+	{
+		for (; BlocksCount != 0; BlocksCount--, Data += 64) {
+			uint32_t Schedule[64];
+			for (int i = 0; i < 16; i++) {
+				Schedule[i] = (static_cast<uint32_t>(Data[i * 4]) << 24) | (static_cast<uint32_t>(Data[i * 4 + 1]) << 16) |
+					(static_cast<uint32_t>(Data[i * 4 + 2]) << 8) | static_cast<uint32_t>(Data[i * 4 + 3]);
+			}
+
+			for (int i = 16; i < 64; i++) {
+				uint32_t s0 = RotateRight(Schedule[i - 15], 7) ^ RotateRight(Schedule[i - 15], 18) ^ (Schedule[i - 15] >> 3);
+				uint32_t s1 = RotateRight(Schedule[i - 2], 17) ^ RotateRight(Schedule[i - 2], 19) ^ (Schedule[i - 2] >> 10);
+				Schedule[i] = Schedule[i - 16] + s0 + Schedule[i - 7] + s1;
+			}
+
+			uint32_t a = State[0], b = State[1], c = State[2], d = State[3];
+			uint32_t e = State[4], f = State[5], g = State[6], h = State[7];
+			for (int i = 0; i < 64; i++) {
+				uint32_t S1 = RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+				uint32_t Choice = (e & f) ^ (~e & g);
+				uint32_t Temp1 = h + S1 + Choice + Sha256Constants[i] + Schedule[i];
+				uint32_t S0 = RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+				uint32_t Majority = (a & b) ^ (a & c) ^ (b & c);
+				h = g;
+				g = f;
+				f = e;
+				e = d + Temp1;
+				d = c;
+				c = b;
+				b = a;
+				a = Temp1 + S0 + Majority;
+			}
+
+			State[0] += a; State[1] += b; State[2] += c; State[3] += d;
+			State[4] += e; State[5] += f; State[6] += g; State[7] += h;
+		}
+	}
+
+	void
+	Sha256::Update(const uint8_t* Data, size_t DataSize)
+	{
+		TotalSize += DataSize;
+		if (BufferSize != 0) {
+			size_t CopySize = std::min(DataSize, sizeof(Buffer) - BufferSize);
+			std::memcpy(Buffer + BufferSize, Data, CopySize);
+			BufferSize += CopySize;
+			Data += CopySize;
+			DataSize -= CopySize;
+			if (BufferSize < sizeof(Buffer)) {
+				return;
+			}
+
+			ProcessBlocks(Buffer, 1);
+			BufferSize = 0;
+		}
+
+		/* Whole blocks are hashed straight from input, without copies */
+		ProcessBlocks(Data, DataSize / 64);
+		BufferSize = DataSize % 64;
+		std::memcpy(Buffer, Data + DataSize - BufferSize, BufferSize);
+	}
+
+	void
+	Sha256::Finish(Sha256Digest& OutDigest)
+	{
+		uint64_t BitsCount = TotalSize * 8;
+		uint8_t Padding[72] = { 0x80 };
+		size_t PaddingSize = (BufferSize < 56 ? 56 : 120) - BufferSize;
+		for (int i = 0; i < 8; i++) {
+			Padding[PaddingSize + i] = static_cast<uint8_t>(BitsCount >> (56 - i * 8));
+		}
+
+		Update(Padding, PaddingSize + 8);
+		for (int i = 0; i < 8; i++) {
+			OutDigest[i * 4] = static_cast<uint8_t>(State[i] >> 24);
+			OutDigest[i * 4 + 1] = static_cast<uint8_t>(State[i] >> 16);
+			OutDigest[i * 4 + 2] = static_cast<uint8_t>(State[i] >> 8);
+			OutDigest[i * 4 + 3] = static_cast<uint8_t>(State[i]);
+		}
+	}
+
+	bool
+	ParseSha256Digest(std::string_view HexString, Sha256Digest& OutDigest)
+	{
+		if (HexString.size() != OutDigest.size() * 2) {
+			return false;
+		}
+
+		auto HexValue = [](char Symbol) -> int {
+			if (Symbol >= '0' && Symbol <= '9') return Symbol - '0';
+			if (Symbol >= 'a' && Symbol <= 'f') return Symbol - 'a' + 10;
+			if (Symbol >= 'A' && Symbol <= 'F') return Symbol - 'A' + 10;
+			return -1;
+		};
+
+		for (size_t i = 0; i < OutDigest.size(); i++) {
+			int High = HexValue(HexString[i * 2]);
+			int Low = HexValue(HexString[i * 2 + 1]);
+			if (High < 0 || Low < 0) {
+				return false;
+			}
+
+			OutDigest[i] = static_cast<uint8_t>((High << 4) | Low);
+		}
+
+		return true;
+	}
+}
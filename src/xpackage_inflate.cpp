@@ -0,0 +1,111 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: bulk inflate routines
+*********************************************************/
+#include "xpackage_internal.h"
+#include "zlib.h"
+#include <climits>
+
+namespace xpckg
+{
+	int
+	DetectDeflateWindow(const uint8_t* Input, size_t InputSize)
+	{
+		if (InputSize >= 2 && Input[0] == 0x1F && Input[1] == 0x8B) {
+			return GzipWindow;
+		}
+
+		/* zlib header: deflate method, window up to 32K and FCHECK makes header multiple of 31 */
+		if (InputSize >= 2 && (Input[0] & 0x0F) == Z_DEFLATED && (Input[0] >> 4) <= 7 && ((Input[0] << 8) | Input[1]) % 31 == 0) {
+			return ZlibWindow;
+		}
+
+		return RawDeflateWindow;
+	}
+
+	/*
+		Core loop shared by both entry points. z_stream counters are 32-bit, so input and
+		output are fed in UINT_MAX portions: it's the only reason to have loop here at all.
+	*/
+	static int
+	InflateLoop(z_stream& stream, const uint8_t*& Input, size_t& InputLeft, uint8_t* Output, size_t& OutputLeft)
+	{
+		stream.next_out = Output;
+		int result = Z_OK;
+		while (result == Z_OK) {
+			if (stream.avail_in == 0 && InputLeft != 0) {
+				stream.next_in = const_cast<Bytef*>(Input);
+				stream.avail_in = static_cast<uInt>(std::min<size_t>(InputLeft, UINT_MAX));
+				Input += stream.avail_in;
+				InputLeft -= stream.avail_in;
+			}
+
+			if (stream.avail_out == 0 && OutputLeft != 0) {
+				stream.avail_out = static_cast<uInt>(std::min<size_t>(OutputLeft, UINT_MAX));
+				OutputLeft -= stream.avail_out;
+			}
+
+			result = inflate(&stream, Z_NO_FLUSH);
+			if (result == Z_BUF_ERROR && (stream.avail_in != 0 || InputLeft != 0) && (stream.avail_out != 0 || OutputLeft != 0)) {
+				result = Z_OK;
+			}
+		}
+
+		/* Return unused output portion back to caller */
+		OutputLeft += stream.avail_out;
+		stream.avail_out = 0;
+		return result;
+	}
+
+	bool
+	InflateBuffer(const uint8_t* Input, size_t InputSize, uint8_t* Output, size_t OutputSize, int WindowBits, size_t& OutputWritten)
+	{
+		OutputWritten = 0;
+		if (OutputSize == 0) {
+			return false;
+		}
+
+		z_stream stream = {};
+		if (inflateInit2(&stream, WindowBits) != Z_OK) {
+			return false;
+		}
+
+		size_t OutputLeft = OutputSize;
+		int result = InflateLoop(stream, Input, InputSize, Output, OutputLeft);
+		OutputWritten = OutputSize - OutputLeft;
+		inflateEnd(&stream);
+		return result == Z_STREAM_END;
+	}
+
+	bool
+	InflateToVector(const uint8_t* Input, size_t InputSize, std::vector<uint8_t>& Output, int WindowBits, size_t GrowStep)
+	{
+		z_stream stream = {};
+		if (inflateInit2(&stream, WindowBits) != Z_OK) {
+			return false;
+		}
+
+		size_t BaseSize = Output.size();
+		size_t OutputSize = BaseSize;
+		int result = Z_BUF_ERROR;
+		while (true) {
+			/* Grow geometrically, so count of inflate restarts is logarithmic */
+			size_t NewCapacity = std::max(GrowStep, (OutputSize - BaseSize));
+			Output.resize(OutputSize + NewCapacity);
+
+			size_t OutputLeft = NewCapacity;
+			result = InflateLoop(stream, Input, InputSize, Output.data() + OutputSize, OutputLeft);
+			OutputSize += NewCapacity - OutputLeft;
+			if (result != Z_BUF_ERROR || OutputLeft != 0) {
+				break;
+			}
+		}
+
+		Output.resize(OutputSize);
+		inflateEnd(&stream);
+		return result == Z_STREAM_END;
+	}
+}
@@ -0,0 +1,513 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: private declarations shared by platform layers
+*********************************************************/
+#pragma once
+#include "xpackage.h"
+
+namespace xpckg
+{
+	extern std::unordered_map<std::string, PackageBinaries> BinaryPlatformsMap;
+	extern std::unordered_map<PackageBinaries, std::string> PlatformsStringMap;
+
+	/* Convert archive path separators ('/') to separators of current platform */
+	void ConvertToNativeStyle(std::string& CurrentString);
+
+	/*
+		Entry path which stays inside plugin folder: relative, '/' separated, without empty,
+		"." or ".." components, backslashes and drive prefix. Names of manifest and registry
+		are checked before anything is joined to folder path.
+	*/
+	bool IsSafeEntryPath(std::string_view Path);
+
+	/* 64-bit FNV-1a, cheap enough for names and stable between runs and platforms */
+	inline uint64_t
+	HashString(std::string_view String)
+	{
+		uint64_t Hash = 0xcbf29ce484222325ull;
+		for (char Symbol : String) {
+			Hash ^= static_cast<uint8_t>(Symbol);
+			Hash *= 0x100000001b3ull;
+		}
+
+		return Hash;
+	}
+
+	/* Plain positional copy through user space buffer, fallback for kernel-side copies */
+	size_t CopyFileData(FileHandle& SourceFile, size_t SourcePosition, FileHandle& TargetFile, size_t TargetPosition, size_t SizeToCopy);
+
+	/* Suffix of folder where package is assembled before it replaces plugin folder */
+	constexpr const char* StagingSuffix = ".staging";
+
+	/* Suffix of changed file written next to its old version in place, renamed over it when all are written */
+	constexpr const char* PendingSuffix = ".pending";
+
+	/*
+		Deleted plugin folder is renamed to "<plugin>.removed<N>" and reclaimed in background.
+		Files are removed by batches, every batch is one task of remove pool.
+	*/
+	constexpr const char* RemovedSuffix = ".removed";
+	constexpr size_t RemoveBatchSize = 256;
+	constexpr size_t MaxRemovedFolders = 64;
+
+	/* True for folders left by deletion of plugin, including ones left by crashed process */
+	bool IsRemovedFolder(std::string_view FolderName, std::string_view PluginName);
+
+	/* Shared pointer which flushes file before it's closed, failed flush raises the flag */
+	FilePointer FlushOnClose(FilePointer TargetFile, std::atomic<bool>& IsFlushFailed);
+
+	/* ZIP record signatures and fixed sizes, shared by archive reader and writer */
+	constexpr uint32_t LocalHeaderSignature = 0x04034b50;
+	constexpr uint32_t CentralHeaderSignature = 0x02014b50;
+	constexpr uint32_t EndOfDirectorySignature = 0x06054b50;
+	constexpr uint32_t Zip64EndOfDirectorySignature = 0x06064b50;
+	constexpr uint32_t Zip64LocatorSignature = 0x07064b50;
+	constexpr uint16_t Zip64ExtraTag = 0x0001;
+
+	constexpr size_t LocalHeaderSize = 30;
+	constexpr size_t CentralHeaderSize = 46;
+	constexpr size_t EndOfDirectorySize = 22;
+	constexpr size_t Zip64EndOfDirectorySize = 56;
+	constexpr size_t Zip64LocatorSize = 20;
+
+	/*
+		Native package (".xpkg"), little-endian. Header takes the first page, payloads follow it,
+		index, buckets and names blob go last. Index is sorted by FNV-1a hash of name (then by
+		name) and bucket N is the first index entry with top hash bits >= N, so both are used
+		straight from mapping: no parsing, lookup is one bucket probe. Payloads of page size
+		and more start at page boundary: stored ones are usable in place and can share extents
+		with installed files, small ones are packed tightly.
+	*/
+	constexpr uint32_t NativeSignature = 0x474B5058;		// "XPKG"
+	constexpr uint16_t NativeVersion = 1;
+	constexpr uint64_t NativePageSize = 4096;
+	constexpr uint64_t NativeSmallAlignment = 16;
+
+	struct NativeHeader
+	{
+		uint32_t Signature;
+		uint16_t Version;
+		uint16_t HeaderSize;
+		uint32_t PageSize;
+		uint32_t IndexCrc;				// CRC-32 of index, buckets and names
+		uint64_t EntriesCount;
+		uint64_t IndexOffset;
+		uint64_t BucketsOffset;			// (1 << BucketBits) + 1 values of uint32_t
+		uint64_t NamesOffset;
+		uint64_t NamesSize;
+		uint32_t BucketBits;
+		uint32_t Reserved;
+	};
+
+	struct NativeIndexEntry
+	{
+		uint64_t NameHash;
+		uint64_t DataOffset;
+		uint64_t CompressedSize;
+		uint64_t UncompressedSize;
+		uint32_t NameOffset;			// in names blob
+		uint16_t NameLength;
+		uint16_t Method;				// "CompressionMethod" value
+		uint32_t Crc32;
+		uint32_t PlatformMask;			// "PackageBinaries" which install entry, zero if none
+	};
+
+	static_assert(sizeof(NativeHeader) == 64 && sizeof(NativeIndexEntry) == 48, "native package records are fixed");
+
+	/* zlib window bits for raw deflate, zlib and gzip streams */
+	constexpr int RawDeflateWindow = -15;
+	constexpr int ZlibWindow = 15;
+	constexpr int GzipWindow = 15 + 16;
+
+	/* Deflate can't expand data more than this, sizes above it from headers are forged or damaged */
+	constexpr size_t MaxDeflateRatio = 1032;
+
+	/* Detect stream format by header bytes: gzip, zlib or raw deflate otherwise */
+	int DetectDeflateWindow(const uint8_t* Input, size_t InputSize);
+
+	/*
+		Single-shot inflate of whole input into presized output. Works directly on caller
+		memory (mapped archive, presized vector), so there is no staging buffer at all.
+	*/
+	bool InflateBuffer(const uint8_t* Input, size_t InputSize, uint8_t* Output, size_t OutputSize, int WindowBits, size_t& OutputWritten);
+
+	/* Inflate with unknown output size: vector grows geometrically and is inflated into in place */
+	bool InflateToVector(const uint8_t* Input, size_t InputSize, std::vector<uint8_t>& Output, int WindowBits, size_t GrowStep);
+
+	/*
+		Whole deflate stream file (gzip, zlib or raw) appended to output. Buffer size is the least
+		step of output growth when size isn't known from gzip trailer. Used by "UnpackFile()".
+	*/
+	bool UnpackDeflateFile(FileHandle& PackageFile, std::vector<uint8_t>& UnpackedData, size_t BufferSize);
+
+	/* Parse package manifest with given parser, false if it isn't JSON object with package id. Used by "ParseJson()" */
+	bool ParseManifest(simdjson::dom::parser& Parser, std::vector<uint8_t>& ManifestData, std::shared_ptr<simdjson::dom::element>& ParsedElement);
+
+	/*
+		Zstandard entries (ZIP method 93). Writer makes them seekable: payload is a row of
+		independent frames closed by skippable frame with seek table ("seekable format" of
+		zstd), so big entries are decoded by parts in parallel and ranges of them without
+		decoding from start. Plain zstd streams of other writers are decoded sequentially.
+		Builds without zstd keep the functions, but they fail and stream constructor throws.
+	*/
+	constexpr size_t DefaultZstdFrameSize = 1024 * 1024;
+	constexpr size_t MinZstdFrameSize = 64 * 1024;
+	constexpr size_t MaxZstdFrameSize = 64 * 1024 * 1024;
+
+	struct ZstdFrame
+	{
+		uint64_t CompressedOffset;		// from start of entry payload
+		uint64_t DecompressedOffset;
+		uint32_t CompressedSize;
+		uint32_t DecompressedSize;
+	};
+
+	bool IsZstdSupported();
+
+	/*
+		False if payload doesn't end with seek table, table doesn't cover payload and decompressed size
+		exactly, or some frame is bigger than MaxZstdFrameSize
+	*/
+	bool ReadSeekTable(const uint8_t* Payload, uint64_t PayloadSize, uint64_t DecompressedSize, std::vector<ZstdFrame>& OutFrames);
+
+	/* False if zstd isn't available or output isn't smaller than input (entry is stored then) */
+	bool CompressSeekable(const uint8_t* Input, size_t InputSize, int Level, size_t FrameSize, std::vector<uint8_t>& Output);
+
+	/* Decode all frames of input into presized output, on decompression context of current thread */
+	bool DecompressZstd(const uint8_t* Input, size_t InputSize, uint8_t* Output, size_t OutputSize, size_t& OutputWritten);
+
+	/* Streaming decoder of one entry at a time, for outputs which don't fit memory */
+	class ZstdStream
+	{
+	private:
+		void* Context = nullptr;
+
+	public:
+		ZstdStream();
+		~ZstdStream();
+
+		void Reset();
+
+		/* Moves both buffers forward: -1 on damaged or truncated data, 1 at stream end, 0 if output is full */
+		int Decode(const uint8_t*& Input, size_t& InputSize, uint8_t*& Output, size_t& OutputSize);
+	};
+
+	/*
+		CRC-32 of ZIP entries, continues from previous value (zero for new data). CPUs with
+		carry-less multiply fold 64 bytes per step, others and short tails go through zlib.
+	*/
+	uint32_t UpdateCrc32(uint32_t Crc, const uint8_t* Data, size_t DataSize);
+
+	/* Incremental SHA-256 for digests declared in package manifest */
+	class Sha256
+	{
+	private:
+		uint32_t State[8];
+		uint8_t Buffer[64];
+		size_t BufferSize = 0;
+		uint64_t TotalSize = 0;
+
+		void ProcessBlocks(const uint8_t* Data, size_t BlocksCount);
+
+	public:
+		Sha256();
+
+		void Update(const uint8_t* Data, size_t DataSize);
+		void Finish(Sha256Digest& OutDigest);
+	};
+
+	/* Digest from 64 hex digits, false on wrong length or symbol */
+	bool ParseSha256Digest(std::string_view HexString, Sha256Digest& OutDigest);
+
+	/*
+		Folders of package entries, created in one pass before files are written. Entry
+		paths are reduced to set of unique folders (paths live in one arena, no per-file
+		strings), every folder is created relative to handle of its parent and handles are
+		kept for file writes. After "CreateTree()" tree is read-only and safe for workers.
+	*/
+	class DirectoryTree
+	{
+	private:
+		struct TreeNode
+		{
+			std::string_view Path;
+			size_t Parent = 0;
+			RawHandle Handle = nullptr;
+		};
+
+		RawHandle RootHandle = nullptr;
+		std::string RootPath;
+		std::vector<std::unique_ptr<char[]>> PathsArena;
+		std::vector<TreeNode> Nodes;
+		std::unordered_map<std::string_view, size_t> NodesIndex;
+
+		void AddFolder(std::string_view FolderPath);
+		bool CreateFolder(TreeNode& Node, bool bKeepHandle);
+		void CloseFolder(TreeNode& Node);
+
+	public:
+		/*
+			Root handle is borrowed, it's parent of top-level folders. Windows has no public
+			"create at" API, so folders are created by root path there and have no handles.
+		*/
+		DirectoryTree(RawHandle RootDirectory, const std::string& RootDirectoryPath);
+		~DirectoryTree();
+
+		/* Collect folders of entries, parents always get lower index than children */
+		void AddEntries(const EntriesList& Entries);
+
+		/* Create all collected folders, false on first folder which can't be created */
+		bool CreateTree();
+
+		/* Flush folders, so names of files created in them survive crash too */
+		bool FlushTree();
+
+		/* Handle of folder containing entry and name inside it, entries of folders without handle are addressed from root */
+		RawHandle GetEntryFolder(std::string_view EntryPath, std::string_view& OutName);
+
+		/* Count of collected folders, root isn't counted */
+		size_t GetFoldersCount();
+	};
+
+	/*
+		Counters of running install phase, shared by every thread working for it. Threads
+		find them through thread-local pointer, which is null while statistics are disabled,
+		so instrumented calls cost one load and branch then.
+	*/
+	struct TraceCounters
+	{
+		std::atomic<uint64_t> BytesRead = { 0 };
+		std::atomic<uint64_t> BytesWritten = { 0 };
+		std::atomic<uint64_t> SystemCalls = { 0 };
+		std::atomic<uint64_t> InflateTime = { 0 };
+		std::atomic<uint64_t> WriteTime = { 0 };
+	};
+
+	extern thread_local TraceCounters* CurrentCounters;
+
+	inline void
+	CountSystemCalls(uint64_t Count)
+	{
+		if (CurrentCounters != nullptr) {
+			CurrentCounters->SystemCalls.fetch_add(Count, std::memory_order_relaxed);
+		}
+	}
+
+	inline void
+	CountBytesRead(uint64_t Size)
+	{
+		if (CurrentCounters != nullptr) {
+			CurrentCounters->BytesRead.fetch_add(Size, std::memory_order_relaxed);
+		}
+	}
+
+	inline void
+	CountBytesWritten(uint64_t Size)
+	{
+		if (CurrentCounters != nullptr) {
+			CurrentCounters->BytesWritten.fetch_add(Size, std::memory_order_relaxed);
+		}
+	}
+
+	/* Monotonic clock in nanoseconds, time base of install statistics */
+	uint64_t GetTraceTime();
+
+	/* Adds time spent in scope to one of current counters */
+	class TraceTimer
+	{
+	private:
+		std::atomic<uint64_t>* Counter = nullptr;
+		uint64_t StartTime = 0;
+
+	public:
+		TraceTimer(std::atomic<uint64_t> TraceCounters::* CounterField)
+		{
+			if (CurrentCounters != nullptr) {
+				Counter = &(CurrentCounters->*CounterField);
+				StartTime = GetTraceTime();
+			}
+		}
+
+		~TraceTimer()
+		{
+			if (Counter != nullptr) {
+				Counter->fetch_add(GetTraceTime() - StartTime, std::memory_order_relaxed);
+			}
+		}
+	};
+
+	/* Counters of submitter become current on helper thread until scope exit */
+	class TraceContext
+	{
+	private:
+		TraceCounters* PreviousCounters;
+
+	public:
+		TraceContext(TraceCounters* Counters) : PreviousCounters(CurrentCounters)
+		{
+			CurrentCounters = Counters;
+		}
+
+		~TraceContext()
+		{
+			CurrentCounters = PreviousCounters;
+		}
+	};
+
+	/*
+		Control of asynchronous install which current thread works for, null for regular
+		installs. Like trace counters it follows install tasks to pool workers.
+	*/
+	extern thread_local InstallControl* CurrentControl;
+
+	inline bool
+	IsInstallCancelled()
+	{
+		return CurrentControl != nullptr && CurrentControl->IsCancelRequested.load(std::memory_order_relaxed);
+	}
+
+	inline void
+	AddInstallProgress(uint64_t Size)
+	{
+		if (CurrentControl != nullptr) {
+			CurrentControl->BytesDone.fetch_add(Size, std::memory_order_relaxed);
+		}
+	}
+
+	/* Progress restarts when entries to write are known, upgrade writes only part of package */
+	inline void
+	BeginInstallProgress(const EntriesList& Entries)
+	{
+		if (CurrentControl == nullptr) {
+			return;
+		}
+
+		uint64_t BytesTotal = 0;
+		for (auto& Entry : Entries) {
+			BytesTotal += Entry.first->UncompressedSize;
+		}
+
+		CurrentControl->BytesDone.store(0, std::memory_order_relaxed);
+		CurrentControl->BytesTotal.store(BytesTotal, std::memory_order_relaxed);
+	}
+
+	class ControlContext
+	{
+	private:
+		InstallControl* PreviousControl;
+
+	public:
+		ControlContext(InstallControl* Control) : PreviousControl(CurrentControl)
+		{
+			CurrentControl = Control;
+		}
+
+		~ControlContext()
+		{
+			CurrentControl = PreviousControl;
+		}
+	};
+
+	/*
+		Single phase of install: measures wall time and owns counters, which are current
+		on this thread while phase runs; phase of asynchronous install is also published to
+		its control. Without stats object it measures nothing. Phases of one function
+		follow each other, so previous one is stopped before next starts.
+	*/
+	class PhaseScope
+	{
+	private:
+		PhaseStats* Stats = nullptr;
+		TraceCounters Counters;
+		TraceCounters* PreviousCounters = nullptr;
+
+	public:
+		PhaseScope(InstallStats* InstallToTrace, InstallPhase Phase);
+		~PhaseScope();
+
+		void AddEntries(uint64_t Count);
+		void Stop();
+	};
+
+	/* State of single package passed from one install stage to another */
+	struct InstallTask
+	{
+		size_t RequestIndex = 0;
+		PackageInfo PathToPackage;
+		PackageBinaries BinaryType = PackageBinaries::BinariesWindows_x64;
+		PackageCallback* CustomCallback = nullptr;
+
+		FilePointer PackageFile;
+		ArchivePointer PackageArchive;
+		PackagePointer PackageToInstall;
+		EntriesList BinariesList;
+		std::string FullPluginDir;
+		PackageManager::ReturnCodes Result = PackageManager::ReturnCodes::NoError;
+
+		/*
+			How extraction left plugin folder, failed install is undone by it: folder created by
+			install is removed, old version kept under staging name is put back, and folder
+			whose pending files were already moved over old ones keeps them, but loses registry
+			record which no longer fits them.
+		*/
+		bool IsNewPluginDir = false;
+		bool IsOldVersionStaged = false;
+
+		/* Files of previous version dropped by new one, removed only when new version is in place */
+		std::vector<std::string> ObsoleteFiles;
+
+		/* Null unless manager collects install statistics */
+		std::unique_ptr<InstallStats> Stats;
+
+		/* Null unless install was started asynchronously */
+		ControlPointer Control;
+	};
+
+	/* FIFO with fixed capacity between pipeline stages: fast producer waits for slow consumer */
+	template<typename T>
+	class BoundedQueue
+	{
+	private:
+		std::deque<T> Items;
+		size_t Capacity;
+		bool IsClosed = false;
+		std::mutex QueueMutex;
+		std::condition_variable QueueEvent;
+
+	public:
+		BoundedQueue(size_t NewCapacity) : Capacity(std::max<size_t>(NewCapacity, 1)) {}
+
+		void Push(T NewItem)
+		{
+			std::unique_lock<std::mutex> Lock(QueueMutex);
+			QueueEvent.wait(Lock, [this]() { return Items.size() < Capacity; });
+			Items.push_back(std::move(NewItem));
+			QueueEvent.notify_all();
+		}
+
+		/* Returns false when queue is closed and drained */
+		bool Pop(T& OutItem)
+		{
+			std::unique_lock<std::mutex> Lock(QueueMutex);
+			QueueEvent.wait(Lock, [this]() { return IsClosed || !Items.empty(); });
+			if (Items.empty()) {
+				return false;
+			}
+
+			OutItem = std::move(Items.front());
+			Items.pop_front();
+			QueueEvent.notify_all();
+			return true;
+		}
+
+		void Close()
+		{
+			std::lock_guard<std::mutex> Lock(QueueMutex);
+			IsClosed = true;
+			QueueEvent.notify_all();
+		}
+	};
+}
@@ -0,0 +1,196 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: work-stealing thread pool
+*********************************************************/
+#include "xpackage_internal.h"
+
+namespace xpckg
+{
+	static thread_local ThreadPool* CurrentPool = nullptr;
+	static thread_local size_t CurrentWorkerIndex = static_cast<size_t>(-1);
+
+	ThreadPool::ThreadPool(size_t ThreadsCount)
+	{
+		if (ThreadsCount == 0) {
+			ThreadsCount = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+		}
+
+		for (size_t i = 0; i < ThreadsCount; i++) {
+			Queues.push_back(std::make_unique<WorkerQueue>());
+		}
+
+		for (size_t i = 0; i < ThreadsCount; i++) {
+			Workers.emplace_back(&ThreadPool::WorkerProc, this, i);
+		}
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> Lock(PoolMutex);
+			IsTerminating = true;
+		}
+
+		WorkEvent.notify_all();
+		for (auto& Worker : Workers) {
+			Worker.join();
+		}
+	}
+
+	size_t
+	ThreadPool::GetThreadsCount()
+	{
+		return Workers.size();
+	}
+
+	size_t
+	ThreadPool::GetWorkerIndex()
+	{
+		return CurrentWorkerIndex;
+	}
+
+	bool
+	ThreadPool::PopTask(size_t WorkerIndex, std::function<void()>& OutTask)
+	{
+		{
+			WorkerQueue& OwnQueue = *Queues[WorkerIndex];
+			std::lock_guard<std::mutex> Lock(OwnQueue.QueueMutex);
+			if (!OwnQueue.Tasks.empty()) {
+				OutTask = std::move(OwnQueue.Tasks.back());
+				OwnQueue.Tasks.pop_back();
+				return true;
+			}
+		}
+
+		for (size_t i = 1; i < Queues.size(); i++) {
+			WorkerQueue& VictimQueue = *Queues[(WorkerIndex + i) % Queues.size()];
+			std::lock_guard<std::mutex> Lock(VictimQueue.QueueMutex);
+			if (!VictimQueue.Tasks.empty()) {
+				OutTask = std::move(VictimQueue.Tasks.front());
+				VictimQueue.Tasks.pop_front();
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void
+	ThreadPool::WorkerProc(size_t WorkerIndex)
+	{
+		CurrentPool = this;
+		CurrentWorkerIndex = WorkerIndex;
+
+		std::function<void()> Task;
+		while (true) {
+			if (PopTask(WorkerIndex, Task)) {
+				QueuedTasks--;
+				try {
+					Task();
+				}
+				catch (...) {
+					/* Tasks report their errors themselves, worker must survive anyway */
+				}
+
+				Task = nullptr;
+
+				if (--ActiveTasks == 0) {
+					std::lock_guard<std::mutex> Lock(PoolMutex);
+					DoneEvent.notify_all();
+				}
+
+				continue;
+			}
+
+			std::unique_lock<std::mutex> Lock(PoolMutex);
+			WorkEvent.wait(Lock, [this]() { return IsTerminating || QueuedTasks.load() != 0; });
+			if (IsTerminating && QueuedTasks.load() == 0) {
+				return;
+			}
+		}
+	}
+
+	std::function<void()>
+	ThreadPool::WrapTask(std::function<void()> Task)
+	{
+		/* Task works for the same install phase as its submitter, statistics and control follow it to worker */
+		if (CurrentCounters != nullptr || CurrentControl != nullptr) {
+			Task = [Counters = CurrentCounters, Control = CurrentControl, PhaseTask = std::move(Task)]() {
+				TraceContext Context(Counters);
+				ControlContext InstallContext(Control);
+				PhaseTask();
+			};
+		}
+
+		return Task;
+	}
+
+	void
+	ThreadPool::Submit(std::function<void()> Task)
+	{
+		/* Tasks spawned from worker go to its own queue, so they stay on the same core */
+		size_t QueueIndex = CurrentPool == this ? CurrentWorkerIndex : NextQueue++ % Queues.size();
+		Task = WrapTask(std::move(Task));
+
+		ActiveTasks++;
+		{
+			std::lock_guard<std::mutex> Lock(PoolMutex);
+			QueuedTasks++;
+		}
+
+		{
+			WorkerQueue& TargetQueue = *Queues[QueueIndex];
+			std::lock_guard<std::mutex> Lock(TargetQueue.QueueMutex);
+			TargetQueue.Tasks.push_back(std::move(Task));
+		}
+
+		WorkEvent.notify_one();
+	}
+
+	void
+	ThreadPool::SubmitBatch(std::vector<std::function<void()>>& Tasks)
+	{
+		if (Tasks.empty()) {
+			return;
+		}
+
+		/* Batch of worker stays in its queue like single task, others are dealt round-robin */
+		bool IsOwnQueue = CurrentPool == this;
+		size_t FirstQueue = IsOwnQueue ? CurrentWorkerIndex : NextQueue.fetch_add(Tasks.size()) % Queues.size();
+		size_t QueuesCount = IsOwnQueue ? 1 : std::min(Queues.size(), Tasks.size());
+		for (auto& Task : Tasks) {
+			Task = WrapTask(std::move(Task));
+		}
+
+		ActiveTasks += Tasks.size();
+		{
+			std::lock_guard<std::mutex> Lock(PoolMutex);
+			QueuedTasks += Tasks.size();
+		}
+
+		/* Owner pops from back, so tasks are pushed to front in priority order: the first one ends at back */
+		for (size_t i = 0; i < QueuesCount; i++) {
+			WorkerQueue& TargetQueue = *Queues[(FirstQueue + i) % Queues.size()];
+			std::lock_guard<std::mutex> Lock(TargetQueue.QueueMutex);
+			for (size_t TaskIndex = i; TaskIndex < Tasks.size(); TaskIndex += QueuesCount) {
+				TargetQueue.Tasks.push_front(std::move(Tasks[TaskIndex]));
+			}
+		}
+
+		Tasks.clear();
+		{
+			std::lock_guard<std::mutex> Lock(PoolMutex);
+			WorkEvent.notify_all();
+		}
+	}
+
+	void
+	ThreadPool::Wait()
+	{
+		std::unique_lock<std::mutex> Lock(PoolMutex);
+		DoneEvent.wait(Lock, [this]() { return ActiveTasks.load() == 0; });
+	}
+}
@@ -0,0 +1,477 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: database of installed packages
+*********************************************************/
+#include "xpackage_internal.h"
+#include "zlib.h"
+#include <cstdio>
+#include <filesystem>
+
+namespace xpckg
+{
+	constexpr uint64_t RegistryMagic = 0x31474552474B5058ull;	// "XPKGREG1"
+	constexpr uint32_t LogRecordMagic = 0x474C5258;				// "XRLG"
+	constexpr uint32_t LogRecordPut = 1;
+	constexpr uint32_t LogRecordRemove = 2;
+	constexpr size_t LogCompactionThreshold = 64;
+
+	struct RegistryHeader
+	{
+		uint64_t Magic;
+		uint64_t SnapshotCount;
+		uint64_t IndexOffset;
+		uint64_t LogOffset;
+	};
+
+	struct LogRecordHeader
+	{
+		uint32_t Magic;
+		uint32_t Kind;
+		uint32_t PayloadSize;
+		uint32_t PayloadCrc;
+		uint64_t Id;
+	};
+
+	/* Records are plain length-prefixed fields, see SerializePackage for order */
+	static void
+	SerializePackage(const InstalledPackage& Package, std::vector<uint8_t>& OutData)
+	{
+		auto PutData = [&OutData](const void* Data, size_t DataSize) {
+			const uint8_t* Bytes = static_cast<const uint8_t*>(Data);
+			OutData.insert(OutData.end(), Bytes, Bytes + DataSize);
+		};
+
+		auto PutString = [&PutData](const std::string& String) {
+			uint32_t Length = static_cast<uint32_t>(String.size());
+			PutData(&Length, sizeof(Length));
+			PutData(String.data(), String.size());
+		};
+
+		uint64_t Platform = static_cast<uint64_t>(Package.Platform);
+		uint32_t FilesCount = static_cast<uint32_t>(Package.Files.size());
+		PutData(&Package.Id, sizeof(Package.Id));
+		PutData(&Platform, sizeof(Platform));
+		PutString(Package.Version);
+		PutString(Package.InstallDirectory);
+		PutData(&FilesCount, sizeof(FilesCount));
+		for (auto& File : Package.Files) {
+			PutString(File.Path);
+			PutData(&File.Size, sizeof(File.Size));
+			PutData(&File.Crc32, sizeof(File.Crc32));
+		}
+	}
+
+	static bool
+	DeserializePackage(const uint8_t* Data, size_t DataSize, InstalledPackage& OutPackage)
+	{
+		size_t Offset = 0;
+		auto GetData = [Data, DataSize, &Offset](void* OutValue, size_t ValueSize) -> bool {
+			if (DataSize - Offset < ValueSize) {
+				return false;
+			}
+
+			std::memcpy(OutValue, Data + Offset, ValueSize);
+			Offset += ValueSize;
+			return true;
+		};
+
+		auto GetString = [Data, DataSize, &Offset, &GetData](std::string& OutString) -> bool {
+			uint32_t Length = 0;
+			if (!GetData(&Length, sizeof(Length)) || DataSize - Offset < Length) {
+				return false;
+			}
+
+			OutString.assign(reinterpret_cast<const char*>(Data + Offset), Length);
+			Offset += Length;
+			return true;
+		};
+
+		uint64_t Platform = 0;
+		uint32_t FilesCount = 0;
+		if (!GetData(&OutPackage.Id, sizeof(OutPackage.Id)) || !GetData(&Platform, sizeof(Platform)) ||
+			!GetString(OutPackage.Version) || !GetString(OutPackage.InstallDirectory) || !GetData(&FilesCount, sizeof(FilesCount))) {
+			return false;
+		}
+
+		/* Every file takes at least 16 bytes, so don't trust damaged count for reserve */
+		OutPackage.Platform = static_cast<PackageBinaries>(Platform);
+		OutPackage.Files.clear();
+		OutPackage.Files.reserve(std::min<size_t>(FilesCount, (DataSize - Offset) / 16));
+		for (uint32_t i = 0; i < FilesCount; i++) {
+			InstalledFile NewFile = {};
+			if (!GetString(NewFile.Path) || !GetData(&NewFile.Size, sizeof(NewFile.Size)) || !GetData(&NewFile.Crc32, sizeof(NewFile.Crc32))) {
+				return false;
+			}
+
+			/* Paths are removed and compared on upgrade, damaged or forged record must not reach outside of plugin folder */
+			if (!IsSafeEntryPath(NewFile.Path)) {
+				return false;
+			}
+
+			OutPackage.Files.push_back(std::move(NewFile));
+		}
+
+		return true;
+	}
+
+	PackageRegistry::PackageRegistry(std::string PathToRegistry)
+	{
+		RegistryPath = PathToRegistry;
+		if (!OpenRegistry()) {
+			throw std::exception();
+		}
+	}
+
+	PackageRegistry::~PackageRegistry()
+	{
+		if (CompactionThread.joinable()) {
+			CompactionThread.join();
+		}
+	}
+
+	bool
+	PackageRegistry::CreateRegistry()
+	{
+		try {
+			RegistryFile = std::make_shared<FileHandle>(RegistryPath, true);
+		}
+		catch (...) {
+			return false;
+		}
+
+		RegistryHeader Header = { RegistryMagic, 0, sizeof(RegistryHeader), sizeof(RegistryHeader) };
+		return RegistryFile->WriteToFile(&Header, sizeof(Header), 0) == sizeof(Header);
+	}
+
+	bool
+	PackageRegistry::OpenRegistry()
+	{
+		RegistryFile = nullptr;
+		SnapshotData = nullptr;
+		SnapshotSize = 0;
+		SnapshotIndex = nullptr;
+		SnapshotCount = 0;
+		LogOverlay.clear();
+		LogRecords = 0;
+
+		try {
+			RegistryFile = std::make_shared<FileHandle>(RegistryPath, false);
+		}
+		catch (...) {
+			/* Only missing file is created; unreadable or locked one must not be truncated */
+			std::error_code StatusError;
+			if (std::filesystem::status(RegistryPath, StatusError).type() != std::filesystem::file_type::not_found || !CreateRegistry()) {
+				RegistryFile = nullptr;
+				return false;
+			}
+		}
+
+		size_t FileSize = RegistryFile->GetFileSize();
+		if (FileSize == 0 && !CreateRegistry()) {
+			RegistryFile = nullptr;
+			return false;
+		}
+
+		FileSize = RegistryFile->GetFileSize();
+		const uint8_t* FileData = RegistryFile->MapFile();
+		if (FileData == nullptr || FileSize < sizeof(RegistryHeader)) {
+			RegistryFile = nullptr;
+			return false;
+		}
+
+		RegistryHeader Header = {};
+		std::memcpy(&Header, FileData, sizeof(Header));
+		if (Header.Magic != RegistryMagic || Header.IndexOffset > Header.LogOffset || Header.LogOffset > FileSize ||
+			Header.IndexOffset % alignof(IndexRecord) != 0 || (Header.LogOffset - Header.IndexOffset) / sizeof(IndexRecord) < Header.SnapshotCount) {
+			RegistryFile = nullptr;
+			return false;
+		}
+
+		SnapshotData = FileData;
+		SnapshotSize = static_cast<size_t>(Header.IndexOffset);
+		SnapshotIndex = reinterpret_cast<const IndexRecord*>(FileData + Header.IndexOffset);
+		SnapshotCount = static_cast<size_t>(Header.SnapshotCount);
+
+		/* Replay log; torn record at the end (crash during append) is dropped and overwritten later */
+		size_t Offset = static_cast<size_t>(Header.LogOffset);
+		while (FileSize - Offset >= sizeof(LogRecordHeader)) {
+			LogRecordHeader Record = {};
+			std::memcpy(&Record, FileData + Offset, sizeof(Record));
+			const uint8_t* Payload = FileData + Offset + sizeof(Record);
+			if (Record.Magic != LogRecordMagic || FileSize - Offset - sizeof(Record) < Record.PayloadSize ||
+				crc32(0, Payload, Record.PayloadSize) != Record.PayloadCrc) {
+				break;
+			}
+
+			if (Record.Kind == LogRecordPut) {
+				/* Intact record with unusable content (unsafe paths) hides package, but doesn't cut the log */
+				auto Package = std::make_shared<InstalledPackage>();
+				LogOverlay[Record.Id] = DeserializePackage(Payload, Record.PayloadSize, *Package) ? Package : nullptr;
+			} else {
+				LogOverlay[Record.Id] = nullptr;
+			}
+
+			LogRecords++;
+			Offset += sizeof(Record) + Record.PayloadSize;
+		}
+
+		LogEnd = Offset;
+		return true;
+	}
+
+	bool
+	PackageRegistry::AppendRecord(uint64_t Id, const std::shared_ptr<InstalledPackage>& Package)
+	{
+		/* File is closed if reopen after compaction failed, nothing can be appended then */
+		if (RegistryFile == nullptr) {
+			return false;
+		}
+
+		std::vector<uint8_t> RecordData(sizeof(LogRecordHeader));
+		if (Package != nullptr) {
+			SerializePackage(*Package, RecordData);
+		}
+
+		LogRecordHeader Record = {};
+		Record.Magic = LogRecordMagic;
+		Record.Kind = Package != nullptr ? LogRecordPut : LogRecordRemove;
+		Record.PayloadSize = static_cast<uint32_t>(RecordData.size() - sizeof(Record));
+		Record.PayloadCrc = crc32(0, RecordData.data() + sizeof(Record), Record.PayloadSize);
+		Record.Id = Id;
+		std::memcpy(RecordData.data(), &Record, sizeof(Record));
+
+		/* Single write per record: header and payload land together or record is torn and ignored */
+		if (RegistryFile->WriteToFile(RecordData.data(), RecordData.size(), LogEnd) != RecordData.size()) {
+			return false;
+		}
+
+		LogEnd += RecordData.size();
+		LogRecords++;
+		LogOverlay[Id] = Package;
+		if (IsCompacting) {
+			CompactionBacklog.emplace_back(Id, Package);
+		}
+
+		return true;
+	}
+
+	const PackageRegistry::IndexRecord*
+	PackageRegistry::FindInSnapshot(uint64_t Id)
+	{
+		const IndexRecord* IndexEnd = SnapshotIndex + SnapshotCount;
+		const IndexRecord* Found = std::lower_bound(SnapshotIndex, IndexEnd, Id, [](const IndexRecord& Record, uint64_t Value) {
+			return Record.Id < Value;
+		});
+
+		return (Found != IndexEnd && Found->Id == Id) ? Found : nullptr;
+	}
+
+	bool
+	PackageRegistry::ContainsPackage(uint64_t PackageId)
+	{
+		std::lock_guard<std::mutex> Lock(RegistryMutex);
+		auto OverlayIt = LogOverlay.find(PackageId);
+		if (OverlayIt != LogOverlay.end()) {
+			return OverlayIt->second != nullptr;
+		}
+
+		return FindInSnapshot(PackageId) != nullptr;
+	}
+
+	bool
+	PackageRegistry::FindPackage(uint64_t PackageId, InstalledPackage& OutPackage)
+	{
+		std::lock_guard<std::mutex> Lock(RegistryMutex);
+		auto OverlayIt = LogOverlay.find(PackageId);
+		if (OverlayIt != LogOverlay.end()) {
+			if (OverlayIt->second == nullptr) {
+				return false;
+			}
+
+			OutPackage = *OverlayIt->second;
+			return true;
+		}
+
+		const IndexRecord* Record = FindInSnapshot(PackageId);
+		if (Record == nullptr || Record->RecordOffset > SnapshotSize || SnapshotSize - Record->RecordOffset < Record->RecordSize) {
+			return false;
+		}
+
+		return DeserializePackage(SnapshotData + Record->RecordOffset, static_cast<size_t>(Record->RecordSize), OutPackage);
+	}
+
+	void
+	PackageRegistry::GetPackagesIds(std::vector<uint64_t>& OutIds)
+	{
+		std::lock_guard<std::mutex> Lock(RegistryMutex);
+		for (size_t i = 0; i < SnapshotCount; i++) {
+			if (LogOverlay.find(SnapshotIndex[i].Id) == LogOverlay.end()) {
+				OutIds.push_back(SnapshotIndex[i].Id);
+			}
+		}
+
+		for (auto& [Id, Package] : LogOverlay) {
+			if (Package != nullptr) {
+				OutIds.push_back(Id);
+			}
+		}
+	}
+
+	bool
+	PackageRegistry::PutPackage(const InstalledPackage& NewPackage)
+	{
+		std::lock_guard<std::mutex> Lock(RegistryMutex);
+		if (!AppendRecord(NewPackage.Id, std::make_shared<InstalledPackage>(NewPackage))) {
+			return false;
+		}
+
+		StartCompaction();
+		return true;
+	}
+
+	bool
+	PackageRegistry::RemovePackage(uint64_t PackageId)
+	{
+		std::lock_guard<std::mutex> Lock(RegistryMutex);
+		if (!AppendRecord(PackageId, nullptr)) {
+			return false;
+		}
+
+		StartCompaction();
+		return true;
+	}
+
+	void
+	PackageRegistry::StartCompaction()
+	{
+		/* Caller holds registry lock */
+		if (IsCompacting || LogRecords < std::max(LogCompactionThreshold, SnapshotCount)) {
+			return;
+		}
+
+		if (CompactionThread.joinable()) {
+			CompactionThread.join();
+		}
+
+		IsCompacting = true;
+		CompactionThread = std::thread([this]() { CompactRegistry(); });
+	}
+
+	bool
+	PackageRegistry::Compact()
+	{
+		{
+			std::lock_guard<std::mutex> Lock(RegistryMutex);
+			if (IsCompacting) {
+				return false;
+			}
+
+			IsCompacting = true;
+		}
+
+		return CompactRegistry();
+	}
+
+	bool
+	PackageRegistry::CompactRegistry()
+	{
+		/*
+			Take consistent view under lock. Snapshot region of current file is never modified
+			(only log is appended), so it's safe to read it without lock until file is swapped.
+		*/
+		std::unordered_map<uint64_t, std::shared_ptr<InstalledPackage>> OverlayCopy;
+		const uint8_t* OldData = nullptr;
+		const IndexRecord* OldIndex = nullptr;
+		size_t OldCount = 0;
+		size_t OldSize = 0;
+		{
+			std::lock_guard<std::mutex> Lock(RegistryMutex);
+			OverlayCopy = LogOverlay;
+			OldData = SnapshotData;
+			OldIndex = SnapshotIndex;
+			OldCount = SnapshotCount;
+			OldSize = SnapshotSize;
+			CompactionBacklog.clear();
+		}
+
+		/* Merge old snapshot (raw records, no decoding) with overlay, sorted by id */
+		std::vector<std::pair<uint64_t, std::vector<uint8_t>>> Records;
+		Records.reserve(OldCount + OverlayCopy.size());
+		for (size_t i = 0; i < OldCount; i++) {
+			if (OldIndex[i].RecordOffset > OldSize || OldSize - OldIndex[i].RecordOffset < OldIndex[i].RecordSize) {
+				continue;
+			}
+
+			if (OverlayCopy.find(OldIndex[i].Id) == OverlayCopy.end()) {
+				const uint8_t* RecordData = OldData + OldIndex[i].RecordOffset;
+				Records.emplace_back(OldIndex[i].Id, std::vector<uint8_t>(RecordData, RecordData + OldIndex[i].RecordSize));
+			}
+		}
+
+		for (auto& [Id, Package] : OverlayCopy) {
+			if (Package != nullptr) {
+				Records.emplace_back(Id, std::vector<uint8_t>());
+				SerializePackage(*Package, Records.back().second);
+			}
+		}
+
+		std::sort(Records.begin(), Records.end(), [](const auto& Left, const auto& Right) {
+			return Left.first < Right.first;
+		});
+
+		std::vector<uint8_t> NewData(sizeof(RegistryHeader));
+		std::vector<IndexRecord> NewIndex;
+		NewIndex.reserve(Records.size());
+		for (auto& [Id, RecordData] : Records) {
+			NewIndex.push_back(IndexRecord{ Id, NewData.size(), RecordData.size() });
+			NewData.insert(NewData.end(), RecordData.begin(), RecordData.end());
+		}
+
+		NewData.resize((NewData.size() + alignof(IndexRecord) - 1) / alignof(IndexRecord) * alignof(IndexRecord));
+		RegistryHeader Header = { RegistryMagic, NewIndex.size(), NewData.size(), NewData.size() + NewIndex.size() * sizeof(IndexRecord) };
+		std::memcpy(NewData.data(), &Header, sizeof(Header));
+		const uint8_t* IndexBytes = reinterpret_cast<const uint8_t*>(NewIndex.data());
+		NewData.insert(NewData.end(), IndexBytes, IndexBytes + NewIndex.size() * sizeof(IndexRecord));
+
+		std::string TempPath = RegistryPath + ".compact";
+		bool IsWritten = false;
+		try {
+			FileHandle TempFile(TempPath, true);
+			/* Data must be on disk before rename, otherwise crash can leave empty file under registry name */
+			IsWritten = TempFile.WriteToFile(NewData.data(), NewData.size(), 0) == NewData.size() && TempFile.FlushFile();
+		}
+		catch (...) {
+			IsWritten = false;
+		}
+
+		std::lock_guard<std::mutex> Lock(RegistryMutex);
+		bool IsSuccess = false;
+		if (IsWritten) {
+			/* Windows can't replace opened file, so old handle must be closed before rename */
+			RegistryFile = nullptr;
+			std::error_code RenameError;
+			std::filesystem::rename(TempPath, RegistryPath, RenameError);
+			IsSuccess = !RenameError && OpenRegistry();
+			if (!IsSuccess && RegistryFile == nullptr) {
+				OpenRegistry();
+			}
+		} else {
+			std::remove(TempPath.c_str());
+		}
+
+		/* Records appended while compaction was running live only in old log, move them to new one */
+		std::vector<std::pair<uint64_t, std::shared_ptr<InstalledPackage>>> Backlog = std::move(CompactionBacklog);
+		CompactionBacklog.clear();
+		IsCompacting = false;
+		if (IsSuccess) {
+			for (auto& [Id, Package] : Backlog) {
+				AppendRecord(Id, Package);
+			}
+		}
+
+		return IsSuccess;
+	}
+}
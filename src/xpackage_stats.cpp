@@ -0,0 +1,157 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: install statistics and traces
+*********************************************************/
+#include "xpackage_internal.h"
+#include <chrono>
+#include <cstdio>
+
+namespace xpckg
+{
+	thread_local TraceCounters* CurrentCounters = nullptr;
+
+	static const char* PhaseNames[InstallPhasesCount] = {
+		"open", "manifest", "prefetch", "folders", "extract", "flush", "link"
+	};
+
+	static std::atomic<uint32_t> NextThreadId = { 1 };
+
+	static uint32_t
+	GetTraceThreadId()
+	{
+		static thread_local uint32_t ThreadId = NextThreadId++;
+		return ThreadId;
+	}
+
+	uint64_t
+	GetTraceTime()
+	{
+		auto Now = std::chrono::steady_clock::now().time_since_epoch();
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Now).count());
+	}
+
+	const char*
+	GetPhaseName(InstallPhase Phase)
+	{
+		size_t PhaseIndex = static_cast<size_t>(Phase);
+		return PhaseIndex < InstallPhasesCount ? PhaseNames[PhaseIndex] : "unknown";
+	}
+
+	PhaseScope::PhaseScope(InstallStats* InstallToTrace, InstallPhase Phase)
+	{
+		if (CurrentControl != nullptr) {
+			CurrentControl->Phase.store(Phase, std::memory_order_relaxed);
+		}
+
+		if (InstallToTrace == nullptr || Phase == InstallPhase::Count) {
+			return;
+		}
+
+		Stats = &InstallToTrace->Phases[static_cast<size_t>(Phase)];
+		Stats->ThreadId = GetTraceThreadId();
+		Stats->StartTime = GetTraceTime();
+		PreviousCounters = CurrentCounters;
+		CurrentCounters = &Counters;
+	}
+
+	PhaseScope::~PhaseScope()
+	{
+		Stop();
+	}
+
+	void
+	PhaseScope::AddEntries(uint64_t Count)
+	{
+		if (Stats != nullptr) {
+			Stats->EntriesCount += Count;
+		}
+	}
+
+	void
+	PhaseScope::Stop()
+	{
+		if (Stats == nullptr) {
+			return;
+		}
+
+		/* Helper threads have finished by now, phase functions wait for their pools */
+		CurrentCounters = PreviousCounters;
+		Stats->Duration = GetTraceTime() - Stats->StartTime;
+		Stats->BytesRead = Counters.BytesRead.load();
+		Stats->BytesWritten = Counters.BytesWritten.load();
+		Stats->SystemCalls = Counters.SystemCalls.load();
+		Stats->InflateTime = Counters.InflateTime.load();
+		Stats->WriteTime = Counters.WriteTime.load();
+		Stats = nullptr;
+	}
+
+	static void
+	AppendEscaped(std::string& Output, const std::string& Value)
+	{
+		for (char Symbol : Value) {
+			if (Symbol == '"' || Symbol == '\\') {
+				Output += '\\';
+				Output += Symbol;
+			} else if (static_cast<unsigned char>(Symbol) < 0x20) {
+				char Escaped[8] = {};
+				std::snprintf(Escaped, sizeof(Escaped), "\\u%04x", Symbol);
+				Output += Escaped;
+			} else {
+				Output += Symbol;
+			}
+		}
+	}
+
+	bool
+	WriteChromeTrace(const std::vector<InstallStats>& Stats, std::string PathToTrace)
+	{
+		/* Timestamps are microseconds from the first phase of the first install */
+		uint64_t BaseTime = UINT64_MAX;
+		for (auto& Install : Stats) {
+			for (auto& Phase : Install.Phases) {
+				if (Phase.Duration != 0) {
+					BaseTime = std::min(BaseTime, Phase.StartTime);
+				}
+			}
+		}
+
+		std::string Trace = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+		bool IsFirst = true;
+		for (auto& Install : Stats) {
+			for (size_t i = 0; i < InstallPhasesCount; i++) {
+				const PhaseStats& Phase = Install.Phases[i];
+				if (Phase.Duration == 0) {
+					continue;
+				}
+
+				char Event[512] = {};
+				std::snprintf(Event, sizeof(Event),
+					"%s{\"name\":\"%s\",\"cat\":\"install\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+					"\"args\":{\"entries\":%llu,\"bytes_read\":%llu,\"bytes_written\":%llu,\"system_calls\":%llu,"
+					"\"inflate_ms\":%.3f,\"write_ms\":%.3f,\"succeeded\":%s,\"package\":\"",
+					IsFirst ? "" : ",", PhaseNames[i], Phase.ThreadId,
+					(Phase.StartTime - BaseTime) / 1000.0, Phase.Duration / 1000.0,
+					static_cast<unsigned long long>(Phase.EntriesCount), static_cast<unsigned long long>(Phase.BytesRead),
+					static_cast<unsigned long long>(Phase.BytesWritten), static_cast<unsigned long long>(Phase.SystemCalls),
+					Phase.InflateTime / 1000000.0, Phase.WriteTime / 1000000.0, Install.IsSucceeded ? "true" : "false");
+
+				Trace += Event;
+				AppendEscaped(Trace, Install.PackagePath);
+				Trace += "\"}}";
+				IsFirst = false;
+			}
+		}
+
+		Trace += "]}\n";
+		try {
+			FileHandle TraceFile(PathToTrace, true);
+			return TraceFile.WriteToFile(Trace.data(), Trace.size(), 0) == Trace.size();
+		}
+		catch (...) {
+			return false;
+		}
+	}
+}
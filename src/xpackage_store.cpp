@@ -0,0 +1,245 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: content-addressed store of installed files
+*********************************************************/
+#include "xpackage_internal.h"
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <unordered_set>
+
+namespace xpckg
+{
+	size_t
+	CopyFileData(FileHandle& SourceFile, size_t SourcePosition, FileHandle& TargetFile, size_t TargetPosition, size_t SizeToCopy)
+	{
+		std::vector<uint8_t> CopyBuffer(std::min<size_t>(SizeToCopy, 1024 * 1024));
+		size_t CopiedSize = 0;
+		while (CopiedSize < SizeToCopy) {
+			size_t PartSize = std::min(CopyBuffer.size(), SizeToCopy - CopiedSize);
+			size_t ReadedSize = SourceFile.ReadFromFile(CopyBuffer.data(), PartSize, SourcePosition + CopiedSize);
+			if (ReadedSize == static_cast<size_t>(-1)) {
+				return -1;
+			}
+
+			if (ReadedSize == 0) {
+				break;
+			}
+
+			if (TargetFile.WriteToFile(CopyBuffer.data(), ReadedSize, TargetPosition + CopiedSize) != ReadedSize) {
+				return -1;
+			}
+
+			CopiedSize += ReadedSize;
+		}
+
+		return CopiedSize;
+	}
+
+	ContentStore::ContentStore(std::string PathToStore)
+	{
+		StorePath = PathToStore;
+
+		std::error_code CreateError;
+		std::filesystem::create_directories(std::filesystem::u8path(StorePath + "/index"), CreateError);
+		if (CreateError) {
+			throw std::exception();
+		}
+
+		/* Temporary names must not clash with other processes filling the same store */
+		std::random_device RandomDevice;
+		TempToken = (static_cast<uint64_t>(RandomDevice()) << 32) | RandomDevice();
+	}
+
+	ContentStore::~ContentStore()
+	{
+
+	}
+
+	std::string
+	ContentStore::MakeTempPath()
+	{
+		std::string TempPath = StorePath + "/" + std::to_string(TempToken) + "." + std::to_string(TempCounter++) + ".tmp";
+		ConvertToNativeStyle(TempPath);
+		return TempPath;
+	}
+
+	std::string
+	ContentStore::GetObjectPath(const Sha256Digest& Digest)
+	{
+		static const char HexDigits[] = "0123456789abcdef";
+		std::string ObjectName(3 + Digest.size() * 2, '/');
+		for (size_t i = 0; i < Digest.size(); i++) {
+			ObjectName[3 + i * 2] = HexDigits[Digest[i] >> 4];
+			ObjectName[4 + i * 2] = HexDigits[Digest[i] & 0xF];
+		}
+
+		ObjectName[0] = ObjectName[3];
+		ObjectName[1] = ObjectName[4];
+
+		std::string ObjectPath = StorePath + "/" + ObjectName;
+		ConvertToNativeStyle(ObjectPath);
+		return ObjectPath;
+	}
+
+	bool
+	ContentStore::ContainsObject(const std::string& ObjectPath, uint64_t ObjectSize)
+	{
+		/* Size check also catches objects truncated by crash: they are written again */
+		std::error_code SizeError;
+		uintmax_t FoundSize = std::filesystem::file_size(std::filesystem::u8path(ObjectPath), SizeError);
+		return !SizeError && FoundSize == ObjectSize;
+	}
+
+	std::string
+	ContentStore::GetIndexPath(uint32_t Crc32, uint64_t ObjectSize)
+	{
+		char IndexName[32] = {};
+		std::snprintf(IndexName, sizeof(IndexName), "%08x-%llu", Crc32, static_cast<unsigned long long>(ObjectSize));
+		std::string IndexPath = StorePath + "/index/" + IndexName;
+		ConvertToNativeStyle(IndexPath);
+		return IndexPath;
+	}
+
+	bool
+	ContentStore::FindIndexedObject(uint32_t Crc32, uint64_t ObjectSize, std::string& OutObjectPath)
+	{
+		/* Most lookups of new content miss, so index file is checked before open */
+		std::string IndexPath = GetIndexPath(Crc32, ObjectSize);
+		std::error_code SizeError;
+		if (std::filesystem::file_size(std::filesystem::u8path(IndexPath), SizeError) != sizeof(Sha256Digest) || SizeError) {
+			return false;
+		}
+
+		try {
+			Sha256Digest Digest = {};
+			FileHandle IndexFile(IndexPath, false);
+			if (IndexFile.ReadFromFile(Digest.data(), Digest.size(), 0) != Digest.size()) {
+				return false;
+			}
+
+			/* Index can outlive object removed by hand, such entry is extracted again */
+			OutObjectPath = GetObjectPath(Digest);
+			return ContainsObject(OutObjectPath, ObjectSize);
+		}
+		catch (...) {
+			return false;
+		}
+	}
+
+	void
+	ContentStore::IndexObject(uint32_t Crc32, uint64_t ObjectSize, const Sha256Digest& Digest)
+	{
+		/* Index is only a hint, object is stored already even if this fails */
+		std::string TempPath = MakeTempPath();
+		try {
+			FileHandle IndexFile(TempPath, true);
+			if (IndexFile.WriteToFile(Digest.data(), Digest.size(), 0) != Digest.size()) {
+				throw std::exception();
+			}
+		}
+		catch (...) {
+			std::remove(TempPath.c_str());
+			return;
+		}
+
+		std::error_code RenameError;
+		std::filesystem::rename(std::filesystem::u8path(TempPath), std::filesystem::u8path(GetIndexPath(Crc32, ObjectSize)), RenameError);
+		if (RenameError) {
+			std::remove(TempPath.c_str());
+		}
+	}
+
+	bool
+	ContentStore::InstallEntries(Archive& SourceArchive, const EntriesList& Entries, RawHandle BaseDirectory,
+		const std::function<bool(const std::string& EntryPath)>& PrepareTarget, ThreadPool* Pool, size_t ChunkSize)
+	{
+		/*
+			Entries with declared digest are found in store by it, the rest by index. Package can
+			have the same content under many names, declared one is extracted once anyway. Digest
+			of missing entries is known only after extraction, it's computed on the way.
+		*/
+		std::unordered_set<std::string> PendingObjects;
+		EntriesList MissingEntries;
+		std::vector<std::string> ObjectPaths(Entries.size());
+		std::vector<size_t> TempIndices(Entries.size(), static_cast<size_t>(-1));
+		for (size_t i = 0; i < Entries.size(); i++) {
+			const ArchiveEntry& Entry = *Entries[i].first;
+			const Sha256Digest* Digest = SourceArchive.GetEntryDigest(Entry);
+			if (Digest != nullptr) {
+				ObjectPaths[i] = GetObjectPath(*Digest);
+				if (PendingObjects.find(ObjectPaths[i]) != PendingObjects.end() || ContainsObject(ObjectPaths[i], Entry.UncompressedSize)) {
+					continue;
+				}
+
+				PendingObjects.insert(ObjectPaths[i]);
+			} else if (FindIndexedObject(Entry.Crc32, Entry.UncompressedSize, ObjectPaths[i])) {
+				continue;
+			} else {
+				ObjectPaths[i].clear();
+			}
+
+			TempIndices[i] = MissingEntries.size();
+			MissingEntries.emplace_back(&Entry, MakeTempPath());
+		}
+
+		auto OpenTarget = [](const ArchiveEntry&, const std::string& TempPath) -> FilePointer {
+			return std::make_shared<FileHandle>(TempPath, true);
+		};
+
+		/* Extraction checks CRC and declared digest, objects appear under final name only when fully written and checked */
+		std::vector<Sha256Digest> Digests;
+		bool IsStored = SourceArchive.ExtractEntries(MissingEntries, OpenTarget, Pool, ChunkSize, &Digests);
+		for (size_t i = 0; i < Entries.size(); i++) {
+			if (TempIndices[i] == static_cast<size_t>(-1)) {
+				continue;
+			}
+
+			const ArchiveEntry& Entry = *Entries[i].first;
+			const std::string& TempPath = MissingEntries[TempIndices[i]].second;
+			if (IsStored && ObjectPaths[i].empty()) {
+				ObjectPaths[i] = GetObjectPath(Digests[TempIndices[i]]);
+			}
+
+			/* Object which appeared meanwhile has the same content, its name is the digest */
+			if (IsStored && !ContainsObject(ObjectPaths[i], Entry.UncompressedSize)) {
+				std::error_code RenameError;
+				std::filesystem::create_directories(std::filesystem::u8path(ObjectPaths[i]).parent_path(), RenameError);
+				if (SealObject(TempPath)) {
+					std::filesystem::rename(std::filesystem::u8path(TempPath), std::filesystem::u8path(ObjectPaths[i]), RenameError);
+					if (!RenameError) {
+						IndexObject(Entry.Crc32, Entry.UncompressedSize, Digests[TempIndices[i]]);
+						continue;
+					}
+				}
+
+				IsStored = false;
+			} else if (IsStored) {
+				IndexObject(Entry.Crc32, Entry.UncompressedSize, Digests[TempIndices[i]]);
+			}
+
+			std::remove(TempPath.c_str());
+		}
+
+		if (!IsStored) {
+			return false;
+		}
+
+		/* Extracted entries are counted in progress by extraction, the rest when linked */
+		for (size_t i = 0; i < Entries.size(); i++) {
+			const std::string& EntryPath = Entries[i].second;
+			if (IsInstallCancelled() || !PrepareTarget(EntryPath) || !MaterializeObject(ObjectPaths[i], BaseDirectory, EntryPath)) {
+				return false;
+			}
+
+			if (TempIndices[i] == static_cast<size_t>(-1)) {
+				AddInstallProgress(Entries[i].first->UncompressedSize);
+			}
+		}
+
+		return true;
+	}
+}
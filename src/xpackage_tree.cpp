@@ -0,0 +1,128 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: folders tree of package entries
+*********************************************************/
+#include "xpackage_internal.h"
+#include <cstring>
+
+namespace xpckg
+{
+	/* Entry paths are native-style already, so both separators can be accepted on any platform */
+	constexpr const char* PathSeparators = "/\\";
+
+	/* Folders beyond this count are created and opened by path relative to root */
+	constexpr size_t MaxFolderHandles = 256;
+
+	DirectoryTree::DirectoryTree(RawHandle RootDirectory, const std::string& RootDirectoryPath)
+	{
+		RootHandle = RootDirectory;
+		RootPath = RootDirectoryPath;
+		Nodes.push_back({ std::string_view(), 0, RootHandle });
+	}
+
+	DirectoryTree::~DirectoryTree()
+	{
+		/* Children are closed before parents, root handle isn't ours */
+		for (size_t i = Nodes.size() - 1; i > 0; i--) {
+			CloseFolder(Nodes[i]);
+		}
+	}
+
+	void
+	DirectoryTree::AddFolder(std::string_view FolderPath)
+	{
+		size_t LastSlash = FolderPath.find_last_of(PathSeparators);
+		size_t Parent = LastSlash == std::string_view::npos ? 0 : NodesIndex[FolderPath.substr(0, LastSlash)];
+		Nodes.push_back({ FolderPath, Parent, nullptr });
+		NodesIndex.emplace(FolderPath, Nodes.size() - 1);
+	}
+
+	void
+	DirectoryTree::AddEntries(const EntriesList& Entries)
+	{
+		/*
+			Only the deepest folder of entry is copied to arena: its ancestors are prefixes of
+			the same copy. So arena never needs more than total size of entry paths, and it's
+			never reallocated, which keeps views in index valid.
+		*/
+		size_t ArenaSize = 0;
+		for (auto& [Entry, EntryPath] : Entries) {
+			ArenaSize += EntryPath.size();
+		}
+
+		PathsArena.push_back(std::make_unique<char[]>(ArenaSize + 1));
+		char* ArenaPointer = PathsArena.back().get();
+
+		std::vector<std::string_view> MissingFolders;
+		for (auto& [Entry, EntryPath] : Entries) {
+			size_t LastSlash = EntryPath.find_last_of(PathSeparators);
+			if (LastSlash == std::string::npos || LastSlash == 0) {
+				continue;
+			}
+
+			std::string_view FolderPath(EntryPath.data(), LastSlash);
+			if (NodesIndex.find(FolderPath) != NodesIndex.end()) {
+				continue;
+			}
+
+			std::memcpy(ArenaPointer, FolderPath.data(), FolderPath.size());
+			FolderPath = std::string_view(ArenaPointer, FolderPath.size());
+			ArenaPointer += FolderPath.size();
+
+			MissingFolders.clear();
+			while (!FolderPath.empty() && NodesIndex.find(FolderPath) == NodesIndex.end()) {
+				MissingFolders.push_back(FolderPath);
+				size_t ParentSlash = FolderPath.find_last_of(PathSeparators);
+				FolderPath = ParentSlash == std::string_view::npos ? std::string_view() : FolderPath.substr(0, ParentSlash);
+			}
+
+			for (auto It = MissingFolders.rbegin(); It != MissingFolders.rend(); It++) {
+				AddFolder(*It);
+			}
+		}
+	}
+
+	bool
+	DirectoryTree::CreateTree()
+	{
+		for (size_t i = 1; i < Nodes.size(); i++) {
+			if (!CreateFolder(Nodes[i], i <= MaxFolderHandles)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	RawHandle
+	DirectoryTree::GetEntryFolder(std::string_view EntryPath, std::string_view& OutName)
+	{
+		size_t LastSlash = EntryPath.find_last_of(PathSeparators);
+		if (LastSlash == std::string_view::npos) {
+			OutName = EntryPath;
+			return RootHandle;
+		}
+
+		OutName = EntryPath.substr(LastSlash + 1);
+		if (LastSlash == 0) {
+			return RootHandle;
+		}
+
+		auto FolderIt = NodesIndex.find(EntryPath.substr(0, LastSlash));
+		if (FolderIt == NodesIndex.end() || Nodes[FolderIt->second].Handle == nullptr) {
+			OutName = EntryPath;
+			return RootHandle;
+		}
+
+		return Nodes[FolderIt->second].Handle;
+	}
+
+	size_t
+	DirectoryTree::GetFoldersCount()
+	{
+		return Nodes.size() - 1;
+	}
+}
@@ -0,0 +1,252 @@
+/*********************************************************
+* Copyright (C) Suirless, 2021. All rights reserved.
+* XPackage - package system for X-Project
+* Apache-2 License
+**********************************************************
+* Module Name: Zstandard entries with seekable frames
+*********************************************************/
+#include "xpackage_internal.h"
+#ifdef XPACKAGE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace xpckg
+{
+	/* Seek table is the last frame of entry: skippable frame header, table entries, footer */
+	constexpr uint32_t SkippableFrameMagic = 0x184D2A5E;
+	constexpr uint32_t SeekableMagic = 0x8F92EAB1;
+	constexpr size_t SkippableHeaderSize = 8;
+	constexpr size_t SeekTableFooterSize = 9;
+	constexpr uint8_t SeekTableChecksumFlag = 0x80;
+
+	static inline uint32_t
+	ReadValue32(const uint8_t* Pointer)
+	{
+		return static_cast<uint32_t>(Pointer[0]) | (static_cast<uint32_t>(Pointer[1]) << 8) |
+			(static_cast<uint32_t>(Pointer[2]) << 16) | (static_cast<uint32_t>(Pointer[3]) << 24);
+	}
+
+	static inline void
+	PutValue32(std::vector<uint8_t>& Output, uint32_t Value)
+	{
+		for (size_t i = 0; i < 4; i++) {
+			Output.push_back(static_cast<uint8_t>(Value >> (i * 8)));
+		}
+	}
+
+	bool
+	ReadSeekTable(const uint8_t* Payload, uint64_t PayloadSize, uint64_t DecompressedSize, std::vector<ZstdFrame>& OutFrames)
+	{
+		OutFrames.clear();
+		if (PayloadSize < SkippableHeaderSize + SeekTableFooterSize) {
+			return false;
+		}
+
+		const uint8_t* Footer = Payload + PayloadSize - SeekTableFooterSize;
+		if (ReadValue32(Footer + 5) != SeekableMagic) {
+			return false;
+		}
+
+		uint64_t FramesCount = ReadValue32(Footer);
+		uint64_t TableEntrySize = (Footer[4] & SeekTableChecksumFlag) ? 12 : 8;
+		uint64_t TableSize = SkippableHeaderSize + FramesCount * TableEntrySize + SeekTableFooterSize;
+		if (TableSize > PayloadSize) {
+			return false;
+		}
+
+		const uint8_t* TableHeader = Payload + PayloadSize - TableSize;
+		if (ReadValue32(TableHeader) != SkippableFrameMagic || ReadValue32(TableHeader + 4) != TableSize - SkippableHeaderSize) {
+			return false;
+		}
+
+		/* Frames go one after another from payload start, so offsets are prefix sums of sizes */
+		OutFrames.reserve(static_cast<size_t>(FramesCount));
+		const uint8_t* TableEntry = TableHeader + SkippableHeaderSize;
+		uint64_t CompressedOffset = 0;
+		uint64_t DecompressedOffset = 0;
+		bool IsFramesFit = true;
+		for (uint64_t i = 0; i < FramesCount; i++, TableEntry += TableEntrySize) {
+			ZstdFrame NewFrame = {};
+			NewFrame.CompressedOffset = CompressedOffset;
+			NewFrame.DecompressedOffset = DecompressedOffset;
+			NewFrame.CompressedSize = ReadValue32(TableEntry);
+			NewFrame.DecompressedSize = ReadValue32(TableEntry + 4);
+			IsFramesFit = IsFramesFit && NewFrame.DecompressedSize <= MaxZstdFrameSize;
+			CompressedOffset += NewFrame.CompressedSize;
+			DecompressedOffset += NewFrame.DecompressedSize;
+			OutFrames.push_back(NewFrame);
+		}
+
+		/* Frame sizes are used for allocations, so table must agree with entry size */
+		if (!IsFramesFit || CompressedOffset != PayloadSize - TableSize || DecompressedOffset != DecompressedSize) {
+			OutFrames.clear();
+			return false;
+		}
+
+		return true;
+	}
+
+#ifdef XPACKAGE_ZSTD
+	bool
+	IsZstdSupported()
+	{
+		return true;
+	}
+
+	bool
+	CompressSeekable(const uint8_t* Input, size_t InputSize, int Level, size_t FrameSize, std::vector<uint8_t>& Output)
+	{
+		Output.clear();
+		FrameSize = std::clamp<size_t>(FrameSize, MinZstdFrameSize, MaxZstdFrameSize);
+		if (InputSize == 0) {
+			return false;
+		}
+
+		std::unique_ptr<ZSTD_CCtx, size_t(*)(ZSTD_CCtx*)> Context(ZSTD_createCCtx(), ZSTD_freeCCtx);
+		if (Context == nullptr || ZSTD_isError(ZSTD_CCtx_setParameter(Context.get(), ZSTD_c_compressionLevel, Level))) {
+			return false;
+		}
+
+		/* Output bigger than input means entry is stored, so compression stops as soon as it's reached */
+		std::vector<uint32_t> FrameSizes;
+		Output.resize(InputSize);
+		size_t OutputSize = 0;
+		for (size_t InputOffset = 0; InputOffset < InputSize; InputOffset += FrameSize) {
+			size_t PartSize = std::min(FrameSize, InputSize - InputOffset);
+			size_t Written = ZSTD_compress2(Context.get(), Output.data() + OutputSize, Output.size() - OutputSize, Input + InputOffset, PartSize);
+			if (ZSTD_isError(Written)) {
+				Output.clear();
+				return false;
+			}
+
+			OutputSize += Written;
+			FrameSizes.push_back(static_cast<uint32_t>(Written));
+		}
+
+		Output.resize(OutputSize);
+		PutValue32(Output, SkippableFrameMagic);
+		PutValue32(Output, static_cast<uint32_t>(FrameSizes.size() * 8 + SeekTableFooterSize));
+		for (size_t i = 0; i < FrameSizes.size(); i++) {
+			PutValue32(Output, FrameSizes[i]);
+			PutValue32(Output, static_cast<uint32_t>(std::min(FrameSize, InputSize - i * FrameSize)));
+		}
+
+		PutValue32(Output, static_cast<uint32_t>(FrameSizes.size()));
+		Output.push_back(0);
+		PutValue32(Output, SeekableMagic);
+		if (Output.size() >= InputSize) {
+			Output.clear();
+			return false;
+		}
+
+		return true;
+	}
+
+	bool
+	DecompressZstd(const uint8_t* Input, size_t InputSize, uint8_t* Output, size_t OutputSize, size_t& OutputWritten)
+	{
+		/* Context keeps its window buffers, so every thread allocates them once */
+		static thread_local std::unique_ptr<ZSTD_DCtx, size_t(*)(ZSTD_DCtx*)> Context(nullptr, ZSTD_freeDCtx);
+		if (Context == nullptr) {
+			Context.reset(ZSTD_createDCtx());
+			if (Context == nullptr) {
+				return false;
+			}
+		}
+
+		size_t Result = ZSTD_decompressDCtx(Context.get(), Output, OutputSize, Input, InputSize);
+		if (ZSTD_isError(Result)) {
+			return false;
+		}
+
+		OutputWritten = Result;
+		return true;
+	}
+
+	ZstdStream::ZstdStream()
+	{
+		Context = ZSTD_createDCtx();
+		if (Context == nullptr) {
+			throw std::exception();
+		}
+	}
+
+	ZstdStream::~ZstdStream()
+	{
+		ZSTD_freeDCtx(static_cast<ZSTD_DCtx*>(Context));
+	}
+
+	void
+	ZstdStream::Reset()
+	{
+		ZSTD_DCtx_reset(static_cast<ZSTD_DCtx*>(Context), ZSTD_reset_session_only);
+	}
+
+	int
+	ZstdStream::Decode(const uint8_t*& Input, size_t& InputSize, uint8_t*& Output, size_t& OutputSize)
+	{
+		while (true) {
+			ZSTD_inBuffer InBuffer = { Input, InputSize, 0 };
+			ZSTD_outBuffer OutBuffer = { Output, OutputSize, 0 };
+			size_t Result = ZSTD_decompressStream(static_cast<ZSTD_DCtx*>(Context), &OutBuffer, &InBuffer);
+			if (ZSTD_isError(Result)) {
+				return -1;
+			}
+
+			Input += InBuffer.pos;
+			InputSize -= InBuffer.pos;
+			Output += OutBuffer.pos;
+			OutputSize -= OutBuffer.pos;
+
+			/* Zero result means frame is decoded and flushed, anything else with no input left is truncated stream */
+			if (OutputSize == 0) {
+				return InputSize == 0 && Result == 0 ? 1 : 0;
+			}
+
+			if (InputSize == 0) {
+				return Result == 0 ? 1 : -1;
+			}
+		}
+	}
+#else
+	bool
+	IsZstdSupported()
+	{
+		return false;
+	}
+
+	bool
+	CompressSeekable(const uint8_t*, size_t, int, size_t, std::vector<uint8_t>&)
+	{
+		return false;
+	}
+
+	bool
+	DecompressZstd(const uint8_t*, size_t, uint8_t*, size_t, size_t&)
+	{
+		return false;
+	}
+
+	ZstdStream::ZstdStream()
+	{
+		throw std::exception();
+	}
+
+	ZstdStream::~ZstdStream()
+	{
+
+	}
+
+	void
+	ZstdStream::Reset()
+	{
+
+	}
+
+	int
+	ZstdStream::Decode(const uint8_t*&, size_t&, uint8_t*&, size_t&)
+	{
+		return -1;
+	}
+#endif
+}